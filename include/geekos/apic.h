@@ -0,0 +1,50 @@
+/*
+ * Local APIC support
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_APIC_H
+#define GEEKOS_APIC_H
+
+#include <geekos/ktypes.h>
+
+/*
+ * Interrupt vectors used by the local APIC.  They are above the
+ * external IRQs and the syscall interrupt, in the highest priority
+ * class.  The boot CPU's timer drives the high-resolution timers;
+ * the other CPUs' timers drive their scheduler tick instead.
+ * The reschedule IPI wakes up a CPU to run a thread.
+ */
+#define APIC_TIMER_VECTOR	0xF0
+#define APIC_TICK_VECTOR	0xF1
+#define APIC_RESCHEDULE_VECTOR	0xF2
+#define APIC_SPURIOUS_VECTOR	0xFF
+
+bool Init_Local_APIC(void);
+void Init_AP_Local_APIC(void);
+bool Local_APIC_Present(void);
+int Get_Local_APIC_ID(void);
+void Local_APIC_EOI(void);
+
+/*
+ * One-shot local APIC timer.  It counts down from the count
+ * given to Start_APIC_Timer(), at a rate which has to be measured
+ * (see timer.c), and interrupts on APIC_TIMER_VECTOR when it
+ * reaches zero.  A count of 0 stops it.
+ */
+void Init_APIC_Timer(void);
+void Start_APIC_Timer(ulong_t count);
+ulong_t Get_APIC_Timer_Count(void);
+void Start_APIC_Tick(ulong_t count);
+
+/*
+ * Interprocessor interrupts.
+ */
+void Send_APIC_IPI(int apicId, int vector);
+void Send_Init_IPI(int apicId);
+void Send_Startup_IPI(int apicId, ulong_t addr);
+
+#endif  /* GEEKOS_APIC_H */
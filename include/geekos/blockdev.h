@@ -49,7 +49,7 @@ struct Block_Request {
     void *buf;
     volatile enum Request_State state;
     volatile int errorCode;
-    struct Thread_Queue waitQueue;
+    struct Prio_Queue waitQueue;
 
     DEFINE_LINK(Block_Request_List, Block_Request);
 };
@@ -68,7 +68,7 @@ struct Block_Device {
     int unit;
     bool inUse;
     void *driverData;
-    struct Thread_Queue *waitQueue;
+    struct Prio_Queue *waitQueue;
     struct Block_Request_List *requestQueue;
 
     DEFINE_LINK(Block_Device_List, Block_Device);
@@ -76,6 +76,8 @@ struct Block_Device {
 
 /*
  * Operations that may be requested on block devices.
+ * Open and Close are called with interrupts disabled,
+ * and must not sleep.
  */
 struct Block_Device_Ops {
     int (*Open)(struct Block_Device *dev);
@@ -88,7 +90,7 @@ struct Block_Device_Ops {
  * Only block device drivers need to use these functions.
  */
 int Register_Block_Device(const char *name, struct Block_Device_Ops *ops,
-    int unit, void *driverData, struct Thread_Queue *waitQueue,
+    int unit, void *driverData, struct Prio_Queue *waitQueue,
     struct Block_Request_List *requestQueue);
 int Open_Block_Device(const char *name, struct Block_Device **pDev);
 int Close_Block_Device(struct Block_Device *dev);
@@ -96,7 +98,7 @@ struct Block_Request *Create_Request(struct Block_Device *dev, enum Request_Type
     int blockNum, void *buf);
 void Post_Request_And_Wait(struct Block_Request *request);
 struct Block_Request *Dequeue_Request(struct Block_Request_List *requestQueue,
-    struct Thread_Queue *waitQueue);
+    struct Prio_Queue *waitQueue);
 void Notify_Request_Completion(struct Block_Request *request, enum Request_State state, int errorCode);
 
 /*
@@ -13,6 +13,7 @@
 struct Boot_Info {
     int bootInfoSize;	 /* size of this struct; for versioning */
     int memSizeKB;	 /* number of KB, as reported by int 15h */
+    int tickHz;		 /* timer interrupt rate, or 0 for the default */
 };
 
 #endif  /* GEEKOS_BOOTINFO_H */
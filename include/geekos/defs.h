@@ -29,6 +29,12 @@
  */
 #define KERNEL_START_ADDR 0x10000
 
+/*
+ * Page below 1MB where the application processors start executing,
+ * in real mode, when they are brought up (see smp.c).
+ */
+#define AP_STARTUP_ADDR 0x2000
+
 /*
  * Kernel and user privilege levels
  */
@@ -33,5 +33,6 @@
 #define ENOSPACE		-16	 /* Out of space on device */
 #define EPIPE			-17	 /* Pipe has no reader */
 #define ENOEXEC			-18	 /* Invalid executable format */
+#define EAGAIN			-19	 /* Resource temporarily unavailable */
 
 #endif  /* GEEKOS_ERRNO_H */
@@ -40,6 +40,13 @@
 #define O_WRITE         0x4	/* Open file for writing. */
 #define O_EXCL          0x8	/* Don't create file if it already exists. */
 
+/*
+ * Descriptors of a process's standard input and output.
+ * While no file is attached to them, they refer to the console.
+ */
+#define STDIN_FD	0
+#define STDOUT_FD	1
+
 /*
  * An entry in an Access Control List (ACL).
  * Represents a set of permissions for a particular user id.
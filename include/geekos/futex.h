@@ -0,0 +1,17 @@
+/*
+ * Futexes: wait and wake on user memory words
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_FUTEX_H
+#define GEEKOS_FUTEX_H
+
+#include <geekos/ktypes.h>
+
+int Futex_Wait(int selector, ulong_t offset, int expected);
+int Futex_Wake(int selector, ulong_t offset, int count);
+
+#endif  /* GEEKOS_FUTEX_H */
@@ -48,6 +48,7 @@ union IDT_Descriptor {
 };
 
 void Init_IDT(void);
+void Init_AP_IDT(void);
 void Init_Interrupt_Gate(union IDT_Descriptor* desc, ulong_t addr,
 	int dpl);
 void Install_Interrupt_Handler(int interrupt, Interrupt_Handler handler);
@@ -0,0 +1,32 @@
+/*
+ * Synchronous message passing between processes
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_IPC_H
+#define GEEKOS_IPC_H
+
+/*
+ * Number of words in a message.  They are carried in the
+ * ecx, edx, esi and edi registers; ebx holds the pid of the
+ * thread at the other end.
+ */
+#define IPC_MESSAGE_WORDS 4
+
+#ifdef GEEKOS
+
+struct Interrupt_State;
+struct Kernel_Thread;
+
+int Ipc_Call(struct Interrupt_State* state);
+int Ipc_Receive(struct Interrupt_State* state);
+int Ipc_Reply(struct Interrupt_State* state);
+int Ipc_Reply_Wait(struct Interrupt_State* state);
+void Ipc_Exit(struct Kernel_Thread* kthread);
+
+#endif  /* GEEKOS */
+
+#endif  /* GEEKOS_IPC_H */
@@ -0,0 +1,14 @@
+/*
+ * Kernel microbenchmarks
+ * $Revision: 1.1 $
+ * 
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_KBENCH_H
+#define GEEKOS_KBENCH_H
+
+void Run_Kernel_Benchmarks(void);
+
+#endif  /* GEEKOS_KBENCH_H */
@@ -12,14 +12,30 @@
 
 #include <geekos/ktypes.h>
 #include <geekos/list.h>
+#include <geekos/rbtree.h>
+#include <geekos/schedstat.h>
+#include <geekos/timer.h>
+#include <geekos/lockstat.h>
+#include <geekos/smp.h>
 
 struct Kernel_Thread;
 struct User_Context;
 struct Interrupt_State;
+struct Mutex;
+struct Prio_Queue;
 
 extern int g_currentSchedulingPolicy;
 extern int g_prevSchedulingPolicy;
 
+/*
+ * Scheduling policies, as passed to Sys_SetSchedulingPolicy().
+ * Threads in the EDF class (see Set_EDF_Params()) always run
+ * before threads scheduled by the policy.
+ */
+#define SCHED_RR  0
+#define SCHED_MLF 1
+#define SCHED_CFS 2
+
 /*
  * Queue of threads.
  * This is used for the run queue(s), and also for
@@ -37,14 +53,48 @@ DEFINE_LIST(All_Thread_List, Kernel_Thread);
  * NOTE: there is assembly code in lowlevel.asm that depends
  * on the offsets of the fields in this struct, so if you change
  * the layout, make sure everything gets updated.
+ *
+ * The fields the scheduler touches on every context switch come
+ * first, so that they share the first cache line of the object.
  */
 struct Kernel_Thread {
     ulong_t esp;			 /* offset 0 */
     volatile ulong_t numTicks;		 /* offset 4 */
     int priority;
     DEFINE_LINK(Thread_Queue, Kernel_Thread);
-    void* stackPage;
     struct User_Context* userContext;
+
+    /* The CPU whose run queue the thread goes on. */
+    int cpu;
+
+    /* Set when the thread waits; cleared when it next runs. */
+    bool blocked;
+
+    /*
+     * The run queue level that the thread should be put on
+     * when it is restarted.  It is only meaningful while
+     * readyQueueEpoch matches the scheduler's aging epoch;
+     * a stale epoch means the thread has been aged back to level 0.
+     */
+    int currentReadyQueue;
+    ulong_t readyQueueEpoch;
+
+    /*
+     * Weighted CPU time used, for the CFS policy, and the thread's
+     * node in the CFS or EDF run queue tree while it is runnable.
+     */
+    ulong_t vruntime;
+    struct Rb_Node runNode;
+
+    /*
+     * The time (in ticks and TSC cycles) at which the thread
+     * was last made runnable, and its scheduling statistics.
+     */
+    ulong_t readyTick;
+    unsigned long long readyTSC;
+    struct Thread_Stats stats;
+
+    void* stackPage;
     struct Kernel_Thread* owner;
     int refCount;
 
@@ -56,19 +106,64 @@ struct Kernel_Thread {
     /* The kernel thread id; also used as process id */
     int pid;
 
+    /* Time (in TSC cycles) at which the thread was created. */
+    unsigned long long createTSC;
+
+    /*
+     * Periodic alarm: the timer event, the queue the thread waits
+     * in for the next alarm, and the alarms not yet waited for.
+     */
+    struct Timer_Event alarmEvent;
+    struct Thread_Queue alarmQueue;
+    ulong_t alarmsPending;
+
     /* Link fields for list of all threads in the system. */
     DEFINE_LINK(All_Thread_List, Kernel_Thread);
 
-    /* Array of MAX_TLOCAL_KEYS pointers to thread-local data. */
+    /*
+     * Array of MAX_TLOCAL_KEYS pointers to thread-local data.
+     * Few threads use thread-local data, so the array is
+     * only allocated when the thread first stores a value.
+     */
 #define MAX_TLOCAL_KEYS 128
-    const void* tlocalData[MAX_TLOCAL_KEYS];
+    const void** tlocalData;
 
     /*
-     * The run queue level that the thread should be put on
-     * when it is restarted.
+     * EDF parameters, and the state of the current job, in ticks.
+     * rtPeriod is 0 for threads not in the EDF class.
      */
-    int currentReadyQueue;
-    bool blocked;
+    ulong_t rtRuntime, rtPeriod, rtDeadline;
+    ulong_t rtPeriodStart;		 /* start of the current period */
+    ulong_t rtAbsDeadline;		 /* deadline of the current job */
+    ulong_t rtBudget;			 /* runtime left in the current period */
+    bool rtMissed;			 /* current job has missed its deadline */
+
+    /*
+     * Priority inheritance.  While the thread holds a mutex that
+     * a higher priority thread is waiting for, priority is raised
+     * above basePriority.  The thread keeps a list of the mutexes
+     * it holds, the mutex it is waiting to lock (if any),
+     * and the priority wait queue it is waiting in (if any).
+     */
+    int basePriority;
+    struct Mutex* heldMutexes;
+    struct Mutex* waitingForMutex;
+    struct Prio_Queue* prioQueue;
+
+    /*
+     * Synchronous IPC (see ipc.c): what the thread is doing, the
+     * result of its IPC operation, its user registers (which hold
+     * the message) while in one, the thread it is calling, and the
+     * queues of callers waiting for it to receive and to reply.
+     * ipcReceiveQueue holds the thread itself while it receives.
+     */
+    int ipcState;
+    int ipcResult;
+    struct Interrupt_State* ipcRegs;
+    struct Kernel_Thread* ipcPartner;
+    struct Thread_Queue ipcReceiveQueue;
+    struct Thread_Queue ipcSendQueue;
+    struct Thread_Queue ipcReplyQueue;
 };
 
 /*
@@ -85,6 +180,36 @@ static __inline__ void Remove_Thread(struct Thread_Queue *queue, struct Kernel_T
     Remove_From_Thread_Queue(queue, kthread);
 }
 
+/*
+ * Wait queue which wakes threads in priority order, and in FIFO
+ * order among threads of equal priority.  Waiting threads are
+ * kept in a tree linked through their runNode, which is free
+ * while they are not runnable, so waking the best thread
+ * takes O(log n) time rather than a scan of the queue.
+ */
+struct Prio_Queue {
+    struct Rb_Tree tree;
+};
+
+#define PRIO_QUEUE_INITIALIZER { { 0, 0 } }
+
+static __inline__ void Clear_Prio_Queue(struct Prio_Queue *queue) {
+    Rb_Init(&queue->tree);
+}
+
+static __inline__ bool Is_Prio_Queue_Empty(struct Prio_Queue *queue) {
+    return Rb_Is_Empty(&queue->tree);
+}
+
+/*
+ * Get the highest priority thread waiting in given queue,
+ * or null if the queue is empty.
+ */
+static __inline__ struct Kernel_Thread *Get_Front_Of_Prio_Queue(struct Prio_Queue *queue) {
+    struct Rb_Node *node = Rb_First(&queue->tree);
+    return node != 0 ? RB_ENTRY(node, struct Kernel_Thread, runNode) : 0;
+}
+
 /*
  * Thread start functions should have this signature.
  */
@@ -100,10 +225,19 @@ typedef void (*Thread_Start_Func)(ulong_t arg);
 #define PRIORITY_HIGH   10
 
 /*
- * Number of ready queue levels.
+ * Number of ready queue levels used by the MLF policy.
+ * Level 0 is the most favored; each level below it
+ * gets twice the quantum of the level above.
  */
 #define MAX_QUEUE_LEVEL 4
 
+/*
+ * Number of levels in the run queue.  There is one FIFO per level,
+ * and a bitmap word with one bit per level, so this must not
+ * exceed the number of bits in a ulong_t.
+ */
+#define NUM_RUN_QUEUE_LEVELS 32
+
 /*
  * Scheduler operations.
  */
@@ -118,12 +252,22 @@ struct Kernel_Thread* Start_User_Thread(struct User_Context* userContext, bool d
 void Make_Runnable(struct Kernel_Thread* kthread);
 void Make_Runnable_Atomic(struct Kernel_Thread* kthread);
 struct Kernel_Thread* Get_Current(void);
+struct Kernel_Thread* Create_Idle_Thread(int cpu);
+void Run_Idle_Thread(void) __attribute__ ((noreturn));
 struct Kernel_Thread* Get_Next_Runnable(void);
+int Get_Quantum(struct Kernel_Thread* kthread);
+void Demote_Thread(struct Kernel_Thread* kthread);
+void Charge_Tick(struct Kernel_Thread* kthread);
+int Set_EDF_Params(ulong_t runtime, ulong_t period, ulong_t deadline);
+ulong_t Get_Idle_Ticks(void);
+void Get_Thread_Pool_Stats(struct Thread_Pool_Stats* stats);
 void Schedule(void);
 void Yield(void);
 void Exit(int exitCode) __attribute__ ((noreturn));
 int Join(struct Kernel_Thread* kthread);
+int Join_With_Stats(struct Kernel_Thread* kthread, struct Thread_Stats* stats);
 struct Kernel_Thread* Lookup_Thread(int pid);
+struct Kernel_Thread* Find_Thread(int pid);
 
 /*
  * Thread context switch function, defined in lowlevel.asm
@@ -134,18 +278,35 @@ void Switch_To_Thread(struct Kernel_Thread*);
  * Wait queue functions.
  */
 void Wait(struct Thread_Queue* waitQueue);
+#define Wait_Spin(waitQueue, lock) Wait_Spin_At((waitQueue), (lock), LOCK_SITE)
+void Wait_Spin_At(struct Thread_Queue* waitQueue, struct Spin_Lock* lock,
+    const char* file, int line);
+void Wait_And_Switch_To(struct Thread_Queue* waitQueue, struct Kernel_Thread* kthread);
 void Wake_Up(struct Thread_Queue* waitQueue);
-void Wake_Up_One(struct Thread_Queue* waitQueue);
+void Wake_Up_First(struct Thread_Queue* waitQueue);
+void Wait_Prio(struct Prio_Queue* waitQueue);
+void Set_Thread_Priority(struct Kernel_Thread* kthread, int priority);
+void Wake_Up_Prio(struct Prio_Queue* waitQueue);
+void Wake_Up_One_Prio(struct Prio_Queue* waitQueue);
+
+/*
+ * Pointer to the thread executing on each CPU.
+ */
+extern struct Kernel_Thread* g_currentThreads[MAX_CPUS];
 
 /*
- * Pointer to currently executing thread.
+ * The currently executing thread.  While there is more than one CPU,
+ * a thread that can be preempted can also move to another CPU, so
+ * Get_Current() keeps interrupts disabled while it looks it up.
  */
-extern struct Kernel_Thread* g_currentThread;
+#define CURRENT_THREAD \
+    (g_numCPUsOnline == 1 ? g_currentThreads[0] : Get_Current())
 
 /*
- * Boolean flag indicating that we need to choose a new runnable thread.
+ * Boolean flag for each CPU indicating that we need to choose
+ * a new runnable thread.
  */
-extern int g_needReschedule;
+extern int g_needReschedule[MAX_CPUS];
 
 /*
  * Boolean flag indicating that preemption should be disabled.
@@ -161,7 +322,7 @@ typedef void (*tlocal_destructor_t)(void *);
 typedef unsigned int tlocal_key_t;
 
 extern int Tlocal_Create(tlocal_key_t *, tlocal_destructor_t);
-extern void Tlocal_Put(tlocal_key_t, const void *);
+extern int Tlocal_Put(tlocal_key_t, const void *);
 extern void *Tlocal_Get(tlocal_key_t);
 
 /* Print list of all threads, for debugging. */
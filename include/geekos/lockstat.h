@@ -0,0 +1,65 @@
+/*
+ * Lock contention statistics shared between kernel and user space
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_LOCKSTAT_H
+#define GEEKOS_LOCKSTAT_H
+
+#include <geekos/ktypes.h>
+
+/*
+ * Define LOCK_STATS to build a kernel which keeps statistics on
+ * mutexes and spin locks (and so on the interrupt-disabled sections
+ * they protect), for each call site which locks them.  It costs two
+ * TSC reads and a table update per lock and unlock, so it is off
+ * by default.
+ */
+/*#define LOCK_STATS*/
+
+/*
+ * Call site arguments passed by the locking macros.
+ */
+#ifdef LOCK_STATS
+#  define LOCK_SITE __FILE__, __LINE__
+#else
+#  define LOCK_SITE 0, 0
+#endif
+
+enum { LOCK_KIND_MUTEX, LOCK_KIND_SPIN };
+
+#define LOCK_STAT_FILE_LEN 24
+
+/* Most entries that can be asked for at once. */
+#define MAX_LOCK_STATS 64
+
+/*
+ * Statistics for one lock as locked from one call site.
+ * Times are in units of 1024 TSC cycles ("kcycles").
+ */
+struct Lock_Stats {
+    ulong_t lock;			 /* kernel address of the lock */
+    int kind;				 /* LOCK_KIND_MUTEX or LOCK_KIND_SPIN */
+    char file[LOCK_STAT_FILE_LEN];	 /* source file of the call site */
+    int line;				 /* source line of the call site */
+    ulong_t acquisitions;
+    ulong_t contended;			 /* acquisitions which had to wait */
+    ulong_t waitKcycles;		 /* total time spent waiting */
+    ulong_t maxWaitKcycles;		 /* longest single wait */
+    ulong_t holdKcycles;		 /* total time held */
+};
+
+struct Lock_Site;
+struct Spin_Lock;
+
+struct Lock_Site *Lock_Stat_Acquired(const void *lock, int kind, const char *file, int line,
+    bool contended, unsigned long long waitCycles);
+void Lock_Stat_Released(struct Lock_Site *site, unsigned long long holdCycles);
+void Lock_Stat_Spin_Lock(struct Spin_Lock *lock, const char *file, int line);
+void Lock_Stat_Spin_Unlock(struct Spin_Lock *lock);
+int Get_Lock_Stats(struct Lock_Stats *stats, int max);
+
+#endif  /* GEEKOS_LOCKSTAT_H */
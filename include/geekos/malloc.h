@@ -12,8 +12,33 @@
 
 #include <geekos/ktypes.h>
 
+/*
+ * Allocations of up to MALLOC_MAX_CACHED_SIZE bytes come from
+ * one of MALLOC_NUM_CACHES size-class caches, of 16, 32, ...
+ * MALLOC_MAX_CACHED_SIZE byte objects; larger ones come from
+ * the kernel heap.
+ */
+#define MALLOC_NUM_CACHES 8
+#define MALLOC_MAX_CACHED_SIZE 2048
+
+/*
+ * Statistics for one size-class cache.
+ */
+struct Malloc_Cache_Stats {
+    ulong_t objectSize;
+    ulong_t slabs;			 /* slabs the cache has now */
+    ulong_t objectsInUse;
+    ulong_t allocs;
+    ulong_t frees;
+    ulong_t slabAllocs;			 /* slabs taken from the page allocator */
+    ulong_t slabFrees;			 /* slabs given back to it */
+};
+
 void Init_Heap(ulong_t start, ulong_t size);
 void* Malloc(ulong_t size);
 void Free(void* buf);
+void* Heap_Alloc(ulong_t size);
+void Heap_Free(void* buf);
+void Get_Malloc_Stats(struct Malloc_Cache_Stats stats[MALLOC_NUM_CACHES]);
 
 #endif  /* GEEKOS_MALLOC_H */
@@ -44,6 +44,12 @@ struct Boot_Info;
  */
 #define KERNEL_HEAP_SIZE (1024*1024)
 
+/*
+ * Free pages are kept in blocks of 2^order pages, for orders
+ * up to this one (4MB blocks).
+ */
+#define MAX_PAGE_ORDER 10
+
 struct Page;
 
 /*
@@ -57,15 +63,29 @@ DEFINE_LIST(Page_List, Page);
  */
 struct Page {
     unsigned flags;			 /* Flags indicating state of page */
+    int order;				 /* Order of block page starts, or -1 */
     DEFINE_LINK(Page_List, Page);	 /* Link fields for Page_List */
 };
 
 IMPLEMENT_LIST(Page_List, Page);
 
+/*
+ * Free page statistics, for measuring fragmentation.
+ */
+struct Page_Stats {
+    ulong_t freeBlocks[MAX_PAGE_ORDER + 1];  /* free blocks of each order */
+    ulong_t freePages;
+    int largestOrder;			 /* order of largest free block, or -1 */
+};
+
 void Init_Mem(struct Boot_Info* bootInfo);
 void Init_BSS(void);
 void* Alloc_Page(void);
 void Free_Page(void* pageAddr);
+void* Alloc_Pages(int order);
+void Free_Pages(void* pageAddr, int order);
+void Get_Page_Stats(struct Page_Stats* stats);
+int Get_Fragmentation(const struct Page_Stats* stats);
 
 /*
  * Determine if given address is a multiple of the page size.
@@ -122,8 +142,4 @@ static __inline__ ulong_t Get_Page_Address(struct Page *page)
     return index << PAGE_POWER;
 }
 
-/*
- * Initialize Semaphroes
- */
-void Init_Semaphores();
 #endif  /* GEEKOS_MEM_H */
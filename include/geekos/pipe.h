@@ -0,0 +1,19 @@
+/*
+ * Pipes
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_PIPE_H
+#define GEEKOS_PIPE_H
+
+/* Number of bytes a pipe can hold before writers must wait. */
+#define PIPE_BUFFER_SIZE 4096
+
+struct File;
+
+int Create_Pipe(struct File **pReadFile, struct File **pWriteFile);
+
+#endif  /* GEEKOS_PIPE_H */
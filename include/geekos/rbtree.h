@@ -0,0 +1,64 @@
+/*
+ * Intrusive red-black tree
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_RBTREE_H
+#define GEEKOS_RBTREE_H
+
+#include <stddef.h>
+#include <geekos/ktypes.h>
+
+/*
+ * A node in a red-black tree.
+ * Embed one of these in each object to be stored in a tree,
+ * and use RB_ENTRY() to get back from the node to the object.
+ */
+struct Rb_Node {
+    struct Rb_Node *parent, *left, *right;
+    int color;
+};
+
+/*
+ * A red-black tree.  The leftmost (smallest) node is cached,
+ * so finding the minimum is constant time.
+ */
+struct Rb_Tree {
+    struct Rb_Node *root;
+    struct Rb_Node *leftmost;
+};
+
+/*
+ * Ordering function: returns true if node a sorts before node b.
+ */
+typedef bool (*Rb_Less_Func)(struct Rb_Node *a, struct Rb_Node *b);
+
+/*
+ * Get the object containing given tree node.
+ */
+#define RB_ENTRY(node, type, member) \
+    ((type *) ((char *) (node) - offsetof(type, member)))
+
+static __inline__ void Rb_Init(struct Rb_Tree *tree)
+{
+    tree->root = tree->leftmost = 0;
+}
+
+static __inline__ bool Rb_Is_Empty(struct Rb_Tree *tree)
+{
+    return tree->root == 0;
+}
+
+static __inline__ struct Rb_Node *Rb_First(struct Rb_Tree *tree)
+{
+    return tree->leftmost;
+}
+
+void Rb_Insert(struct Rb_Tree *tree, struct Rb_Node *node, Rb_Less_Func less);
+void Rb_Remove(struct Rb_Tree *tree, struct Rb_Node *node);
+struct Rb_Node *Rb_Next(struct Rb_Node *node);
+
+#endif  /* GEEKOS_RBTREE_H */
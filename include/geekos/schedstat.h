@@ -0,0 +1,48 @@
+/*
+ * Per-thread scheduling statistics shared between kernel and user space
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_SCHEDSTAT_H
+#define GEEKOS_SCHEDSTAT_H
+
+#include <geekos/ktypes.h>
+
+/*
+ * Number of buckets in the wakeup latency histogram.
+ * Latencies are measured in units of 1024 TSC cycles ("kcycles").
+ * Bucket 0 counts latencies under 1 kcycle, and bucket i > 0
+ * counts latencies in [2^(i-1), 2^i) kcycles.  The last bucket
+ * also counts everything larger.
+ */
+#define NUM_LATENCY_BUCKETS 16
+#define LATENCY_UNIT_SHIFT 10
+
+/*
+ * Cumulative scheduling statistics for a thread.
+ * Returned by the GetThreadStats system call.
+ */
+struct Thread_Stats {
+    ulong_t runTicks;			 /* timer ticks spent running */
+    ulong_t waitTicks;			 /* timer ticks spent runnable, but not running */
+    ulong_t numVoluntarySwitches;	 /* times the thread gave up the CPU */
+    ulong_t numInvoluntarySwitches;	 /* times the thread was preempted */
+    ulong_t wakeupLatency[NUM_LATENCY_BUCKETS];  /* wakeup-to-run latency histogram */
+    ulong_t numDeadlineMisses;		 /* EDF jobs not run to completion by their deadline */
+};
+
+/*
+ * System-wide thread recycling statistics.
+ * Returned by the GetThreadPoolStats system call.
+ */
+struct Thread_Pool_Stats {
+    ulong_t poolHits;			 /* threads created from the recycle pool */
+    ulong_t poolMisses;			 /* threads which needed new memory */
+    ulong_t numExits;			 /* threads which have exited */
+    ulong_t lifetimeKcycles;		 /* total creation-to-exit time of those threads */
+};
+
+#endif  /* GEEKOS_SCHEDSTAT_H */
@@ -0,0 +1,26 @@
+/*
+ * Semaphores
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_SEM_H
+#define GEEKOS_SEM_H
+
+#include <geekos/ktypes.h>
+
+/* Maximum length of a semaphore name, not counting the nul. */
+#define MAX_SEMAPHORE_NAME_LEN 63
+
+struct User_Context;
+
+void Init_Semaphores(void);
+int Sem_Create(struct User_Context* context, const char* name, int initialValue);
+int Sem_P(struct User_Context* context, int handle);
+int Sem_V(struct User_Context* context, int handle);
+int Sem_Destroy(struct User_Context* context, int handle);
+void Sem_Release_All(struct User_Context* context);
+
+#endif  /* GEEKOS_SEM_H */
@@ -0,0 +1,32 @@
+/*
+ * Shared memory segments
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_SHM_H
+#define GEEKOS_SHM_H
+
+#include <geekos/ktypes.h>
+
+/* Maximum length of a shared memory segment name, not counting the nul. */
+#define MAX_SHM_NAME_LEN 63
+
+/*
+ * Largest shared memory segment, in bytes.  Segments are allocated
+ * as blocks of 2^order pages, so this must not exceed a block of
+ * MAX_PAGE_ORDER.
+ */
+#define MAX_SHM_SIZE (1024 * 1024)
+
+struct User_Context;
+struct Interrupt_State;
+
+int Shm_Attach(struct User_Context* context, const char* name, ulong_t size);
+int Shm_Detach(struct User_Context* context, int selector, struct Interrupt_State* state);
+void Shm_Detach_All(struct User_Context* context);
+char* Shm_Get_Memory(struct User_Context* context, int selector, ulong_t* size);
+
+#endif  /* GEEKOS_SHM_H */
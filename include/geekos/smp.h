@@ -0,0 +1,48 @@
+/*
+ * Multiprocessor support
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_SMP_H
+#define GEEKOS_SMP_H
+
+#include <geekos/ktypes.h>
+
+/*
+ * Maximum number of CPUs supported.
+ * CPUs are numbered from 0 (the boot CPU) to MAX_CPUS-1.
+ */
+#define MAX_CPUS 8
+
+/*
+ * Number of CPUs currently running the scheduler.
+ */
+extern int g_numCPUsOnline;
+
+/*
+ * CPU number of each local APIC id.
+ * Used by Get_CPU_ID(), and by lowlevel.asm.
+ */
+extern uchar_t g_apicIdToCPU[256];
+
+/*
+ * The kernel lock.  It is 0 when free, and otherwise one more than
+ * the number of the CPU holding it.  Once there is more than one
+ * CPU online, a CPU holds it whenever it runs kernel code, except
+ * while its idle thread is halted.  Interrupt entry in lowlevel.asm
+ * takes it, and the return to user mode releases it.
+ */
+extern volatile int g_kernelLock;
+
+void Init_SMP(void);
+void Start_Application_Processors(void);
+int Get_Num_CPUs_Found(void);
+int Get_CPU_ID(void);
+void Lock_Kernel(void);
+void Unlock_Kernel(void);
+void Send_IPI(int cpu, int vector);
+
+#endif  /* GEEKOS_SMP_H */
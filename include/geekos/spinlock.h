@@ -0,0 +1,116 @@
+/*
+ * Spin locks
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_SPINLOCK_H
+#define GEEKOS_SPINLOCK_H
+
+#include <geekos/ktypes.h>
+#include <geekos/int.h>
+#include <geekos/lockstat.h>
+
+/*
+ * A spin lock protects data shared between CPUs.
+ * Disabling interrupts only keeps other threads on the same CPU
+ * out, so code that used Begin_Int_Atomic() to protect shared data
+ * should use Begin_Spin_Atomic() instead, which does both.
+ * A spin lock must never be held while waiting on a thread queue.
+ */
+struct Spin_Lock {
+    volatile int locked;
+#ifdef LOCK_STATS
+    struct Lock_Site* statSite;		/* call site which locked it */
+    unsigned long long lockTSC;		/* when it was locked */
+#endif
+};
+
+#define SPIN_LOCK_INITIALIZER { 0 }
+
+static __inline__ void Spin_Lock_Init(struct Spin_Lock* lock)
+{
+    lock->locked = 0;
+}
+
+/*
+ * Try once to acquire given spin lock.
+ * Returns true if the lock was acquired.
+ */
+static __inline__ bool Spin_Try_Lock(struct Spin_Lock* lock)
+{
+    int old = 1;
+
+    __asm__ __volatile__ ("xchgl %0, %1"
+	: "+r" (old), "+m" (lock->locked) : : "memory");
+    return old == 0;
+}
+
+/*
+ * Acquire given spin lock, spinning until it is free.
+ * Interrupts should be disabled, or else an interrupt handler
+ * taking the same lock could deadlock.
+ */
+static __inline__ void Spin_Lock(struct Spin_Lock* lock)
+{
+    while (!Spin_Try_Lock(lock)) {
+	/* Spin reading, not writing, so the cache line stays shared. */
+	while (lock->locked)
+	    __asm__ __volatile__ ("pause");
+    }
+}
+
+static __inline__ void Spin_Unlock(struct Spin_Lock* lock)
+{
+    KASSERT(lock->locked);
+    __asm__ __volatile__ ("" : : : "memory");
+    lock->locked = 0;
+}
+
+/*
+ * Acquire or release given spin lock with interrupts already
+ * disabled.  With LOCK_STATS, the time it is held is accounted
+ * to the call site which acquired it.
+ */
+static __inline__ void Acquire_Spin_Lock_At(struct Spin_Lock* lock, const char* file, int line)
+{
+#ifdef LOCK_STATS
+    Lock_Stat_Spin_Lock(lock, file, line);
+#else
+    Spin_Lock(lock);
+#endif
+}
+
+static __inline__ void Release_Spin_Lock(struct Spin_Lock* lock)
+{
+#ifdef LOCK_STATS
+    Lock_Stat_Spin_Unlock(lock);
+#else
+    Spin_Unlock(lock);
+#endif
+}
+
+/*
+ * Begin a region that is atomic with respect to interrupts
+ * on this CPU and to holders of given lock on other CPUs.
+ * Returns a flag to be passed to End_Spin_Atomic().
+ * With LOCK_STATS, the region is accounted to its call site.
+ */
+#define Begin_Spin_Atomic(lock) Begin_Spin_Atomic_At((lock), LOCK_SITE)
+
+static __inline__ bool Begin_Spin_Atomic_At(struct Spin_Lock* lock, const char* file, int line)
+{
+    bool iflag = Begin_Int_Atomic();
+    Acquire_Spin_Lock_At(lock, file, line);
+    return iflag;
+}
+
+static __inline__ void End_Spin_Atomic(struct Spin_Lock* lock, bool iflag)
+{
+    Release_Spin_Lock(lock);
+    End_Int_Atomic(iflag);
+}
+
+#endif  /* GEEKOS_SPINLOCK_H */
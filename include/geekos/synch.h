@@ -11,6 +11,7 @@
 #define GEEKOS_SYNCH_H
 
 #include <geekos/kthread.h>
+#include <geekos/lockstat.h>
 
 /*
  * mutex states
@@ -20,25 +21,56 @@ enum { MUTEX_UNLOCKED, MUTEX_LOCKED };
 struct Mutex {
     int state;
     struct Kernel_Thread* owner;
-    struct Thread_Queue waitQueue;
+    struct Prio_Queue waitQueue;
+    struct Mutex* nextHeld;	/* next in owner's list of held mutexes */
+#ifdef LOCK_STATS
+    struct Lock_Site* statSite;	/* call site which locked it */
+    unsigned long long lockTSC;	/* when it was locked */
+#endif
 };
 
-#define MUTEX_INITIALIZER { MUTEX_UNLOCKED, 0, THREAD_QUEUE_INITIALIZER }
+#define MUTEX_INITIALIZER { MUTEX_UNLOCKED, 0, PRIO_QUEUE_INITIALIZER, 0 }
 
 struct Condition {
-    struct Thread_Queue waitQueue;
+    struct Prio_Queue waitQueue;
 };
 
+/*
+ * A reader-writer lock is held either by any number of readers,
+ * or by one writer.  Writers are preferred: once a writer is
+ * waiting, new readers wait behind it.
+ */
+struct RW_Lock {
+    int readers;			/* number of readers holding the lock */
+    struct Kernel_Thread* writer;	/* writer holding the lock */
+    struct Prio_Queue readQueue;
+    struct Prio_Queue writeQueue;
+};
+
+#define RW_LOCK_INITIALIZER { 0, 0, PRIO_QUEUE_INITIALIZER, PRIO_QUEUE_INITIALIZER }
+
+/*
+ * Locking a mutex passes the call site, for LOCK_STATS.
+ */
+#define Mutex_Lock(mutex) Mutex_Lock_At((mutex), LOCK_SITE)
+#define Cond_Wait(cond, mutex) Cond_Wait_At((cond), (mutex), LOCK_SITE)
+
 void Mutex_Init(struct Mutex* mutex);
-void Mutex_Lock(struct Mutex* mutex);
+void Mutex_Lock_At(struct Mutex* mutex, const char* file, int line);
 void Mutex_Unlock(struct Mutex* mutex);
 
 void Cond_Init(struct Condition* cond);
-void Cond_Wait(struct Condition* cond, struct Mutex* mutex);
+void Cond_Wait_At(struct Condition* cond, struct Mutex* mutex, const char* file, int line);
 void Cond_Signal(struct Condition* cond);
 void Cond_Broadcast(struct Condition* cond);
 
+void RW_Lock_Init(struct RW_Lock* lock);
+void Read_Lock(struct RW_Lock* lock);
+void Read_Unlock(struct RW_Lock* lock);
+void Write_Lock(struct RW_Lock* lock);
+void Write_Unlock(struct RW_Lock* lock);
+
 #define IS_HELD(mutex) \
-    ((mutex)->state == MUTEX_LOCKED && (mutex)->owner == g_currentThread)
+    ((mutex)->state == MUTEX_LOCKED && (mutex)->owner == CURRENT_THREAD)
 
 #endif  /* GEEKOS_SYNCH_H */
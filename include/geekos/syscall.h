@@ -53,6 +53,28 @@ enum {
     SYS_P,		 /* P (acquire semaphore) system call  */
     SYS_V,		 /* V (release semaphore) system call  */
     SYS_DESTROYSEMAPHORE,  /* Destroy semaphore system call  */
+    SYS_GETTHREADSTATS,	 /* Get thread scheduling statistics system call */
+    SYS_SETEDFPARAMS,	 /* Set EDF real-time parameters system call */
+    SYS_GETTHREADPOOLSTATS,  /* Get thread recycle pool statistics system call */
+    SYS_SLEEP,		 /* Sleep for a number of ticks system call */
+    SYS_SLEEPUS,	 /* Sleep for a number of microseconds system call */
+    SYS_SETALARM,	 /* Set periodic alarm system call */
+    SYS_WAITALARM,	 /* Wait for periodic alarm system call */
+    SYS_FUTEXWAIT,	 /* Wait on futex system call */
+    SYS_FUTEXWAKE,	 /* Wake futex waiters system call */
+    SYS_GETLOCKSTATS,	 /* Get lock contention statistics system call */
+    SYS_GETTICKRATE,	 /* Get timer interrupt rate system call */
+    SYS_OPEN,		 /* Open file system call */
+    SYS_CLOSE,		 /* Close file descriptor system call */
+    SYS_READ,		 /* Read from file descriptor system call */
+    SYS_WRITE,		 /* Write to file descriptor system call */
+    SYS_PIPE,		 /* Create pipe system call */
+    SYS_IPCCALL,	 /* IPC call system call */
+    SYS_IPCRECEIVE,	 /* IPC receive system call */
+    SYS_IPCREPLY,	 /* IPC reply system call */
+    SYS_IPCREPLYWAIT,	 /* IPC reply and receive system call */
+    SYS_SHMATTACH,	 /* Attach shared memory segment system call */
+    SYS_SHMDETACH,	 /* Detach shared memory segment system call */
 };
 
 /*
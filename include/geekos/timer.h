@@ -12,27 +12,118 @@
 
 #define TIMER_IRQ 0
 
+/*
+ * Timer interrupt rate, in Hz.  It is chosen at boot: the boot
+ * loader can pass one in the Boot_Info (e.g. 1000, trading interrupt
+ * overhead for scheduling granularity), and otherwise it is
+ * DEFAULT_TICK_HZ.  The PIT can't go slower than about 19 Hz.
+ * Quanta and other scheduler intervals are counted in ticks, with
+ * their defaults derived from the rate.
+ */
+#define DEFAULT_TICK_HZ 100
+#define MIN_TICK_HZ 19
+#define MAX_TICK_HZ 10000
+
+extern ulong_t g_tickHz;
+
+/*
+ * Convert a time in milliseconds to ticks, rounding up.
+ */
+static __inline__ ulong_t Ms_To_Ticks(ulong_t ms)
+{
+    return (ms * g_tickHz + 999) / 1000;
+}
+
 extern int g_Quantum;
 
 extern volatile ulong_t g_numTicks;
 
-typedef void (*timerCallback)(int);
-
-void Init_Timer(void);
+void Init_Timer(int tickHz);
+void Init_AP_Timer(void);
 
 void Micro_Delay(int us);
 
-typedef struct {
-    int ticks;				 /* timer code decrements this */
-    int id;				 /* unqiue id for this timer even */
-    timerCallback callBack;		 /* Queue to wakeup on timer expire */
-    int origTicks;
-} timerEvent;
+/*
+ * Timer event, kept in the timer wheel until it expires.
+ * The callback runs in the timer interrupt handler, with interrupts
+ * disabled, when the given number of ticks have passed, and then
+ * every period ticks if period is non-zero.  The caller provides the
+ * storage, which must stay valid until a one-shot event has fired,
+ * or the event is cancelled.
+ */
+struct Timer_Event;
+typedef void (*timerCallback)(struct Timer_Event *event);
 
-int Start_Timer(int ticks, timerCallback);
-int Get_Remaing_Timer_Ticks(int id);
-int Cancel_Timer(int id);
+struct Timer_Event {
+    ulong_t expires;			 /* tick at which the event fires */
+    ulong_t period;			 /* ticks between firings; 0 for one-shot */
+    timerCallback callBack;
+    struct Timer_Event *next;		 /* links in the timer wheel slot */
+    struct Timer_Event **pprev;		 /* null if not pending */
+};
 
-void Micro_Delay(int us);
+static __inline__ void Init_Timer_Event(struct Timer_Event *event)
+{
+    event->pprev = 0;
+}
+
+static __inline__ bool Is_Timer_Pending(struct Timer_Event *event)
+{
+    return event->pprev != 0;
+}
+
+/*
+ * Read the processor's time stamp counter.
+ */
+static __inline__ unsigned long long Read_TSC(void)
+{
+    unsigned long long tsc;
+    __asm__ __volatile__ ("rdtsc" : "=A" (tsc));
+    return tsc;
+}
+
+void Start_Timer(struct Timer_Event *event, ulong_t ticks, ulong_t period, timerCallback cb);
+bool Cancel_Timer(struct Timer_Event *event);
+ulong_t Get_Remaining_Timer_Ticks(struct Timer_Event *event);
+
+/*
+ * Monotonic clock, calibrated against the PIT at boot.
+ * Times are in nanoseconds since the clock was calibrated.
+ */
+unsigned long long Get_Time_Ns(void);
+unsigned long long Cycles_To_Ns(unsigned long long cycles);
+ulong_t Get_TSC_KHz(void);
+
+/*
+ * High-resolution one-shot timer.  The caller provides the storage,
+ * which must stay valid until the timer fires or is cancelled.
+ * The callback runs in an interrupt handler, with interrupts
+ * disabled, once the expiry time has passed.  The local APIC timer
+ * is programmed to go off when the earliest pending timer expires,
+ * so timers are not rounded up to ticks.  Without a local APIC,
+ * pending timers are checked on each tick instead, and the
+ * resolution is one tick (1/g_tickHz seconds).
+ */
+struct HR_Timer;
+typedef void (*HR_Timer_Callback)(struct HR_Timer *timer);
+
+struct HR_Timer {
+    unsigned long long expires;		 /* expiry time, from Get_Time_Ns() */
+    HR_Timer_Callback callBack;
+    struct HR_Timer *next;		 /* next pending timer, by expiry time */
+    bool pending;
+};
+
+void Start_HR_Timer(struct HR_Timer *timer, unsigned long long expires, HR_Timer_Callback cb);
+bool Cancel_HR_Timer(struct HR_Timer *timer);
+
+/*
+ * Blocking the current thread for a time, or until its
+ * periodic alarm next goes off.
+ */
+void Sleep_Ticks(ulong_t ticks);
+void Sleep_Us(ulong_t us);
+void Set_Alarm(ulong_t period);
+int Wait_Alarm(void);
 
 #endif  /* GEEKOS_TIMER_H */
@@ -16,10 +16,15 @@
 #include <geekos/elf.h>
 
 struct File;
+struct Semaphore;
+struct Shm_Segment;
 
 /* Number of files user process can have open. */
 #define USER_MAX_FILES		10
 
+/* Number of shared memory segments user process can have attached. */
+#define USER_MAX_SHM		4
+
 /*
  * A user mode context which can be attached to a Kernel_Thread,
  * to allow it to execute in user mode (ring 3).  This struct
@@ -28,13 +33,17 @@ struct File;
  * the process (such as semaphores and files).
  */
 struct User_Context {
-    /* We need one LDT entry each for user code and data segments. */
-#define NUM_USER_LDT_ENTRIES 2
+    /*
+     * We need one LDT entry each for user code and data segments,
+     * and one for each shared memory segment that may be attached.
+     */
+#define NUM_USER_LDT_ENTRIES (2 + USER_MAX_SHM)
 
     /*
      * Each user context contains a local descriptor table with
-     * just enough room for one code and one data segment
-     * describing the process's memory.
+     * room for one code and one data segment describing the
+     * process's memory, followed by the descriptors of attached
+     * shared memory segments (see shm.c).
      */
     struct Segment_Descriptor ldt[NUM_USER_LDT_ENTRIES];
     struct Segment_Descriptor* ldtDescriptor;
@@ -68,9 +77,21 @@ struct User_Context {
      */
     int refCount;
 
-#if 0
-    int *semaphores;
-#endif
+    /*
+     * Semaphores the process has handles to, indexed by handle;
+     * grown as needed.  See sem.c.
+     */
+    struct Semaphore** semaphores;
+    int maxSemaphores;
+
+    /*
+     * Open files, indexed by file descriptor.  A null STDIN_FD
+     * or STDOUT_FD entry means the console.
+     */
+    struct File* file[USER_MAX_FILES];
+
+    /* Attached shared memory segments, by slot in the LDT. */
+    struct Shm_Segment* shm[USER_MAX_SHM];
 };
 
 struct Kernel_Thread;
@@ -83,6 +104,9 @@ struct Interrupt_State;
 void Attach_User_Context(struct Kernel_Thread* kthread, struct User_Context* context);
 void Detach_User_Context(struct Kernel_Thread* kthread);
 int Spawn(const char *program, const char *command, struct Kernel_Thread **pThread);
+int Spawn_With_Files(const char *program, const char *command, struct File *stdFiles[2],
+    bool detached, struct Kernel_Thread **pThread);
+void Close_User_Files(struct User_Context* context);
 void Switch_To_User_Context(struct Kernel_Thread* kthread, struct Interrupt_State* state);
 
 /*
@@ -75,6 +75,13 @@ struct File {
      */
     int mode;			 /* Mode (read vs. write). */
     struct Mount_Point *mountPoint; /* Mounted filesystem file is part of. */
+
+    /*
+     * Number of references (e.g., process file descriptors) to the
+     * file; Close() only really closes it when the last one goes away.
+     * Set by Allocate_File().
+     */
+    int refCount;
 };
 
 /* Operations that can be performed on a File. */
@@ -118,6 +125,7 @@ int Sync(void);
 /* File operations. */
 struct File *Allocate_File(struct File_Ops *ops, int filePos, int endPos, void *fsData,
     int mode, struct Mount_Point *mountPoint);
+void Ref_File(struct File *file);
 int FStat(struct File *file, struct VFS_File_Stat *stat);
 int Read(struct File *file, void *buf, ulong_t len);
 int Write(struct File *file, void *buf, ulong_t len);
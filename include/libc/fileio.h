@@ -0,0 +1,22 @@
+/*
+ * User-mode file I/O
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <stddef.h>
+#include <geekos/ktypes.h>
+#include <geekos/fileio.h>
+
+int Open(const char *path, int mode);
+int Close(int fd);
+int Read(int fd, void *buf, ulong_t len);
+int Write(int fd, const void *buf, ulong_t len);
+int Create_Pipe(int *readFd, int *writeFd);
+
+#endif  /* FILEIO_H */
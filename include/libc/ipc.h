@@ -0,0 +1,28 @@
+/*
+ * Synchronous message passing between processes
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef IPC_H
+#define IPC_H
+
+#include <geekos/ktypes.h>
+#include <geekos/ipc.h>
+
+/*
+ * A message, passed in registers.  Each call replaces
+ * the message it is given with the one it gets back.
+ */
+struct Ipc_Message {
+    ulong_t word[IPC_MESSAGE_WORDS];
+};
+
+int Ipc_Call(int pid, struct Ipc_Message *msg);
+int Ipc_Receive(struct Ipc_Message *msg);
+int Ipc_Reply(int pid, struct Ipc_Message *reply);
+int Ipc_Reply_Wait(int pid, struct Ipc_Message *msg);
+
+#endif  /* IPC_H */
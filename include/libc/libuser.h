@@ -4,5 +4,9 @@
 
 #include <conio.h>
 #include <sema.h>
+#include <mutex.h>
 #include <sched.h>
+#include <fileio.h>
+#include <ipc.h>
+#include <shm.h>
 
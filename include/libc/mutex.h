@@ -0,0 +1,70 @@
+/*
+ * User-space mutexes and condition variables
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef MUTEX_H
+#define MUTEX_H
+
+#include <geekos/ktypes.h>
+
+/*
+ * A mutex in user memory.  Locking and unlocking an uncontended
+ * mutex never enters the kernel; the futex system calls are
+ * only used to sleep on and wake up a contended mutex.
+ */
+struct User_Mutex {
+    volatile int state;		/* 0: unlocked, 1: locked, 2: locked, maybe waiters */
+};
+
+#define USER_MUTEX_INITIALIZER { 0 }
+
+/*
+ * A condition variable in user memory, used with a User_Mutex.
+ */
+struct User_Condition {
+    volatile int seq;		/* bumped by every signal */
+    volatile int waiters;	/* number of threads in User_Cond_Wait() */
+};
+
+#define USER_CONDITION_INITIALIZER { 0, 0 }
+
+int Futex_Wait(volatile int *addr, int expected);
+int Futex_Wake(volatile int *addr, int count);
+int Shm_Futex_Wait(int shm, ulong_t offset, int expected);
+int Shm_Futex_Wake(int shm, ulong_t offset, int count);
+
+void User_Mutex_Init(struct User_Mutex *mutex);
+void User_Mutex_Lock(struct User_Mutex *mutex);
+int User_Mutex_Try_Lock(struct User_Mutex *mutex);
+void User_Mutex_Unlock(struct User_Mutex *mutex);
+
+/*
+ * A mutex at given offset (a multiple of 4) in an attached shared
+ * memory segment, which can be shared between processes.
+ */
+void Shm_Mutex_Lock(int shm, ulong_t offset);
+int Shm_Mutex_Try_Lock(int shm, ulong_t offset);
+void Shm_Mutex_Unlock(int shm, ulong_t offset);
+
+/*
+ * A condition variable at given offset (a multiple of 4) in an
+ * attached shared memory segment, used with a shared memory mutex
+ * at mutexOffset in the same segment.  It takes SHM_CONDITION_SIZE
+ * bytes, which start out zeroed like the rest of the segment.
+ */
+#define SHM_CONDITION_SIZE (2 * sizeof(int))
+
+void Shm_Cond_Wait(int shm, ulong_t offset, ulong_t mutexOffset);
+void Shm_Cond_Signal(int shm, ulong_t offset);
+void Shm_Cond_Broadcast(int shm, ulong_t offset);
+
+void User_Cond_Init(struct User_Condition *cond);
+void User_Cond_Wait(struct User_Condition *cond, struct User_Mutex *mutex);
+void User_Cond_Signal(struct User_Condition *cond);
+void User_Cond_Broadcast(struct User_Condition *cond);
+
+#endif  /* MUTEX_H */
@@ -11,11 +11,18 @@
 #ifndef PROCESS_H
 #define PROCESS_H
 
+#include <geekos/schedstat.h>
+
 int Null(void);
 int Exit(int exitCode);
 int Spawn_Program(const char* program, const char* command);
+int Spawn_Program_With_Files(const char *program, const char *command,
+    int stdinFd, int stdoutFd);
 int Spawn_With_Path(const char *program, const char *command, const char *path);
+int Spawn_With_Path_And_Files(const char *program, const char *command,
+    const char *path, int stdinFd, int stdoutFd);
 int Wait(int pid);
+int Wait_With_Stats(int pid, struct Thread_Stats *stats);
 int Get_PID(void);
 
 #endif  /* PROCESS_H */
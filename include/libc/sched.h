@@ -11,8 +11,21 @@
 #ifndef SCHED_H
 #define SCHED_H
 
+#include <geekos/schedstat.h>
+#include <geekos/lockstat.h>
+
 int Set_Scheduling_Policy(int policy, int quantum);
 int Get_Time_Of_Day(void);
+int Get_Thread_Stats(int pid, struct Thread_Stats *stats);
+int Set_EDF_Params(int runtime, int period, int deadline);
+int Get_Thread_Pool_Stats(struct Thread_Pool_Stats *stats);
+int Sleep(int ticks);
+int Sleep_Us(int us);
+int Set_Alarm(int period);
+int Wait_Alarm(void);
+int Get_Lock_Stats(struct Lock_Stats *stats, int max);
+int Get_Tick_Rate(void);
+unsigned long long Read_TSC(void);
 
 #endif  /* SCHED_H */
 
@@ -0,0 +1,48 @@
+/*
+ * Shared memory segments
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef SHM_H
+#define SHM_H
+
+#include <geekos/ktypes.h>
+
+int Shm_Attach(const char *name, ulong_t size);
+int Shm_Detach(int shm);
+
+/*
+ * Access to an attached segment, by its selector and byte offsets
+ * within it.  These go straight to the shared memory, through a
+ * segment register, without entering the kernel.
+ */
+void Shm_Read(int shm, ulong_t offset, void *buf, ulong_t len);
+void Shm_Write(int shm, ulong_t offset, const void *buf, ulong_t len);
+
+static __inline__ ulong_t Shm_Get_Long(int shm, ulong_t offset)
+{
+    ulong_t value;
+
+    __asm__ __volatile__ (
+	"movw %w1, %%fs\n\t"
+	"movl %%fs:(%2), %0"
+	: "=r" (value)
+	: "r" (shm), "r" (offset)
+	: "memory");
+    return value;
+}
+
+static __inline__ void Shm_Put_Long(int shm, ulong_t offset, ulong_t value)
+{
+    __asm__ __volatile__ (
+	"movw %w0, %%fs\n\t"
+	"movl %2, %%fs:(%1)"
+	:
+	: "r" (shm), "r" (offset), "r" (value)
+	: "memory");
+}
+
+#endif  /* SHM_H */
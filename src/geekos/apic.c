@@ -0,0 +1,233 @@
+/*
+ * Local APIC support
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+/*
+ * Source: Intel 64 and IA-32 Architectures Software Developer's
+ * Manual, volume 3, chapter 10 (Advanced Programmable Interrupt
+ * Controller).
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/screen.h>
+#include <geekos/idt.h>
+#include <geekos/apic.h>
+
+/* CPUID feature flag (edx) indicating an on-chip local APIC. */
+#define CPUID_FEATURE_APIC (1 << 9)
+
+/*
+ * Default physical address of the local APIC registers.
+ * Each CPU sees its own local APIC at this address.
+ */
+#define LOCAL_APIC_BASE		0xFEE00000
+
+/* Register offsets. */
+#define APIC_ID			0x20
+#define APIC_VERSION		0x30
+#define APIC_EOI		0xB0
+#define APIC_SVR		0xF0
+#define APIC_ICR_LOW		0x300
+#define APIC_ICR_HIGH		0x310
+#define APIC_LVT_TIMER		0x320
+#define APIC_LVT_LINT0		0x350
+#define APIC_LVT_LINT1		0x360
+#define APIC_TIMER_INITIAL	0x380
+#define APIC_TIMER_CURRENT	0x390
+#define APIC_TIMER_DIVIDE	0x3E0
+
+#define APIC_SVR_ENABLE		0x100
+#define APIC_LVT_MASKED		0x10000
+#define APIC_TIMER_PERIODIC	0x20000
+#define APIC_DELIVER_NMI	0x400
+#define APIC_DELIVER_INIT	0x500
+#define APIC_DELIVER_STARTUP	0x600
+#define APIC_DELIVER_EXTINT	0x700
+#define APIC_ICR_PENDING	0x1000
+#define APIC_LEVEL_ASSERT	0x4000
+#define APIC_TRIGGER_LEVEL	0x8000
+
+/* Divide configuration value for dividing the bus clock by 16. */
+#define APIC_TIMER_DIVIDE_16	0x3
+
+/* ----------------------------------------------------------------------
+ * Private data and functions
+ * ---------------------------------------------------------------------- */
+
+static volatile ulong_t *s_localApic = (volatile ulong_t *) LOCAL_APIC_BASE;
+static bool s_haveLocalApic;
+
+static __inline__ ulong_t Read_APIC(int reg)
+{
+    return s_localApic[reg / 4];
+}
+
+static __inline__ void Write_APIC(int reg, ulong_t value)
+{
+    s_localApic[reg / 4] = value;
+}
+
+/*
+ * Send an interprocessor interrupt command to the local APIC
+ * with given id, once the previous one has been delivered.
+ * Interrupts must be disabled, so that nothing else on this CPU
+ * writes the command register in between.
+ */
+static void Send_Command(int apicId, ulong_t command)
+{
+    while (Read_APIC(APIC_ICR_LOW) & APIC_ICR_PENDING)
+	__asm__ __volatile__ ("pause");
+    Write_APIC(APIC_ICR_HIGH, (ulong_t) apicId << 24);
+    Write_APIC(APIC_ICR_LOW, command);
+}
+
+/*
+ * A spurious interrupt is not in service, so it must not be
+ * acknowledged.
+ */
+static void Spurious_Interrupt_Handler(struct Interrupt_State* state)
+{
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Enable the local APIC of the boot CPU, if it has one.
+ * External interrupts keep coming from the PICs through LINT0
+ * (virtual wire mode).  Returns true if there is a local APIC.
+ */
+bool Init_Local_APIC(void)
+{
+    ulong_t eax, ebx, ecx, edx;
+
+    __asm__ __volatile__ ("cpuid"
+	: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+    s_haveLocalApic = (edx & CPUID_FEATURE_APIC) != 0;
+    if (!s_haveLocalApic) {
+	Print("No local APIC\n");
+	return false;
+    }
+
+    Install_Interrupt_Handler(APIC_SPURIOUS_VECTOR, &Spurious_Interrupt_Handler);
+    Write_APIC(APIC_LVT_LINT0, APIC_DELIVER_EXTINT);
+    Write_APIC(APIC_LVT_LINT1, APIC_DELIVER_NMI);
+    Write_APIC(APIC_SVR, APIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+
+    Print("Local APIC: id %d, version %lx\n",
+	Get_Local_APIC_ID(), Read_APIC(APIC_VERSION) & 0xff);
+    return true;
+}
+
+/*
+ * Enable the local APIC of an application processor.
+ * Only the boot CPU takes external interrupts from the PICs,
+ * so LINT0 is masked.
+ */
+void Init_AP_Local_APIC(void)
+{
+    Write_APIC(APIC_LVT_LINT0, APIC_LVT_MASKED | APIC_DELIVER_EXTINT);
+    Write_APIC(APIC_LVT_LINT1, APIC_DELIVER_NMI);
+    Write_APIC(APIC_SVR, APIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+/*
+ * Return whether the CPUs have a local APIC.
+ */
+bool Local_APIC_Present(void)
+{
+    return s_haveLocalApic;
+}
+
+/*
+ * Get the id of the local APIC of the CPU we are running on.
+ */
+int Get_Local_APIC_ID(void)
+{
+    KASSERT(s_haveLocalApic);
+    return Read_APIC(APIC_ID) >> 24;
+}
+
+/*
+ * Acknowledge the interrupt being serviced.
+ * Handlers for interrupts delivered by the local APIC call this
+ * instead of End_IRQ().
+ */
+void Local_APIC_EOI(void)
+{
+    Write_APIC(APIC_EOI, 0);
+}
+
+/*
+ * Set up the timer of the current CPU's local APIC in one-shot
+ * mode, stopped.  The caller installs the interrupt handler.
+ */
+void Init_APIC_Timer(void)
+{
+    KASSERT(s_haveLocalApic);
+    Write_APIC(APIC_TIMER_INITIAL, 0);
+    Write_APIC(APIC_TIMER_DIVIDE, APIC_TIMER_DIVIDE_16);
+    Write_APIC(APIC_LVT_TIMER, APIC_TIMER_VECTOR);
+}
+
+/*
+ * Start the local APIC timer counting down from given count,
+ * or stop it if count is 0.
+ */
+void Start_APIC_Timer(ulong_t count)
+{
+    Write_APIC(APIC_TIMER_INITIAL, count);
+}
+
+/*
+ * Get the current count of the local APIC timer.
+ */
+ulong_t Get_APIC_Timer_Count(void)
+{
+    return Read_APIC(APIC_TIMER_CURRENT);
+}
+
+/*
+ * Make the local APIC timer of the current CPU interrupt on
+ * APIC_TICK_VECTOR every time it has counted down given count.
+ */
+void Start_APIC_Tick(ulong_t count)
+{
+    Write_APIC(APIC_TIMER_DIVIDE, APIC_TIMER_DIVIDE_16);
+    Write_APIC(APIC_LVT_TIMER, APIC_TIMER_PERIODIC | APIC_TICK_VECTOR);
+    Write_APIC(APIC_TIMER_INITIAL, count);
+}
+
+/*
+ * Send an interrupt on given vector to the CPU with given
+ * local APIC id.  Interrupts must be disabled.
+ */
+void Send_APIC_IPI(int apicId, int vector)
+{
+    Send_Command(apicId, vector);
+}
+
+/*
+ * Assert INIT on the CPU with given local APIC id, which resets it
+ * to wait for a startup IPI.  Interrupts must be disabled.
+ */
+void Send_Init_IPI(int apicId)
+{
+    Send_Command(apicId, APIC_TRIGGER_LEVEL | APIC_LEVEL_ASSERT | APIC_DELIVER_INIT);
+}
+
+/*
+ * Send a startup IPI to the CPU with given local APIC id, which makes
+ * it start executing in real mode at given address.  The address
+ * must be page aligned and below 1MB.  Interrupts must be disabled.
+ */
+void Send_Startup_IPI(int apicId, ulong_t addr)
+{
+    KASSERT((addr & 0xfff) == 0 && addr < 0x100000);
+    Send_Command(apicId, APIC_DELIVER_STARTUP | (addr >> 12));
+}
@@ -14,6 +14,7 @@
 #include <geekos/int.h>
 #include <geekos/kthread.h>
 #include <geekos/synch.h>
+#include <geekos/spinlock.h>
 #include <geekos/blockdev.h>
 
 /*#define BLOCKDEV_DEBUG */
@@ -29,8 +30,15 @@
 
 /*
  * Lock protecting access/modification of block device list.
+ * Opening a device only reads the list.
  */
-static struct Mutex s_blockdevLock;
+static struct RW_Lock s_blockdevLock;
+
+/*
+ * Spin lock protecting the inUse flags of devices, and the
+ * drivers' Open and Close functions, which must not sleep.
+ */
+static struct Spin_Lock s_inUseLock;
 
 /*
  * List datatype for list of block devices.
@@ -73,7 +81,7 @@ static int Do_Request(struct Block_Device *dev, enum Request_Type type, int bloc
  * Returns 0 if successful, error code otherwise.
  */
 int Register_Block_Device(const char *name, struct Block_Device_Ops *ops,
-    int unit, void *driverData, struct Thread_Queue *waitQueue,
+    int unit, void *driverData, struct Prio_Queue *waitQueue,
     struct Block_Request_List *requestQueue)
 {
     struct Block_Device *dev;
@@ -94,11 +102,11 @@ int Register_Block_Device(const char *name, struct Block_Device_Ops *ops,
     dev->waitQueue = waitQueue;
     dev->requestQueue = requestQueue;
 
-    Mutex_Lock(&s_blockdevLock);
+    Write_Lock(&s_blockdevLock);
     /* FIXME: handle name conflict with existing device */
     Debug("Registering block device %s\n", dev->name);
     Add_To_Back_Of_Block_Device_List(&s_deviceList, dev);
-    Mutex_Unlock(&s_blockdevLock);
+    Write_Unlock(&s_blockdevLock);
 
     return 0;
 }
@@ -111,19 +119,22 @@ int Open_Block_Device(const char *name, struct Block_Device **pDev)
 {
     struct Block_Device *dev;
     int rc = 0;
+    bool iflag;
 
-    Mutex_Lock(&s_blockdevLock);
-
+    Read_Lock(&s_blockdevLock);
     dev = Get_Front_Of_Block_Device_List(&s_deviceList);
     while (dev != 0) {
 	if (strcmp(dev->name, name) == 0)
 	    break;
 	dev = Get_Next_In_Block_Device_List(dev);
     }
+    Read_Unlock(&s_blockdevLock);
 
     if (dev == 0)
-	rc = ENODEV;
-    else if (dev->inUse)
+	return ENODEV;
+
+    iflag = Begin_Spin_Atomic(&s_inUseLock);
+    if (dev->inUse)
 	rc = EBUSY;
     else {
 	rc = dev->ops->Open(dev);
@@ -132,8 +143,7 @@ int Open_Block_Device(const char *name, struct Block_Device **pDev)
 	    dev->inUse = true;
 	}
     }
-
-    Mutex_Unlock(&s_blockdevLock);
+    End_Spin_Atomic(&s_inUseLock, iflag);
 
     return rc;
 }
@@ -145,15 +155,14 @@ int Open_Block_Device(const char *name, struct Block_Device **pDev)
 int Close_Block_Device(struct Block_Device *dev)
 {
     int rc;
+    bool iflag;
 
-    Mutex_Lock(&s_blockdevLock);
-
+    iflag = Begin_Spin_Atomic(&s_inUseLock);
     KASSERT(dev->inUse);
     rc = dev->ops->Close(dev);
     if (rc == 0)
 	dev->inUse = false;
-
-    Mutex_Unlock(&s_blockdevLock);
+    End_Spin_Atomic(&s_inUseLock, iflag);
 
     return rc;
 }
@@ -171,7 +180,7 @@ struct Block_Request *Create_Request(struct Block_Device *dev, enum Request_Type
 	request->blockNum = blockNum;
 	request->buf = buf;
 	request->state = PENDING;
-	Clear_Thread_Queue(&request->waitQueue);
+	Clear_Prio_Queue(&request->waitQueue);
     }
     return request;
 }
@@ -194,14 +203,14 @@ void Post_Request_And_Wait(struct Block_Request *request)
     Debug("Posting block device request [@%x]...\n", request);
     Disable_Interrupts();
     Add_To_Back_Of_Block_Request_List(dev->requestQueue, request);
-    Wake_Up(dev->waitQueue);
+    Wake_Up_Prio(dev->waitQueue);
     Enable_Interrupts();
 
     /* Wait for request to be processed */
     Disable_Interrupts();
     while (request->state == PENDING) {
 	Debug("Waiting, state=%d\n", request->state);
-	Wait(&request->waitQueue);
+	Wait_Prio(&request->waitQueue);
     }
     Debug("Wait completed!\n");
     Enable_Interrupts();
@@ -211,13 +220,13 @@ void Post_Request_And_Wait(struct Block_Request *request)
  * Wait for a block request to arrive.
  */
 struct Block_Request *Dequeue_Request(struct Block_Request_List *requestQueue,
-    struct Thread_Queue *waitQueue)
+    struct Prio_Queue *waitQueue)
 {
     struct Block_Request *request;
 
     Disable_Interrupts();
     while (Is_Block_Request_List_Empty(requestQueue))
-	Wait(waitQueue);
+	Wait_Prio(waitQueue);
     request = Get_Front_Of_Block_Request_List(requestQueue);
     Remove_From_Front_Of_Block_Request_List(requestQueue);
     Enable_Interrupts();
@@ -233,7 +242,7 @@ void Notify_Request_Completion(struct Block_Request *request, enum Request_State
     Disable_Interrupts();
     request->state = state;
     request->errorCode = errorCode;
-    Wake_Up(&request->waitQueue);
+    Wake_Up_Prio(&request->waitQueue);
     Enable_Interrupts();
 }
 
@@ -35,6 +35,7 @@
 #include <geekos/screen.h>
 #include <geekos/range.h>
 #include <geekos/int.h>
+#include <geekos/spinlock.h>
 #include <geekos/io.h>
 #include <geekos/dma.h>
 
@@ -119,6 +120,7 @@ static const uchar_t s_dmaPageRegisterList[] = {
  * ---------------------------------------------------------------------- */
 
 static uchar_t s_allocated;	 /*!< Which channels have been allocated. */
+static struct Spin_Lock s_dmaLock;
 
 /* ----------------------------------------------------------------------
  * Public functions
@@ -142,7 +144,7 @@ void Init_DMA(void)
  */
 bool Reserve_DMA(int chan)
 {
-    bool iflag = Begin_Int_Atomic();
+    bool iflag = Begin_Spin_Atomic(&s_dmaLock);
     bool result = false;
 
     KASSERT(VALID_CHANNEL(chan));
@@ -156,7 +158,7 @@ bool Reserve_DMA(int chan)
 	result = true;
     }
 
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_dmaLock, iflag);
 
     return result;
 }
@@ -194,7 +194,7 @@ static struct Block_Request_List s_floppyRequestQueue;
  * Thread queue where request processing thread sleeps waiting for
  * a request to arrive.
  */
-static struct Thread_Queue s_floppyWaitQueue;
+static struct Prio_Queue s_floppyWaitQueue;
 
 /* ----------------------------------------------------------------------
  * Private functions
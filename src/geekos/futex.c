@@ -0,0 +1,162 @@
+/*
+ * Futexes: wait and wake on user memory words
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+/*
+ * A futex is just an aligned int in user memory.  User-space locks
+ * change it with atomic instructions, and only call into the kernel
+ * to sleep when the lock is contended, or to wake sleepers.
+ * A futex is named by a segment selector and an offset in the
+ * segment: the process's own data segment, or a shared memory
+ * segment it has attached (see shm.c).  Waiters are keyed by the
+ * linear address of the futex, which is its kernel address, so a
+ * futex in a shared memory segment has the same key in every
+ * process that has the segment attached, whatever the selector.
+ *
+ * All futex state is protected by s_futexLock.
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/errno.h>
+#include <geekos/int.h>
+#include <geekos/kthread.h>
+#include <geekos/spinlock.h>
+#include <geekos/user.h>
+#include <geekos/shm.h>
+#include <geekos/futex.h>
+
+/*
+ * A thread waiting on a futex.  Lives on the waiting thread's stack.
+ */
+struct Futex_Waiter {
+    struct Futex_Waiter* next;
+    ulong_t key;
+    bool woken;
+    struct Thread_Queue waitQueue;
+};
+
+/* Number of hash buckets; a power of two. */
+#define FUTEX_HASH_BUCKETS 64
+
+/* ----------------------------------------------------------------------
+ * Private data
+ * ---------------------------------------------------------------------- */
+
+/* Waiters in each bucket are kept in FIFO order. */
+static struct Futex_Waiter* s_futexHash[FUTEX_HASH_BUCKETS];
+static struct Spin_Lock s_futexLock = SPIN_LOCK_INITIALIZER;
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+static __inline__ struct Futex_Waiter** Get_Bucket(ulong_t key)
+{
+    return &s_futexHash[(key >> 2) & (FUTEX_HASH_BUCKETS - 1)];
+}
+
+/*
+ * Read the futex at given offset in the segment with given selector,
+ * and get its key.  A selector of 0 means the process's data segment.
+ * Returns false if that is not a valid futex address.
+ */
+static bool Read_Futex(int selector, ulong_t offset, int* value, ulong_t* key)
+{
+    struct User_Context* context = CURRENT_THREAD->userContext;
+    char* base;
+    ulong_t size;
+
+    if (selector == 0 || (selector & ~0x3) == (context->dsSelector & ~0x3)) {
+	base = context->memory;
+	size = context->size;
+    } else if ((base = Shm_Get_Memory(context, selector, &size)) == 0) {
+	return false;
+    }
+
+    if ((offset & (sizeof(int) - 1)) != 0 || offset >= size || size - offset < sizeof(int))
+	return false;
+    *value = *((volatile int*) (base + offset));
+    *key = (ulong_t) base + offset;
+    return true;
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Wait on the futex at given offset in the segment with given
+ * selector (0 for the process's data segment), if it still holds
+ * the expected value.  The check and the wait are atomic with
+ * respect to Futex_Wake().
+ * Returns 0 once woken, EAGAIN if the futex held a different
+ * value, or EINVALID if the address is not valid.
+ */
+int Futex_Wait(int selector, ulong_t offset, int expected)
+{
+    struct Futex_Waiter waiter, **link;
+    int value, rc = 0;
+    bool iflag;
+
+    iflag = Begin_Spin_Atomic(&s_futexLock);
+
+    if (!Read_Futex(selector, offset, &value, &waiter.key)) {
+	rc = EINVALID;
+    } else if (value != expected) {
+	rc = EAGAIN;
+    } else {
+	waiter.next = 0;
+	waiter.woken = false;
+	Clear_Thread_Queue(&waiter.waitQueue);
+	for (link = Get_Bucket(waiter.key); *link != 0; link = &(*link)->next)
+	    ;
+	*link = &waiter;
+
+	while (!waiter.woken)
+	    Wait_Spin(&waiter.waitQueue, &s_futexLock);
+    }
+
+    End_Spin_Atomic(&s_futexLock, iflag);
+    return rc;
+}
+
+/*
+ * Wake up to given number of threads waiting on the futex
+ * at given offset in the segment with given selector,
+ * longest waiting first.
+ * Returns the number of threads woken, or EINVALID if the
+ * address is not valid.
+ */
+int Futex_Wake(int selector, ulong_t offset, int count)
+{
+    struct Futex_Waiter *waiter, **link;
+    ulong_t key;
+    int value, woken = 0;
+    bool iflag;
+
+    iflag = Begin_Spin_Atomic(&s_futexLock);
+
+    if (!Read_Futex(selector, offset, &value, &key)) {
+	End_Spin_Atomic(&s_futexLock, iflag);
+	return EINVALID;
+    }
+
+    link = Get_Bucket(key);
+    while ((waiter = *link) != 0 && woken < count) {
+	if (waiter->key == key) {
+	    *link = waiter->next;
+	    waiter->woken = true;
+	    Wake_Up(&waiter->waitQueue);
+	    ++woken;
+	} else {
+	    link = &waiter->next;
+	}
+    }
+
+    End_Spin_Atomic(&s_futexLock, iflag);
+    return woken;
+}
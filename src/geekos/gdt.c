@@ -10,6 +10,8 @@
 #include <geekos/kassert.h>
 #include <geekos/segment.h>
 #include <geekos/int.h>
+#include <geekos/spinlock.h>
+#include <geekos/smp.h>
 #include <geekos/tss.h>
 #include <geekos/gdt.h>
 
@@ -24,8 +26,9 @@ extern void Load_GDTR(ushort_t* limitAndBase);
 
 /*
  * Number of entries in the kernel GDT.
+ * Each CPU's TSS takes one.
  */
-#define NUM_GDT_ENTRIES 16
+#define NUM_GDT_ENTRIES (16 + MAX_CPUS)
 
 /*
  * This is the kernel's global descriptor table.
@@ -36,6 +39,7 @@ static struct Segment_Descriptor s_GDT[ NUM_GDT_ENTRIES ];
  * Number of allocated GDT entries.
  */
 static int s_numAllocated = 0;
+static struct Spin_Lock s_gdtLock;
 
 /* ----------------------------------------------------------------------
  * Functions
@@ -51,7 +55,7 @@ struct Segment_Descriptor* Allocate_Segment_Descriptor(void)
     int i;
     bool iflag;
 
-    iflag = Begin_Int_Atomic();
+    iflag = Begin_Spin_Atomic(&s_gdtLock);
 
     /* Note; entry 0 is unused (thus never allocated) */
     for (i = 1; i < NUM_GDT_ENTRIES; ++i) {
@@ -64,7 +68,7 @@ struct Segment_Descriptor* Allocate_Segment_Descriptor(void)
 	}
     }
 
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_gdtLock, iflag);
 
     return result;
 }
@@ -74,7 +78,7 @@ struct Segment_Descriptor* Allocate_Segment_Descriptor(void)
  */
 void Free_Segment_Descriptor(struct Segment_Descriptor* desc)
 {
-    bool iflag = Begin_Int_Atomic();
+    bool iflag = Begin_Spin_Atomic(&s_gdtLock);
 
     KASSERT(!desc->avail);
 
@@ -82,7 +86,7 @@ void Free_Segment_Descriptor(struct Segment_Descriptor* desc)
     desc->avail = 1;
     --s_numAllocated;
 
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_gdtLock, iflag);
 }
 
 /*
@@ -102,7 +102,7 @@ int ideDebug = 0;
 static int numDrives;
 static ideDisk drives[IDE_MAX_DRIVES];
 
-struct Thread_Queue s_ideWaitQueue;
+struct Prio_Queue s_ideWaitQueue;
 struct Block_Request_List s_ideRequestQueue;
 
 /*
@@ -20,6 +20,11 @@
  */
 static union IDT_Descriptor s_IDT[ NUM_IDT_ENTRIES ];
 
+/*
+ * Limit and base address of the IDT, which all CPUs share.
+ */
+static ushort_t s_limitAndBase[3];
+
 /*
  * These symbols are defined in lowlevel.asm, and define the
  * size of the interrupt entry point table and the sizes
@@ -50,7 +55,6 @@ Interrupt_Handler g_interruptTable[ NUM_IDT_ENTRIES ];
 void Init_IDT(void)
 {
     int i;
-    ushort_t limitAndBase[3];
     ulong_t idtBaseAddr = (ulong_t) s_IDT;
     ulong_t tableBaseAddr = (ulong_t) &g_entryPointTableStart;
     ulong_t addr;
@@ -82,12 +86,20 @@ void Init_IDT(void)
      * Cruft together a 16 bit limit and 32 bit base address
      * to load into the IDTR.
      */
-    limitAndBase[0] = 8 * NUM_IDT_ENTRIES;
-    limitAndBase[1] = idtBaseAddr & 0xffff;
-    limitAndBase[2] = idtBaseAddr >> 16;
+    s_limitAndBase[0] = 8 * NUM_IDT_ENTRIES;
+    s_limitAndBase[1] = idtBaseAddr & 0xffff;
+    s_limitAndBase[2] = idtBaseAddr >> 16;
 
     /* Install the new table in the IDTR. */
-    Load_IDTR(limitAndBase);
+    Load_IDTR(s_limitAndBase);
+}
+
+/*
+ * Load the IDT, already built by Init_IDT(), on an application processor.
+ */
+void Init_AP_IDT(void)
+{
+    Load_IDTR(s_limitAndBase);
 }
 
 /*
@@ -0,0 +1,267 @@
+/*
+ * Synchronous message passing between processes
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+/*
+ * A client calls a server with a small message, and waits for
+ * the reply; a server receives a call from any client, and
+ * later replies to it.  Messages are carried in registers:
+ * the sender's are copied straight into the saved user
+ * registers of the receiver, with no buffering in the kernel.
+ *
+ * When a server is already waiting to receive, a call switches
+ * directly from the client to the server, and when a server
+ * replies and waits for the next call, it switches directly back
+ * to the client; neither goes through the run queue.  So a call
+ * to an idle server costs two context switches and nothing else.
+ *
+ * Callers waiting for a server to receive them are kept in FIFO
+ * order in its ipcSendQueue; callers it has received and not yet
+ * replied to are kept in its ipcReplyQueue.  If the server exits,
+ * they fail with ENOTFOUND.
+ *
+ * All IPC state is protected by disabling interrupts.
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/errno.h>
+#include <geekos/int.h>
+#include <geekos/kthread.h>
+#include <geekos/ipc.h>
+
+/* What a thread is doing, in its ipcState field. */
+enum {
+    IPC_IDLE,			/* not in an IPC operation */
+    IPC_RECEIVING,		/* waiting for a call */
+    IPC_CALLING,		/* waiting to be received */
+    IPC_AWAITING_REPLY,		/* received, waiting for the reply */
+};
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Copy a message into the saved user registers of its receiver.
+ */
+static __inline__ void Copy_Message(struct Interrupt_State* to,
+    const struct Interrupt_State* from, int fromPid)
+{
+    to->ebx = fromPid;
+    to->ecx = from->ecx;
+    to->edx = from->edx;
+    to->esi = from->esi;
+    to->edi = from->edi;
+}
+
+/*
+ * Take the call at the front of the current thread's send queue,
+ * if there is one, copying its message into the current thread's
+ * registers.  Returns true if there was a call.
+ */
+static bool Take_Call(struct Kernel_Thread* current)
+{
+    struct Kernel_Thread* caller;
+
+    if (Is_Thread_Queue_Empty(&current->ipcSendQueue))
+	return false;
+
+    caller = Remove_From_Front_Of_Thread_Queue(&current->ipcSendQueue);
+    Copy_Message(current->ipcRegs, caller->ipcRegs, caller->pid);
+    caller->ipcState = IPC_AWAITING_REPLY;
+    Enqueue_Thread(&current->ipcReplyQueue, caller);
+    return true;
+}
+
+/*
+ * Find the caller with given pid that the current thread
+ * has received and not yet replied to, and take it off the
+ * reply queue.  Returns null if there is none.
+ */
+static struct Kernel_Thread* Take_Caller(struct Kernel_Thread* current, int pid)
+{
+    struct Kernel_Thread* caller = Get_Front_Of_Thread_Queue(&current->ipcReplyQueue);
+
+    while (caller != 0 && caller->pid != pid)
+	caller = Get_Next_In_Thread_Queue(caller);
+    if (caller != 0) {
+	KASSERT(caller->ipcState == IPC_AWAITING_REPLY && caller->ipcPartner == current);
+	Remove_Thread(&current->ipcReplyQueue, caller);
+    }
+    return caller;
+}
+
+/*
+ * Copy the reply in the current thread's registers to a caller,
+ * and finish its call.
+ */
+static void Finish_Call(struct Kernel_Thread* caller, struct Interrupt_State* state)
+{
+    Copy_Message(caller->ipcRegs, state, CURRENT_THREAD->pid);
+    caller->ipcState = IPC_IDLE;
+    caller->ipcPartner = 0;
+    caller->ipcResult = 0;
+}
+
+/*
+ * Fail every call waiting in given queue.
+ */
+static void Fail_Calls(struct Thread_Queue* queue)
+{
+    while (!Is_Thread_Queue_Empty(queue)) {
+	struct Kernel_Thread* caller = Remove_From_Front_Of_Thread_Queue(queue);
+
+	caller->ipcState = IPC_IDLE;
+	caller->ipcPartner = 0;
+	caller->ipcResult = ENOTFOUND;
+	Make_Runnable(caller);
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Call a server with the message in the caller's registers,
+ * and wait for the reply, which replaces it.
+ * Params:
+ *   state->ebx - pid of the server; on return, the pid of the replier
+ *   state->ecx..edi - message; on return, the reply
+ * Returns: 0 if successful, ENOTFOUND if there is no such
+ *   process, or it exited before replying, EINVALID if
+ *   a process calls itself
+ * Interrupts must be disabled.
+ */
+int Ipc_Call(struct Interrupt_State* state)
+{
+    struct Kernel_Thread* current = CURRENT_THREAD;
+    struct Kernel_Thread* server;
+
+    KASSERT(!Interrupts_Enabled());
+
+    server = Find_Thread(state->ebx);
+    if (server == 0 || server->userContext == 0)
+	return ENOTFOUND;
+    if (server == current)
+	return EINVALID;
+
+    current->ipcRegs = state;
+    current->ipcPartner = server;
+
+    if (server->ipcState == IPC_RECEIVING) {
+	/* Hand the message and the CPU straight to the server. */
+	Copy_Message(server->ipcRegs, state, current->pid);
+	server->ipcState = IPC_IDLE;
+	server->ipcResult = 0;
+	Remove_Thread(&server->ipcReceiveQueue, server);
+
+	current->ipcState = IPC_AWAITING_REPLY;
+	Wait_And_Switch_To(&server->ipcReplyQueue, server);
+    } else {
+	current->ipcState = IPC_CALLING;
+	Wait(&server->ipcSendQueue);
+    }
+
+    KASSERT(current->ipcState == IPC_IDLE);
+    return current->ipcResult;
+}
+
+/*
+ * Wait for a call from any process.
+ * Params:
+ *   on return, state->ebx - pid of the caller
+ *   on return, state->ecx..edi - message
+ * Returns: 0
+ * Interrupts must be disabled.
+ */
+int Ipc_Receive(struct Interrupt_State* state)
+{
+    struct Kernel_Thread* current = CURRENT_THREAD;
+
+    KASSERT(!Interrupts_Enabled());
+
+    current->ipcRegs = state;
+    if (Take_Call(current))
+	return 0;
+
+    current->ipcState = IPC_RECEIVING;
+    Wait(&current->ipcReceiveQueue);
+    return current->ipcResult;
+}
+
+/*
+ * Reply to a call received earlier.  The caller
+ * becomes runnable, and the current thread goes on.
+ * Params:
+ *   state->ebx - pid of the caller
+ *   state->ecx..edi - reply
+ * Returns: 0 if successful, EINVALID if the process
+ *   is not waiting for a reply from the current thread
+ * Interrupts must be disabled.
+ */
+int Ipc_Reply(struct Interrupt_State* state)
+{
+    struct Kernel_Thread* caller;
+
+    KASSERT(!Interrupts_Enabled());
+
+    caller = Take_Caller(CURRENT_THREAD, state->ebx);
+    if (caller == 0)
+	return EINVALID;
+
+    Finish_Call(caller, state);
+    Make_Runnable(caller);
+    return 0;
+}
+
+/*
+ * Reply to a call received earlier, and wait for the next one.
+ * If there isn't a call waiting, the current thread switches
+ * straight back to the caller.
+ * Params:
+ *   state->ebx - pid of the caller; on return, the pid of the next caller
+ *   state->ecx..edi - reply; on return, the next message
+ * Returns: 0 if successful, EINVALID if the process
+ *   is not waiting for a reply from the current thread
+ * Interrupts must be disabled.
+ */
+int Ipc_Reply_Wait(struct Interrupt_State* state)
+{
+    struct Kernel_Thread* current = CURRENT_THREAD;
+    struct Kernel_Thread* caller;
+
+    KASSERT(!Interrupts_Enabled());
+
+    caller = Take_Caller(current, state->ebx);
+    if (caller == 0)
+	return EINVALID;
+
+    Finish_Call(caller, state);
+
+    current->ipcRegs = state;
+    if (Take_Call(current)) {
+	Make_Runnable(caller);
+	return 0;
+    }
+
+    current->ipcState = IPC_RECEIVING;
+    Wait_And_Switch_To(&current->ipcReceiveQueue, caller);
+    return current->ipcResult;
+}
+
+/*
+ * Fail the calls waiting for an exiting thread.
+ * Interrupts must be disabled.
+ */
+void Ipc_Exit(struct Kernel_Thread* kthread)
+{
+    KASSERT(!Interrupts_Enabled());
+
+    Fail_Calls(&kthread->ipcSendQueue);
+    Fail_Calls(&kthread->ipcReplyQueue);
+}
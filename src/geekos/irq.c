@@ -11,6 +11,7 @@
 #include <geekos/idt.h>
 #include <geekos/io.h>
 #include <geekos/irq.h>
+#include <geekos/spinlock.h>
 
 /* ----------------------------------------------------------------------
  * Private functions and data
@@ -22,6 +23,7 @@
  * (which does the initial programming of the PICs).
  */
 static ushort_t s_irqMask = 0xfffb;
+static struct Spin_Lock s_irqMaskLock;
 
 /*
  * Get the master and slave parts of an IRQ mask.
@@ -79,14 +81,14 @@ void Set_IRQ_Mask(ushort_t mask)
  */
 void Enable_IRQ(int irq)
 {
-    bool iflag = Begin_Int_Atomic();
+    bool iflag = Begin_Spin_Atomic(&s_irqMaskLock);
 
     KASSERT(irq >= 0 && irq < 16);
     ushort_t mask = Get_IRQ_Mask();
     mask &= ~(1 << irq);
     Set_IRQ_Mask(mask);
 
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_irqMaskLock, iflag);
 }
 
 /*
@@ -94,14 +96,14 @@ void Enable_IRQ(int irq)
  */
 void Disable_IRQ(int irq)
 {
-    bool iflag = Begin_Int_Atomic();
+    bool iflag = Begin_Spin_Atomic(&s_irqMaskLock);
 
     KASSERT(irq >= 0 && irq < 16);
     ushort_t mask = Get_IRQ_Mask();
     mask |= (1 << irq);
     Set_IRQ_Mask(mask);
 
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_irqMaskLock, iflag);
 }
 
 /*
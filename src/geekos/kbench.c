@@ -0,0 +1,592 @@
+/*
+ * Kernel microbenchmarks
+ * $Revision: 1.1 $
+ * 
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/screen.h>
+#include <geekos/string.h>
+#include <geekos/int.h>
+#include <geekos/malloc.h>
+#include <geekos/mem.h>
+#include <geekos/kthread.h>
+#include <geekos/synch.h>
+#include <geekos/timer.h>
+#include <geekos/vfs.h>
+#include <geekos/kbench.h>
+
+/*
+ * These benchmarks poke directly at kernel data structures,
+ * so they are meant to be run once at boot (see KERNEL_BENCH
+ * in main.c), before any user processes exist.
+ * Results are reported in TSC cycles.
+ */
+
+/* ----------------------------------------------------------------------
+ * Scheduler benchmarks
+ * ---------------------------------------------------------------------- */
+
+/* Number of pick-next operations timed per run. */
+#define PICK_NEXT_ITERATIONS 10000
+
+/*
+ * Number of priorities the fake threads are spread across.
+ * They sit above every real thread's priority, so the scheduler
+ * only ever picks fake threads while the benchmark runs.
+ */
+#define PICK_NEXT_LEVELS 8
+#define PICK_NEXT_BASE_PRIORITY (PRIORITY_HIGH + 1)
+
+/*
+ * Time a Get_Next_Runnable()/Make_Runnable() pair with given
+ * number of runnable threads.  The threads are never switched to;
+ * they exist only to populate the run queue.
+ */
+static void Bench_Pick_Next(int numThreads)
+{
+    struct Kernel_Thread **threads;
+    unsigned long long start, end;
+    int i;
+
+    KASSERT(PICK_NEXT_BASE_PRIORITY + PICK_NEXT_LEVELS <= NUM_RUN_QUEUE_LEVELS);
+
+    threads = Malloc(numThreads * sizeof(struct Kernel_Thread*));
+    if (threads == 0)
+	goto nomem;
+    for (i = 0; i < numThreads; ++i) {
+	threads[i] = Malloc(sizeof(struct Kernel_Thread));
+	if (threads[i] == 0) {
+	    while (--i >= 0)
+		Free(threads[i]);
+	    Free(threads);
+	    goto nomem;
+	}
+	memset(threads[i], '\0', sizeof(struct Kernel_Thread));
+	threads[i]->priority = PICK_NEXT_BASE_PRIORITY + (i % PICK_NEXT_LEVELS);
+    }
+
+    Disable_Interrupts();
+
+    for (i = 0; i < numThreads; ++i)
+	Make_Runnable(threads[i]);
+
+    start = Read_TSC();
+    for (i = 0; i < PICK_NEXT_ITERATIONS; ++i)
+	Make_Runnable(Get_Next_Runnable());
+    end = Read_TSC();
+
+    /* The fake threads have the highest priorities, so they come out first. */
+    for (i = 0; i < numThreads; ++i)
+	Get_Next_Runnable();
+
+    Enable_Interrupts();
+
+    Print("pick-next: %4d threads, %lu cycles/op\n", numThreads,
+	(ulong_t) (end - start) / PICK_NEXT_ITERATIONS);
+
+    for (i = 0; i < numThreads; ++i)
+	Free(threads[i]);
+    Free(threads);
+    return;
+
+nomem:
+    Print("pick-next: %4d threads, out of memory\n", numThreads);
+}
+
+/* Number of round trips timed by the ping/pong benchmark. */
+#define PING_PONG_ROUNDS 10000
+
+static struct Thread_Queue s_pingQueue, s_pongQueue;
+static unsigned long long s_pingPongCycles;
+
+/*
+ * The ping thread wakes the pong thread and waits to be woken
+ * in turn, timing the whole exchange.
+ */
+static void Ping(ulong_t arg)
+{
+    unsigned long long start;
+    int i;
+
+    Disable_Interrupts();
+    start = Read_TSC();
+    for (i = 0; i < PING_PONG_ROUNDS; ++i) {
+	Wake_Up(&s_pongQueue);
+	Wait(&s_pingQueue);
+    }
+    s_pingPongCycles = Read_TSC() - start;
+    Enable_Interrupts();
+}
+
+static void Pong(ulong_t arg)
+{
+    int i;
+
+    Disable_Interrupts();
+    for (i = 0; i < PING_PONG_ROUNDS; ++i) {
+	Wait(&s_pongQueue);
+	Wake_Up(&s_pingQueue);
+    }
+    Enable_Interrupts();
+}
+
+/*
+ * Time context switches between two kernel threads that
+ * take turns waking each other.  Each round trip is two switches.
+ * The pong thread is started first, so it is already waiting
+ * when the ping thread first wakes it.
+ */
+static void Bench_Ping_Pong(void)
+{
+    struct Kernel_Thread *ping, *pong;
+
+    Clear_Thread_Queue(&s_pingQueue);
+    Clear_Thread_Queue(&s_pongQueue);
+
+    pong = Start_Kernel_Thread(Pong, 0, PICK_NEXT_BASE_PRIORITY, false);
+    if (pong == 0)
+	goto nomem;
+    ping = Start_Kernel_Thread(Ping, 0, PICK_NEXT_BASE_PRIORITY, false);
+    if (ping == 0)
+	goto nomem;	/* pong is left waiting; we're short of memory anyway */
+    Join(ping);
+    Join(pong);
+
+    Print("ping-pong: %lu cycles/switch\n",
+	(ulong_t) s_pingPongCycles / (2 * PING_PONG_ROUNDS));
+    return;
+
+nomem:
+    Print("ping-pong: out of memory\n");
+}
+
+/* Number of threads created by the thread create/exit benchmark. */
+#define CREATE_EXIT_ROUNDS 1000
+
+static void Null_Thread(ulong_t arg)
+{
+}
+
+/*
+ * Time creating a kernel thread, running it to completion, and
+ * joining it.  The reaper frees each thread's object and stack
+ * in the background, so they are mostly recycled by the thread
+ * and stack caches.
+ */
+static void Bench_Create_Exit(void)
+{
+    struct Kernel_Thread *kthread;
+    unsigned long long start, end;
+    int i;
+
+    start = Read_TSC();
+    for (i = 0; i < CREATE_EXIT_ROUNDS; ++i) {
+	kthread = Start_Kernel_Thread(Null_Thread, 0, PICK_NEXT_BASE_PRIORITY, false);
+	if (kthread == 0) {
+	    Print("create-exit: out of memory\n");
+	    return;
+	}
+	Join(kthread);
+    }
+    end = Read_TSC();
+
+    Print("create-exit: %lu cycles/thread\n",
+	(ulong_t) (end - start) / CREATE_EXIT_ROUNDS);
+}
+
+/*
+ * Priority inversion test.  A low priority thread holds a mutex
+ * for PI_HOLD_TICKS of CPU time while medium priority threads
+ * hog the CPU for PI_HOG_TICKS, and a high priority thread waits
+ * for the mutex.  With priority inheritance the low priority
+ * thread runs at high priority until it unlocks, so the high
+ * priority thread waits about PI_HOLD_TICKS; without it, the
+ * wait would include the hogs' PI_HOG_TICKS.
+ */
+#define PI_HOLD_TICKS  5
+#define PI_HOG_TICKS   50
+#define PI_NUM_HOGS    2
+#define PI_SLACK_TICKS 2
+
+#define PI_LOW_PRIORITY    PICK_NEXT_BASE_PRIORITY
+#define PI_MEDIUM_PRIORITY (PICK_NEXT_BASE_PRIORITY + 1)
+#define PI_HIGH_PRIORITY   (PICK_NEXT_BASE_PRIORITY + 2)
+
+static struct Mutex s_piMutex;
+static struct Thread_Queue s_piGoQueue;
+static volatile bool s_piHeld;
+static ulong_t s_piWaitTicks;
+
+/*
+ * Lock the mutex, wait for the high priority thread to start
+ * the hogs, then use PI_HOLD_TICKS of CPU time before unlocking.
+ */
+static void PI_Low(ulong_t arg)
+{
+    volatile ulong_t *runTicks = &CURRENT_THREAD->stats.runTicks;
+    ulong_t start;
+
+    Mutex_Lock(&s_piMutex);
+    s_piHeld = true;
+
+    Disable_Interrupts();
+    Wait(&s_piGoQueue);
+    Enable_Interrupts();
+
+    start = *runTicks;
+    while (*runTicks - start < PI_HOLD_TICKS)
+	;
+    Mutex_Unlock(&s_piMutex);
+}
+
+static void PI_Hog(ulong_t arg)
+{
+    ulong_t start = g_numTicks;
+
+    while (g_numTicks - start < PI_HOG_TICKS)
+	;
+}
+
+/*
+ * Start the hogs, let the low priority thread continue,
+ * and time how long it takes to get the mutex.
+ */
+static void PI_High(ulong_t arg)
+{
+    struct Kernel_Thread *hogs[PI_NUM_HOGS];
+    ulong_t start;
+    int i;
+
+    for (i = 0; i < PI_NUM_HOGS; ++i)
+	hogs[i] = Start_Kernel_Thread(PI_Hog, 0, PI_MEDIUM_PRIORITY, false);
+    Disable_Interrupts();
+    Wake_Up(&s_piGoQueue);
+    Enable_Interrupts();
+
+    start = g_numTicks;
+    Mutex_Lock(&s_piMutex);
+    s_piWaitTicks = g_numTicks - start;
+    Mutex_Unlock(&s_piMutex);
+
+    for (i = 0; i < PI_NUM_HOGS; ++i) {
+	if (hogs[i] != 0)
+	    Join(hogs[i]);
+    }
+}
+
+static void Test_Priority_Inversion(void)
+{
+    struct Kernel_Thread *low, *high;
+
+    Mutex_Init(&s_piMutex);
+    Clear_Thread_Queue(&s_piGoQueue);
+    s_piHeld = false;
+
+    low = Start_Kernel_Thread(PI_Low, 0, PI_LOW_PRIORITY, false);
+    if (low == 0)
+	goto nomem;
+    while (!s_piHeld)
+	Yield();
+    high = Start_Kernel_Thread(PI_High, 0, PI_HIGH_PRIORITY, false);
+    if (high == 0)
+	goto nomem;	/* low is left waiting; we're short of memory anyway */
+    Join(high);
+    Join(low);
+
+    Print("priority-inversion: waited %lu ticks, bound %d ticks: %s\n",
+	s_piWaitTicks, PI_HOLD_TICKS + PI_SLACK_TICKS,
+	s_piWaitTicks <= PI_HOLD_TICKS + PI_SLACK_TICKS ? "ok" : "FAILED");
+    return;
+
+nomem:
+    Print("priority-inversion: out of memory\n");
+}
+
+/* ----------------------------------------------------------------------
+ * VFS benchmarks
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Total number of opens timed by the VFS open benchmark, and the
+ * file opened: the init program on the default (IDE) root filesystem.
+ */
+#define VFS_OPEN_ROUNDS 1600
+#define VFS_OPEN_PATH "/c/shell.exe"
+
+static volatile int s_openErrors;
+
+static void Open_Close_Thread(ulong_t rounds)
+{
+    struct File *file;
+    ulong_t i;
+
+    for (i = 0; i < rounds; ++i) {
+	if (Open(VFS_OPEN_PATH, O_READ, &file) != 0) {
+	    ++s_openErrors;
+	    return;
+	}
+	Close(file);
+    }
+}
+
+/*
+ * Time opening and closing a file from given number of threads
+ * at once, which contend for the VFS mount point lock and the
+ * filesystem's own locks.
+ */
+static void Bench_VFS_Open(int numThreads)
+{
+    struct Kernel_Thread **threads;
+    unsigned long long start, end;
+    ulong_t rounds = VFS_OPEN_ROUNDS / numThreads;
+    int i;
+
+    threads = Malloc(numThreads * sizeof(struct Kernel_Thread*));
+    if (threads == 0)
+	goto nomem;
+    s_openErrors = 0;
+
+    start = Read_TSC();
+    for (i = 0; i < numThreads; ++i)
+	threads[i] = Start_Kernel_Thread(Open_Close_Thread, rounds, PICK_NEXT_BASE_PRIORITY, false);
+    for (i = 0; i < numThreads; ++i) {
+	if (threads[i] != 0)
+	    Join(threads[i]);
+    }
+    end = Read_TSC();
+    Free(threads);
+
+    if (s_openErrors != 0)
+	Print("vfs-open: %3d threads, could not open %s\n", numThreads, VFS_OPEN_PATH);
+    else
+	Print("vfs-open: %3d threads, %lu cycles/open\n", numThreads,
+	    (ulong_t) (end - start) / (rounds * numThreads));
+    return;
+
+nomem:
+    Print("vfs-open: %3d threads, out of memory\n", numThreads);
+}
+
+/* ----------------------------------------------------------------------
+ * Page allocator benchmarks
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Number of blocks the page allocator stress test keeps allocated
+ * at once, the largest order it allocates, and the number of
+ * allocate/free rounds it times.
+ */
+#define PAGE_STRESS_SLOTS  256
+#define PAGE_STRESS_ORDER  4
+#define PAGE_STRESS_ROUNDS 20000
+
+static void Print_Page_Stats(const char *when)
+{
+    struct Page_Stats stats;
+    int order;
+
+    Get_Page_Stats(&stats);
+    Print("page-alloc: %s: %lu pages free, largest block order %d, %d%% fragmented\n",
+	when, stats.freePages, stats.largestOrder, Get_Fragmentation(&stats));
+    Print("  free blocks by order:");
+    for (order = 0; order <= MAX_PAGE_ORDER; ++order)
+	Print(" %lu", stats.freeBlocks[order]);
+    Print("\n");
+}
+
+/*
+ * Allocate and free blocks of random orders in random order,
+ * keeping up to PAGE_STRESS_SLOTS of them allocated at once, and
+ * report the average cost of an allocate/free pair and how
+ * fragmented free memory is while they are allocated.  Once all
+ * of them are freed, buddies should have merged back into the
+ * blocks there were to begin with.
+ */
+static void Bench_Page_Alloc(void)
+{
+    void **blocks;
+    int *orders;
+    ulong_t seed = 12345, allocs = 0, failures = 0;
+    unsigned long long start, end;
+    int i, slot;
+
+    blocks = Malloc(PAGE_STRESS_SLOTS * sizeof(void*));
+    orders = Malloc(PAGE_STRESS_SLOTS * sizeof(int));
+    if (blocks == 0 || orders == 0)
+	goto nomem;
+    memset(blocks, '\0', PAGE_STRESS_SLOTS * sizeof(void*));
+
+    Print_Page_Stats("before");
+
+    start = Read_TSC();
+    for (i = 0; i < PAGE_STRESS_ROUNDS; ++i) {
+	seed = seed * 1103515245 + 12345;
+	slot = (seed >> 16) % PAGE_STRESS_SLOTS;
+	if (blocks[slot] != 0) {
+	    Free_Pages(blocks[slot], orders[slot]);
+	    blocks[slot] = 0;
+	} else {
+	    orders[slot] = (seed >> 8) % (PAGE_STRESS_ORDER + 1);
+	    blocks[slot] = Alloc_Pages(orders[slot]);
+	    if (blocks[slot] == 0)
+		++failures;
+	    else
+		++allocs;
+	}
+    }
+    end = Read_TSC();
+
+    Print("page-alloc: %lu cycles/operation, %lu allocations, %lu failed\n",
+	(ulong_t) (end - start) / PAGE_STRESS_ROUNDS, allocs, failures);
+    Print_Page_Stats("during");
+
+    for (slot = 0; slot < PAGE_STRESS_SLOTS; ++slot) {
+	if (blocks[slot] != 0)
+	    Free_Pages(blocks[slot], orders[slot]);
+    }
+    Print_Page_Stats("after");
+
+    Free(orders);
+    Free(blocks);
+    return;
+
+nomem:
+    if (orders != 0)
+	Free(orders);
+    if (blocks != 0)
+	Free(blocks);
+    Print("page-alloc: out of memory\n");
+}
+
+/* ----------------------------------------------------------------------
+ * Kernel heap benchmarks
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Number of buffers the Malloc benchmark keeps allocated at once,
+ * and the number of allocate/free operations it times.
+ */
+#define MALLOC_SLOTS  64
+#define MALLOC_ROUNDS 20000
+
+/*
+ * Allocate and free buffers of given size in random order, keeping
+ * up to MALLOC_SLOTS of them allocated at once, using given
+ * functions.  Reports the average cycles per operation, and the
+ * longest operation, which is about as long as interrupts were
+ * held off by the allocator.
+ */
+static void Time_Malloc(const char *name, ulong_t size,
+    void* (*alloc)(ulong_t), void (*release)(void*))
+{
+    void *bufs[MALLOC_SLOTS];
+    ulong_t seed = 12345, worst = 0;
+    unsigned long long start, end, total = 0;
+    int i, slot;
+
+    memset(bufs, '\0', sizeof(bufs));
+
+    for (i = 0; i < MALLOC_ROUNDS; ++i) {
+	seed = seed * 1103515245 + 12345;
+	slot = (seed >> 16) % MALLOC_SLOTS;
+	start = Read_TSC();
+	if (bufs[slot] != 0) {
+	    release(bufs[slot]);
+	    bufs[slot] = 0;
+	} else {
+	    bufs[slot] = alloc(size);
+	}
+	end = Read_TSC();
+	total += end - start;
+	if ((ulong_t) (end - start) > worst)
+	    worst = (ulong_t) (end - start);
+    }
+
+    for (slot = 0; slot < MALLOC_SLOTS; ++slot) {
+	if (bufs[slot] != 0)
+	    release(bufs[slot]);
+    }
+
+    Print("malloc: %-6s %4lu bytes, %lu cycles/operation, longest %lu cycles\n",
+	name, size, (ulong_t) total / MALLOC_ROUNDS, worst);
+}
+
+/*
+ * Compare small allocations from the size-class caches (Malloc())
+ * with the same allocations from the kernel heap (Heap_Alloc()),
+ * which is how every allocation was made before the caches existed.
+ */
+static void Bench_Malloc(void)
+{
+    static const ulong_t sizes[] = { 24, 100, 512, 2000 };
+    struct Malloc_Cache_Stats stats[MALLOC_NUM_CACHES];
+    unsigned i;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+	Time_Malloc("heap", sizes[i], Heap_Alloc, Heap_Free);
+	Time_Malloc("cache", sizes[i], Malloc, Free);
+    }
+
+    Get_Malloc_Stats(stats);
+    Print("  size  slabs  in use    allocs     frees  slab allocs/frees\n");
+    for (i = 0; i < MALLOC_NUM_CACHES; ++i)
+	Print("  %4lu  %5lu  %6lu  %8lu  %8lu  %lu/%lu\n",
+	    stats[i].objectSize, stats[i].slabs, stats[i].objectsInUse,
+	    stats[i].allocs, stats[i].frees, stats[i].slabAllocs, stats[i].slabFrees);
+}
+
+/* ----------------------------------------------------------------------
+ * Timer benchmarks
+ * ---------------------------------------------------------------------- */
+
+#define SLEEP_ROUNDS 20
+
+/*
+ * Time how long Sleep_Us() really blocks for given number of
+ * microseconds, and report the average and the longest overshoot.
+ */
+static void Bench_Sleep_Us(ulong_t us)
+{
+    unsigned long long start;
+    ulong_t elapsed, total = 0, worst = 0;
+    int i;
+
+    for (i = 0; i < SLEEP_ROUNDS; ++i) {
+	start = Get_Time_Ns();
+	Sleep_Us(us);
+	elapsed = (ulong_t) (Get_Time_Ns() - start) - us * 1000;
+	total += elapsed;
+	if (elapsed > worst)
+	    worst = elapsed;
+    }
+
+    Print("sleep-us: %5lu us, late by %lu ns on average, %lu ns at most\n",
+	us, total / SLEEP_ROUNDS, worst);
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+void Run_Kernel_Benchmarks(void)
+{
+    Print("Running kernel benchmarks...\n");
+
+    Bench_Pick_Next(10);
+    Bench_Pick_Next(100);
+    Bench_Pick_Next(1000);
+    Bench_Ping_Pong();
+    Bench_Create_Exit();
+    Test_Priority_Inversion();
+    Bench_VFS_Open(1);
+    Bench_VFS_Open(4);
+    Bench_VFS_Open(16);
+    Bench_Page_Alloc();
+    Bench_Malloc();
+    Bench_Sleep_Us(50);
+    Bench_Sleep_Us(1000);
+    Bench_Sleep_Us(25000);
+}
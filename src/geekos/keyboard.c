@@ -247,7 +247,7 @@ noflagchange:
 	 * Pick a new thread upon return from interrupt
 	 * (hopefully the one waiting for the keyboard event)
 	 */
-	g_needReschedule = true;
+	g_needReschedule[Get_CPU_ID()] = true;
     }
 
 done:
@@ -17,18 +17,71 @@
 #include <geekos/kthread.h>
 #include <geekos/malloc.h>
 #include <geekos/user.h>
+#include <geekos/timer.h>
+#include <geekos/spinlock.h>
+#include <geekos/smp.h>
+#include <geekos/apic.h>
+#include <geekos/errno.h>
+#include <geekos/ipc.h>
 
-#define RR  0
-#define MLF 1
+int g_currentSchedulingPolicy = SCHED_RR;
+int g_prevSchedulingPolicy = SCHED_RR;
 
-int g_currentSchedulingPolicy = RR;
-int g_prevSchedulingPolicy = RR;
+/*
+ * Under MLF, every MLF_AGING_MS milliseconds all threads are
+ * aged back to level 0, so CPU-bound threads that sank to the
+ * bottom level are not starved by a stream of interactive ones.
+ * Aging is done lazily: advancing the epoch invalidates every
+ * thread's currentReadyQueue at once, and a thread's level is reset
+ * the next time the scheduler looks at it.
+ */
+#define MLF_AGING_MS 500
+static ulong_t s_mlfEpoch;
+static ulong_t s_mlfLastAgingTick;
 
+/*
+ * Protects policy changes and MLF aging, which touch every
+ * CPU's run queue.  It must be taken before any run queue lock.
+ */
+static struct Spin_Lock s_policyLock;
+
+/*
+ * Under CFS, runnable threads are kept in a red-black tree ordered
+ * by virtual runtime, and the thread with the least runs next.
+ * Each tick a thread runs adds CFS_NICE_0_WEIGHT / weight to its
+ * virtual runtime, scaled up by 2^CFS_VRUNTIME_SHIFT, where the weight
+ * comes from the thread's priority: each step up in priority
+ * is worth 25% more CPU time than the step below it.
+ */
+#define CFS_NICE_0_WEIGHT  1024
+#define CFS_VRUNTIME_SHIFT 10
+static const ulong_t s_cfsWeights[NUM_RUN_QUEUE_LEVELS] = {
+    336, 419, 524, 655, 819, 1024, 1280, 1600,
+    2000, 2500, 3125, 3906, 4883, 6104, 7629, 9537,
+    11921, 14901, 18626, 23283, 29104, 36380, 45475, 56843,
+    71054, 88818, 111022, 138778, 173472, 216840, 271051, 338813,
+};
 
-#define TIME_TO_STARVE 100000
-static ulong_t counterStarvationCheck=0;
+/*
+ * A thread waking up after a long sleep has its virtual runtime
+ * raised to no less than this much below the run queue's minimum,
+ * so it runs promptly but cannot monopolize the CPU while it
+ * catches up.  This is one tick's worth for a PRIORITY_NORMAL thread.
+ */
+#define CFS_SLEEPER_CREDIT (1UL << CFS_VRUNTIME_SHIFT)
 
-static struct Kernel_Thread *IdleThread;
+/*
+ * EDF threads are admitted only while the sum of their densities
+ * (runtime / deadline) stays within EDF_MAX_UTILIZATION, in units of
+ * 2^-EDF_UTIL_SHIFT.  Since deadlines may not exceed periods, this
+ * guarantees every admitted thread meets its deadlines, and the
+ * remainder of the CPU is left for threads scheduled by the policy.
+ * Protected by s_policyLock.
+ */
+#define EDF_UTIL_SHIFT 10
+#define EDF_MAX_UTILIZATION ((90 << EDF_UTIL_SHIFT) / 100)
+#define EDF_MAX_RUNTIME (1UL << (32 - EDF_UTIL_SHIFT - 1))
+static ulong_t s_edfUtilization;
 
 /* ----------------------------------------------------------------------
  * Private data
@@ -38,28 +91,65 @@ static struct Kernel_Thread *IdleThread;
  * List of all threads in the system.
  */
 static struct All_Thread_List s_allThreadList;
+static struct Spin_Lock s_allThreadLock;
 
 /*
- * Queue of runnable threads.
+ * Queue of runnable threads.  Each CPU has its own.
+ * There is one FIFO per level, and bit i of readyMask is set
+ * exactly when level i is non-empty.  This lets the scheduler
+ * find the best runnable thread with a single bit scan,
+ * no matter how many threads are runnable.
  */
-static struct Thread_Queue s_runQueue[4];
+struct Run_Queue {
+    struct Spin_Lock lock;
+    ulong_t readyMask;
+    struct Thread_Queue level[NUM_RUN_QUEUE_LEVELS];
+
+    /*
+     * Under CFS, every runnable thread except the idle thread
+     * is kept in fairTree instead.  minVruntime never decreases,
+     * and tracks the smallest virtual runtime of the threads
+     * that are runnable or running.
+     */
+    struct Rb_Tree fairTree;
+    ulong_t minVruntime;
+
+    /*
+     * Runnable EDF threads, ordered by absolute deadline, and
+     * EDF threads that have used up their budget for the current
+     * period, which are not runnable until the next period starts.
+     */
+    struct Rb_Tree edfTree;
+    struct Thread_Queue throttled;
+
+    /*
+     * Number of queued threads other than the idle thread.
+     * A CPU with none left steals from the busiest other CPU.
+     */
+    int numRunnable;
+    struct Kernel_Thread* idleThread;
+};
+static struct Run_Queue s_runQueues[MAX_CPUS];
 
 /*
- * Current thread.
+ * Current thread of each CPU.
  */
-struct Kernel_Thread* g_currentThread;
+struct Kernel_Thread* g_currentThreads[MAX_CPUS];
 
 /*
- * Boolean flag indicating that we need to choose a new runnable thread.
- * It is checked by the interrupt return code (Handle_Interrupt,
- * in lowlevel.asm) before returning from an interrupt.
+ * Boolean flag for each CPU indicating that we need to choose
+ * a new runnable thread.  It is checked by the interrupt return
+ * code (Handle_Interrupt, in lowlevel.asm) before returning
+ * from an interrupt.
  */
-int g_needReschedule;
+int g_needReschedule[MAX_CPUS];
 
 /*
  * Boolean flag indicating that preemption is disabled.
  * When set, external interrupts (such as the timer tick)
- * will not cause a new thread to be selected.
+ * will not cause a new thread to be selected.  One flag does
+ * for all CPUs, since it is only set by kernel code, which runs
+ * under the kernel lock.
  */
 volatile int g_preemptionDisabled;
 
@@ -71,18 +161,62 @@ volatile int g_preemptionDisabled;
 static struct Thread_Queue s_graveyardQueue;
 static struct Thread_Queue s_reaperWaitQueue;
 
+/*
+ * Set by Schedule(), so that Get_Next_Runnable() can tell
+ * a voluntary context switch from a preemption.
+ */
+static bool s_voluntarySwitch;
+
 /*
  * Counter for keys that access thread-local data, and an array
  * of destructors for freeing that data when the thread dies.  This is
  * based on POSIX threads' thread-specific data functionality.
  */
+static struct Spin_Lock s_tlocalLock;
 static unsigned int s_tlocalKeyCounter = 0;
 static tlocal_destructor_t s_tlocalDestructors[MAX_TLOCAL_KEYS];
 
+/*
+ * The reaper keeps up to RECYCLE_POOL_MAX dead threads, still
+ * attached to their stacks, in a recycle pool, and Create_Thread()
+ * draws from the pool before allocating anything.  Dead threads
+ * beyond that are freed.  Thread objects themselves come from
+ * Malloc(), whose size-class slab caches already make that cheap.
+ * The pool and the statistics are protected by s_recyclePoolLock.
+ */
+#define RECYCLE_POOL_MAX 16
+static struct Spin_Lock s_recyclePoolLock;
+static struct Thread_Queue s_recyclePool;
+static int s_recyclePoolSize;
+static struct Thread_Pool_Stats s_threadPoolStats;
+
 /* ----------------------------------------------------------------------
  * Private functions
  * ---------------------------------------------------------------------- */
 
+/*
+ * Take a thread, and the stack it had, from the recycle pool.
+ * Returns null if the pool is empty.
+ */
+static struct Kernel_Thread* Take_Recycled_Thread(void** stackPage)
+{
+    struct Kernel_Thread* kthread = 0;
+    bool iflag;
+
+    iflag = Begin_Spin_Atomic(&s_recyclePoolLock);
+    if (s_recyclePoolSize > 0) {
+	kthread = Remove_From_Front_Of_Thread_Queue(&s_recyclePool);
+	--s_recyclePoolSize;
+	*stackPage = kthread->stackPage;
+	++s_threadPoolStats.poolHits;
+    } else {
+	++s_threadPoolStats.poolMisses;
+    }
+    End_Spin_Atomic(&s_recyclePoolLock, iflag);
+
+    return kthread;
+}
+
 /*
  * Initialize a new Kernel_Thread.
  */
@@ -91,13 +225,14 @@ static void Init_Thread(struct Kernel_Thread* kthread, void* stackPage,
 {
     static int nextFreePid = 1;
 
-    struct Kernel_Thread* owner = detached ? (struct Kernel_Thread*)0 : g_currentThread;
+    struct Kernel_Thread* owner = detached ? (struct Kernel_Thread*)0 : CURRENT_THREAD;
 
     memset(kthread, '\0', sizeof(*kthread));
     kthread->stackPage = stackPage;
     kthread->esp = ((ulong_t) kthread->stackPage) + PAGE_SIZE;
     kthread->numTicks = 0;
     kthread->priority = priority;
+    kthread->basePriority = priority;
     kthread->userContext = 0;
     kthread->owner = owner;
 
@@ -111,6 +246,14 @@ static void Init_Thread(struct Kernel_Thread* kthread, void* stackPage,
     kthread->alive = true;
     Clear_Thread_Queue(&kthread->joinQueue);
     kthread->pid = nextFreePid++;
+    kthread->createTSC = Read_TSC();
+
+    /*
+     * New threads start on the CPU that created them, even with
+     * the fairest thread runnable there.
+     */
+    kthread->cpu = Get_CPU_ID();
+    kthread->vruntime = s_runQueues[kthread->cpu].minVruntime;
 
 }
 
@@ -122,21 +265,26 @@ static struct Kernel_Thread* Create_Thread(int priority, bool detached)
 {
     struct Kernel_Thread* kthread;
     void* stackPage = 0;
+    bool iflag;
 
     /*
-     * For now, just allocate one page each for the thread context
-     * object and the thread's stack.
+     * Reuse a dead thread and its stack if there is one.
+     * Otherwise, allocate a new thread context object;
+     * the thread's stack is one page.
      */
-    kthread = Alloc_Page();
-    if (kthread != 0)
-        stackPage = Alloc_Page();    
-
-    /* Make sure that the memory allocations succeeded. */
-    if (kthread == 0)
-	return 0;
-    if (stackPage == 0) {
-	Free_Page(kthread);
-	return 0;
+    kthread = Take_Recycled_Thread(&stackPage);
+    if (kthread == 0) {
+	kthread = (struct Kernel_Thread*) Malloc(sizeof(*kthread));
+	if (kthread != 0)
+	    stackPage = Alloc_Page();
+
+	/* Make sure that the memory allocations succeeded. */
+	if (kthread == 0)
+	    return 0;
+	if (stackPage == 0) {
+	    Free(kthread);
+	    return 0;
+	}
     }
 
     /*Print("New thread @ %x, stack @ %x\n", kthread, stackPage); */
@@ -148,7 +296,9 @@ static struct Kernel_Thread* Create_Thread(int priority, bool detached)
     Init_Thread(kthread, stackPage, priority, detached);
 
     /* Add to the list of all threads in the system. */
+    iflag = Begin_Spin_Atomic(&s_allThreadLock);
     Add_To_Back_Of_All_Thread_List(&s_allThreadList, kthread);
+    End_Spin_Atomic(&s_allThreadLock, iflag);
 
     return kthread;
 }
@@ -165,24 +315,55 @@ static __inline__ void Push(struct Kernel_Thread* kthread, ulong_t value)
 }
 
 /*
- * Destroy given thread.
- * This function should perform all cleanup needed to
- * reclaim the resources used by a thread.
- * Called with interrupts enabled.
+ * Destroy given queue of dead threads.
+ * This function performs all cleanup needed to reclaim the
+ * resources used by the threads.  As many threads as fit are
+ * kept in the recycle pool, and the rest are freed.
+ * Called with interrupts disabled; returns with them enabled.
  */
-static void Destroy_Thread(struct Kernel_Thread* kthread)
+static void Destroy_Threads(struct Thread_Queue* deadQueue)
 {
+    struct Kernel_Thread* kthread;
 
-    /* Dispose of the thread's memory. */
+    KASSERT(!Interrupts_Enabled());
+
+    /* Remove them all from the list of all threads at once. */
+    Spin_Lock(&s_allThreadLock);
+    for (kthread = deadQueue->head; kthread != 0; kthread = Get_Next_In_Thread_Queue(kthread))
+	Remove_From_All_Thread_List(&s_allThreadList, kthread);
+    Spin_Unlock(&s_allThreadLock);
+
+    /* Destroy the user contexts of dead processes. */
+    Enable_Interrupts();
+    for (kthread = deadQueue->head; kthread != 0; kthread = Get_Next_In_Thread_Queue(kthread))
+	Detach_User_Context(kthread);
     Disable_Interrupts();
-    Free_Page(kthread->stackPage);
-    Free_Page(kthread);
 
-    /* Remove from list of all threads */
-    Remove_From_All_Thread_List(&s_allThreadList, kthread);
+    /* Free thread-local data, and fill up the recycle pool. */
+    Spin_Lock(&s_recyclePoolLock);
+    while ((kthread = deadQueue->head) != 0 && s_recyclePoolSize < RECYCLE_POOL_MAX) {
+	Remove_From_Front_Of_Thread_Queue(deadQueue);
+	if (kthread->tlocalData != 0)
+	    Free(kthread->tlocalData);
+	Add_To_Back_Of_Thread_Queue(&s_recyclePool, kthread);
+	++s_recyclePoolSize;
+    }
+    Spin_Unlock(&s_recyclePoolLock);
 
     Enable_Interrupts();
 
+    /* Dispose of the memory of the threads that didn't fit. */
+    while ((kthread = deadQueue->head) != 0) {
+	Remove_From_Front_Of_Thread_Queue(deadQueue);
+#if 0
+	Print("Reaper: disposing of thread @ %x, stack @ %x\n",
+	    kthread, kthread->stackPage);
+#endif
+	if (kthread->tlocalData != 0)
+	    Free(kthread->tlocalData);
+	Free_Page(kthread->stackPage);
+	Free(kthread);
+    }
 }
 
 /*
@@ -348,15 +529,59 @@ static void Setup_Kernel_Thread(
 }
 
 
+/*
+ * Send a reschedule IPI to given CPU, which a thread has just
+ * been queued on, if it is idle; or else to some other idle CPU,
+ * which can steal the thread.  The calling CPU, which runs the
+ * scheduler soon enough if it is idle itself, is not sent one.
+ * Interrupts must be disabled.
+ */
+static void Wake_Idle_CPU(int cpu, int self)
+{
+    int other;
+
+    if (g_currentThreads[cpu] == s_runQueues[cpu].idleThread) {
+	if (cpu != self)
+	    Send_IPI(cpu, APIC_RESCHEDULE_VECTOR);
+	return;
+    }
+    for (other = 0; other < g_numCPUsOnline; ++other) {
+	if (other != self && g_currentThreads[other] == s_runQueues[other].idleThread) {
+	    Send_IPI(other, APIC_RESCHEDULE_VECTOR);
+	    return;
+	}
+    }
+}
+
 /*
  * This is the body of the idle thread.  Its job is to preserve
  * the invariant that a runnable thread always exists,
  * i.e., the run queue is never empty.
+ * When no other thread is runnable, it halts the CPU until
+ * the next interrupt rather than spinning through the scheduler.
  */
 static void Idle(ulong_t arg)
 {
-    while (true)
+    struct Run_Queue* rq = &s_runQueues[Get_CPU_ID()];
+
+    while (true) {
+	Disable_Interrupts();
+	if (rq->numRunnable == 0) {
+	    /*
+	     * Other CPUs can't enter the kernel while this one holds
+	     * the kernel lock, so let go of it while halted; the
+	     * interrupt which wakes us up takes it again.
+	     * sti does not take effect until after the next instruction,
+	     * so no interrupt can make a thread runnable between the
+	     * check above and the hlt without waking us up.
+	     */
+	    Unlock_Kernel();
+	    __asm__ __volatile__ ("sti; hlt");
+	} else {
+	    Enable_Interrupts();
+	}
 	Yield();
+    }
 }
 
 /*
@@ -365,38 +590,25 @@ static void Idle(ulong_t arg)
  */
 static void Reaper(ulong_t arg)
 {
-    struct Kernel_Thread *kthread;
+    struct Thread_Queue deadQueue;
 
     Disable_Interrupts();
 
     while (true) {
 	/* See if there are any threads needing disposal. */
-	if ((kthread = s_graveyardQueue.head) == 0) {
+	if (Is_Thread_Queue_Empty(&s_graveyardQueue)) {
 	    /* Graveyard is empty, so wait for a thread to die. */
 	    Wait(&s_reaperWaitQueue);
 	}
 	else {
-	    /* Make the graveyard queue empty. */
-	    Clear_Thread_Queue(&s_graveyardQueue);
+	    /* Take all the threads needing disposal, emptying the graveyard. */
+	    Clear_Thread_Queue(&deadQueue);
+	    Append_Thread_Queue(&deadQueue, &s_graveyardQueue);
 
-	    /*
-	     * Now we can re-enable interrupts, since we
-	     * have removed all the threads needing disposal.
-	     */
-	    Enable_Interrupts();
+	    /* Dispose of the dead threads; this reenables interrupts. */
+	    Destroy_Threads(&deadQueue);
 	    Yield();   /* allow other threads to run? */
 
-	    /* Dispose of the dead threads. */
-	    while (kthread != 0) {
-		struct Kernel_Thread* next = Get_Next_In_Thread_Queue(kthread);
-#if 0
-		Print("Reaper: disposing of thread @ %x, stack @ %x\n",
-		    kthread, kthread->stackPage);
-#endif
-		Destroy_Thread(kthread);
-		kthread = next;
-	    }
-
 	    /*
 	     * Disable interrupts again, since we're going to
 	     * do another iteration.
@@ -407,31 +619,481 @@ static void Reaper(ulong_t arg)
 }
 
 /*
- * Find the best (highest priority) thread in given
- * thread queue.  Returns null if queue is empty.
+ * Get the MLF level of given thread, first resetting it
+ * to level 0 if the thread has been aged since its level was set.
+ */
+static __inline__ int Get_MLF_Level(struct Kernel_Thread* kthread)
+{
+    if (kthread->readyQueueEpoch != s_mlfEpoch) {
+	kthread->readyQueueEpoch = s_mlfEpoch;
+	kthread->currentReadyQueue = 0;
+    }
+    return kthread->currentReadyQueue;
+}
+
+/*
+ * Get the run queue level a runnable thread belongs on.
+ * Under RR, higher priority threads go on higher levels.
+ * Under MLF, MLF level 0 maps to the highest run queue level
+ * used, and the idle thread sits alone below all MLF levels.
  */
-static __inline__ struct Kernel_Thread* Find_Best(struct Thread_Queue* queue)
+static __inline__ int Get_Run_Queue_Level(struct Kernel_Thread* kthread)
 {
-    /* Pick the highest priority thread */
-    struct Kernel_Thread *kthread = queue->head, *best = 0;
+    if (g_currentSchedulingPolicy == SCHED_MLF) {
+	if (kthread->priority == PRIORITY_IDLE)
+	    return 0;
+	return MAX_QUEUE_LEVEL - Get_MLF_Level(kthread);
+    }
+
+    KASSERT(kthread->priority >= 0 && kthread->priority < NUM_RUN_QUEUE_LEVELS);
+    return kthread->priority;
+}
+
+/*
+ * Return the index of the most significant bit set in given word,
+ * which must be non-zero.
+ */
+static __inline__ int Find_Last_Set(ulong_t word)
+{
+    int bit;
+
+    KASSERT(word != 0);
+    __asm__ ("bsrl %1, %0" : "=r" (bit) : "rm" (word));
+    return bit;
+}
+
+/*
+ * Compare virtual runtimes or tick counts so that the order
+ * is still right after they wrap around.
+ */
+static __inline__ bool Seq_Before(ulong_t a, ulong_t b)
+{
+    return (long) (a - b) < 0;
+}
+
+/*
+ * Ordering function for the CFS run queue tree.
+ */
+static bool Fair_Less(struct Rb_Node* a, struct Rb_Node* b)
+{
+    return Seq_Before(RB_ENTRY(a, struct Kernel_Thread, runNode)->vruntime,
+	RB_ENTRY(b, struct Kernel_Thread, runNode)->vruntime);
+}
+
+/*
+ * Ordering function for the EDF run queue tree.
+ */
+static bool Deadline_Less(struct Rb_Node* a, struct Rb_Node* b)
+{
+    return Seq_Before(RB_ENTRY(a, struct Kernel_Thread, runNode)->rtAbsDeadline,
+	RB_ENTRY(b, struct Kernel_Thread, runNode)->rtAbsDeadline);
+}
+
+static __inline__ bool Is_EDF_Thread(struct Kernel_Thread* kthread)
+{
+    return kthread->rtPeriod != 0;
+}
+
+/*
+ * Is given thread scheduled by the CFS run queue tree?
+ */
+static __inline__ bool Is_Fair_Thread(struct Kernel_Thread* kthread)
+{
+    return g_currentSchedulingPolicy == SCHED_CFS &&
+	kthread->priority != PRIORITY_IDLE && !Is_EDF_Thread(kthread);
+}
+
+/*
+ * Start a new period for given EDF thread if its current one is over,
+ * replenishing its budget and setting the deadline of its next job.
+ */
+static void EDF_Advance_Period(struct Kernel_Thread* kthread)
+{
+    ulong_t elapsed = g_numTicks - kthread->rtPeriodStart;
+
+    if (elapsed >= kthread->rtPeriod) {
+	kthread->rtPeriodStart += (elapsed / kthread->rtPeriod) * kthread->rtPeriod;
+	kthread->rtAbsDeadline = kthread->rtPeriodStart + kthread->rtDeadline;
+	kthread->rtBudget = kthread->rtRuntime;
+	kthread->rtMissed = false;
+    }
+}
+
+/*
+ * Count a deadline miss if given EDF thread, which is runnable
+ * or running, still has work to do in a job whose deadline has passed.
+ */
+static __inline__ void EDF_Check_Deadline(struct Kernel_Thread* kthread)
+{
+    if (kthread->rtBudget > 0 && !kthread->rtMissed &&
+	!Seq_Before(g_numTicks, kthread->rtAbsDeadline)) {
+	kthread->rtMissed = true;
+	++kthread->stats.numDeadlineMisses;
+    }
+}
+
+/*
+ * Add an EDF thread to given run queue: to the EDF tree if it has
+ * budget left in the current period, otherwise to the throttled queue.
+ * Returns true if the thread is runnable.
+ */
+static bool Enqueue_EDF(struct Run_Queue* rq, struct Kernel_Thread* kthread)
+{
+    EDF_Advance_Period(kthread);
+    if (kthread->rtBudget == 0) {
+	Enqueue_Thread(&rq->throttled, kthread);
+	return false;
+    }
+    Rb_Insert(&rq->edfTree, &kthread->runNode, &Deadline_Less);
+    return true;
+}
+
+/*
+ * Make throttled EDF threads whose next period has started runnable.
+ */
+static void Release_Throttled(struct Run_Queue* rq)
+{
+    struct Kernel_Thread *kthread = rq->throttled.head, *next;
+
     while (kthread != 0) {
-	if (best == 0 || kthread->priority > best->priority)
-	    best = kthread;
-	kthread = Get_Next_In_Thread_Queue(kthread);
+	next = Get_Next_In_Thread_Queue(kthread);
+	if (g_numTicks - kthread->rtPeriodStart >= kthread->rtPeriod) {
+	    Remove_Thread(&rq->throttled, kthread);
+	    Enqueue_EDF(rq, kthread);
+	    ++rq->numRunnable;
+	}
+	kthread = next;
+    }
+}
+
+/*
+ * Remove and return the EDF thread with the earliest deadline
+ * from given run queue's EDF tree, which must not be empty.
+ */
+static __inline__ struct Kernel_Thread* Dequeue_EDF(struct Run_Queue* rq)
+{
+    struct Rb_Node* node = Rb_First(&rq->edfTree);
+    struct Kernel_Thread* kthread = RB_ENTRY(node, struct Kernel_Thread, runNode);
+
+    Rb_Remove(&rq->edfTree, node);
+    EDF_Check_Deadline(kthread);
+    EDF_Advance_Period(kthread);
+    return kthread;
+}
+
+/*
+ * Add a thread to the CFS run queue tree.
+ */
+static __inline__ void Enqueue_Fair(struct Run_Queue* rq, struct Kernel_Thread* kthread)
+{
+    ulong_t floor = rq->minVruntime - CFS_SLEEPER_CREDIT;
+
+    if (Seq_Before(kthread->vruntime, floor))
+	kthread->vruntime = floor;
+    Rb_Insert(&rq->fairTree, &kthread->runNode, &Fair_Less);
+}
+
+/*
+ * Remove and return the thread with the least virtual runtime
+ * from the CFS run queue tree, which must not be empty.
+ */
+static __inline__ struct Kernel_Thread* Dequeue_Fair(struct Run_Queue* rq)
+{
+    struct Rb_Node* node = Rb_First(&rq->fairTree);
+    struct Kernel_Thread* kthread = RB_ENTRY(node, struct Kernel_Thread, runNode);
+
+    Rb_Remove(&rq->fairTree, node);
+    if (Seq_Before(rq->minVruntime, kthread->vruntime))
+	rq->minVruntime = kthread->vruntime;
+    return kthread;
+}
+
+/*
+ * Add a thread to the back of its level in given run queue,
+ * or to the run queue's CFS or EDF tree.
+ * Interrupts must be disabled, and the run queue locked.
+ */
+static __inline__ void Enqueue_Runnable(struct Run_Queue* rq, struct Kernel_Thread* kthread)
+{
+    int level;
+
+    kthread->readyTick = g_numTicks;
+    kthread->readyTSC = Read_TSC();
+
+    if (Is_EDF_Thread(kthread)) {
+	if (Enqueue_EDF(rq, kthread))
+	    ++rq->numRunnable;
+	return;
+    }
+
+    if (kthread->priority != PRIORITY_IDLE)
+	++rq->numRunnable;
+
+    if (Is_Fair_Thread(kthread)) {
+	Enqueue_Fair(rq, kthread);
+	return;
+    }
+
+    level = Get_Run_Queue_Level(kthread);
+    Enqueue_Thread(&rq->level[level], kthread);
+    rq->readyMask |= (1UL << level);
+}
+
+/*
+ * Remove and return the best thread in given run queue: the EDF
+ * thread with the earliest deadline if there is one, otherwise
+ * the fairest thread in the CFS tree if there is one, otherwise
+ * the thread at the front of the highest non-empty level.
+ * Interrupts must be disabled, the run queue locked and not empty.
+ */
+static __inline__ struct Kernel_Thread* Dequeue_Runnable(struct Run_Queue* rq)
+{
+    int level;
+    struct Thread_Queue* queue;
+    struct Kernel_Thread* kthread;
+
+    if (!Rb_Is_Empty(&rq->edfTree)) {
+	kthread = Dequeue_EDF(rq);
+    } else if (!Rb_Is_Empty(&rq->fairTree)) {
+	kthread = Dequeue_Fair(rq);
+    } else {
+	level = Find_Last_Set(rq->readyMask);
+	queue = &rq->level[level];
+	kthread = Remove_From_Front_Of_Thread_Queue(queue);
+
+	if (Is_Thread_Queue_Empty(queue))
+	    rq->readyMask &= ~(1UL << level);
+    }
+
+    if (kthread->priority != PRIORITY_IDLE)
+	--rq->numRunnable;
+    return kthread;
+}
+
+/*
+ * Steal the best runnable thread from the busiest other CPU's run
+ * queue, for the CPU owning given run queue.  Returns null if no
+ * other CPU has a thread to spare.
+ * Interrupts must be disabled, and the run queue locked.
+ */
+static struct Kernel_Thread* Steal_Runnable(struct Run_Queue* rq)
+{
+    struct Run_Queue* victim = 0;
+    struct Kernel_Thread* kthread = 0;
+    int cpu;
+
+    for (cpu = 0; cpu < g_numCPUsOnline; ++cpu) {
+	struct Run_Queue* other = &s_runQueues[cpu];
+	if (other != rq && other->numRunnable > 0 &&
+	    (victim == 0 || other->numRunnable > victim->numRunnable))
+	    victim = other;
+    }
+    if (victim == 0)
+	return 0;
+
+    /*
+     * Two CPUs may be trying to steal from each other,
+     * so don't wait for the victim's lock while holding our own.
+     */
+    if (!Spin_Try_Lock(&victim->lock))
+	return 0;
+    if (victim->numRunnable > 0) {
+	kthread = Dequeue_Runnable(victim);
+	kthread->cpu = rq - s_runQueues;
+    }
+    Spin_Unlock(&victim->lock);
+
+    return kthread;
+}
+
+/*
+ * Lock or unlock every CPU's run queue, in CPU order.
+ * s_policyLock must be held.
+ */
+static void Lock_All_Run_Queues(void)
+{
+    int cpu;
+
+    for (cpu = 0; cpu < g_numCPUsOnline; ++cpu)
+	Spin_Lock(&s_runQueues[cpu].lock);
+}
+
+static void Unlock_All_Run_Queues(void)
+{
+    int cpu;
+
+    for (cpu = g_numCPUsOnline - 1; cpu >= 0; --cpu)
+	Spin_Unlock(&s_runQueues[cpu].lock);
+}
+
+/*
+ * Put every thread in every run queue back on the level chosen
+ * by the current scheduling policy.  Called when the policy changes.
+ * All run queues must be locked.
+ */
+static void Requeue_All_Runnable(void)
+{
+    struct Thread_Queue all;
+    struct Kernel_Thread* kthread;
+    int cpu, level;
+
+    /* EDF threads don't depend on the policy, so they stay put. */
+    Clear_Thread_Queue(&all);
+    for (cpu = 0; cpu < g_numCPUsOnline; ++cpu) {
+	struct Run_Queue* rq = &s_runQueues[cpu];
+	for (level = 0; level < NUM_RUN_QUEUE_LEVELS; ++level)
+	    Append_Thread_Queue(&all, &rq->level[level]);
+	rq->readyMask = 0;
+	while (!Rb_Is_Empty(&rq->fairTree))
+	    Enqueue_Thread(&all, Dequeue_Fair(rq));
+    }
+
+    while (!Is_Thread_Queue_Empty(&all)) {
+	kthread = Remove_From_Front_Of_Thread_Queue(&all);
+	if (kthread->priority != PRIORITY_IDLE)
+	    --s_runQueues[kthread->cpu].numRunnable;
+	Enqueue_Runnable(&s_runQueues[kthread->cpu], kthread);
+    }
+}
+
+/*
+ * Age every runnable MLF thread in given run queue back to level 0.
+ * The run queue levels are spliced together in constant time;
+ * the caller starts a new epoch to reset the level of every other thread.
+ */
+static void Age_MLF_Threads(struct Run_Queue* rq)
+{
+    int top = MAX_QUEUE_LEVEL;
+    int level;
+
+    for (level = top - 1; level > 0; --level) {
+	if (!Is_Thread_Queue_Empty(&rq->level[level])) {
+	    Append_Thread_Queue(&rq->level[top], &rq->level[level]);
+	    rq->readyMask &= ~(1UL << level);
+	    rq->readyMask |= (1UL << top);
+	}
+    }
+}
+
+/*
+ * Bring the run queues up to date with a change of scheduling
+ * policy, and age MLF threads when it is time to.
+ * Interrupts must be disabled.
+ */
+static void Update_Run_Queues(void)
+{
+    int cpu;
+
+    Spin_Lock(&s_policyLock);
+
+    if (g_currentSchedulingPolicy != g_prevSchedulingPolicy) {
+	/* Everyone starts at the top level when MLF is switched on. */
+	++s_mlfEpoch;
+	s_mlfLastAgingTick = g_numTicks;
+	Lock_All_Run_Queues();
+	Requeue_All_Runnable();
+	Unlock_All_Run_Queues();
+	g_prevSchedulingPolicy = g_currentSchedulingPolicy;
+    }
+
+    if (g_currentSchedulingPolicy == SCHED_MLF &&
+	g_numTicks - s_mlfLastAgingTick >= Ms_To_Ticks(MLF_AGING_MS)) {
+	s_mlfLastAgingTick = g_numTicks;
+	++s_mlfEpoch;
+	for (cpu = 0; cpu < g_numCPUsOnline; ++cpu) {
+	    Spin_Lock(&s_runQueues[cpu].lock);
+	    Age_MLF_Threads(&s_runQueues[cpu]);
+	    Spin_Unlock(&s_runQueues[cpu].lock);
+	}
+    }
+
+    Spin_Unlock(&s_policyLock);
+}
+
+/*
+ * Get the wakeup latency histogram bucket for given number of
+ * TSC cycles (see <geekos/schedstat.h>).
+ */
+static __inline__ int Get_Latency_Bucket(unsigned long long cycles)
+{
+    ulong_t units;
+    int bucket;
+
+    if ((cycles >> (32 + LATENCY_UNIT_SHIFT)) != 0)
+	return NUM_LATENCY_BUCKETS - 1;
+    units = (ulong_t) (cycles >> LATENCY_UNIT_SHIFT);
+    if (units == 0)
+	return 0;
+    bucket = Find_Last_Set(units) + 1;
+    return MIN(bucket, NUM_LATENCY_BUCKETS - 1);
+}
+
+/*
+ * Update the statistics of a thread chosen to run next,
+ * and of the thread giving up the CPU.
+ */
+static void Account_Switch(struct Kernel_Thread* prev, struct Kernel_Thread* next,
+    bool voluntary)
+{
+    next->stats.waitTicks += g_numTicks - next->readyTick;
+    if (next->blocked) {
+	next->blocked = false;
+	++next->stats.wakeupLatency[Get_Latency_Bucket(Read_TSC() - next->readyTSC)];
+    }
+
+    if (next != prev) {
+	if (voluntary)
+	    ++prev->stats.numVoluntarySwitches;
+	else
+	    ++prev->stats.numInvoluntarySwitches;
     }
-    return best;
+}
+
+/*
+ * Update the state of the current thread as it is about to wait.
+ */
+static void Prepare_To_Wait(struct Kernel_Thread* current)
+{
+    /*
+     * Under MLF, a thread that blocks before using up its
+     * quantum is interactive, so it moves up one level.
+     */
+    if (g_currentSchedulingPolicy == SCHED_MLF && Get_MLF_Level(current) > 0)
+	--current->currentReadyQueue;
+
+    current->blocked = true;
+}
+
+/*
+ * Ordering function for priority wait queues.
+ */
+static bool Prio_Less(struct Rb_Node* a, struct Rb_Node* b)
+{
+    return RB_ENTRY(a, struct Kernel_Thread, runNode)->priority >
+	RB_ENTRY(b, struct Kernel_Thread, runNode)->priority;
 }
 
 /*
  * Acquires pointer to thread-local data from the current thread
- * indexed by the given key.  Assumes interrupts are off.
+ * indexed by the given key, allocating the thread's array of
+ * thread-local data if alloc is true and it has none yet.
+ * Returns null if the thread has no array.
  */
-static __inline__ const void** Get_Tlocal_Pointer(tlocal_key_t k) 
+static const void** Get_Tlocal_Pointer(tlocal_key_t k, bool alloc)
 {
-    struct Kernel_Thread* current = g_currentThread;
+    struct Kernel_Thread* current = CURRENT_THREAD;
 
     KASSERT(k < MAX_TLOCAL_KEYS);
 
+    if (current->tlocalData == 0) {
+	if (!alloc)
+	    return 0;
+	current->tlocalData = Malloc(MAX_TLOCAL_KEYS * sizeof(const void*));
+	if (current->tlocalData == 0)
+	    return 0;
+	memset(current->tlocalData, '\0', MAX_TLOCAL_KEYS * sizeof(const void*));
+    }
+
     return &current->tlocalData[k];
 }
 
@@ -444,13 +1106,19 @@ static __inline__ const void** Get_Tlocal_Pointer(tlocal_key_t k)
  * of an iteration, we are done.
  */
 static void Tlocal_Exit(struct Kernel_Thread* curr) {
-    int i, j, called = 0;
+    int i, j, called;
+    int numKeys = s_tlocalKeyCounter;
 
     KASSERT(!Interrupts_Enabled());
 
+    /* Threads that never stored thread-local data have nothing to do. */
+    if (curr->tlocalData == 0)
+	return;
+
     for (j = 0; j<MIN_DESTRUCTOR_ITERATIONS; j++) {
 
-        for (i = 0; i<MAX_TLOCAL_KEYS; i++) {
+        called = 0;
+        for (i = 0; i<numKeys; i++) {
 
 	    void *x = (void *)curr->tlocalData[i];
 	    if (x != NULL && s_tlocalDestructors[i] != NULL) {
@@ -481,14 +1149,14 @@ void Init_Scheduler(void)
      * and make them current.
      */
     Init_Thread(mainThread, (void *) KERN_STACK, PRIORITY_NORMAL, true);
-    g_currentThread = mainThread;
+    g_currentThreads[0] = mainThread;
     Add_To_Back_Of_All_Thread_List(&s_allThreadList, mainThread);
 
     /*
      * Create the idle thread.
      */
     /*Print("starting idle thread\n");*/
-    Start_Kernel_Thread(Idle, 0, PRIORITY_IDLE, true);
+    s_runQueues[0].idleThread = Start_Kernel_Thread(Idle, 0, PRIORITY_IDLE, true);
 
     /*
      * Create the reaper thread.
@@ -557,14 +1225,34 @@ Start_User_Thread(struct User_Context* userContext, bool detached)
 }
 
 /*
- * Add given thread to the run queue, so that it
- * may be scheduled.  Must be called with interrupts disabled!
+ * Add given thread to the run queue of the CPU it last ran on,
+ * so that it may be scheduled.  Must be called with interrupts disabled!
  */
 void Make_Runnable(struct Kernel_Thread* kthread)
 {
+    struct Run_Queue* rq = &s_runQueues[kthread->cpu];
+    int self = Get_CPU_ID();
+    struct Kernel_Thread* current = g_currentThreads[self];
+
     KASSERT(!Interrupts_Enabled());
 
-    Enqueue_Thread(&s_runQueue, kthread);
+    Spin_Lock(&rq->lock);
+    Enqueue_Runnable(rq, kthread);
+    Spin_Unlock(&rq->lock);
+
+    /*
+     * A waking EDF thread preempts threads scheduled by the policy,
+     * and EDF threads with later deadlines.
+     */
+    if (Is_EDF_Thread(kthread) && kthread->rtBudget > 0 &&
+	kthread != current && kthread->cpu == self &&
+	(!Is_EDF_Thread(current) ||
+	 Seq_Before(kthread->rtAbsDeadline, current->rtAbsDeadline)))
+	g_needReschedule[self] = true;
+
+    /* A thread put back by its own CPU is about to be rescheduled there. */
+    if (g_numCPUsOnline > 1 && kthread != current)
+	Wake_Idle_CPU(kthread->cpu, self);
 }
 
 /*
@@ -583,72 +1271,77 @@ void Make_Runnable_Atomic(struct Kernel_Thread* kthread)
  */
 struct Kernel_Thread* Get_Current(void)
 {
-    return g_currentThread;
+    struct Kernel_Thread* current;
+    bool iflag;
+
+    iflag = Begin_Int_Atomic();
+    current = g_currentThreads[Get_CPU_ID()];
+    End_Int_Atomic(iflag);
+
+    return current;
 }
 
 /*
- * Get the next runnable thread from the run queue.
+ * Create the idle thread of given application processor, which
+ * is about to be started.  The CPU starts on the thread's stack,
+ * and calls Run_Idle_Thread() once it is ready to schedule.
+ * Returns null if there isn't enough memory.
+ */
+struct Kernel_Thread* Create_Idle_Thread(int cpu)
+{
+    struct Kernel_Thread* idle = Create_Thread(PRIORITY_IDLE, true);
+
+    if (idle != 0) {
+	idle->cpu = cpu;
+	s_runQueues[cpu].idleThread = idle;
+	g_currentThreads[cpu] = idle;
+    }
+    return idle;
+}
+
+/*
+ * Become the idle thread of the application processor we are
+ * running on.  Called with interrupts disabled.
+ */
+void Run_Idle_Thread(void)
+{
+    Enable_Interrupts();
+    Idle(0);
+    KASSERT(false);
+    while (true)
+	;
+}
+
+/*
+ * Get the next runnable thread from this CPU's run queue,
+ * stealing one from another CPU if only the idle thread is left.
  * This is the scheduler.
  */
 struct Kernel_Thread* Get_Next_Runnable(void)
 {
+    struct Run_Queue* rq = &s_runQueues[Get_CPU_ID()];
     struct Kernel_Thread* best = 0;
-    static ulong_t starvationCheck = 0;
-    
-    if (g_currentSchedulingPolicy != g_prevSchedulingPolicy){
-        if (g_currentSchedulingPolicy == RR){
-            int i;
-            //moving all threads to queue[0]
-            for ( i = MAX_QUEUE_LEVEL - 1; i > 0; i--) {
-                Append_Thread_Queue(&s_runQueue[i-1],&s_runQueue[i]);
-            }
-        }
-        //Serg's
-    }
-     
-    if (g_currentSchedulingPolicy == RR){
-    	best = Find_Best(&s_runQueue[0]);
-    	KASSERT(best != 0);
-	Remove_Thread(&s_runQueue[0], best);
-    }
-    else {
-        int counter;
-        for(counter = 0; counter < MAX_QUEUE_LEVEL; counter++)
-        {
-            best = Get_Front_Of_Thread_Queue(&s_runQueue[counter]);
-            Remove_Thread(&s_runQueue[counter], best);
-            break;
-        }
-
-        counterStarvationCheck++;
-
-        if(counterStarvationCheck > TIME_TO_STARVE){
-            counterStarvationCheck = 0;
-            struct Kernel_Thread* currThread = Get_Front_Of_Thread_Queue(&s_runQueue[MAX_QUEUE_LEVEL-1]);
-            for(counter = MAX_QUEUE_LEVEL-1; counter >= 0; --counter)
-            {
-                while(currThread != NULL)
-                {
-                    if(currThread == IdleThread)break; 
-                    
-                    if(currThread->numTicks == (TIME_TO_STARVE + 1)){ 
-                        if(currThread->currentReadyQueue>0){
-                            --currThread->currentReadyQueue;
-                            Remove_Thread(&s_runQueue[counter], currThread);
-                            Enqueue_Thread(&s_runQueue[counter-1], currThread);
-                        }
-                    }
-                    else{
-                        currThread->numTicks = (TIME_TO_STARVE + 1);               
-                    }  
-                    
-		    currThread = Get_Next_In_Thread_Queue(currThread);
-                }
-            }
-            
-        }
-    }
-    
+    bool voluntary = s_voluntarySwitch;
+
+    s_voluntarySwitch = false;
+
+    if (g_currentSchedulingPolicy != g_prevSchedulingPolicy ||
+	(g_currentSchedulingPolicy == SCHED_MLF &&
+	 g_numTicks - s_mlfLastAgingTick >= Ms_To_Ticks(MLF_AGING_MS)))
+	Update_Run_Queues();
+
+    Spin_Lock(&rq->lock);
+    if (!Is_Thread_Queue_Empty(&rq->throttled))
+	Release_Throttled(rq);
+    if (rq->numRunnable == 0 && g_numCPUsOnline > 1)
+	best = Steal_Runnable(rq);
+    if (best == 0)
+	best = Dequeue_Runnable(rq);
+    Spin_Unlock(&rq->lock);
+    KASSERT(best != 0);
+
+    Account_Switch(CURRENT_THREAD, best, voluntary);
+
     best->numTicks=0; 
 /*
  *    Print("Scheduling %x\n", best);
@@ -656,6 +1349,132 @@ struct Kernel_Thread* Get_Next_Runnable(void)
     return best;
 }
 
+/*
+ * Get the number of timer ticks the CPUs have spent idle.
+ */
+ulong_t Get_Idle_Ticks(void)
+{
+    ulong_t ticks = 0;
+    int cpu;
+
+    for (cpu = 0; cpu < g_numCPUsOnline; ++cpu)
+	ticks += s_runQueues[cpu].idleThread->stats.runTicks;
+    return ticks;
+}
+
+/*
+ * Get the thread recycle pool statistics.
+ */
+void Get_Thread_Pool_Stats(struct Thread_Pool_Stats* stats)
+{
+    bool iflag = Begin_Spin_Atomic(&s_recyclePoolLock);
+    *stats = s_threadPoolStats;
+    End_Spin_Atomic(&s_recyclePoolLock, iflag);
+}
+
+/*
+ * Get the number of ticks given thread may run before
+ * it is preempted.  Under MLF, each level below the top
+ * doubles the quantum, so CPU-bound threads that sink
+ * down the levels are switched less often.
+ */
+int Get_Quantum(struct Kernel_Thread* kthread)
+{
+    if (g_currentSchedulingPolicy == SCHED_MLF)
+	return g_Quantum << Get_MLF_Level(kthread);
+    return g_Quantum;
+}
+
+/*
+ * Called when given thread has used up its entire quantum.
+ * Under MLF, the thread moves down one level.
+ * Interrupts must be disabled.
+ */
+void Demote_Thread(struct Kernel_Thread* kthread)
+{
+    KASSERT(!Interrupts_Enabled());
+
+    if (g_currentSchedulingPolicy == SCHED_MLF &&
+	Get_MLF_Level(kthread) < MAX_QUEUE_LEVEL - 1)
+	++kthread->currentReadyQueue;
+}
+
+/*
+ * Put the current thread in the EDF class, with given runtime
+ * per period and relative deadline, in ticks; or if period is 0,
+ * take it out of the EDF class.
+ * Returns 0 if successful, EINVALID if the parameters are
+ * inconsistent, or EBUSY if admitting the thread would exceed
+ * the EDF utilization limit.
+ * Interrupts must be disabled.
+ */
+int Set_EDF_Params(ulong_t runtime, ulong_t period, ulong_t deadline)
+{
+    struct Kernel_Thread* current = CURRENT_THREAD;
+    ulong_t oldUtil = 0, newUtil = 0;
+    int rc = 0;
+
+    KASSERT(!Interrupts_Enabled());
+
+    if (period != 0) {
+	if (runtime == 0 || runtime > deadline || deadline > period ||
+	    runtime >= EDF_MAX_RUNTIME)
+	    return EINVALID;
+	newUtil = (runtime << EDF_UTIL_SHIFT) / deadline;
+    }
+
+    Spin_Lock(&s_policyLock);
+
+    if (Is_EDF_Thread(current))
+	oldUtil = (current->rtRuntime << EDF_UTIL_SHIFT) / current->rtDeadline;
+    if (s_edfUtilization - oldUtil + newUtil > EDF_MAX_UTILIZATION) {
+	rc = EBUSY;
+    } else {
+	s_edfUtilization = s_edfUtilization - oldUtil + newUtil;
+	current->rtRuntime = runtime;
+	current->rtPeriod = period;
+	current->rtDeadline = deadline;
+
+	/* The first job is released now. */
+	current->rtPeriodStart = g_numTicks;
+	current->rtAbsDeadline = g_numTicks + deadline;
+	current->rtBudget = runtime;
+	current->rtMissed = false;
+    }
+
+    Spin_Unlock(&s_policyLock);
+
+    return rc;
+}
+
+/*
+ * Charge given thread, which is running, for one timer tick
+ * of CPU time.  Under CFS, this advances its virtual runtime
+ * in inverse proportion to its weight.  EDF threads use up
+ * their budget, and are preempted when it runs out.
+ * Interrupts must be disabled.
+ */
+void Charge_Tick(struct Kernel_Thread* kthread)
+{
+    int priority;
+
+    KASSERT(!Interrupts_Enabled());
+
+    if (Is_EDF_Thread(kthread)) {
+	EDF_Check_Deadline(kthread);
+	if (kthread->rtBudget > 0 && --kthread->rtBudget == 0)
+	    g_needReschedule[Get_CPU_ID()] = true;
+	return;
+    }
+
+    if (!Is_Fair_Thread(kthread))
+	return;
+
+    priority = MIN(kthread->priority, NUM_RUN_QUEUE_LEVELS - 1);
+    kthread->vruntime +=
+	(CFS_NICE_0_WEIGHT << CFS_VRUNTIME_SHIFT) / s_cfsWeights[priority];
+}
+
 /*
  * Schedule a thread that is waiting to run.
  * Must be called with interrupts off!
@@ -675,6 +1494,7 @@ void Schedule(void)
     KASSERT(!g_preemptionDisabled);
 
     /* Get next thread to run from the run queue */
+    s_voluntarySwitch = true;
     runnable = Get_Next_Runnable();
 
     /*
@@ -693,7 +1513,7 @@ void Schedule(void)
 void Yield(void)
 {
     Disable_Interrupts();
-    Make_Runnable(g_currentThread);
+    Make_Runnable(CURRENT_THREAD);
     Schedule();
     Enable_Interrupts();
 }
@@ -704,7 +1524,7 @@ void Yield(void)
  */
 void Exit(int exitCode)
 {
-    struct Kernel_Thread* current = g_currentThread;
+    struct Kernel_Thread* current = CURRENT_THREAD;
 
     if (Interrupts_Enabled())
 	Disable_Interrupts();
@@ -713,14 +1533,28 @@ void Exit(int exitCode)
     current->exitCode = exitCode;
     current->alive = false;
 
+    Spin_Lock(&s_recyclePoolLock);
+    ++s_threadPoolStats.numExits;
+    s_threadPoolStats.lifetimeKcycles +=
+	(ulong_t) ((Read_TSC() - current->createTSC) >> LATENCY_UNIT_SHIFT);
+    Spin_Unlock(&s_recyclePoolLock);
+
     /* Clean up any thread-local memory */
-    Tlocal_Exit(g_currentThread);
+    Tlocal_Exit(CURRENT_THREAD);
+
+    /* Give up any EDF reservation, and stop any alarm. */
+    if (Is_EDF_Thread(current))
+	Set_EDF_Params(0, 0, 0);
+    Set_Alarm(0);
 
     /* Notify the thread's owner, if any */
     Wake_Up(&current->joinQueue);
 
+    /* Fail any IPC calls waiting for the thread. */
+    Ipc_Exit(current);
+
     /* Remove the thread's implicit reference to itself. */
-    Detach_Thread(g_currentThread);
+    Detach_Thread(CURRENT_THREAD);
 
     /*
      * Schedule a new thread.
@@ -739,13 +1573,24 @@ void Exit(int exitCode)
  * Returns the thread exit code.
  */
 int Join(struct Kernel_Thread* kthread)
+{
+    return Join_With_Stats(kthread, 0);
+}
+
+/*
+ * Wait for given thread to die, and if stats is not null,
+ * store the thread's final scheduling statistics in it.
+ * Interrupts must be enabled.
+ * Returns the thread exit code.
+ */
+int Join_With_Stats(struct Kernel_Thread* kthread, struct Thread_Stats* stats)
 {
     int exitCode;
 
     KASSERT(Interrupts_Enabled());
 
     /* It is only legal for the owner to join */
-    KASSERT(kthread->owner == g_currentThread);
+    KASSERT(kthread->owner == CURRENT_THREAD);
 
     Disable_Interrupts();
 
@@ -754,8 +1599,10 @@ int Join(struct Kernel_Thread* kthread)
 	Wait(&kthread->joinQueue);
     }
 
-    /* Get thread exit code. */
+    /* Get thread exit code and statistics. */
     exitCode = kthread->exitCode;
+    if (stats != 0)
+	*stats = kthread->stats;
 
     /* Release our reference to the thread */
     Detach_Thread(kthread);
@@ -765,6 +1612,26 @@ int Join(struct Kernel_Thread* kthread)
     return exitCode;
 }
 
+/*
+ * Find a live thread by its process id, whoever its owner is.
+ * Returns null if there is none.  Interrupts must be disabled,
+ * and the thread may only be used until they are enabled again.
+ */
+struct Kernel_Thread* Find_Thread(int pid)
+{
+    struct Kernel_Thread *kthread;
+
+    KASSERT(!Interrupts_Enabled());
+
+    Spin_Lock(&s_allThreadLock);
+    kthread = Get_Front_Of_All_Thread_List(&s_allThreadList);
+    while (kthread != 0 && kthread->pid != pid)
+	kthread = Get_Next_In_All_Thread_List(kthread);
+    Spin_Unlock(&s_allThreadLock);
+
+    return (kthread != 0 && kthread->alive) ? kthread : 0;
+}
+
 /*
  * Look up a thread by its process id.
  * The caller must be the thread's owner.
@@ -773,7 +1640,7 @@ struct Kernel_Thread* Lookup_Thread(int pid)
 {
     struct Kernel_Thread *result = 0;
 
-    bool iflag = Begin_Int_Atomic();
+    bool iflag = Begin_Spin_Atomic(&s_allThreadLock);
 
     /*
      * TODO: we could remove the requirement that the caller
@@ -784,14 +1651,14 @@ struct Kernel_Thread* Lookup_Thread(int pid)
     result = Get_Front_Of_All_Thread_List(&s_allThreadList);
     while (result != 0) {
 	if (result->pid == pid) {
-	    if (g_currentThread != result->owner)
+	    if (CURRENT_THREAD != result->owner)
 		result = 0;
 	    break;
 	}
 	result = Get_Next_In_All_Thread_List(result);
     }
 
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_allThreadLock, iflag);
 
     return result;
 }
@@ -809,10 +1676,12 @@ struct Kernel_Thread* Lookup_Thread(int pid)
  */
 void Wait(struct Thread_Queue* waitQueue)
 {
-    struct Kernel_Thread* current = g_currentThread;
+    struct Kernel_Thread* current = CURRENT_THREAD;
 
     KASSERT(!Interrupts_Enabled());
 
+    Prepare_To_Wait(current);
+
     /* Add the thread to the wait queue. */
     Enqueue_Thread(waitQueue, current);
 
@@ -820,6 +1689,62 @@ void Wait(struct Thread_Queue* waitQueue)
     Schedule();
 }
 
+/*
+ * Wait on given wait queue, which is protected by given spin lock.
+ * The lock must be held, and interrupts disabled, by a region begun
+ * with Begin_Spin_Atomic().  The lock is released once the thread
+ * is on the wait queue, so that a waker taking the lock can't miss
+ * it, and is held again when the function returns.
+ */
+void Wait_Spin_At(struct Thread_Queue* waitQueue, struct Spin_Lock* lock,
+    const char* file, int line)
+{
+    struct Kernel_Thread* current = CURRENT_THREAD;
+
+    KASSERT(!Interrupts_Enabled());
+
+    Prepare_To_Wait(current);
+    Enqueue_Thread(waitQueue, current);
+
+    Release_Spin_Lock(lock);
+    Schedule();
+    Acquire_Spin_Lock_At(lock, file, line);
+}
+
+/*
+ * Wait on given wait queue, running given thread in our place
+ * instead of the one the scheduler would pick.  The thread must
+ * be waiting, and already removed from its wait queue.  This lets
+ * a thread which hands work to another and waits for the result
+ * run it at once, without a trip through the run queue
+ * (see ipc.c).  EDF threads, whose running is limited by their
+ * budget, and threads of other CPUs are made runnable instead.
+ * Must be called with interrupts disabled!
+ */
+void Wait_And_Switch_To(struct Thread_Queue* waitQueue, struct Kernel_Thread* kthread)
+{
+    struct Kernel_Thread* current = CURRENT_THREAD;
+
+    KASSERT(!Interrupts_Enabled());
+    KASSERT(!g_preemptionDisabled);
+
+    if (Is_EDF_Thread(kthread) || kthread->cpu != Get_CPU_ID()) {
+	Make_Runnable(kthread);
+	Wait(waitQueue);
+	return;
+    }
+
+    Prepare_To_Wait(current);
+    Enqueue_Thread(waitQueue, current);
+
+    kthread->readyTick = g_numTicks;
+    kthread->readyTSC = Read_TSC();
+    Account_Switch(current, kthread, true);
+    kthread->numTicks = 0;
+
+    Switch_To_Thread(kthread);
+}
+
 /*
  * Wake up all threads waiting on given wait queue.
  * Must be called with interrupts disabled!
@@ -847,25 +1772,131 @@ void Wake_Up(struct Thread_Queue* waitQueue)
 }
 
 /*
- * Wake up a single thread waiting on given wait queue
- * (if there are any threads waiting).  Chooses the highest priority thread.
+ * Wake up the thread that has waited longest on given wait queue
+ * (if there are any threads waiting).
  * Interrupts must be disabled!
  */
-void Wake_Up_One(struct Thread_Queue* waitQueue)
+void Wake_Up_First(struct Thread_Queue* waitQueue)
 {
-    struct Kernel_Thread* best;
+    KASSERT(!Interrupts_Enabled());
+
+    if (!Is_Thread_Queue_Empty(waitQueue))
+	Make_Runnable(Remove_From_Front_Of_Thread_Queue(waitQueue));
+}
+
+/*
+ * Wait on given priority wait queue.
+ * Must be called with interrupts disabled!
+ * Like Wait(), returns with interrupts disabled.
+ */
+void Wait_Prio(struct Prio_Queue* waitQueue)
+{
+    struct Kernel_Thread* current = CURRENT_THREAD;
+
+    KASSERT(!Interrupts_Enabled());
+
+    Prepare_To_Wait(current);
+    Rb_Insert(&waitQueue->tree, &current->runNode, &Prio_Less);
+    current->prioQueue = waitQueue;
+    Schedule();
+}
 
+/*
+ * Wake up all threads waiting on given priority wait queue,
+ * highest priority first.
+ * Must be called with interrupts disabled!
+ */
+void Wake_Up_Prio(struct Prio_Queue* waitQueue)
+{
     KASSERT(!Interrupts_Enabled());
 
-    best = Find_Best(waitQueue);
+    while (!Is_Prio_Queue_Empty(waitQueue))
+	Wake_Up_One_Prio(waitQueue);
+}
 
+/*
+ * Wake up the highest priority thread waiting on given
+ * priority wait queue (if there are any threads waiting).
+ * Interrupts must be disabled!
+ */
+void Wake_Up_One_Prio(struct Prio_Queue* waitQueue)
+{
+    struct Kernel_Thread* best;
+
+    KASSERT(!Interrupts_Enabled());
+
+    best = Get_Front_Of_Prio_Queue(waitQueue);
     if (best != 0) {
-	Remove_Thread(waitQueue, best);
+	Rb_Remove(&waitQueue->tree, &best->runNode);
+	best->prioQueue = 0;
 	Make_Runnable(best);
-	/*Print("Wake_Up_One: waking up %x from %x\n", best, g_currentThread); */
     }
 }
 
+/*
+ * Change the effective priority of given thread, moving it to its
+ * new place in the priority wait queue or run queue it is in.
+ * Used for priority inheritance; the thread's base priority
+ * is not changed.  Interrupts must be disabled.
+ */
+void Set_Thread_Priority(struct Kernel_Thread* kthread, int priority)
+{
+    struct Run_Queue* rq;
+    int cpu, level;
+
+    KASSERT(!Interrupts_Enabled());
+    KASSERT(priority > PRIORITY_IDLE && priority < NUM_RUN_QUEUE_LEVELS);
+
+    if (kthread->priority == priority)
+	return;
+
+    if (kthread->prioQueue != 0) {
+	Rb_Remove(&kthread->prioQueue->tree, &kthread->runNode);
+	kthread->priority = priority;
+	Rb_Insert(&kthread->prioQueue->tree, &kthread->runNode, &Prio_Less);
+	return;
+    }
+
+    /*
+     * Only the round robin policy places runnable threads by
+     * priority, and EDF threads ignore it.  A pending change of
+     * policy will requeue the thread anyway.
+     */
+    Spin_Lock(&s_policyLock);
+    if (g_currentSchedulingPolicy != SCHED_RR || g_prevSchedulingPolicy != SCHED_RR ||
+	Is_EDF_Thread(kthread)) {
+	kthread->priority = priority;
+	Spin_Unlock(&s_policyLock);
+	return;
+    }
+
+    /* The thread may be stolen by another CPU until its run queue is locked. */
+    for (;;) {
+	cpu = kthread->cpu;
+	rq = &s_runQueues[cpu];
+	Spin_Lock(&rq->lock);
+	if (kthread->cpu == cpu)
+	    break;
+	Spin_Unlock(&rq->lock);
+    }
+
+    level = Get_Run_Queue_Level(kthread);
+    if (kthread != CURRENT_THREAD && Is_Member_Of_Thread_Queue(&rq->level[level], kthread)) {
+	Remove_Thread(&rq->level[level], kthread);
+	if (Is_Thread_Queue_Empty(&rq->level[level]))
+	    rq->readyMask &= ~(1UL << level);
+	kthread->priority = priority;
+	level = Get_Run_Queue_Level(kthread);
+	Enqueue_Thread(&rq->level[level], kthread);
+	rq->readyMask |= (1UL << level);
+    } else {
+	kthread->priority = priority;
+    }
+
+    Spin_Unlock(&rq->lock);
+    Spin_Unlock(&s_policyLock);
+}
+
 /*
  * Allocate a key for accessing thread-local data.
  */
@@ -873,28 +1904,36 @@ int Tlocal_Create(tlocal_key_t *key, tlocal_destructor_t destructor)
 {
     KASSERT(key);
 
-    bool iflag = Begin_Int_Atomic();
+    bool iflag = Begin_Spin_Atomic(&s_tlocalLock);
 
-    if (s_tlocalKeyCounter == MAX_TLOCAL_KEYS) return -1;
+    if (s_tlocalKeyCounter == MAX_TLOCAL_KEYS) {
+	End_Spin_Atomic(&s_tlocalLock, iflag);
+	return -1;
+    }
     s_tlocalDestructors[s_tlocalKeyCounter] = destructor;
     *key = s_tlocalKeyCounter++;
 
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_tlocalLock, iflag);
   
     return 0;
 }
 
 /*
- * Store a value for a thread-local item
+ * Store a value for a thread-local item.
+ * Returns 0 if successful, or ENOMEM if there is no memory
+ * for the thread's thread-local data.
  */
-void Tlocal_Put(tlocal_key_t k, const void *v) 
+int Tlocal_Put(tlocal_key_t k, const void *v) 
 {
     const void **pv;
 
     KASSERT(k < s_tlocalKeyCounter);
 
-    pv = Get_Tlocal_Pointer(k);
+    pv = Get_Tlocal_Pointer(k, v != 0);
+    if (pv == 0)
+	return v != 0 ? ENOMEM : 0;
     *pv = v;
+    return 0;
 }
 
 /*
@@ -906,8 +1945,8 @@ void *Tlocal_Get(tlocal_key_t k)
 
     KASSERT(k < s_tlocalKeyCounter);
 
-    pv = Get_Tlocal_Pointer(k);
-    return (void *)*pv;
+    pv = Get_Tlocal_Pointer(k, false);
+    return pv != 0 ? (void *)*pv : 0;
 }
 
 /*
@@ -918,7 +1957,7 @@ void Dump_All_Thread_List(void)
 {
     struct Kernel_Thread *kthread;
     int count = 0;
-    bool iflag = Begin_Int_Atomic();
+    bool iflag = Begin_Spin_Atomic(&s_allThreadLock);
 
     kthread = Get_Front_Of_All_Thread_List(&s_allThreadList);
 
@@ -935,5 +1974,5 @@ void Dump_All_Thread_List(void)
     Print("]\n");
     Print("%d threads are running\n", count);
 
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_allThreadLock, iflag);
 }
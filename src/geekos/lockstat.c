@@ -0,0 +1,250 @@
+/*
+ * Lock contention statistics
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/errno.h>
+#include <geekos/int.h>
+#include <geekos/string.h>
+#include <geekos/spinlock.h>
+#include <geekos/schedstat.h>
+#include <geekos/timer.h>
+#include <geekos/lockstat.h>
+
+/*
+ * Statistics are kept for each (lock, call site) pair in a fixed
+ * size hash table.  Dynamically allocated locks (such as those of
+ * open files) get a new entry each time, and a lock whose memory
+ * is reused adds to the entries of the old one, so the table can
+ * fill up; after that, new pairs are only counted as dropped.
+ */
+struct Lock_Site {
+    const void *lock;
+    const char *file;
+    int line;
+    int kind;
+    ulong_t acquisitions;
+    ulong_t contended;
+    unsigned long long waitCycles;
+    unsigned long long maxWaitCycles;
+    unsigned long long holdCycles;
+};
+
+/* Number of entries in the table; a power of two. */
+#define LOCK_STAT_SITES 256
+
+/* ----------------------------------------------------------------------
+ * Private data
+ * ---------------------------------------------------------------------- */
+
+static struct Lock_Site s_lockSites[LOCK_STAT_SITES];
+static ulong_t s_numDropped;
+
+/*
+ * Protects the table.  It is taken with Spin_Lock(), which
+ * doesn't go through the statistics code itself.
+ */
+static struct Spin_Lock s_lockStatLock;
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Find the entry for given lock and call site, adding one if needed.
+ * Returns null if the table is full.
+ * s_lockStatLock must be held.
+ */
+static struct Lock_Site *Find_Site(const void *lock, int kind, const char *file, int line)
+{
+    ulong_t i = (((ulong_t) lock >> 2) ^ (ulong_t) line ^ (ulong_t) file) & (LOCK_STAT_SITES - 1);
+    int probes;
+
+    for (probes = 0; probes < LOCK_STAT_SITES; ++probes) {
+	struct Lock_Site *site = &s_lockSites[i];
+
+	if (site->lock == lock && site->file == file && site->line == line)
+	    return site;
+	if (site->lock == 0) {
+	    site->lock = lock;
+	    site->file = file;
+	    site->line = line;
+	    site->kind = kind;
+	    return site;
+	}
+	i = (i + 1) & (LOCK_STAT_SITES - 1);
+    }
+
+    ++s_numDropped;
+    return 0;
+}
+
+static __inline__ ulong_t To_Kcycles(unsigned long long cycles)
+{
+    return (ulong_t) (cycles >> LATENCY_UNIT_SHIFT);
+}
+
+/*
+ * Copy the last component of a source file path.
+ */
+static __inline__ void Copy_File_Name(char *dest, const char *path)
+{
+    const char *slash = strrchr(path, '/');
+
+    if (slash != 0)
+	path = slash + 1;
+    strncpy(dest, path, LOCK_STAT_FILE_LEN - 1);
+    dest[LOCK_STAT_FILE_LEN - 1] = '\0';
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Record an acquisition of given lock from given call site.
+ * Returns the entry to be passed to Lock_Stat_Released()
+ * when the lock is unlocked (possibly null).
+ */
+struct Lock_Site *Lock_Stat_Acquired(const void *lock, int kind, const char *file, int line,
+    bool contended, unsigned long long waitCycles)
+{
+    struct Lock_Site *site;
+    bool iflag;
+
+    iflag = Begin_Int_Atomic();
+    Spin_Lock(&s_lockStatLock);
+
+    site = Find_Site(lock, kind, file, line);
+    if (site != 0) {
+	++site->acquisitions;
+	if (contended) {
+	    ++site->contended;
+	    site->waitCycles += waitCycles;
+	    if (waitCycles > site->maxWaitCycles)
+		site->maxWaitCycles = waitCycles;
+	}
+    }
+
+    Spin_Unlock(&s_lockStatLock);
+    End_Int_Atomic(iflag);
+
+    return site;
+}
+
+/*
+ * Record how long a lock was held.
+ */
+void Lock_Stat_Released(struct Lock_Site *site, unsigned long long holdCycles)
+{
+    bool iflag;
+
+    if (site == 0)
+	return;
+
+    iflag = Begin_Int_Atomic();
+    Spin_Lock(&s_lockStatLock);
+    site->holdCycles += holdCycles;
+    Spin_Unlock(&s_lockStatLock);
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Acquire a spin lock for Begin_Spin_Atomic(), recording the time
+ * spent spinning, and when the lock was acquired.
+ * Interrupts must be disabled.
+ */
+void Lock_Stat_Spin_Lock(struct Spin_Lock *lock, const char *file, int line)
+{
+#ifdef LOCK_STATS
+    unsigned long long start = Read_TSC();
+    bool contended = !Spin_Try_Lock(lock);
+
+    if (contended)
+	Spin_Lock(lock);
+    lock->lockTSC = Read_TSC();
+    lock->statSite = Lock_Stat_Acquired(lock, LOCK_KIND_SPIN, file, line,
+	contended, lock->lockTSC - start);
+#else
+    Spin_Lock(lock);
+#endif
+}
+
+/*
+ * Release a spin lock for End_Spin_Atomic(), recording how long
+ * it was held, which is also how long interrupts were disabled.
+ * Interrupts must be disabled.
+ */
+void Lock_Stat_Spin_Unlock(struct Spin_Lock *lock)
+{
+#ifdef LOCK_STATS
+    struct Lock_Site *site = lock->statSite;
+    unsigned long long holdCycles = Read_TSC() - lock->lockTSC;
+
+    Spin_Unlock(lock);
+    Lock_Stat_Released(site, holdCycles);
+#else
+    Spin_Unlock(lock);
+#endif
+}
+
+/*
+ * Get the statistics for up to max of the most contended
+ * lock call sites, ordered by total time spent waiting.
+ * Returns the number of entries filled in, or EUNSUPPORTED
+ * if the kernel wasn't built with LOCK_STATS.
+ */
+int Get_Lock_Stats(struct Lock_Stats *stats, int max)
+{
+#ifdef LOCK_STATS
+    bool taken[LOCK_STAT_SITES];
+    int count, i, best;
+    bool iflag;
+
+    memset(taken, '\0', sizeof(taken));
+
+    iflag = Begin_Int_Atomic();
+    Spin_Lock(&s_lockStatLock);
+
+    for (count = 0; count < max; ++count) {
+	struct Lock_Site *site;
+
+	/* Find the most contended entry not yet reported. */
+	best = -1;
+	for (i = 0; i < LOCK_STAT_SITES; ++i) {
+	    if (s_lockSites[i].lock == 0 || taken[i])
+		continue;
+	    if (best < 0 ||
+		s_lockSites[i].waitCycles > s_lockSites[best].waitCycles ||
+		(s_lockSites[i].waitCycles == s_lockSites[best].waitCycles &&
+		 s_lockSites[i].acquisitions > s_lockSites[best].acquisitions))
+		best = i;
+	}
+	if (best < 0)
+	    break;
+	taken[best] = true;
+
+	site = &s_lockSites[best];
+	stats[count].lock = (ulong_t) site->lock;
+	stats[count].kind = site->kind;
+	Copy_File_Name(stats[count].file, site->file);
+	stats[count].line = site->line;
+	stats[count].acquisitions = site->acquisitions;
+	stats[count].contended = site->contended;
+	stats[count].waitKcycles = To_Kcycles(site->waitCycles);
+	stats[count].maxWaitKcycles = To_Kcycles(site->maxWaitCycles);
+	stats[count].holdKcycles = To_Kcycles(site->holdCycles);
+    }
+
+    Spin_Unlock(&s_lockStatLock);
+    End_Int_Atomic(iflag);
+
+    return count;
+#else
+    return EUNSUPPORTED;
+#endif
+}
@@ -23,11 +23,28 @@
 ; This is the size of the Interrupt_State struct in int.h
 INTERRUPT_STATE_SIZE equ 64
 
+; Address of the id register of the local APIC (see apic.c).
+LOCAL_APIC_ID equ 0xFEE00020
+
+; Put the number of the CPU we are running on in the register
+; given as the argument.  Only that register and the flags
+; are modified.
+; This must be kept up to date with Get_CPU_ID() in smp.c.
+%macro Get_CPU 1
+	xor	%1, %1
+	cmp	[g_numCPUsOnline], dword 1
+	je	%%done
+	mov	%1, [LOCAL_APIC_ID]
+	shr	%1, 24
+	movzx	%1, byte [g_apicIdToCPU+%1]
+%%done:
+%endmacro
+
 ; Save registers prior to calling a handler function.
 ; This must be kept up to date with:
 ;   - Interrupt_State struct in int.h
 ;   - Setup_Initial_Thread_Context() in kthread.c
-%macro Save_Registers 0
+%macro Save_General_Registers 0
 	push	eax
 	push	ebx
 	push	ecx
@@ -35,6 +52,10 @@ INTERRUPT_STATE_SIZE equ 64
 	push	esi
 	push	edi
 	push	ebp
+%endmacro
+
+%macro Save_Registers 0
+	Save_General_Registers
 	push	ds
 	push	es
 	push	fs
@@ -43,11 +64,26 @@ INTERRUPT_STATE_SIZE equ 64
 
 ; Restore registers and clean up the stack after calling a handler function
 ; (i.e., just before we return from the interrupt via an iret instruction).
+; Returning to user mode lets go of the kernel lock (see smp.h).
+; Loading a segment register is slow, so they are only restored when
+; returning to user mode.  In the kernel, ds and es always hold
+; KERNEL_DS, which Handle_Interrupt loads on entry, and fs and gs
+; are not used; so switching between threads running in the kernel
+; leaves them as they are.  This also means that a user selector
+; left in fs or gs is never reloaded in the kernel, after its
+; descriptor may have gone away.
 %macro Restore_Registers 0
+	test	byte [esp+INTERRUPT_CS], 3	; returning to user mode?
+	jz	%%kernel
+	mov	[g_kernelLock], dword 0
 	pop	gs
 	pop	fs
 	pop	es
 	pop	ds
+	jmp	%%general
+%%kernel:
+	add	esp, 16		; skip saved segment registers
+%%general:
 	pop	ebp
 	pop	edi
 	pop	esi
@@ -61,11 +97,12 @@ INTERRUPT_STATE_SIZE equ 64
 ; Code to activate a new user context (if necessary), before returning
 ; to executing a thread.  Should be called just before restoring
 ; registers (because the interrupt context is used).
-%macro Activate_User_Context 0
+; The argument is a register holding the number of the CPU.
+%macro Activate_User_Context 1
 	; If the new thread has a user context which is not the current
 	; one, activate it.
 	push    esp                     ; Interrupt_State pointer
-	push    dword [g_currentThread] ; Kernel_Thread pointer
+	push    dword [g_currentThreads+%1*4] ; Kernel_Thread pointer
 	call    Switch_To_User_Context
 	add     esp, 8                  ; clear 2 arguments
 %endmacro
@@ -75,6 +112,10 @@ INTERRUPT_STATE_SIZE equ 64
 ; registers have been saved.
 REG_SKIP equ (11*4)
 
+; Offset of the saved cs from the top of the stack,
+; after the registers have been saved.
+INTERRUPT_CS equ (REG_SKIP+12)
+
 ; Template for entry point code for interrupts that have
 ; an explicit processor-generated error code.
 ; The argument is the interrupt number.
@@ -104,13 +145,25 @@ align 16
 ; of C handler functions for interrupts.
 IMPORT g_interruptTable
 
-; Global variable pointing to context struct for current thread.
-IMPORT g_currentThread
+; Global array pointing to context struct for each CPU's current thread.
+IMPORT g_currentThreads
 
-; Set to non-zero when we need to choose a new thread
+; Set to non-zero for a CPU when we need to choose a new thread
 ; in the interrupt return code.
 IMPORT g_needReschedule
 
+; Number of CPUs online, and the CPU number of each local APIC id.
+IMPORT g_numCPUsOnline
+IMPORT g_apicIdToCPU
+
+; The kernel lock, and the function to take it.
+IMPORT g_kernelLock
+IMPORT Lock_Kernel
+
+; Stack and C entry point of an application processor.
+IMPORT g_apStartStack
+IMPORT AP_Main
+
 ; Set to non-zero when preemption is disabled.
 IMPORT g_preemptionDisabled
 
@@ -146,6 +199,12 @@ EXPORT Switch_To_Thread
 ; Return current value of eflags register.
 EXPORT Get_Current_EFLAGS
 
+; Startup code for the application processors, and the place
+; where smp.c puts the GDT limit and base for it.
+EXPORT g_apTrampoline
+EXPORT g_apTrampolineGDTR
+EXPORT g_apTrampolineEnd
+
 
 ; ----------------------------------------------------------------------
 ; Code
@@ -200,6 +259,13 @@ Handle_Interrupt:
 	mov	ds, ax
 	mov	es, ax
 
+	; Once other CPUs are running, take the kernel lock
+	; (see smp.h).
+	cmp	[g_numCPUsOnline], dword 1
+	je	.locked
+	call	Lock_Kernel
+.locked:
+
 	; Get the address of the C handler function from the
 	; table of handler functions.
 	mov	eax, g_interruptTable	; get address of handler table
@@ -213,37 +279,40 @@ Handle_Interrupt:
 	call	ebx
 	add	esp, 4			; clear 1 argument
 
+	; Keep the CPU number in edi, which C functions preserve.
+	Get_CPU	edi
+
 	; If preemption is disabled, then the current thread
 	; keeps running.
 	cmp	[g_preemptionDisabled], dword 0
 	jne	.restore
 
 	; See if we need to choose a new thread to run.
-	cmp	[g_needReschedule], dword 0
+	cmp	[g_needReschedule+edi*4], dword 0
 	je	.restore
 
 	; Put current thread back on the run queue
-	push	dword [g_currentThread]
+	push	dword [g_currentThreads+edi*4]
 	call	Make_Runnable
 	add	esp, 4			; clear 1 argument
 
 	; Save stack pointer in current thread context, and
 	; clear numTicks field.
-	mov	eax, [g_currentThread]
+	mov	eax, [g_currentThreads+edi*4]
 	mov	[eax+0], esp		; esp field
 	mov	[eax+4], dword 0	; numTicks field
 
 	; Pick a new thread to run, and switch to its stack
 	call	Get_Next_Runnable
-	mov	[g_currentThread], eax
+	mov	[g_currentThreads+edi*4], eax
 	mov	esp, [eax+0]		; esp field
 
 	; Clear "need reschedule" flag
-	mov	[g_needReschedule], dword 0
+	mov	[g_needReschedule+edi*4], dword 0
 
 .restore:
 	; Activate the user context, if necessary.
-	Activate_User_Context
+	Activate_User_Context edi
 
 	; Restore registers
 	Restore_Registers
@@ -292,11 +361,17 @@ Switch_To_Thread:
 	push	dword 0
 	push	dword 0
 
-	; Save general purpose registers.
-	Save_Registers
+	; Save general purpose registers.  The thread will be resumed
+	; in the kernel, so Restore_Registers won't reload its segment
+	; registers; just make room for them.
+	Save_General_Registers
+	sub	esp, 16
+
+	; Keep the CPU number in esi.
+	Get_CPU	esi
 
 	; Save stack pointer in the thread context struct (at offset 0).
-	mov	eax, [g_currentThread]
+	mov	eax, [g_currentThreads+esi*4]
 	mov	[eax+0], esp
 
 	; Clear numTicks field in thread context, since this
@@ -309,14 +384,15 @@ Switch_To_Thread:
 	mov	eax, [esp+INTERRUPT_STATE_SIZE]
 
 	; Make the new thread current, and switch to its stack.
-	mov	[g_currentThread], eax
+	mov	[g_currentThreads+esi*4], eax
 	mov	esp, [eax+0]
 
 	; Activate the user context, if necessary.
-	Activate_User_Context
+	Activate_User_Context esi
 
-	; Restore general purpose and segment registers, and clear interrupt
-	; number and error code.
+	; Restore general purpose registers, and segment registers
+	; if returning to user mode, and clear interrupt number
+	; and error code.
 	Restore_Registers
 
 	; We'll return to the place where the thread was
@@ -330,6 +406,50 @@ Get_Current_EFLAGS:
 	pop	eax		; pop contents into eax
 	ret
 
+; ----------------------------------------------------------------------
+; Application processor startup.
+;   An application processor starts executing a copy of this code
+;   at AP_STARTUP_ADDR, in real mode, with cs set to the segment of
+;   that address and ip to 0 (see Start_AP() in smp.c).  It switches
+;   to protected mode using the kernel GDT, and calls AP_Main()
+;   on the stack at g_apStartStack.
+; ----------------------------------------------------------------------
+[BITS 16]
+align 16
+g_apTrampoline:
+	cli
+	mov	ax, cs
+	mov	ds, ax
+
+	; Load the kernel GDT.  Without an operand size prefix, lgdt
+	; only uses 24 bits of the base, which is enough since the
+	; kernel is loaded below 16MB.
+	lgdt	[g_apTrampolineGDTR - g_apTrampoline]
+
+	; Turn on protected mode, and jump to the 32 bit code in
+	; the kernel, which is where the linker put it.
+	mov	ax, 1
+	lmsw	ax
+	jmp	dword KERNEL_CS:AP_Start_32
+
+align 4
+g_apTrampolineGDTR:
+	dw	0		; limit
+	dd	0		; base
+g_apTrampolineEnd:
+
+[BITS 32]
+align 16
+AP_Start_32:
+	mov	ax, KERNEL_DS
+	mov	ds, ax
+	mov	es, ax
+	mov	fs, ax
+	mov	gs, ax
+	mov	ss, ax
+	mov	esp, [g_apStartStack]
+	call	AP_Main
+
 ; ----------------------------------------------------------------------
 ; Generate interrupt-specific entry points for all interrupts.
 ; We also define symbols to indicate the extend of the table
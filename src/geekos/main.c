@@ -26,7 +26,10 @@
 #include <geekos/pfat.h>
 #include <geekos/vfs.h>
 #include <geekos/user.h>
-//#include <libc/sema.h>
+#include <geekos/kbench.h>
+#include <geekos/apic.h>
+#include <geekos/smp.h>
+#include <geekos/sem.h>
 
 
 /*
@@ -46,10 +49,17 @@
 
 #define INIT_PROGRAM "/" ROOT_PREFIX "/shell.exe"
 
+/*
+ * Define this to run the kernel microbenchmarks in kbench.c
+ * before the init process is spawned.
+ */
+/*#define KERNEL_BENCH*/
+
 
 
 static void Mount_Root_Filesystem(void);
 static void Spawn_Init_Process(void);
+static int Get_Boot_Tick_Rate(struct Boot_Info* bootInfo);
 
 /*
  * Kernel C code entry point.
@@ -65,14 +75,17 @@ void Main(struct Boot_Info* bootInfo)
     Init_TSS();
     Init_Interrupts();
     Init_Scheduler();
+    Init_Local_APIC();
+    Init_SMP();
     Init_Traps();
-    Init_Timer();
+    Init_Timer(Get_Boot_Tick_Rate(bootInfo));
     Init_Keyboard();
     Init_DMA();
     Init_Floppy();
     Init_IDE();
     Init_PFAT();
     Init_Semaphores();
+    Start_Application_Processors();
 
     Mount_Root_Filesystem();
 
@@ -80,8 +93,9 @@ void Main(struct Boot_Info* bootInfo)
     Print("Welcome to GeekOS!\n");
     Set_Current_Attr(ATTRIB(BLACK, GRAY));
 
-
-
+#ifdef KERNEL_BENCH
+    Run_Kernel_Benchmarks();
+#endif
 
     Spawn_Init_Process();
 
@@ -89,6 +103,17 @@ void Main(struct Boot_Info* bootInfo)
     Exit(0);
 }
 
+/*
+ * Get the timer interrupt rate the boot loader asked for, or 0
+ * if it is one which doesn't pass a rate.
+ */
+static int Get_Boot_Tick_Rate(struct Boot_Info* bootInfo)
+{
+    if (bootInfo->bootInfoSize < (int) sizeof(struct Boot_Info))
+	return 0;
+    return bootInfo->tickHz;
+}
+
 static void Mount_Root_Filesystem(void)
 {
     if (Mount(ROOT_DEVICE, ROOT_PREFIX, "pfat") != 0)
@@ -117,6 +142,7 @@ static void Spawn_Init_Process(void)
         /* Wait for it to exit */
         int exitCode = Join(pThread);
         Print("Init process exited with code %d\n", exitCode);
+        Print("CPU was idle for %lu of %lu ticks\n", Get_Idle_Ticks(), g_numTicks);
     }
    
    while(true){
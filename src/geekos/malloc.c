@@ -9,18 +9,221 @@
 
 #include <geekos/screen.h>
 #include <geekos/int.h>
+#include <geekos/spinlock.h>
 #include <geekos/bget.h>
 #include <geekos/kassert.h>
+#include <geekos/list.h>
+#include <geekos/mem.h>
 #include <geekos/malloc.h>
 
+/*
+ * Small allocations come from size-class slab caches rather than
+ * the kernel heap, so they take constant time instead of a best-fit
+ * search of the heap's free list with interrupts disabled.
+ *
+ * A slab is a block of 2^SLAB_ORDER pages from the page allocator,
+ * aligned to its size, with a Slab header at the start followed by
+ * objects of its cache's size.  Free objects are linked through
+ * their first word.  Each cache keeps the slabs which have free
+ * objects on a list; allocating takes an object from the first of
+ * them, and freeing finds the slab by rounding the address down.
+ * A cache keeps one empty slab for later, and gives any more back
+ * to the page allocator.
+ *
+ * Slabs never lie within the kernel heap, so Free() tells
+ * the two apart by address.
+ */
+#define SLAB_ORDER 2
+#define SLAB_SIZE (PAGE_SIZE << SLAB_ORDER)
+#define SLAB_MAGIC 0x51ab51abUL
+
+/* Offset of the first object in a slab. */
+#define SLAB_HEADER_SIZE ((sizeof(struct Slab) + 15) & ~15)
+
+/* Smallest size class, as a shift. */
+#define MIN_CACHE_SHIFT 4
+
+struct Slab;
+struct Free_Object;
+
+DEFINE_LIST(Slab_List, Slab);
+
+struct Slab_Cache {
+    struct Spin_Lock lock;
+    struct Slab_List partialList;	 /* slabs with free objects */
+    ulong_t objectSize;
+    ulong_t objectsPerSlab;
+    ulong_t emptySlabs;
+    struct Malloc_Cache_Stats stats;
+};
+
+struct Slab {
+    ulong_t magic;
+    struct Slab_Cache* cache;
+    struct Free_Object* freeList;
+    ulong_t numFree;
+    DEFINE_LINK(Slab_List, Slab);
+};
+
+IMPLEMENT_LIST(Slab_List, Slab);
+
+struct Free_Object {
+    struct Free_Object* next;
+};
+
+/* ----------------------------------------------------------------------
+ * Private data
+ * ---------------------------------------------------------------------- */
+
+/* Protects the kernel heap. */
+static struct Spin_Lock s_heapLock;
+static ulong_t s_heapStart, s_heapEnd;
+
+static struct Slab_Cache s_caches[MALLOC_NUM_CACHES];
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Get the cache for allocations of given size, which is the one
+ * for the smallest power of two at least as large.  It is found
+ * from the most significant bit of size-1, so that larger sizes
+ * don't take longer.
+ */
+static __inline__ struct Slab_Cache* Get_Cache(ulong_t size)
+{
+    int bit;
+
+    if (size <= (1UL << MIN_CACHE_SHIFT))
+	return &s_caches[0];
+    __asm__ ("bsrl %1, %0" : "=r" (bit) : "rm" (size - 1));
+    return &s_caches[bit + 1 - MIN_CACHE_SHIFT];
+}
+
+/*
+ * Carve a new slab into free objects for given cache.
+ */
+static struct Slab* Init_Slab(void* block, struct Slab_Cache* cache)
+{
+    struct Slab* slab = (struct Slab*) block;
+    char* obj = (char*) block + SLAB_HEADER_SIZE;
+    ulong_t i;
+
+    slab->magic = SLAB_MAGIC;
+    slab->cache = cache;
+    slab->freeList = 0;
+    slab->numFree = cache->objectsPerSlab;
+    for (i = 0; i < cache->objectsPerSlab; ++i, obj += cache->objectSize) {
+	((struct Free_Object*) obj)->next = slab->freeList;
+	slab->freeList = (struct Free_Object*) obj;
+    }
+    return slab;
+}
+
+/*
+ * Allocate an object from given cache, adding a new slab if needed.
+ * Returns null if there are no pages for a new slab.
+ */
+static void* Cache_Alloc(struct Slab_Cache* cache)
+{
+    struct Slab* slab;
+    struct Free_Object* obj;
+    void* block;
+    bool iflag;
+
+    iflag = Begin_Spin_Atomic(&cache->lock);
+    slab = Get_Front_Of_Slab_List(&cache->partialList);
+    if (slab == 0) {
+	/* Page allocation takes its own lock, so drop ours meanwhile. */
+	End_Spin_Atomic(&cache->lock, iflag);
+	block = Alloc_Pages(SLAB_ORDER);
+	if (block == 0)
+	    return 0;
+	slab = Init_Slab(block, cache);
+	iflag = Begin_Spin_Atomic(&cache->lock);
+	Add_To_Front_Of_Slab_List(&cache->partialList, slab);
+	++cache->emptySlabs;
+	++cache->stats.slabs;
+	++cache->stats.slabAllocs;
+    }
+
+    if (slab->numFree == cache->objectsPerSlab)
+	--cache->emptySlabs;
+    obj = slab->freeList;
+    slab->freeList = obj->next;
+    if (--slab->numFree == 0)
+	Remove_From_Slab_List(&cache->partialList, slab);
+    ++cache->stats.objectsInUse;
+    ++cache->stats.allocs;
+    End_Spin_Atomic(&cache->lock, iflag);
+
+    return obj;
+}
+
+/*
+ * Return an object to the slab it came from.
+ */
+static void Cache_Free(void* buf)
+{
+    struct Slab* slab = (struct Slab*) ((ulong_t) buf & ~(SLAB_SIZE - 1));
+    struct Slab_Cache* cache = slab->cache;
+    struct Free_Object* obj = (struct Free_Object*) buf;
+    bool release = false;
+    bool iflag;
+
+    KASSERT(slab->magic == SLAB_MAGIC);
+
+    iflag = Begin_Spin_Atomic(&cache->lock);
+    if (slab->numFree == 0)
+	Add_To_Front_Of_Slab_List(&cache->partialList, slab);
+    obj->next = slab->freeList;
+    slab->freeList = obj;
+    if (++slab->numFree == cache->objectsPerSlab) {
+	if (cache->emptySlabs > 0) {
+	    Remove_From_Slab_List(&cache->partialList, slab);
+	    --cache->stats.slabs;
+	    ++cache->stats.slabFrees;
+	    release = true;
+	} else {
+	    ++cache->emptySlabs;
+	}
+    }
+    --cache->stats.objectsInUse;
+    ++cache->stats.frees;
+    End_Spin_Atomic(&cache->lock, iflag);
+
+    if (release) {
+	slab->magic = 0;
+	Free_Pages(slab, SLAB_ORDER);
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
 /*
  * Initialize the heap starting at given address and occupying
- * specified number of bytes.
+ * specified number of bytes, and the size-class caches.
  */
 void Init_Heap(ulong_t start, ulong_t size)
 {
+    int i;
+
     /*Print("Creating kernel heap: start=%lx, size=%ld\n", start, size);*/
     bpool((void*) start, size);
+    s_heapStart = start;
+    s_heapEnd = start + size;
+
+    for (i = 0; i < MALLOC_NUM_CACHES; ++i) {
+	struct Slab_Cache* cache = &s_caches[i];
+
+	cache->objectSize = 1UL << (i + MIN_CACHE_SHIFT);
+	cache->objectsPerSlab = (SLAB_SIZE - SLAB_HEADER_SIZE) / cache->objectSize;
+	cache->stats.objectSize = cache->objectSize;
+    }
+    KASSERT(s_caches[MALLOC_NUM_CACHES - 1].objectSize == MALLOC_MAX_CACHED_SIZE);
 }
 
 /*
@@ -29,27 +232,77 @@ void Init_Heap(ulong_t start, ulong_t size)
  * allocation.
  */
 void* Malloc(ulong_t size)
+{
+    void *result;
+
+    KASSERT(size > 0);
+
+    if (size <= MALLOC_MAX_CACHED_SIZE) {
+	result = Cache_Alloc(Get_Cache(size));
+	if (result != 0)
+	    return result;
+	/* Out of pages; the heap may still have room. */
+    }
+
+    return Heap_Alloc(size);
+}
+
+/*
+ * Free a buffer allocated with Malloc() or Heap_Alloc().
+ */
+void Free(void* buf)
+{
+    ulong_t addr = (ulong_t) buf;
+
+    if (buf == 0 || (addr >= s_heapStart && addr < s_heapEnd))
+	Heap_Free(buf);
+    else
+	Cache_Free(buf);
+}
+
+/*
+ * Allocate a buffer of given size from the kernel heap,
+ * whatever its size.
+ * Returns null if there is not enough memory.
+ */
+void* Heap_Alloc(ulong_t size)
 {
     void *result;
     bool iflag;
 
     KASSERT(size > 0);
 
-    iflag = Begin_Int_Atomic();
+    iflag = Begin_Spin_Atomic(&s_heapLock);
     result = bget(size);
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_heapLock, iflag);
 
     return result;
 }
 
 /*
- * Free a buffer allocated with Malloc() or Malloc().
+ * Free a buffer allocated from the kernel heap.
  */
-void Free(void* buf)
+void Heap_Free(void* buf)
 {
     bool iflag;
 
-    iflag = Begin_Int_Atomic();
+    iflag = Begin_Spin_Atomic(&s_heapLock);
     brel(buf);
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_heapLock, iflag);
+}
+
+/*
+ * Get the statistics of each size-class cache,
+ * smallest size first.
+ */
+void Get_Malloc_Stats(struct Malloc_Cache_Stats stats[MALLOC_NUM_CACHES])
+{
+    int i;
+    bool iflag;
+
+    for (i = 0; i < MALLOC_NUM_CACHES; ++i) {
+	iflag = Begin_Spin_Atomic(&s_caches[i].lock);
+	stats[i] = s_caches[i].stats;
+	End_Spin_Atomic(&s_caches[i].lock, iflag);
+    }
 }
@@ -15,10 +15,10 @@
 #include <geekos/gdt.h>
 #include <geekos/screen.h>
 #include <geekos/int.h>
+#include <geekos/spinlock.h>
 #include <geekos/malloc.h>
 #include <geekos/string.h>
 #include <geekos/mem.h>
-#include <libc/sema.h>
 
 /* ----------------------------------------------------------------------
  * Global data
@@ -45,15 +45,77 @@ extern int debugFaults;
 #define Debug(args...) if (debugFaults) Print(args)
 
 /*
- * List of pages available for allocation.
+ * Pages available for allocation are managed by a binary buddy
+ * system.  Free memory is divided into blocks of 2^order pages,
+ * each aligned to its own size, with a free list for each order.
+ * Allocating takes a block of the smallest order big enough,
+ * splitting it in halves down to the order wanted; freeing
+ * merges a block with its buddy (the other half of the block of
+ * the next order up) for as long as the buddy is free too.
+ * Both take at most MAX_PAGE_ORDER steps.
+ *
+ * The flags and order of a block are kept in the Page of its
+ * first page; the order of every other page is -1.
  */
-static struct Page_List s_freeList;
+static struct Page_List s_freeLists[MAX_PAGE_ORDER + 1];
+static ulong_t s_numFreeBlocks[MAX_PAGE_ORDER + 1];
+static struct Spin_Lock s_freeListLock;
 
 /*
  * Total number of physical pages.
  */
 int unsigned s_numPages;
 
+/*
+ * Get the buddy of the block of given order starting at given page,
+ * or null if it would lie beyond the end of memory.
+ */
+static __inline__ struct Page *Get_Buddy(struct Page *page, int order)
+{
+    ulong_t index = (ulong_t) (page - g_pageList) ^ (1UL << order);
+
+    return index < s_numPages ? &g_pageList[index] : 0;
+}
+
+static __inline__ void Add_Free_Block(struct Page *page, int order)
+{
+    page->flags = PAGE_AVAIL;
+    page->order = order;
+    Add_To_Front_Of_Page_List(&s_freeLists[order], page);
+    ++s_numFreeBlocks[order];
+}
+
+static __inline__ void Remove_Free_Block(struct Page *page, int order)
+{
+    Remove_From_Page_List(&s_freeLists[order], page);
+    --s_numFreeBlocks[order];
+    page->order = -1;
+}
+
+/*
+ * Put a block of given order on the free lists, merged with its
+ * buddy, and so on up, as far as they are free.
+ * s_freeListLock must be held.
+ */
+static void Free_Block(struct Page *page, int order)
+{
+    page->flags = PAGE_AVAIL;
+    page->order = -1;
+
+    while (order < MAX_PAGE_ORDER) {
+	struct Page *buddy = Get_Buddy(page, order);
+
+	if (buddy == 0 || buddy->flags != PAGE_AVAIL || buddy->order != order)
+	    break;
+	Remove_Free_Block(buddy, order);
+	if (buddy < page)
+	    page = buddy;
+	++order;
+    }
+
+    Add_Free_Block(page, order);
+}
+
 /*
  * Add a range of pages to the inventory of physical memory.
  */
@@ -71,12 +133,14 @@ static void Add_Page_Range(ulong_t start, ulong_t end, int flags)
 	page->flags = flags;
 
 	if (flags == PAGE_AVAIL) {
-	    /* Add the page to the freelist */
-	    Add_To_Back_Of_Page_List(&s_freeList, page);
+	    /* Add the page to the free lists */
+	    Free_Block(page, 0);
 
 	    /* Update free page count */
 	    ++g_freePageCount;
 	} else {
+	    /* Allocated pages may be freed one at a time. */
+	    page->order = (flags == PAGE_ALLOCATED) ? 0 : -1;
 	    Set_Next_In_Page_List(page, 0);
 	    Set_Prev_In_Page_List(page, 0);
 	}
@@ -105,6 +169,7 @@ void Init_Mem(struct Boot_Info* bootInfo)
     unsigned numPageListBytes = sizeof(struct Page) * numPages;
     ulong_t pageListAddr;
     ulong_t kernEnd;
+    ulong_t i;
 
     KASSERT(bootInfo->memSizeKB > 0);
 
@@ -125,6 +190,16 @@ void Init_Mem(struct Boot_Info* bootInfo)
     kernEnd = Round_Up_To_Page(pageListAddr + numPageListBytes);
     s_numPages = numPages;
 
+    /*
+     * Until the page ranges below are added, every page is unused,
+     * so that merging free blocks never looks at a Page which
+     * hasn't been set up yet.
+     */
+    for (i = 0; i < numPages; ++i) {
+	g_pageList[i].flags = PAGE_UNUSED;
+	g_pageList[i].order = -1;
+    }
+
     /*
      * The initial kernel thread and its stack are placed
      * just beyond the ISA hole.
@@ -134,7 +209,8 @@ void Init_Mem(struct Boot_Info* bootInfo)
 
     /*
      * Memory looks like this:
-     * 0 - start: available (might want to preserve BIOS data area)
+     * 0 - start: available (might want to preserve BIOS data area),
+     *    except for the application processor startup page
      * start - end: kernel
      * end - ISA_HOLE_START: available
      * ISA_HOLE_START - ISA_HOLE_END: used by hardware (and ROM BIOS?)
@@ -145,7 +221,9 @@ void Init_Mem(struct Boot_Info* bootInfo)
      */
 
     Add_Page_Range(0, PAGE_SIZE, PAGE_UNUSED);
-    Add_Page_Range(PAGE_SIZE, KERNEL_START_ADDR, PAGE_AVAIL);
+    Add_Page_Range(PAGE_SIZE, AP_STARTUP_ADDR, PAGE_AVAIL);
+    Add_Page_Range(AP_STARTUP_ADDR, AP_STARTUP_ADDR + PAGE_SIZE, PAGE_KERN);
+    Add_Page_Range(AP_STARTUP_ADDR + PAGE_SIZE, KERNEL_START_ADDR, PAGE_AVAIL);
     Add_Page_Range(KERNEL_START_ADDR, kernEnd, PAGE_KERN);
     Add_Page_Range(kernEnd, ISA_HOLE_START, PAGE_AVAIL);
     Add_Page_Range(ISA_HOLE_START, ISA_HOLE_END, PAGE_HW);
@@ -175,64 +253,121 @@ void Init_BSS(void)
  * Allocate a page of physical memory.
  */
 void* Alloc_Page(void)
+{
+    return Alloc_Pages(0);
+}
+
+/*
+ * Free a page of physical memory.
+ */
+void Free_Page(void* pageAddr)
+{
+    Free_Pages(pageAddr, 0);
+}
+
+/*
+ * Allocate 2^order physically contiguous pages, aligned
+ * to their combined size.
+ * Returns the address of the first page, or null if there
+ * is no free block big enough.
+ */
+void* Alloc_Pages(int order)
 {
     struct Page* page;
     void *result = 0;
+    int k;
+    bool iflag;
+
+    if (order < 0 || order > MAX_PAGE_ORDER)
+	return 0;
 
-    bool iflag = Begin_Int_Atomic();
+    iflag = Begin_Spin_Atomic(&s_freeListLock);
 
-    /* See if we have a free page */
-    if (!Is_Page_List_Empty(&s_freeList)) {
-	/* Remove the first page on the freelist. */
-	page = Get_Front_Of_Page_List(&s_freeList);
+    /* Find the smallest free block big enough */
+    for (k = order; k <= MAX_PAGE_ORDER && Is_Page_List_Empty(&s_freeLists[k]); ++k)
+	;
+
+    if (k <= MAX_PAGE_ORDER) {
+	page = Get_Front_Of_Page_List(&s_freeLists[k]);
 	KASSERT((page->flags & PAGE_ALLOCATED) == 0);
-	Remove_From_Front_Of_Page_List(&s_freeList);
+	Remove_Free_Block(page, k);
 
-	/* Mark page as having been allocated. */
+	/* Split it, giving back the upper halves */
+	while (k > order) {
+	    --k;
+	    Add_Free_Block(page + (1UL << k), k);
+	}
+
+	/* Mark block as having been allocated. */
 	page->flags |= PAGE_ALLOCATED;
-	g_freePageCount--;
+	page->order = order;
+	g_freePageCount -= 1UL << order;
 	result = (void*) Get_Page_Address(page);
     }
 
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_freeListLock, iflag);
 
     return result;
 }
 
 /*
- * Free a page of physical memory.
+ * Free 2^order pages of physical memory allocated
+ * with Alloc_Pages() with the same order.
  */
-void Free_Page(void* pageAddr)
+void Free_Pages(void* pageAddr, int order)
 {
     ulong_t addr = (ulong_t) pageAddr;
     struct Page* page;
     bool iflag;
 
-    iflag = Begin_Int_Atomic();
-
     KASSERT(Is_Page_Multiple(addr));
+    KASSERT(order >= 0 && order <= MAX_PAGE_ORDER);
+
+    iflag = Begin_Spin_Atomic(&s_freeListLock);
 
-    /* Get the Page object for this page */
+    /* Get the Page object for the first page */
     page = Get_Page(addr);
     KASSERT((page->flags & PAGE_ALLOCATED) != 0);
+    KASSERT(page->order == order);
 
-    /* Clear the allocation bit */
-    page->flags &= ~(PAGE_ALLOCATED);
+    /* Put the block back on the free lists */
+    Free_Block(page, order);
+    g_freePageCount += 1UL << order;
 
-    /* Put the page back on the freelist */
-    Add_To_Back_Of_Page_List(&s_freeList, page);
-    g_freePageCount++;
-
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_freeListLock, iflag);
 }
 
 /*
- * Initialize semaphores
- */ 
-void Init_Semaphores(){
-    int index = 0;
-    for(; index < TOTAL_SEMAPHORES; index++){
-        semaphores[index].name[0] = NULL;
-    }    
+ * Get the number of free blocks of each order.
+ */
+void Get_Page_Stats(struct Page_Stats* stats)
+{
+    int order;
+    bool iflag;
+
+    iflag = Begin_Spin_Atomic(&s_freeListLock);
+    stats->freePages = g_freePageCount;
+    stats->largestOrder = -1;
+    for (order = 0; order <= MAX_PAGE_ORDER; ++order) {
+	stats->freeBlocks[order] = s_numFreeBlocks[order];
+	if (s_numFreeBlocks[order] > 0)
+	    stats->largestOrder = order;
+    }
+    End_Spin_Atomic(&s_freeListLock, iflag);
 }
 
+/*
+ * Get the fragmentation of free memory, as the percentage of free
+ * pages which are not in a block of the largest order there is.
+ * 0 means all free memory is in blocks as big as any free block;
+ * close to 100 means it is scattered in blocks much smaller.
+ */
+int Get_Fragmentation(const struct Page_Stats* stats)
+{
+    ulong_t largestPages;
+
+    if (stats->freePages == 0)
+	return 0;
+    largestPages = stats->freeBlocks[stats->largestOrder] << stats->largestOrder;
+    return 100 - (int) (largestPages * 100 / stats->freePages);
+}
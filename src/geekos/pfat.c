@@ -104,6 +104,8 @@ static int PFAT_FStat(struct File *file, struct VFS_File_Stat *stat)
 
 /*
  * Read function for PFAT files.
+ * Reads from the current position and advances it, stopping
+ * at the end of the file; returns 0 once there.
  */
 static int PFAT_Read(struct File *file, void *buf, ulong_t numBytes)
 {
@@ -119,17 +121,25 @@ static int PFAT_Read(struct File *file, void *buf, ulong_t numBytes)
 	return EINVALID;
 
     /* Make sure request represents a valid range within the file */
-    if (start >= file->endPos || end > file->endPos || end < start) {
+    if (end < start) {
 	Debug("Invalid read position: filePos=%lu, numBytes=%lu, endPos=%lu\n",
 	    file->filePos, numBytes, file->endPos);
 	return EINVALID;
     }
 
+    /* Reads stop at the end of the file. */
+    if (start >= file->endPos)
+	return 0;
+    if (end > file->endPos) {
+	end = file->endPos;
+	numBytes = end - start;
+    }
+
     /*
      * Now the complicated part; ensure that all blocks containing the
      * data we need are in the file data cache.
      */
-    startBlock = (start % SECTOR_SIZE) / SECTOR_SIZE;
+    startBlock = start / SECTOR_SIZE;
     endBlock = Round_Up_To_Block(end) / SECTOR_SIZE;
 
     /*
@@ -179,6 +189,7 @@ static int PFAT_Read(struct File *file, void *buf, ulong_t numBytes)
      * so just copy it into the caller's buffer.
      */
     memcpy(buf, pfatFile->fileDataCache + start, numBytes);
+    file->filePos = end;
 
     Debug("Read satisfied!\n");
 
@@ -631,9 +642,10 @@ static int PFAT_Mount(struct Mount_Point *mountPoint)
 
     /* Read the root directory */
     Debug("Root directory size = %d\n", rootDirSize);
-    for (i = 0; i < rootDirSize; i += SECTOR_SIZE) {
+    for (i = 0; i < rootDirSize / SECTOR_SIZE; ++i) {
 	int blockNum = fsinfo->rootDirectoryOffset + i;
-	if ((rc = Block_Read(mountPoint->dev, blockNum, instance->rootDir + (i*SECTOR_SIZE))) < 0)
+	char *p = ((char*)instance->rootDir) + (i * SECTOR_SIZE);
+	if ((rc = Block_Read(mountPoint->dev, blockNum, p)) < 0)
 	    goto fail;
     }
     Debug("Read root directory successfully!\n");
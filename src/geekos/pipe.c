@@ -0,0 +1,224 @@
+/*
+ * Pipes
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/errno.h>
+#include <geekos/int.h>
+#include <geekos/malloc.h>
+#include <geekos/string.h>
+#include <geekos/kthread.h>
+#include <geekos/spinlock.h>
+#include <geekos/vfs.h>
+#include <geekos/pipe.h>
+
+/*
+ * A pipe is a fixed size ring buffer with a File for each end.
+ * Readers wait while it is empty and writers wait while it is full,
+ * so the processes on either end of a pipe run at the same time,
+ * each going only as far ahead of the other as the buffer allows.
+ *
+ * Once every write end is closed, reads return whatever is left
+ * and then 0 (end of file); once every read end is closed, writes
+ * fail with EPIPE.
+ *
+ * All of a pipe's state is protected by its lock.
+ */
+struct Pipe {
+    struct Spin_Lock lock;
+    uchar_t *buf;
+    ulong_t readPos;			/* index of the oldest byte */
+    ulong_t count;			/* number of bytes in buf */
+    int readers;			/* open read ends */
+    int writers;			/* open write ends */
+    struct Thread_Queue readWaitQueue;	/* waiting for data */
+    struct Thread_Queue writeWaitQueue;	/* waiting for space */
+};
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Read from the read end of a pipe, waiting until there is
+ * something to read or no more writers.
+ * Returns the number of bytes read, which is 0 at end of file.
+ */
+static int Pipe_Read(struct File *file, void *buf, ulong_t numBytes)
+{
+    struct Pipe *pipe = (struct Pipe*) file->fsData;
+    ulong_t count, first;
+    bool iflag;
+
+    if (numBytes == 0)
+	return 0;
+
+    iflag = Begin_Spin_Atomic(&pipe->lock);
+
+    while (pipe->count == 0 && pipe->writers > 0)
+	Wait_Spin(&pipe->readWaitQueue, &pipe->lock);
+
+    count = MIN(numBytes, pipe->count);
+    first = MIN(count, PIPE_BUFFER_SIZE - pipe->readPos);
+    memcpy(buf, pipe->buf + pipe->readPos, first);
+    memcpy((uchar_t*) buf + first, pipe->buf, count - first);
+    pipe->readPos = (pipe->readPos + count) % PIPE_BUFFER_SIZE;
+    pipe->count -= count;
+
+    if (count > 0)
+	Wake_Up(&pipe->writeWaitQueue);
+
+    End_Spin_Atomic(&pipe->lock, iflag);
+
+    return count;
+}
+
+/*
+ * Write to the write end of a pipe, waiting for space as needed
+ * until all of the data has been written.
+ * Returns the number of bytes written, or EPIPE if there are
+ * no readers; if the last reader goes away part of the way
+ * through, the number of bytes written up to then.
+ */
+static int Pipe_Write(struct File *file, void *buf, ulong_t numBytes)
+{
+    struct Pipe *pipe = (struct Pipe*) file->fsData;
+    ulong_t done = 0;
+    bool iflag;
+
+    iflag = Begin_Spin_Atomic(&pipe->lock);
+
+    while (done < numBytes) {
+	ulong_t writePos, count, first;
+
+	if (pipe->readers == 0)
+	    break;
+	if (pipe->count == PIPE_BUFFER_SIZE) {
+	    Wait_Spin(&pipe->writeWaitQueue, &pipe->lock);
+	    continue;
+	}
+
+	writePos = (pipe->readPos + pipe->count) % PIPE_BUFFER_SIZE;
+	count = MIN(numBytes - done, PIPE_BUFFER_SIZE - pipe->count);
+	first = MIN(count, PIPE_BUFFER_SIZE - writePos);
+	memcpy(pipe->buf + writePos, (uchar_t*) buf + done, first);
+	memcpy(pipe->buf, (uchar_t*) buf + done + first, count - first);
+	pipe->count += count;
+	done += count;
+
+	Wake_Up(&pipe->readWaitQueue);
+    }
+
+    End_Spin_Atomic(&pipe->lock, iflag);
+
+    return (done == 0 && numBytes > 0) ? EPIPE : (int) done;
+}
+
+/*
+ * Close one end of a pipe, freeing the pipe once
+ * both ends are closed.
+ */
+static int Pipe_Close(struct File *file)
+{
+    struct Pipe *pipe = (struct Pipe*) file->fsData;
+    bool unused;
+    bool iflag;
+
+    iflag = Begin_Spin_Atomic(&pipe->lock);
+
+    if (file->mode & O_READ)
+	--pipe->readers;
+    else
+	--pipe->writers;
+    KASSERT(pipe->readers >= 0 && pipe->writers >= 0);
+
+    /* Waiters on either side may have to give up now. */
+    Wake_Up(&pipe->readWaitQueue);
+    Wake_Up(&pipe->writeWaitQueue);
+    unused = (pipe->readers == 0 && pipe->writers == 0);
+
+    End_Spin_Atomic(&pipe->lock, iflag);
+
+    if (unused) {
+	Free(pipe->buf);
+	Free(pipe);
+    }
+    return 0;
+}
+
+/* ----------------------------------------------------------------------
+ * Private data
+ * ---------------------------------------------------------------------- */
+
+static struct File_Ops s_pipeReadOps = {
+    0,			/* FStat */
+    &Pipe_Read,
+    0,			/* Write */
+    0,			/* Seek */
+    &Pipe_Close,
+    0,			/* Read_Entry */
+};
+
+static struct File_Ops s_pipeWriteOps = {
+    0,			/* FStat */
+    0,			/* Read */
+    &Pipe_Write,
+    0,			/* Seek */
+    &Pipe_Close,
+    0,			/* Read_Entry */
+};
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Create a pipe.
+ * Params:
+ *   pReadFile - where to store the File for the read end
+ *   pWriteFile - where to store the File for the write end
+ * Returns: 0 if successful, ENOMEM if out of memory
+ */
+int Create_Pipe(struct File **pReadFile, struct File **pWriteFile)
+{
+    struct Pipe *pipe;
+    struct File *readFile = 0, *writeFile = 0;
+
+    pipe = (struct Pipe*) Malloc(sizeof(*pipe));
+    if (pipe == 0)
+	return ENOMEM;
+    pipe->buf = (uchar_t*) Malloc(PIPE_BUFFER_SIZE);
+    if (pipe->buf == 0)
+	goto fail;
+
+    Spin_Lock_Init(&pipe->lock);
+    pipe->readPos = 0;
+    pipe->count = 0;
+    pipe->readers = 1;
+    pipe->writers = 1;
+    Clear_Thread_Queue(&pipe->readWaitQueue);
+    Clear_Thread_Queue(&pipe->writeWaitQueue);
+
+    readFile = Allocate_File(&s_pipeReadOps, 0, 0, pipe, O_READ, 0);
+    writeFile = Allocate_File(&s_pipeWriteOps, 0, 0, pipe, O_WRITE, 0);
+    if (readFile == 0 || writeFile == 0)
+	goto fail;
+
+    *pReadFile = readFile;
+    *pWriteFile = writeFile;
+    return 0;
+
+fail:
+    if (readFile != 0)
+	Free(readFile);
+    if (writeFile != 0)
+	Free(writeFile);
+    if (pipe->buf != 0)
+	Free(pipe->buf);
+    Free(pipe);
+    return ENOMEM;
+}
@@ -0,0 +1,295 @@
+/*
+ * Intrusive red-black tree
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+/*
+ * Source: _Introduction to Algorithms_ by Cormen, Leiserson,
+ * Rivest and Stein, chapter 13, using null pointers in place
+ * of the sentinel leaf node.
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/rbtree.h>
+
+enum { RB_RED, RB_BLACK };
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+static __inline__ bool Is_Red(struct Rb_Node *node)
+{
+    return node != 0 && node->color == RB_RED;
+}
+
+static __inline__ bool Is_Black(struct Rb_Node *node)
+{
+    return node == 0 || node->color == RB_BLACK;
+}
+
+/*
+ * Replace the child pointer to old in old's parent
+ * (or the root pointer) with new.
+ */
+static void Replace_Child(struct Rb_Tree *tree, struct Rb_Node *old,
+    struct Rb_Node *new)
+{
+    struct Rb_Node *parent = old->parent;
+
+    if (parent == 0)
+	tree->root = new;
+    else if (parent->left == old)
+	parent->left = new;
+    else
+	parent->right = new;
+    if (new != 0)
+	new->parent = parent;
+}
+
+static void Rotate_Left(struct Rb_Tree *tree, struct Rb_Node *x)
+{
+    struct Rb_Node *y = x->right;
+
+    x->right = y->left;
+    if (y->left != 0)
+	y->left->parent = x;
+    Replace_Child(tree, x, y);
+    y->left = x;
+    x->parent = y;
+}
+
+static void Rotate_Right(struct Rb_Tree *tree, struct Rb_Node *x)
+{
+    struct Rb_Node *y = x->left;
+
+    x->left = y->right;
+    if (y->right != 0)
+	y->right->parent = x;
+    Replace_Child(tree, x, y);
+    y->right = x;
+    x->parent = y;
+}
+
+static struct Rb_Node *Minimum(struct Rb_Node *node)
+{
+    while (node->left != 0)
+	node = node->left;
+    return node;
+}
+
+/*
+ * Restore the red-black properties after inserting node.
+ */
+static void Insert_Fixup(struct Rb_Tree *tree, struct Rb_Node *node)
+{
+    while (Is_Red(node->parent)) {
+	struct Rb_Node *parent = node->parent;
+	struct Rb_Node *grandparent = parent->parent;
+
+	if (parent == grandparent->left) {
+	    struct Rb_Node *uncle = grandparent->right;
+	    if (Is_Red(uncle)) {
+		parent->color = RB_BLACK;
+		uncle->color = RB_BLACK;
+		grandparent->color = RB_RED;
+		node = grandparent;
+	    } else {
+		if (node == parent->right) {
+		    node = parent;
+		    Rotate_Left(tree, node);
+		    parent = node->parent;
+		}
+		parent->color = RB_BLACK;
+		grandparent->color = RB_RED;
+		Rotate_Right(tree, grandparent);
+	    }
+	} else {
+	    struct Rb_Node *uncle = grandparent->left;
+	    if (Is_Red(uncle)) {
+		parent->color = RB_BLACK;
+		uncle->color = RB_BLACK;
+		grandparent->color = RB_RED;
+		node = grandparent;
+	    } else {
+		if (node == parent->left) {
+		    node = parent;
+		    Rotate_Right(tree, node);
+		    parent = node->parent;
+		}
+		parent->color = RB_BLACK;
+		grandparent->color = RB_RED;
+		Rotate_Left(tree, grandparent);
+	    }
+	}
+    }
+    tree->root->color = RB_BLACK;
+}
+
+/*
+ * Restore the red-black properties after removing a black node.
+ * node is the (possibly null) node that took its place,
+ * and parent is node's parent.
+ */
+static void Remove_Fixup(struct Rb_Tree *tree, struct Rb_Node *node,
+    struct Rb_Node *parent)
+{
+    while (node != tree->root && Is_Black(node)) {
+	if (node == parent->left) {
+	    struct Rb_Node *sibling = parent->right;
+	    if (Is_Red(sibling)) {
+		sibling->color = RB_BLACK;
+		parent->color = RB_RED;
+		Rotate_Left(tree, parent);
+		sibling = parent->right;
+	    }
+	    if (Is_Black(sibling->left) && Is_Black(sibling->right)) {
+		sibling->color = RB_RED;
+		node = parent;
+		parent = node->parent;
+	    } else {
+		if (Is_Black(sibling->right)) {
+		    sibling->left->color = RB_BLACK;
+		    sibling->color = RB_RED;
+		    Rotate_Right(tree, sibling);
+		    sibling = parent->right;
+		}
+		sibling->color = parent->color;
+		parent->color = RB_BLACK;
+		sibling->right->color = RB_BLACK;
+		Rotate_Left(tree, parent);
+		node = tree->root;
+	    }
+	} else {
+	    struct Rb_Node *sibling = parent->left;
+	    if (Is_Red(sibling)) {
+		sibling->color = RB_BLACK;
+		parent->color = RB_RED;
+		Rotate_Right(tree, parent);
+		sibling = parent->left;
+	    }
+	    if (Is_Black(sibling->left) && Is_Black(sibling->right)) {
+		sibling->color = RB_RED;
+		node = parent;
+		parent = node->parent;
+	    } else {
+		if (Is_Black(sibling->left)) {
+		    sibling->right->color = RB_BLACK;
+		    sibling->color = RB_RED;
+		    Rotate_Left(tree, sibling);
+		    sibling = parent->left;
+		}
+		sibling->color = parent->color;
+		parent->color = RB_BLACK;
+		sibling->left->color = RB_BLACK;
+		Rotate_Right(tree, parent);
+		node = tree->root;
+	    }
+	}
+    }
+    if (node != 0)
+	node->color = RB_BLACK;
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Insert a node into a tree.
+ * Nodes that compare equal to nodes already in the tree
+ * are placed after them, so equal nodes come out in FIFO order.
+ */
+void Rb_Insert(struct Rb_Tree *tree, struct Rb_Node *node, Rb_Less_Func less)
+{
+    struct Rb_Node *parent = 0, **link = &tree->root;
+    bool leftmost = true;
+
+    while (*link != 0) {
+	parent = *link;
+	if (less(node, parent))
+	    link = &parent->left;
+	else {
+	    link = &parent->right;
+	    leftmost = false;
+	}
+    }
+
+    node->parent = parent;
+    node->left = node->right = 0;
+    node->color = RB_RED;
+    *link = node;
+
+    if (leftmost)
+	tree->leftmost = node;
+
+    Insert_Fixup(tree, node);
+}
+
+/*
+ * Remove a node from the tree it is in.
+ */
+void Rb_Remove(struct Rb_Tree *tree, struct Rb_Node *node)
+{
+    struct Rb_Node *child, *parent;
+    int removedColor;
+
+    KASSERT(tree->root != 0);
+
+    if (tree->leftmost == node)
+	tree->leftmost = Rb_Next(node);
+
+    if (node->left == 0 || node->right == 0) {
+	/* At most one child: splice the node out. */
+	child = node->left != 0 ? node->left : node->right;
+	parent = node->parent;
+	removedColor = node->color;
+	Replace_Child(tree, node, child);
+    } else {
+	/*
+	 * Two children: move the node's successor,
+	 * which has no left child, into its place.
+	 */
+	struct Rb_Node *next = Minimum(node->right);
+
+	removedColor = next->color;
+	child = next->right;
+	if (next->parent == node) {
+	    parent = next;
+	} else {
+	    parent = next->parent;
+	    Replace_Child(tree, next, child);
+	    next->right = node->right;
+	    next->right->parent = next;
+	}
+	Replace_Child(tree, node, next);
+	next->left = node->left;
+	next->left->parent = next;
+	next->color = node->color;
+    }
+
+    if (removedColor == RB_BLACK)
+	Remove_Fixup(tree, child, parent);
+}
+
+/*
+ * Get the node following given node in sort order,
+ * or null if it is the last node.
+ */
+struct Rb_Node *Rb_Next(struct Rb_Node *node)
+{
+    struct Rb_Node *parent;
+
+    if (node->right != 0)
+	return Minimum(node->right);
+
+    parent = node->parent;
+    while (parent != 0 && node == parent->right) {
+	node = parent;
+	parent = parent->parent;
+    }
+    return parent;
+}
@@ -12,6 +12,7 @@
 #include <geekos/ktypes.h>
 #include <geekos/io.h>
 #include <geekos/int.h>
+#include <geekos/spinlock.h>
 #include <geekos/fmtout.h>
 #include <geekos/screen.h>
 
@@ -51,6 +52,7 @@ struct Console_State {
 };
 
 static struct Console_State s_cons;
+static struct Spin_Lock s_consLock;
 
 #define NUM_SCREEN_DWORDS ((NUMROWS * NUMCOLS * 2) / 4)
 #define NUM_SCROLL_DWORDS (((NUMROWS-1) * NUMCOLS * 2) / 4)
@@ -78,6 +80,20 @@ static void Scroll(void)
 	*v++ = fill;
 }
 
+/*
+ * Clear the screen using the current attribute.
+ * The console lock must be held.
+ */
+static void Clear_Screen_Imp(void)
+{
+    uint_t* v = (uint_t*)VIDMEM;
+    int i;
+    uint_t fill = FILL_DWORD;
+
+    for (i = 0; i < NUM_SCREEN_DWORDS; ++i)
+	*v++ = fill;
+}
+
 /*
  * Clear current cursor position to end of line using
  * current attribute.
@@ -333,8 +349,8 @@ again:
 	    if (s_cons.numArgs == 2) Move_Cursor(Get_Arg(0)-1, Get_Arg(1)-1); break;
 	case 'J':
 	    if (s_cons.numArgs == 1 && Get_Arg(0) == 2) {
-		Clear_Screen();
-		Put_Cursor(0, 0);
+		Clear_Screen_Imp();
+		Move_Cursor(0, 0);
 	    }
 	    break;
 	default: break;
@@ -392,13 +408,13 @@ static void Update_Cursor(void)
  */
 void Init_Screen(void)
 {
-    bool iflag = Begin_Int_Atomic();
+    bool iflag = Begin_Spin_Atomic(&s_consLock);
 
     s_cons.row = s_cons.col = 0;
     s_cons.currentAttr = DEFAULT_ATTRIBUTE;
-    Clear_Screen();
+    Clear_Screen_Imp();
 
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_consLock, iflag);
 }
 
 /*
@@ -406,16 +422,9 @@ void Init_Screen(void)
  */
 void Clear_Screen(void)
 {
-    uint_t* v = (uint_t*)VIDMEM;
-    int i;
-    uint_t fill = FILL_DWORD;
-
-    bool iflag = Begin_Int_Atomic();
-
-    for (i = 0; i < NUM_SCREEN_DWORDS; ++i)
-	*v++ = fill;
-
-    End_Int_Atomic(iflag);
+    bool iflag = Begin_Spin_Atomic(&s_consLock);
+    Clear_Screen_Imp();
+    End_Spin_Atomic(&s_consLock, iflag);
 }
 
 /*
@@ -423,10 +432,10 @@ void Clear_Screen(void)
  */
 void Get_Cursor(int* row, int* col)
 {
-    bool iflag = Begin_Int_Atomic();
+    bool iflag = Begin_Spin_Atomic(&s_consLock);
     *row = s_cons.row;
     *col = s_cons.col;
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_consLock, iflag);
 }
 
 /*
@@ -441,11 +450,11 @@ bool Put_Cursor(int row, int col)
     if (row < 0 || row >= NUMROWS || col < 0 || col >= NUMCOLS)
 	return false;
 
-    iflag = Begin_Int_Atomic();
+    iflag = Begin_Spin_Atomic(&s_consLock);
     s_cons.row = row;
     s_cons.col = col;
     Update_Cursor();
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_consLock, iflag);
 
     return true;
 }
@@ -463,9 +472,9 @@ uchar_t Get_Current_Attr(void)
  */
 void Set_Current_Attr(uchar_t attrib)
 {
-    bool iflag = Begin_Int_Atomic();
+    bool iflag = Begin_Spin_Atomic(&s_consLock);
     s_cons.currentAttr = attrib;
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_consLock, iflag);
 }
 
 /*
@@ -474,10 +483,10 @@ void Set_Current_Attr(uchar_t attrib)
  */
 void Put_Char(int c)
 {
-    bool iflag = Begin_Int_Atomic();
+    bool iflag = Begin_Spin_Atomic(&s_consLock);
     Put_Char_Imp(c);
     Update_Cursor();
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_consLock, iflag);
 }
 
 /*
@@ -486,11 +495,11 @@ void Put_Char(int c)
  */
 void Put_String(const char* s)
 {
-    bool iflag = Begin_Int_Atomic();
+    bool iflag = Begin_Spin_Atomic(&s_consLock);
     while (*s != '\0')
 	Put_Char_Imp(*s++);
     Update_Cursor();
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_consLock, iflag);
 }
 
 /*
@@ -499,13 +508,13 @@ void Put_String(const char* s)
  */
 void Put_Buf(const char* buf, ulong_t length)
 {
-    bool iflag = Begin_Int_Atomic();
+    bool iflag = Begin_Spin_Atomic(&s_consLock);
     while (length > 0) {
 	Put_Char_Imp(*buf++);
 	--length;
     }
     Update_Cursor();
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_consLock, iflag);
 }
 
 /* Support for Print(). */
@@ -521,12 +530,12 @@ void Print(const char *fmt, ...)
 {
     va_list args;
 
-    bool iflag = Begin_Int_Atomic();
+    bool iflag = Begin_Spin_Atomic(&s_consLock);
 
     va_start(args, fmt);
     Format_Output(&s_outputSink, fmt, args);
     va_end(args);
 
-    End_Int_Atomic(iflag);
+    End_Spin_Atomic(&s_consLock, iflag);
 }
 
@@ -0,0 +1,296 @@
+/*
+ * Semaphores
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/errno.h>
+#include <geekos/int.h>
+#include <geekos/malloc.h>
+#include <geekos/string.h>
+#include <geekos/kthread.h>
+#include <geekos/spinlock.h>
+#include <geekos/user.h>
+#include <geekos/sem.h>
+
+/*
+ * Semaphores are named, and live in a hash table keyed by name
+ * for as long as some process has a handle to them.
+ * A process refers to a semaphore by a handle, which is an
+ * index into the handle table in its User_Context.
+ *
+ * V() never wakes more than one thread: if anyone is waiting,
+ * the unit is handed directly to the thread that has waited
+ * longest instead of being added to the value, so a woken
+ * thread never has to recheck the value or wait again.
+ *
+ * All semaphore state, including the handle tables, is protected
+ * by s_semLock.
+ */
+struct Semaphore {
+    struct Semaphore* hashNext;
+    ulong_t hash;
+    int value;
+    int refCount;			/* number of handles to it */
+    struct Thread_Queue waitQueue;	/* FIFO */
+    char name[MAX_SEMAPHORE_NAME_LEN + 1];
+};
+
+/* Number of hash buckets; a power of two. */
+#define SEM_HASH_BUCKETS 64
+
+/* Initial number of handles in a process's handle table. */
+#define SEM_INITIAL_HANDLES 8
+
+/* ----------------------------------------------------------------------
+ * Private data
+ * ---------------------------------------------------------------------- */
+
+static struct Semaphore* s_semHash[SEM_HASH_BUCKETS];
+static struct Spin_Lock s_semLock;
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * FNV-1a hash of a semaphore name.
+ */
+static ulong_t Hash_Name(const char* name)
+{
+    ulong_t hash = 2166136261UL;
+
+    while (*name != '\0') {
+	hash ^= (uchar_t) *name++;
+	hash *= 16777619UL;
+    }
+    return hash;
+}
+
+static struct Semaphore* Lookup_Semaphore(const char* name, ulong_t hash)
+{
+    struct Semaphore* sem = s_semHash[hash & (SEM_HASH_BUCKETS - 1)];
+
+    while (sem != 0 && (sem->hash != hash || strcmp(sem->name, name) != 0))
+	sem = sem->hashNext;
+    return sem;
+}
+
+/*
+ * Get the semaphore given handle refers to in given process,
+ * or null if the handle is not valid.
+ */
+static __inline__ struct Semaphore* Get_Semaphore(struct User_Context* context, int handle)
+{
+    if (handle < 0 || handle >= context->maxSemaphores)
+	return 0;
+    return context->semaphores[handle];
+}
+
+/*
+ * Find a free slot in a process's handle table, growing it if needed.
+ * Returns the handle, or ENOMEM if the table couldn't be grown.
+ */
+static int Alloc_Handle(struct User_Context* context)
+{
+    struct Semaphore** table;
+    int handle, newMax;
+
+    for (handle = 0; handle < context->maxSemaphores; ++handle) {
+	if (context->semaphores[handle] == 0)
+	    return handle;
+    }
+
+    newMax = context->maxSemaphores == 0 ? SEM_INITIAL_HANDLES : context->maxSemaphores * 2;
+    table = (struct Semaphore**) Malloc(newMax * sizeof(struct Semaphore*));
+    if (table == 0)
+	return ENOMEM;
+    memset(table, '\0', newMax * sizeof(struct Semaphore*));
+    if (context->semaphores != 0) {
+	memcpy(table, context->semaphores, context->maxSemaphores * sizeof(struct Semaphore*));
+	Free(context->semaphores);
+    }
+    context->semaphores = table;
+    context->maxSemaphores = newMax;
+    return handle;
+}
+
+/*
+ * Drop a handle's reference to a semaphore, destroying the
+ * semaphore when the last handle to it goes away.
+ */
+static void Release_Semaphore(struct Semaphore* sem)
+{
+    struct Semaphore** link;
+
+    KASSERT(sem->refCount > 0);
+    if (--sem->refCount > 0)
+	return;
+
+    /* Nobody has a handle, so nobody can be waiting. */
+    KASSERT(Is_Thread_Queue_Empty(&sem->waitQueue));
+
+    link = &s_semHash[sem->hash & (SEM_HASH_BUCKETS - 1)];
+    while (*link != sem)
+	link = &(*link)->hashNext;
+    *link = sem->hashNext;
+    Free(sem);
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+void Init_Semaphores(void)
+{
+    memset(s_semHash, '\0', sizeof(s_semHash));
+    Spin_Lock_Init(&s_semLock);
+}
+
+/*
+ * Get a handle to the semaphore with given name, creating it
+ * with given initial value if it doesn't exist.  A process
+ * opening the same semaphore again gets back its existing handle.
+ * Returns the handle, or an error code (< 0) if unsuccessful.
+ */
+int Sem_Create(struct User_Context* context, const char* name, int initialValue)
+{
+    struct Semaphore* sem;
+    ulong_t hash;
+    int handle;
+    bool iflag;
+
+    if (initialValue < 0 || strlen(name) > MAX_SEMAPHORE_NAME_LEN)
+	return EINVALID;
+
+    hash = Hash_Name(name);
+    iflag = Begin_Spin_Atomic(&s_semLock);
+
+    sem = Lookup_Semaphore(name, hash);
+    if (sem != 0) {
+	for (handle = 0; handle < context->maxSemaphores; ++handle) {
+	    if (context->semaphores[handle] == sem)
+		goto done;
+	}
+    }
+
+    handle = Alloc_Handle(context);
+    if (handle < 0)
+	goto done;
+
+    if (sem == 0) {
+	sem = (struct Semaphore*) Malloc(sizeof(*sem));
+	if (sem == 0) {
+	    handle = ENOMEM;
+	    goto done;
+	}
+	strcpy(sem->name, name);
+	sem->hash = hash;
+	sem->value = initialValue;
+	sem->refCount = 0;
+	Clear_Thread_Queue(&sem->waitQueue);
+	sem->hashNext = s_semHash[hash & (SEM_HASH_BUCKETS - 1)];
+	s_semHash[hash & (SEM_HASH_BUCKETS - 1)] = sem;
+    }
+
+    ++sem->refCount;
+    context->semaphores[handle] = sem;
+
+done:
+    End_Spin_Atomic(&s_semLock, iflag);
+    return handle;
+}
+
+/*
+ * Acquire a semaphore, waiting until its value is positive.
+ * Returns 0 if successful, or EINVALID if the handle is not valid.
+ */
+int Sem_P(struct User_Context* context, int handle)
+{
+    struct Semaphore* sem;
+    int rc = 0;
+    bool iflag;
+
+    iflag = Begin_Spin_Atomic(&s_semLock);
+    sem = Get_Semaphore(context, handle);
+    if (sem == 0)
+	rc = EINVALID;
+    else if (sem->value > 0)
+	--sem->value;
+    else
+	Wait_Spin(&sem->waitQueue, &s_semLock);	/* Sem_V() hands us its unit */
+    End_Spin_Atomic(&s_semLock, iflag);
+
+    return rc;
+}
+
+/*
+ * Release a semaphore, waking the thread that has waited longest
+ * on it if there is one.
+ * Returns 0 if successful, or EINVALID if the handle is not valid.
+ */
+int Sem_V(struct User_Context* context, int handle)
+{
+    struct Semaphore* sem;
+    int rc = 0;
+    bool iflag;
+
+    iflag = Begin_Spin_Atomic(&s_semLock);
+    sem = Get_Semaphore(context, handle);
+    if (sem == 0)
+	rc = EINVALID;
+    else if (Is_Thread_Queue_Empty(&sem->waitQueue))
+	++sem->value;
+    else
+	Wake_Up_First(&sem->waitQueue);
+    End_Spin_Atomic(&s_semLock, iflag);
+
+    return rc;
+}
+
+/*
+ * Close a process's handle to a semaphore.
+ * Returns 0 if successful, or EINVALID if the handle is not valid.
+ */
+int Sem_Destroy(struct User_Context* context, int handle)
+{
+    struct Semaphore* sem;
+    int rc = 0;
+    bool iflag;
+
+    iflag = Begin_Spin_Atomic(&s_semLock);
+    sem = Get_Semaphore(context, handle);
+    if (sem == 0) {
+	rc = EINVALID;
+    } else {
+	context->semaphores[handle] = 0;
+	Release_Semaphore(sem);
+    }
+    End_Spin_Atomic(&s_semLock, iflag);
+
+    return rc;
+}
+
+/*
+ * Close all of a process's semaphore handles, and free its
+ * handle table.  Called when the process is destroyed.
+ */
+void Sem_Release_All(struct User_Context* context)
+{
+    int handle;
+    bool iflag;
+
+    iflag = Begin_Spin_Atomic(&s_semLock);
+    for (handle = 0; handle < context->maxSemaphores; ++handle) {
+	if (context->semaphores[handle] != 0)
+	    Release_Semaphore(context->semaphores[handle]);
+    }
+    if (context->semaphores != 0)
+	Free(context->semaphores);
+    context->semaphores = 0;
+    context->maxSemaphores = 0;
+    End_Spin_Atomic(&s_semLock, iflag);
+}
@@ -15,6 +15,13 @@
 
 %include "defs.asm"
 
+; Timer interrupt rate to pass to the kernel, in Hz, or 0 to let
+; the kernel use its default.  Set with "make TICK_HZ=...", which
+; only rebuilds the boot image, not the kernel.
+%ifndef TICK_HZ
+%define TICK_HZ 0
+%endif
+
 [BITS 16]
 [ORG 0x0]
 
@@ -75,10 +82,11 @@ setup_32:
 	; Build Boot_Info struct on stack.
 	; Note that we push the fields on in reverse order,
 	; since the stack grows downwards.
+	push	dword TICK_HZ	; tickHz
 	xor	eax, eax
 	mov	ax, [(SETUPSEG<<4)+mem_size_kbytes]
 	push	eax		; memSizeKB
-	push	dword 8		; bootInfoSize
+	push	dword 12	; bootInfoSize
 
 	; Pass pointer to Boot_Info struct as argument to kernel
 	; entry point.
@@ -0,0 +1,269 @@
+/*
+ * Shared memory segments
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/errno.h>
+#include <geekos/int.h>
+#include <geekos/mem.h>
+#include <geekos/malloc.h>
+#include <geekos/string.h>
+#include <geekos/synch.h>
+#include <geekos/segment.h>
+#include <geekos/user.h>
+#include <geekos/shm.h>
+
+/*
+ * A shared memory segment is a named block of kernel memory which
+ * exists for as long as some process has it attached.  A process
+ * attaches it by getting an LDT data descriptor for it, after the
+ * descriptors for its own code and data; the selector for that
+ * descriptor is how the process refers to the segment, and what it
+ * loads into a segment register to get at the memory directly.
+ * So data put in a segment by one process is seen at once by the
+ * others, without going through the kernel at all.
+ *
+ * The list of segments is protected by s_shmLock.  A process's
+ * own attachments are only changed by the process itself, or
+ * when it is destroyed.
+ */
+struct Shm_Segment {
+    struct Shm_Segment* next;
+    char* memory;			/* 2^order pages from Alloc_Pages() */
+    int order;
+    ulong_t numPages;			/* pages the descriptor covers */
+    int refCount;			/* number of processes attached */
+    char name[MAX_SHM_NAME_LEN + 1];
+};
+
+/* LDT entry of the first shared memory descriptor. */
+#define FIRST_SHM_LDT_ENTRY (NUM_USER_LDT_ENTRIES - USER_MAX_SHM)
+
+/* ----------------------------------------------------------------------
+ * Private data
+ * ---------------------------------------------------------------------- */
+
+static struct Shm_Segment* s_shmList;
+static struct Mutex s_shmLock = MUTEX_INITIALIZER;
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+static struct Shm_Segment* Lookup_Segment(const char* name)
+{
+    struct Shm_Segment* shm = s_shmList;
+
+    while (shm != 0 && strcmp(shm->name, name) != 0)
+	shm = shm->next;
+    return shm;
+}
+
+/*
+ * Get the smallest order of a block of pages holding given number of pages.
+ */
+static int Pages_To_Order(ulong_t numPages)
+{
+    int order = 0;
+
+    while ((1UL << order) < numPages)
+	++order;
+    return order;
+}
+
+static __inline__ ushort_t Shm_Selector(int slot)
+{
+    return Selector(USER_PRIVILEGE, false, FIRST_SHM_LDT_ENTRY + slot);
+}
+
+/*
+ * Remove a process's attachment in given slot, destroying the
+ * segment if it was the last one.
+ * s_shmLock must be held.
+ */
+static void Detach_Slot(struct User_Context* context, int slot)
+{
+    struct Shm_Segment* shm = context->shm[slot];
+    struct Shm_Segment** link;
+
+    context->shm[slot] = 0;
+    Init_Null_Segment_Descriptor(&context->ldt[FIRST_SHM_LDT_ENTRY + slot]);
+
+    KASSERT(shm->refCount > 0);
+    if (--shm->refCount > 0)
+	return;
+
+    link = &s_shmList;
+    while (*link != shm)
+	link = &(*link)->next;
+    *link = shm->next;
+    Free_Pages(shm->memory, shm->order);
+    Free(shm);
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Attach the shared memory segment with given name to a process,
+ * creating it with given size (rounded up to a whole number of
+ * pages, and filled with zeroes) if it doesn't exist.  A size of 0
+ * only attaches an existing segment.  Attaching a segment which is
+ * already attached returns the same selector again.
+ * Interrupts must be enabled.
+ * Returns: the selector for the segment, or an error code (< 0):
+ *   ENOTFOUND if size is 0 and there is no such segment, EINVALID
+ *   if the name or size is invalid, or the segment exists and is
+ *   smaller than size, EMFILE if the process has no free slot,
+ *   or ENOMEM
+ */
+int Shm_Attach(struct User_Context* context, const char* name, ulong_t size)
+{
+    struct Shm_Segment* shm;
+    int slot, freeSlot = -1;
+    int rc;
+
+    if (strlen(name) > MAX_SHM_NAME_LEN || size > MAX_SHM_SIZE)
+	return EINVALID;
+
+    Mutex_Lock(&s_shmLock);
+
+    shm = Lookup_Segment(name);
+    for (slot = 0; slot < USER_MAX_SHM; ++slot) {
+	if (shm != 0 && context->shm[slot] == shm) {
+	    rc = Shm_Selector(slot);
+	    goto done;
+	}
+	if (context->shm[slot] == 0 && freeSlot < 0)
+	    freeSlot = slot;
+    }
+
+    if (shm != 0 && size > shm->numPages * PAGE_SIZE) {
+	rc = EINVALID;
+	goto done;
+    }
+    if (shm == 0 && size == 0) {
+	rc = ENOTFOUND;
+	goto done;
+    }
+    if (freeSlot < 0) {
+	rc = EMFILE;
+	goto done;
+    }
+
+    if (shm == 0) {
+	shm = (struct Shm_Segment*) Malloc(sizeof(*shm));
+	if (shm == 0) {
+	    rc = ENOMEM;
+	    goto done;
+	}
+	/*
+	 * Segments come straight from the page allocator, since the
+	 * kernel heap is too small for big ones, and is needed for
+	 * process images.
+	 */
+	shm->numPages = Round_Up_To_Page(size) / PAGE_SIZE;
+	shm->order = Pages_To_Order(shm->numPages);
+	shm->memory = Alloc_Pages(shm->order);
+	if (shm->memory == 0) {
+	    Free(shm);
+	    rc = ENOMEM;
+	    goto done;
+	}
+	memset(shm->memory, '\0', shm->numPages * PAGE_SIZE);
+	strcpy(shm->name, name);
+	shm->refCount = 0;
+	shm->next = s_shmList;
+	s_shmList = shm;
+    }
+
+    ++shm->refCount;
+    context->shm[freeSlot] = shm;
+    Init_Data_Segment_Descriptor(&context->ldt[FIRST_SHM_LDT_ENTRY + freeSlot],
+	(ulong_t) shm->memory, shm->numPages, USER_PRIVILEGE);
+    rc = Shm_Selector(freeSlot);
+
+done:
+    Mutex_Unlock(&s_shmLock);
+    return rc;
+}
+
+/*
+ * Detach the shared memory segment with given selector from
+ * a process.  Any of the process's data segment registers,
+ * saved in state, which hold the selector are reset, so that
+ * returning to user mode doesn't load a descriptor which is
+ * no longer valid.
+ * Interrupts must be enabled.
+ * Returns: 0 if successful, or EINVALID if the selector
+ *   is not that of an attached segment
+ */
+int Shm_Detach(struct User_Context* context, int selector, struct Interrupt_State* state)
+{
+    int slot;
+
+    for (slot = 0; slot < USER_MAX_SHM; ++slot) {
+	if (context->shm[slot] != 0 && Shm_Selector(slot) == selector)
+	    break;
+    }
+    if (slot == USER_MAX_SHM)
+	return EINVALID;
+
+    if ((state->ds & ~0x3) == (selector & ~0x3))
+	state->ds = context->dsSelector;
+    if ((state->es & ~0x3) == (selector & ~0x3))
+	state->es = context->dsSelector;
+    if ((state->fs & ~0x3) == (selector & ~0x3))
+	state->fs = 0;
+    if ((state->gs & ~0x3) == (selector & ~0x3))
+	state->gs = 0;
+
+    Mutex_Lock(&s_shmLock);
+    Detach_Slot(context, slot);
+    Mutex_Unlock(&s_shmLock);
+
+    return 0;
+}
+
+/*
+ * Detach all of a process's shared memory segments.
+ * Called when the process is destroyed.
+ */
+void Shm_Detach_All(struct User_Context* context)
+{
+    int slot;
+
+    Mutex_Lock(&s_shmLock);
+    for (slot = 0; slot < USER_MAX_SHM; ++slot) {
+	if (context->shm[slot] != 0)
+	    Detach_Slot(context, slot);
+    }
+    Mutex_Unlock(&s_shmLock);
+}
+
+/*
+ * Get the memory of the shared memory segment with given selector
+ * attached to a process.  The segment can't go away while it is
+ * attached, and only the process itself detaches it.
+ * Returns: the kernel address of the segment, with its size in
+ *   bytes stored in size, or null if the selector is not that of
+ *   an attached segment
+ */
+char* Shm_Get_Memory(struct User_Context* context, int selector, ulong_t* size)
+{
+    int slot;
+
+    for (slot = 0; slot < USER_MAX_SHM; ++slot) {
+	struct Shm_Segment* shm = context->shm[slot];
+	if (shm != 0 && (Shm_Selector(slot) & ~0x3) == (selector & ~0x3)) {
+	    *size = shm->numPages * PAGE_SIZE;
+	    return shm->memory;
+	}
+    }
+    return 0;
+}
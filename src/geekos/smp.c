@@ -0,0 +1,400 @@
+/*
+ * Multiprocessor support
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+/*
+ * Source: Intel MultiProcessor Specification, version 1.4,
+ * chapter 4 (MP configuration table).
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/defs.h>
+#include <geekos/screen.h>
+#include <geekos/string.h>
+#include <geekos/int.h>
+#include <geekos/idt.h>
+#include <geekos/tss.h>
+#include <geekos/timer.h>
+#include <geekos/kthread.h>
+#include <geekos/apic.h>
+#include <geekos/smp.h>
+
+/*
+ * The MP floating pointer structure, which the BIOS leaves
+ * on a 16 byte boundary in one of the areas searched below.
+ */
+struct MP_Float_Pointer {
+    char signature[4];		/* "_MP_" */
+    ulong_t configTable;	/* physical address of MP config table */
+    uchar_t length;		/* in 16 byte units */
+    uchar_t specRev;
+    uchar_t checksum;
+    uchar_t feature[5];		/* feature[0] != 0 means a default config */
+} __attribute__ ((packed));
+
+/*
+ * Header of the MP configuration table.
+ */
+struct MP_Config_Header {
+    char signature[4];		/* "PCMP" */
+    ushort_t length;
+    uchar_t specRev;
+    uchar_t checksum;
+    char oemId[8];
+    char productId[12];
+    ulong_t oemTable;
+    ushort_t oemTableSize;
+    ushort_t entryCount;
+    ulong_t localApicAddr;
+    ushort_t extTableLength;
+    uchar_t extTableChecksum;
+    uchar_t reserved;
+} __attribute__ ((packed));
+
+/*
+ * Processor entry in the MP configuration table.
+ * All other entry types are 8 bytes long.
+ */
+struct MP_Processor_Entry {
+    uchar_t type;		/* MP_ENTRY_PROCESSOR */
+    uchar_t localApicId;
+    uchar_t localApicVersion;
+    uchar_t flags;
+    ulong_t signature;
+    ulong_t featureFlags;
+    ulong_t reserved[2];
+} __attribute__ ((packed));
+
+#define MP_ENTRY_PROCESSOR    0
+#define MP_PROCESSOR_ENABLED  0x01
+
+/* ----------------------------------------------------------------------
+ * Private data
+ * ---------------------------------------------------------------------- */
+
+int g_numCPUsOnline = 1;
+uchar_t g_apicIdToCPU[256];
+volatile int g_kernelLock;
+
+/*
+ * Local APIC ids of the CPUs found, indexed by CPU number.
+ * The boot CPU is always CPU 0.
+ */
+static int s_numCPUsFound = 1;
+static uchar_t s_apicIds[MAX_CPUS];
+
+/*
+ * Startup code for the application processors, in lowlevel.asm.
+ * It is copied to AP_STARTUP_ADDR, and the kernel GDT's limit and
+ * base are filled in at g_apTrampolineGDTR.  Each AP starts on the
+ * stack at g_apStartStack.
+ */
+extern char g_apTrampoline, g_apTrampolineGDTR, g_apTrampolineEnd;
+ulong_t g_apStartStack;
+
+/*
+ * Set by an application processor once it is running kernel code.
+ */
+static volatile bool s_apStarted;
+
+/*
+ * Time an application processor has to start, in microseconds.
+ */
+#define AP_START_TIMEOUT_US 100000
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+static bool Checksum_OK(const void *addr, ulong_t len)
+{
+    const uchar_t *p = addr;
+    uchar_t sum = 0;
+
+    while (len-- > 0)
+	sum += *p++;
+    return sum == 0;
+}
+
+/*
+ * Search given physical memory range for the MP floating pointer.
+ */
+static struct MP_Float_Pointer *Search_MP_Float_Pointer(ulong_t start, ulong_t len)
+{
+    ulong_t addr;
+
+    for (addr = start; addr + sizeof(struct MP_Float_Pointer) <= start + len; addr += 16) {
+	struct MP_Float_Pointer *mpfp = (struct MP_Float_Pointer *) addr;
+	if (memcmp(mpfp->signature, "_MP_", 4) == 0 &&
+	    Checksum_OK(mpfp, mpfp->length * 16))
+	    return mpfp;
+    }
+    return 0;
+}
+
+/*
+ * Find the MP floating pointer, looking in the first KB of the
+ * extended BIOS data area, the last KB of base memory,
+ * and the BIOS ROM, in that order.
+ */
+static struct MP_Float_Pointer *Find_MP_Float_Pointer(void)
+{
+    struct MP_Float_Pointer *mpfp = 0;
+    ulong_t ebda = ((ulong_t) *(ushort_t *) 0x40E) << 4;
+    ulong_t baseMemKB = *(ushort_t *) 0x413;
+
+    if (ebda != 0)
+	mpfp = Search_MP_Float_Pointer(ebda, 1024);
+    if (mpfp == 0)
+	mpfp = Search_MP_Float_Pointer((baseMemKB - 1) * 1024, 1024);
+    if (mpfp == 0)
+	mpfp = Search_MP_Float_Pointer(0xF0000, 0x10000);
+    return mpfp;
+}
+
+/*
+ * Record the processors listed in the MP configuration table.
+ */
+static void Scan_MP_Config(struct MP_Config_Header *config)
+{
+    uchar_t *entry = (uchar_t *) (config + 1);
+    int bspApicId = Get_Local_APIC_ID();
+    int i;
+
+    for (i = 0; i < config->entryCount; ++i) {
+	if (*entry == MP_ENTRY_PROCESSOR) {
+	    struct MP_Processor_Entry *proc = (struct MP_Processor_Entry *) entry;
+	    if ((proc->flags & MP_PROCESSOR_ENABLED) && proc->localApicId != bspApicId) {
+		if (s_numCPUsFound < MAX_CPUS)
+		    s_apicIds[s_numCPUsFound] = proc->localApicId;
+		++s_numCPUsFound;
+	    }
+	    entry += sizeof(struct MP_Processor_Entry);
+	} else {
+	    entry += 8;
+	}
+    }
+}
+
+/*
+ * Atomically set *addr to newValue if it equals expected.
+ * Returns the old value of *addr.
+ */
+static __inline__ int Compare_And_Swap(volatile int *addr, int expected, int newValue)
+{
+    int old;
+
+    __asm__ __volatile__ ("lock; cmpxchgl %2, %1"
+	: "=a" (old), "+m" (*addr) : "r" (newValue), "0" (expected) : "memory");
+    return old;
+}
+
+/*
+ * The reschedule IPI wakes up a CPU which is halted in its idle
+ * thread, because another CPU made a thread runnable.
+ */
+static void Reschedule_Interrupt_Handler(struct Interrupt_State* state)
+{
+    g_needReschedule[Get_CPU_ID()] = true;
+    Local_APIC_EOI();
+}
+
+/*
+ * Bring up given application processor, which will become
+ * the given CPU number, and wait for it to start.
+ * Returns true if it started.
+ * Interrupts must be disabled, and the kernel lock held.
+ */
+static bool Start_AP(int cpu)
+{
+    struct Kernel_Thread* idle;
+    int apicId = s_apicIds[cpu];
+    int us;
+
+    KASSERT(cpu == g_numCPUsOnline);
+
+    /* The AP starts out on the stack of its idle thread. */
+    idle = Create_Idle_Thread(cpu);
+    if (idle == 0)
+	return false;
+    g_apStartStack = (ulong_t) idle->stackPage + PAGE_SIZE;
+    g_apicIdToCPU[apicId] = cpu;
+    s_apStarted = false;
+    ++g_numCPUsOnline;
+
+    /*
+     * INIT, then two startup IPIs, as in the MP specification,
+     * appendix B.4.  The second is ignored if the first worked.
+     */
+    Send_Init_IPI(apicId);
+    Micro_Delay(10000);
+    Send_Startup_IPI(apicId, AP_STARTUP_ADDR);
+    Micro_Delay(200);
+    if (!s_apStarted)
+	Send_Startup_IPI(apicId, AP_STARTUP_ADDR);
+
+    /* The AP waits for the kernel lock, which we hold. */
+    for (us = 0; !s_apStarted && us < AP_START_TIMEOUT_US; us += 100)
+	Micro_Delay(100);
+    if (!s_apStarted) {
+	--g_numCPUsOnline;
+	Print("SMP: CPU with APIC id %d did not start\n", apicId);
+	return false;
+    }
+    return true;
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Find the CPUs in the system.
+ * Only the boot CPU is online until Start_Application_Processors()
+ * is called.
+ */
+void Init_SMP(void)
+{
+    struct MP_Float_Pointer *mpfp;
+
+    if (Local_APIC_Present()) {
+	s_apicIds[0] = Get_Local_APIC_ID();
+
+	mpfp = Find_MP_Float_Pointer();
+	if (mpfp != 0 && mpfp->feature[0] == 0 && mpfp->configTable != 0) {
+	    struct MP_Config_Header *config = (struct MP_Config_Header *) mpfp->configTable;
+	    if (memcmp(config->signature, "PCMP", 4) == 0 &&
+		Checksum_OK(config, config->length))
+		Scan_MP_Config(config);
+	} else if (mpfp != 0) {
+	    /* A default configuration always has two CPUs. */
+	    s_numCPUsFound = 2;
+	}
+    }
+
+    Print("SMP: %d CPU(s) found\n", s_numCPUsFound);
+}
+
+/*
+ * Bring the other CPUs online.  Each one runs the scheduler from
+ * then on, with its own idle thread.
+ */
+void Start_Application_Processors(void)
+{
+    int numCPUs = MIN(s_numCPUsFound, MAX_CPUS);
+    ulong_t* gdtr;
+    int cpu;
+
+    if (numCPUs == 1)
+	return;
+
+    Install_Interrupt_Handler(APIC_RESCHEDULE_VECTOR, &Reschedule_Interrupt_Handler);
+
+    /*
+     * Copy the startup code below 1MB, where real mode code can
+     * run, and give it the kernel GDT.
+     */
+    memcpy((void*) AP_STARTUP_ADDR, &g_apTrampoline,
+	&g_apTrampolineEnd - &g_apTrampoline);
+    gdtr = (ulong_t*) (AP_STARTUP_ADDR + (&g_apTrampolineGDTR - &g_apTrampoline));
+    __asm__ __volatile__ ("sgdt %0" : "=m" (*gdtr));
+
+    /*
+     * From now on, kernel code runs under the kernel lock.
+     * This CPU takes it before the count of CPUs online changes,
+     * since the interrupt code only takes it when there is
+     * more than one.
+     */
+    Disable_Interrupts();
+    Lock_Kernel();
+    for (cpu = 1; cpu < numCPUs; ++cpu) {
+	/* CPU numbers are dense, so a failed AP's number is reused. */
+	s_apicIds[g_numCPUsOnline] = s_apicIds[cpu];
+	Start_AP(g_numCPUsOnline);
+    }
+    Enable_Interrupts();
+
+    Print("SMP: %d CPU(s) online\n", g_numCPUsOnline);
+}
+
+/*
+ * C entry point of an application processor, called from
+ * lowlevel.asm with interrupts disabled, on the stack of the
+ * CPU's idle thread.  It never returns.
+ */
+void AP_Main(void)
+{
+    Init_AP_IDT();
+    Init_AP_Local_APIC();
+
+    /* Let the boot CPU go on, and wait until it lets go of the kernel. */
+    s_apStarted = true;
+    Lock_Kernel();
+
+    Init_TSS();
+    Init_AP_Timer();
+
+    Run_Idle_Thread();
+}
+
+/*
+ * Get the number of CPUs the system has.
+ */
+int Get_Num_CPUs_Found(void)
+{
+    return s_numCPUsFound;
+}
+
+/*
+ * Get the number of the CPU we are running on.
+ * Keep up to date with the Get_CPU macro in lowlevel.asm.
+ */
+int Get_CPU_ID(void)
+{
+    if (g_numCPUsOnline == 1)
+	return 0;
+    return g_apicIdToCPU[Get_Local_APIC_ID()];
+}
+
+/*
+ * Take the kernel lock, unless this CPU already holds it.
+ * Interrupts must be disabled.
+ */
+void Lock_Kernel(void)
+{
+    int self = Get_CPU_ID() + 1;
+
+    KASSERT(!Interrupts_Enabled());
+
+    if (g_kernelLock == self)
+	return;
+    while (Compare_And_Swap(&g_kernelLock, 0, self) != 0) {
+	while (g_kernelLock != 0)
+	    __asm__ __volatile__ ("pause");
+    }
+}
+
+/*
+ * Release the kernel lock, which this CPU holds.
+ * Interrupts must be disabled.
+ */
+void Unlock_Kernel(void)
+{
+    KASSERT(!Interrupts_Enabled());
+    __asm__ __volatile__ ("" : : : "memory");
+    g_kernelLock = 0;
+}
+
+/*
+ * Send an interrupt on given vector to given CPU.
+ * Interrupts must be disabled.
+ */
+void Send_IPI(int cpu, int vector)
+{
+    KASSERT(cpu < g_numCPUsOnline);
+    Send_APIC_IPI(s_apicIds[cpu], vector);
+}
@@ -12,6 +12,7 @@
 #include <geekos/kassert.h>
 #include <geekos/screen.h>
 #include <geekos/synch.h>
+#include <geekos/timer.h>
 
 /*
  * NOTES:
@@ -21,16 +22,89 @@
  *   concurrent execution of interrupt handlers.  Mutexes and
  *   condition variables should only be used from kernel threads,
  *   with interrupts enabled.
+ * - Mutexes use transitive priority inheritance: a thread waiting
+ *   for a mutex raises the priority of the owner to its own, and of
+ *   the owner of any mutex the owner is itself waiting for, and so on.
+ *   An owner drops back to the highest priority still waiting for
+ *   a mutex it holds when it unlocks.  Bounding the time a high
+ *   priority thread waits behind a low priority one matters for
+ *   the long-held VFS and filesystem instance locks.
+ * - Reader-writer locks do not do priority inheritance, since they
+ *   can have many owners.  They are meant for read-mostly data which
+ *   is held briefly, such as the VFS and block device registries.
+ *   Data shared with interrupt handlers needs a spin lock
+ *   (see <geekos/spinlock.h>) instead.
  */
 
+/*
+ * Limit on the length of a chain of mutex owners which
+ * priority is passed down, in case of a deadlock cycle.
+ */
+#define MAX_INHERIT_DEPTH 16
+
 /* ----------------------------------------------------------------------
  * Private functions
  * ---------------------------------------------------------------------- */
 
+/*
+ * Pass given priority down the chain of threads starting with
+ * the owner of given mutex: its owner, the owner of the mutex that
+ * thread is waiting for, and so on, until reaching a thread which
+ * already has that priority or isn't waiting.
+ * Interrupts must be disabled.
+ */
+static void Inherit_Priority(struct Mutex* mutex, int priority)
+{
+    struct Kernel_Thread* owner;
+    int depth;
+
+    for (depth = 0; mutex != 0 && depth < MAX_INHERIT_DEPTH; ++depth) {
+	owner = mutex->owner;
+	if (owner == 0 || owner->priority >= priority)
+	    break;
+	Set_Thread_Priority(owner, priority);
+	mutex = owner->waitingForMutex;
+    }
+}
+
+/*
+ * Get the priority given thread should run at: its base priority,
+ * or the priority of the best thread waiting for a mutex it holds,
+ * whichever is higher.
+ */
+static int Get_Inherited_Priority(struct Kernel_Thread* kthread)
+{
+    int priority = kthread->basePriority;
+    struct Mutex* mutex;
+    struct Kernel_Thread* waiter;
+
+    for (mutex = kthread->heldMutexes; mutex != 0; mutex = mutex->nextHeld) {
+	waiter = Get_Front_Of_Prio_Queue(&mutex->waitQueue);
+	if (waiter != 0 && waiter->priority > priority)
+	    priority = waiter->priority;
+    }
+    return priority;
+}
+
+/*
+ * Remove given mutex from the list of mutexes its owner holds.
+ */
+static void Remove_Held_Mutex(struct Kernel_Thread* owner, struct Mutex* mutex)
+{
+    struct Mutex** link = &owner->heldMutexes;
+
+    while (*link != mutex) {
+	KASSERT(*link != 0);
+	link = &(*link)->nextHeld;
+    }
+    *link = mutex->nextHeld;
+    mutex->nextHeld = 0;
+}
+
 /*
  * The mutex is currently locked.
- * Atomically reenable preemption and wait in the
- * mutex's wait queue.
+ * Lend the owner our priority, then atomically reenable
+ * preemption and wait in the mutex's wait queue.
  */
 static void Mutex_Wait(struct Mutex *mutex)
 {
@@ -38,9 +112,12 @@ static void Mutex_Wait(struct Mutex *mutex)
     KASSERT(g_preemptionDisabled);
 
     Disable_Interrupts();
+    CURRENT_THREAD->waitingForMutex = mutex;
+    Inherit_Priority(mutex, CURRENT_THREAD->priority);
     g_preemptionDisabled = false;
-    Wait(&mutex->waitQueue);
+    Wait_Prio(&mutex->waitQueue);
     g_preemptionDisabled = true;
+    CURRENT_THREAD->waitingForMutex = 0;
     Enable_Interrupts();
 }
 
@@ -48,8 +125,13 @@ static void Mutex_Wait(struct Mutex *mutex)
  * Lock given mutex.
  * Preemption must be disabled.
  */
-static __inline__ void Mutex_Lock_Imp(struct Mutex* mutex)
+static __inline__ void Mutex_Lock_Imp(struct Mutex* mutex, const char* file, int line)
 {
+#ifdef LOCK_STATS
+    unsigned long long start = Read_TSC();
+    bool contended = mutex->state == MUTEX_LOCKED;
+#endif
+
     KASSERT(g_preemptionDisabled);
 
     /* Make sure we're not already holding the mutex */
@@ -62,7 +144,22 @@ static __inline__ void Mutex_Lock_Imp(struct Mutex* mutex)
 
     /* Now it's ours! */
     mutex->state = MUTEX_LOCKED;
-    mutex->owner = g_currentThread;
+    mutex->owner = CURRENT_THREAD;
+    mutex->nextHeld = CURRENT_THREAD->heldMutexes;
+    CURRENT_THREAD->heldMutexes = mutex;
+
+    /* Take on the priority of any threads still waiting. */
+    if (!Is_Prio_Queue_Empty(&mutex->waitQueue)) {
+	Disable_Interrupts();
+	Inherit_Priority(mutex, Get_Front_Of_Prio_Queue(&mutex->waitQueue)->priority);
+	Enable_Interrupts();
+    }
+
+#ifdef LOCK_STATS
+    mutex->lockTSC = Read_TSC();
+    mutex->statSite = Lock_Stat_Acquired(mutex, LOCK_KIND_MUTEX, file, line,
+	contended, mutex->lockTSC - start);
+#endif
 }
 
 /*
@@ -76,7 +173,12 @@ static __inline__ void Mutex_Unlock_Imp(struct Mutex* mutex)
     /* Make sure mutex was actually acquired by this thread. */
     KASSERT(IS_HELD(mutex));
 
+#ifdef LOCK_STATS
+    Lock_Stat_Released(mutex->statSite, Read_TSC() - mutex->lockTSC);
+#endif
+
     /* Unlock the mutex. */
+    Remove_Held_Mutex(CURRENT_THREAD, mutex);
     mutex->state = MUTEX_UNLOCKED;
     mutex->owner = 0;
 
@@ -87,13 +189,36 @@ static __inline__ void Mutex_Unlock_Imp(struct Mutex* mutex)
      * is disabled, and therefore we know that no thread can
      * concurrently add itself to the queue.
      */
-    if (!Is_Thread_Queue_Empty(&mutex->waitQueue)) {
+    if (!Is_Prio_Queue_Empty(&mutex->waitQueue) ||
+	CURRENT_THREAD->priority != CURRENT_THREAD->basePriority) {
 	Disable_Interrupts();
-	Wake_Up_One(&mutex->waitQueue);
+	Wake_Up_One_Prio(&mutex->waitQueue);
+
+	/*
+	 * Give up any priority lent to us through this mutex,
+	 * letting the thread we woke run as soon as possible.
+	 */
+	if (Get_Inherited_Priority(CURRENT_THREAD) != CURRENT_THREAD->priority) {
+	    Set_Thread_Priority(CURRENT_THREAD, Get_Inherited_Priority(CURRENT_THREAD));
+	    g_needReschedule[Get_CPU_ID()] = true;
+	}
 	Enable_Interrupts();
     }
 }
 
+/*
+ * Hand a free reader-writer lock to the writer that has been
+ * waiting for it the longest among those of the highest priority.
+ * Interrupts must be disabled.
+ */
+static void Give_To_Writer(struct RW_Lock* lock)
+{
+    KASSERT(lock->writer == 0 && lock->readers == 0);
+
+    lock->writer = Get_Front_Of_Prio_Queue(&lock->writeQueue);
+    Wake_Up_One_Prio(&lock->writeQueue);
+}
+
 /* ----------------------------------------------------------------------
  * Public functions
  * ---------------------------------------------------------------------- */
@@ -105,18 +230,20 @@ void Mutex_Init(struct Mutex* mutex)
 {
     mutex->state = MUTEX_UNLOCKED;
     mutex->owner = 0;
-    Clear_Thread_Queue(&mutex->waitQueue);
+    Clear_Prio_Queue(&mutex->waitQueue);
+    mutex->nextHeld = 0;
 }
 
 /*
  * Lock given mutex.
+ * Called through the Mutex_Lock() macro, which passes the call site.
  */
-void Mutex_Lock(struct Mutex* mutex)
+void Mutex_Lock_At(struct Mutex* mutex, const char* file, int line)
 {
     KASSERT(Interrupts_Enabled());
 
     g_preemptionDisabled = true;
-    Mutex_Lock_Imp(mutex);
+    Mutex_Lock_Imp(mutex, file, line);
     g_preemptionDisabled = false;
 }
 
@@ -137,13 +264,14 @@ void Mutex_Unlock(struct Mutex* mutex)
  */
 void Cond_Init(struct Condition* cond)
 {
-    Clear_Thread_Queue(&cond->waitQueue);
+    Clear_Prio_Queue(&cond->waitQueue);
 }
 
 /*
  * Wait on given condition (protected by given mutex).
+ * Called through the Cond_Wait() macro, which passes the call site.
  */
-void Cond_Wait(struct Condition* cond, struct Mutex* mutex)
+void Cond_Wait_At(struct Condition* cond, struct Mutex* mutex, const char* file, int line)
 {
     KASSERT(Interrupts_Enabled());
 
@@ -170,12 +298,12 @@ void Cond_Wait(struct Condition* cond, struct Mutex* mutex)
      */
     Disable_Interrupts();
     g_preemptionDisabled = false;
-    Wait(&cond->waitQueue);
+    Wait_Prio(&cond->waitQueue);
     g_preemptionDisabled = true;
     Enable_Interrupts();
 
     /* Reacquire the mutex. */
-    Mutex_Lock_Imp(mutex);
+    Mutex_Lock_Imp(mutex, file, line);
 
     /* Turn scheduling back on. */
     g_preemptionDisabled = false;
@@ -189,7 +317,7 @@ void Cond_Signal(struct Condition* cond)
 {
     KASSERT(Interrupts_Enabled());
     Disable_Interrupts();  /* prevent scheduling */
-    Wake_Up_One(&cond->waitQueue);
+    Wake_Up_One_Prio(&cond->waitQueue);
     Enable_Interrupts();  /* resume scheduling */
 }
 
@@ -201,6 +329,95 @@ void Cond_Broadcast(struct Condition* cond)
 {
     KASSERT(Interrupts_Enabled());
     Disable_Interrupts();  /* prevent scheduling */
-    Wake_Up(&cond->waitQueue);
+    Wake_Up_Prio(&cond->waitQueue);
     Enable_Interrupts();  /* resume scheduling */
 }
+
+/*
+ * Initialize given reader-writer lock.
+ */
+void RW_Lock_Init(struct RW_Lock* lock)
+{
+    lock->readers = 0;
+    lock->writer = 0;
+    Clear_Prio_Queue(&lock->readQueue);
+    Clear_Prio_Queue(&lock->writeQueue);
+}
+
+/*
+ * Lock given reader-writer lock for reading.
+ * Like a mutex, the lock is only touched from threads, so with
+ * preemption disabled it can be taken without disabling interrupts,
+ * unless we have to wait.
+ */
+void Read_Lock(struct RW_Lock* lock)
+{
+    KASSERT(Interrupts_Enabled());
+
+    g_preemptionDisabled = true;
+    if (lock->writer != 0 || !Is_Prio_Queue_Empty(&lock->writeQueue)) {
+	Disable_Interrupts();
+	g_preemptionDisabled = false;
+	while (lock->writer != 0 || !Is_Prio_Queue_Empty(&lock->writeQueue))
+	    Wait_Prio(&lock->readQueue);
+	g_preemptionDisabled = true;
+	Enable_Interrupts();
+    }
+    ++lock->readers;
+    g_preemptionDisabled = false;
+}
+
+/*
+ * Unlock given reader-writer lock held for reading.
+ * Interrupts are only disabled to hand the lock to a writer.
+ */
+void Read_Unlock(struct RW_Lock* lock)
+{
+    KASSERT(Interrupts_Enabled());
+
+    g_preemptionDisabled = true;
+    KASSERT(lock->readers > 0);
+    if (--lock->readers == 0 && !Is_Prio_Queue_Empty(&lock->writeQueue)) {
+	Disable_Interrupts();
+	Give_To_Writer(lock);
+	Enable_Interrupts();
+    }
+    g_preemptionDisabled = false;
+}
+
+/*
+ * Lock given reader-writer lock for writing.
+ */
+void Write_Lock(struct RW_Lock* lock)
+{
+    KASSERT(Interrupts_Enabled());
+
+    Disable_Interrupts();
+    if (lock->writer == 0 && lock->readers == 0) {
+	lock->writer = CURRENT_THREAD;
+    } else {
+	/* The unlocking thread hands the lock to us. */
+	while (lock->writer != CURRENT_THREAD)
+	    Wait_Prio(&lock->writeQueue);
+    }
+    Enable_Interrupts();
+}
+
+/*
+ * Unlock given reader-writer lock held for writing.
+ * A waiting writer gets the lock next; if there is none,
+ * all waiting readers are woken.
+ */
+void Write_Unlock(struct RW_Lock* lock)
+{
+    KASSERT(Interrupts_Enabled());
+
+    Disable_Interrupts();
+    KASSERT(lock->writer == CURRENT_THREAD);
+    lock->writer = 0;
+    if (!Is_Prio_Queue_Empty(&lock->writeQueue))
+	Give_To_Writer(lock);
+    else
+	Wake_Up_Prio(&lock->readQueue);
+    Enable_Interrupts();
+}
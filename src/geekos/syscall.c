@@ -20,7 +20,12 @@
 #include <geekos/user.h>
 #include <geekos/timer.h>
 #include <geekos/vfs.h>
-#include <libc/sema.h>
+#include <geekos/pipe.h>
+#include <geekos/sem.h>
+#include <geekos/shm.h>
+#include <geekos/futex.h>
+#include <geekos/ipc.h>
+#include <geekos/lockstat.h>
 
 /*
  * Allocate a buffer for a user string, and
@@ -58,6 +63,70 @@ done:
     return rc; 
 }
 
+/*
+ * Most bytes Read and Write copy through the kernel at once.
+ */
+#define SYSCALL_IO_CHUNK 4096
+
+/*
+ * Look up a file descriptor of the current process.
+ * A STDIN_FD or STDOUT_FD with no file attached gives
+ * a null file, meaning the console.
+ * Returns: 0 if successful, EINVALID if fd is not open
+ */
+static int Get_File(int fd, struct File **pFile)
+{
+    struct User_Context *context = CURRENT_THREAD->userContext;
+
+    if (fd < 0 || fd >= USER_MAX_FILES)
+        return EINVALID;
+    *pFile = context->file[fd];
+    if (*pFile == 0 && fd != STDIN_FD && fd != STDOUT_FD)
+        return EINVALID;
+    return 0;
+}
+
+/*
+ * Give a file a descriptor in the current process.
+ * New descriptors never reuse STDIN_FD or STDOUT_FD.
+ * Returns: the descriptor, or EMFILE if the table is full
+ */
+static int Add_File(struct File *file)
+{
+    struct User_Context *context = CURRENT_THREAD->userContext;
+    int fd;
+
+    for (fd = STDOUT_FD + 1; fd < USER_MAX_FILES; ++fd) {
+        if (context->file[fd] == 0) {
+            context->file[fd] = file;
+            return fd;
+        }
+    }
+    return EMFILE;
+}
+
+/*
+ * Write a kernel buffer to a file, or to the console if
+ * the file is null.
+ * Interrupts must be disabled; they are enabled while
+ * writing to a file, which may have to wait.
+ * Returns: number of bytes written, or error code (< 0)
+ */
+static int Write_To_File(struct File *file, void *buf, ulong_t len)
+{
+    int rc;
+
+    if (file == 0) {
+        Put_Buf((char*) buf, len);
+        return len;
+    }
+
+    Enable_Interrupts();
+    rc = Write(file, buf, len);
+    Disable_Interrupts();
+    return rc;
+}
+
 
 /*
  * Null system call.
@@ -84,11 +153,21 @@ static int Sys_Null(struct Interrupt_State* state)
  */
 static int Sys_Exit(struct Interrupt_State* state)
 {
+	/*
+	 * Close files now rather than when the process is reaped,
+	 * so that the reader of a pipe we write to sees end of file
+	 * as soon as we are gone.
+	 */
+	Enable_Interrupts();
+	Close_User_Files(CURRENT_THREAD->userContext);
+	Disable_Interrupts();
+
 	Exit(state->ebx);
 }
 
 /*
- * Print a string to the console.
+ * Print a string to the console, or to the file
+ * attached to STDOUT_FD if there is one.
  * Params:
  *   state->ebx - user pointer of string to be printed
  *   state->ecx - number of characters to print
@@ -105,8 +184,9 @@ static int Sys_PrintString(struct Interrupt_State* state)
         if ((rc = Copy_User_String(state->ebx, length, 1023, (char**) &buf)) != 0)
             goto done;
 
-        /* Write to console. */
-        Put_Buf((char*)buf, length);
+        rc = Write_To_File(CURRENT_THREAD->userContext->file[STDOUT_FD], buf, length);
+        if (rc > 0)
+            rc = 0;
     }
 
 done:
@@ -125,7 +205,7 @@ done:
  */
 static int Sys_GetKey(struct Interrupt_State* state)
 {
-    struct Kernel_Thread* kthread = g_currentThread;
+    struct Kernel_Thread* kthread = CURRENT_THREAD;
 
     while(kthread != 0 && kthread->userContext != 0)
     {
@@ -189,6 +269,9 @@ static int Sys_PutCursor(struct Interrupt_State* state)
  *   state->ecx - length of executable name
  *   state->edx - user address of command string
  *   state->esi - length of command string
+ *   state->edi - if non-zero, user address of two file descriptors
+ *     to become the STDIN_FD and STDOUT_FD of the new process;
+ *     otherwise it gets the same ones as the caller
  * Returns: pid of process if successful, error code (< 0) otherwise
  */
 static int Sys_Spawn(struct Interrupt_State* state)
@@ -197,12 +280,22 @@ static int Sys_Spawn(struct Interrupt_State* state)
     char *program = 0;
     char *command = 0;
     struct Kernel_Thread *process;
+    int fds[2] = { STDIN_FD, STDOUT_FD };
+    struct File *stdFiles[2];
 
     /* Copy program name and command from user space. */
     if ((rc = Copy_User_String(state->ebx, state->ecx, VFS_MAX_PATH_LEN, &program)) != 0 ||
         (rc = Copy_User_String(state->edx, state->esi, 1023, &command)) != 0)
                 goto done;
 
+    if (state->edi != 0 && !Copy_From_User(fds, state->edi, sizeof(fds))) {
+        rc = EINVALID;
+        goto done;
+    }
+    if ((rc = Get_File(fds[0], &stdFiles[0])) != 0 ||
+        (rc = Get_File(fds[1], &stdFiles[1])) != 0)
+        goto done;
+
             Enable_Interrupts();
 
 
@@ -210,7 +303,7 @@ static int Sys_Spawn(struct Interrupt_State* state)
      * Now that we have collected the program name and command string
      * from user space, we can try to actually spawn the process.
      */
-    rc = Spawn(program, command, &process);
+    rc = Spawn_With_Files(program, command, stdFiles, false, &process);
     if (rc == 0) {
         KASSERT(process != 0);
         rc = process->pid;
@@ -232,12 +325,15 @@ done:
  * Wait for a process to exit.
  * Params:
  *   state->ebx - pid of process to wait for
+ *   state->ecx - if non-zero, user address of a Thread_Stats struct
+ *     where the final statistics of the process should be stored
  * Returns: the exit code of the process,
  *   or error code (< 0) on error
  */
 static int Sys_Wait(struct Interrupt_State* state)
 {
     int exitCode;
+    struct Thread_Stats stats;
     struct Kernel_Thread *kthread = Lookup_Thread(state->ebx);
     //if(kthread == 0 || kthread->userContext->background)
     if(kthread == 0)
@@ -246,9 +342,12 @@ static int Sys_Wait(struct Interrupt_State* state)
     }
 
     Enable_Interrupts();
-    exitCode = Join(kthread);
+    exitCode = Join_With_Stats(kthread, &stats);
     Disable_Interrupts();
 
+    if (state->ecx != 0 && !Copy_To_User(state->ecx, &stats, sizeof(stats)))
+        return EINVALID;
+
     return exitCode;
 
 }
@@ -261,7 +360,7 @@ static int Sys_Wait(struct Interrupt_State* state)
  */
 static int Sys_GetPID(struct Interrupt_State* state)
 {
-     return g_currentThread->pid;
+     return CURRENT_THREAD->pid;
 
 }
 
@@ -277,7 +376,7 @@ static int Sys_SetSchedulingPolicy(struct Interrupt_State* state)
     int policy = state->ebx;
     int quantum = state->ecx;
     
-    if(policy!=0 && policy!=1){
+    if(policy!=SCHED_RR && policy!=SCHED_MLF && policy!=SCHED_CFS){
     	return -1;
     }
     if(quantum<2 || quantum>100){
@@ -306,147 +405,531 @@ static int Sys_GetTimeOfDay(struct Interrupt_State* state)
 }
 
 /*
- * Create a semaphore.
+ * Create a semaphore, or open an existing one with the same name.
  * Params:
  *   state->ebx - user address of name of semaphore
  *   state->ecx - length of semaphore name
  *   state->edx - initial semaphore count
- * Returns: the global semaphore id
+ * Returns: the semaphore handle if successful, error code (< 0) if unsuccessful
  */
 static int Sys_CreateSemaphore(struct Interrupt_State* state)
 {
-	char *semaphoreName;
-   	semaphoreName = (char*) state->ebx;
-
-   	if (state->ecx > MAX_SEMAPHORE_NAME_LENGHT){
-    	Print("Error: Max semaphore name lenght exceded.\n");	
-       	return -1;
-   	} 
-
-   	if (!Copy_From_User(semaphoreName, state->ebx, state->ecx)){
-      	Print("Error: Fail to copy memory from user buffer to kernel buffer.\n");
-      	return -1;
-   	}
-
-   	// find a slot for this semaphore, 
-   	// making sure there are no other sempahores with this name
-   	int index = 0;
-   	for(; index < TOTAL_SEMAPHORES; index++){
-		if(semaphores[index].name[0] != NULL && strcmp(semaphoreName, semaphores[index].name ) == 0){
-			/*
-			 * This is the case where the semaphore was created before. 
-			 */
-			semaphores[index].num_ref+= 1; /* Increment the reference to this semaphore by 1. */
-         	return index;
-      		}
-
-      	if(semaphores[index].name[0] == NULL){
-			/*
-             * This is the case where we create the semaphore if there is a slot for it. 
-             */
-         	memcpy(semaphores[index].name, semaphoreName, state->ecx);
-         	semaphores[index].value = state->edx;
-			semaphores[index].id    = index;
-			semaphores[index].num_ref = 1;
-			semaphores[index].exist   = true;
-                Print("Create Semaphores state->edx %d\n", state->edx);
-                Print("Create Semaphroes index %d\n", index);
-                Print("Create Semaphores semaphores[index].value %d\n", semaphores[index].value);
-         	return index;
-      	}
-   	}
-
-	Print("Error: there is no slot for this semaphore!\n");
-   	return -1;
+    char *name;
+    int rc;
+
+    if ((rc = Copy_User_String(state->ebx, state->ecx, MAX_SEMAPHORE_NAME_LEN, &name)) != 0)
+	return rc;
+    rc = Sem_Create(CURRENT_THREAD->userContext, name, state->edx);
+    Free(name);
+    return rc;
 }
 
 /*
  * Acquire a semaphore.
- * Assume that the process has permission to access the semaphore,
- * the call will block until the semaphore count is >= 0.
+ * The call will block until the semaphore count is > 0.
  * Params:
- *   state->ebx - the semaphore id
+ *   state->ebx - the semaphore handle
  *
  * Returns: 0 if successful, error code (< 0) if unsuccessful
  */
 static int Sys_P(struct Interrupt_State* state)
 {
-	if( state->ebx < 0 || semaphores[state->ebx].exist == false ){
-		Print("*** The semaphore with ID = %d does not exist.\n", state->ebx);
-        return -1; // semaphore ID does not exist.
-	}
-
-	// Third, check if the value of the semaphore < 0.
-   	if(semaphores[state->ebx].value <= 0)
-   	{
-      	Print("*** The %s_sem is not available for  PID = %d\n", semaphores[state->ebx].name, Sys_GetPID(state));
-        Print("*** semaphores[state->ebx].value %d\n", semaphores[state->ebx].value);
-        Print("*** state->ebx %d\n", state->ebx);
-        Wait(&semaphores[state->ebx].waitQueue);
-	return -1;
-   	}
-         
-        Print("*** Semaphore %s id %d acquired \n", semaphores[state->ebx].name, state->ebx);
-   	semaphores[state->ebx].value--;
-   	return 0;
-
+    return Sem_P(CURRENT_THREAD->userContext, state->ebx);
 }
 
 /*
  * Release a semaphore.
  * Params:
- *   state->ebx - the semaphore id
+ *   state->ebx - the semaphore handle
  *
  * Returns: 0 if successful, error code (< 0) if unsuccessful
  */
 static int Sys_V(struct Interrupt_State* state)
 {
-	// First, check if the semaphore exist otherwise, distroied,  return -1.
-	if( state->ebx < 0 || semaphores[state->ebx].exist == false ){
-        Print("*** The semaphore with ID = %d does not exist.\n", state->ebx);
-        return -1; // semaphore ID does not exist.
+    return Sem_V(CURRENT_THREAD->userContext, state->ebx);
+}
+
+/*
+ * Destroy a semaphore handle.  The semaphore itself goes away
+ * when the last handle to it is destroyed.
+ * Params:
+ *   state->ebx - the semaphore handle
+ *
+ * Returns: 0 if successful, error code (< 0) if unsuccessful
+ */
+static int Sys_DestroySemaphore(struct Interrupt_State* state)
+{
+    return Sem_Destroy(CURRENT_THREAD->userContext, state->ebx);
+}
+
+
+/*
+ * Get scheduling statistics for a thread.
+ * Params:
+ *   state->ebx - pid of the thread: 0 for the current thread,
+ *     otherwise the current thread must own it
+ *   state->ecx - user address of Thread_Stats struct to fill in
+ *
+ * Returns: 0 if successful, EACCESS if the current thread doesn't
+ *   own the thread, error code (< 0) if otherwise unsuccessful
+ */
+static int Sys_GetThreadStats(struct Interrupt_State* state)
+{
+    struct Kernel_Thread *kthread = CURRENT_THREAD;
+
+    if (state->ebx != 0 && state->ebx != kthread->pid) {
+        kthread = Find_Thread(state->ebx);
+        if (kthread == 0)
+            return ENOTFOUND;
+        if (kthread->owner != CURRENT_THREAD)
+            return EACCESS;
     }
 
-   	if(semaphores[state->ebx].value <= 0)
-   	{
-      	Print("*** Some threads will wake up.\n");
-      	Wake_Up(&semaphores[state->ebx].waitQueue);
-   	}
+    if (!Copy_To_User(state->ecx, &kthread->stats, sizeof(struct Thread_Stats)))
+        return EINVALID;
+    return 0;
+}
 
-        Print("*** Semaphore %s id %d released\n", semaphores[state->ebx].name, state->ebx);
-   	semaphores[state->ebx].value++;
-   	return 0;
+/*
+ * Put the current thread in the EDF real-time class,
+ * or take it out again.
+ * Params:
+ *   state->ebx - runtime per period, in ticks
+ *   state->ecx - period, in ticks; 0 to leave the EDF class
+ *   state->edx - relative deadline, in ticks
+ *
+ * Returns: 0 if successful, EINVALID if the parameters are
+ *   inconsistent, EBUSY if they would exceed the EDF utilization limit
+ */
+static int Sys_SetEDFParams(struct Interrupt_State* state)
+{
+    return Set_EDF_Params(state->ebx, state->ecx, state->edx);
 }
 
 /*
- * Destroy a semaphore.
+ * Get the system-wide thread recycle pool statistics.
  * Params:
- *   state->ebx - the semaphore id
+ *   state->ebx - user address of Thread_Pool_Stats struct to fill in
  *
  * Returns: 0 if successful, error code (< 0) if unsuccessful
  */
-static int Sys_DestroySemaphore(struct Interrupt_State* state)
+static int Sys_GetThreadPoolStats(struct Interrupt_State* state)
+{
+    struct Thread_Pool_Stats stats;
+
+    Get_Thread_Pool_Stats(&stats);
+    if (!Copy_To_User(state->ebx, &stats, sizeof(stats)))
+        return EINVALID;
+    return 0;
+}
+
+/*
+ * Block the current thread for a number of timer ticks.
+ * Params:
+ *   state->ebx - number of ticks
+ *
+ * Returns: 0
+ */
+static int Sys_Sleep(struct Interrupt_State* state)
+{
+    Sleep_Ticks(state->ebx);
+    return 0;
+}
+
+/*
+ * Block the current thread for a number of microseconds.
+ * Params:
+ *   state->ebx - number of microseconds
+ *
+ * Returns: 0
+ */
+static int Sys_SleepUs(struct Interrupt_State* state)
+{
+    Sleep_Us(state->ebx);
+    return 0;
+}
+
+/*
+ * Set the current thread's periodic alarm.
+ * Params:
+ *   state->ebx - period, in ticks; 0 to cancel the alarm
+ *
+ * Returns: 0
+ */
+static int Sys_SetAlarm(struct Interrupt_State* state)
+{
+    Set_Alarm(state->ebx);
+    return 0;
+}
+
+/*
+ * Wait for the current thread's periodic alarm to go off.
+ *
+ * Returns: number of times the alarm went off since the last wait,
+ *   or EINVALID if no alarm is set
+ */
+static int Sys_WaitAlarm(struct Interrupt_State* state)
+{
+    return Wait_Alarm();
+}
+
+/*
+ * Wait on a futex, if it still holds the expected value.
+ * Params:
+ *   state->ebx - offset of the futex (an aligned int) in its segment
+ *   state->ecx - expected value
+ *   state->edx - selector of the segment: 0 for the process's data
+ *     segment, or that of an attached shared memory segment
+ *
+ * Returns: 0 once woken, EAGAIN if the futex held a different value,
+ *   or EINVALID if the address is not valid
+ */
+static int Sys_FutexWait(struct Interrupt_State* state)
+{
+    return Futex_Wait(state->edx, state->ebx, state->ecx);
+}
+
+/*
+ * Wake threads waiting on a futex.
+ * Params:
+ *   state->ebx - offset of the futex (an aligned int) in its segment
+ *   state->ecx - maximum number of threads to wake
+ *   state->edx - selector of the segment, as for Sys_FutexWait()
+ *
+ * Returns: number of threads woken, or EINVALID if the address
+ *   is not valid
+ */
+static int Sys_FutexWake(struct Interrupt_State* state)
+{
+    return Futex_Wake(state->edx, state->ebx, state->ecx);
+}
+
+/*
+ * Get the lock contention statistics of the most contended
+ * lock call sites, most contended first.
+ * Params:
+ *   state->ebx - user address of array of Lock_Stats structs to fill in
+ *   state->ecx - number of entries in the array
+ *
+ * Returns: number of entries filled in, EUNSUPPORTED if the kernel
+ *   wasn't built with LOCK_STATS, or another error code (< 0)
+ */
+static int Sys_GetLockStats(struct Interrupt_State* state)
+{
+    struct Lock_Stats *stats;
+    int max = state->ecx;
+    int rc;
+
+    if (max <= 0 || max > MAX_LOCK_STATS)
+        return EINVALID;
+    stats = (struct Lock_Stats*) Malloc(max * sizeof(struct Lock_Stats));
+    if (stats == 0)
+        return ENOMEM;
+
+    rc = Get_Lock_Stats(stats, max);
+    if (rc > 0 && !Copy_To_User(state->ebx, stats, rc * sizeof(struct Lock_Stats)))
+        rc = EINVALID;
+    Free(stats);
+    return rc;
+}
+
+/*
+ * Get the timer interrupt rate, which Get_Time_Of_Day() and the
+ * other tick counts are in.
+ * Params:
+ *   state - processor registers from user mode
+ *
+ * Returns: ticks per second
+ */
+static int Sys_GetTickRate(struct Interrupt_State* state)
 {
-   	//TODO("DestroySemaphore system call");
-	// First, we need to remove the authority for accessing the semaphore.
+    return g_tickHz;
+}
 
 
-	// Second, check the number of references to this semaphore.
-	// Assuming I have authority on this thread, meaning I called Create_Semaphore() at least once.
-	if(semaphores[state->ebx].num_ref == 1){
-		semaphores[state->ebx].exist   = false;
-		semaphores[state->ebx].name[0] = NULL;
-		semaphores[state->ebx].id      = -1;
-		semaphores[state->ebx].value   = -1;
-		return 0;
-	}
+/*
+ * Open a file.
+ * Params:
+ *   state->ebx - user address of name of file
+ *   state->ecx - length of file name
+ *   state->edx - open flags: combination of O_CREATE, O_READ, O_WRITE, O_EXCL
+ *
+ * Returns: file descriptor if successful, error code (< 0) otherwise
+ */
+static int Sys_Open(struct Interrupt_State* state)
+{
+    char *path = 0;
+    struct File *file;
+    int rc;
 
-   	//semaphores[state->ebx].name[0] = NULL;
-   	//semaphores[state->ebx].value   = 0;
-   	//Print("*** DestroySemaphore is called.\n");
-   	return 0;
+    if ((rc = Copy_User_String(state->ebx, state->ecx, VFS_MAX_PATH_LEN, &path)) != 0)
+        return rc;
+
+    Enable_Interrupts();
+    rc = Open(path, state->edx, &file);
+    Disable_Interrupts();
+    Free(path);
+    if (rc != 0)
+        return rc;
+
+    rc = Add_File(file);
+    if (rc < 0) {
+        Enable_Interrupts();
+        Close(file);
+        Disable_Interrupts();
+    }
+    return rc;
 }
 
+/*
+ * Close a file descriptor.  Closing STDIN_FD or STDOUT_FD
+ * makes it refer to the console again.
+ * Params:
+ *   state->ebx - file descriptor
+ *
+ * Returns: 0 if successful, error code (< 0) otherwise
+ */
+static int Sys_Close(struct Interrupt_State* state)
+{
+    struct User_Context *context = CURRENT_THREAD->userContext;
+    int fd = state->ebx;
+    struct File *file;
+    int rc;
+
+    if (fd < 0 || fd >= USER_MAX_FILES || context->file[fd] == 0)
+        return EINVALID;
+    file = context->file[fd];
+    context->file[fd] = 0;
+
+    Enable_Interrupts();
+    rc = Close(file);
+    Disable_Interrupts();
+    return rc;
+}
+
+/*
+ * Read from a file descriptor.  At most SYSCALL_IO_CHUNK bytes
+ * are read at once; reading from a pipe waits until there is
+ * something to read, and returns what is there.
+ * Params:
+ *   state->ebx - file descriptor
+ *   state->ecx - user address of buffer to read into
+ *   state->edx - size of buffer
+ *
+ * Returns: number of bytes read, 0 at end of file,
+ *   or error code (< 0)
+ */
+static int Sys_Read(struct Interrupt_State* state)
+{
+    struct File *file;
+    ulong_t len = MIN(state->edx, SYSCALL_IO_CHUNK);
+    void *buf;
+    int rc;
+
+    if ((rc = Get_File(state->ebx, &file)) != 0)
+        return rc;
+    if (file == 0)
+        return EUNSUPPORTED;	/* use Get_Key() for the console */
+    if (len == 0)
+        return 0;
+    buf = Malloc(len);
+    if (buf == 0)
+        return ENOMEM;
+
+    Enable_Interrupts();
+    rc = Read(file, buf, len);
+    Disable_Interrupts();
+
+    if (rc > 0 && !Copy_To_User(state->ecx, buf, rc))
+        rc = EINVALID;
+    Free(buf);
+    return rc;
+}
+
+/*
+ * Write to a file descriptor.  Writing to a pipe
+ * waits until all of the data has been written.
+ * Params:
+ *   state->ebx - file descriptor
+ *   state->ecx - user address of data to write
+ *   state->edx - number of bytes to write
+ *
+ * Returns: number of bytes written, or error code (< 0)
+ */
+static int Sys_Write(struct Interrupt_State* state)
+{
+    struct File *file;
+    ulong_t done = 0;
+    void *buf;
+    int rc;
+
+    if ((rc = Get_File(state->ebx, &file)) != 0)
+        return rc;
+    if (state->edx == 0)
+        return 0;
+    buf = Malloc(MIN(state->edx, SYSCALL_IO_CHUNK));
+    if (buf == 0)
+        return ENOMEM;
+
+    while (done < state->edx) {
+        ulong_t len = MIN(state->edx - done, SYSCALL_IO_CHUNK);
+
+        if (!Copy_From_User(buf, state->ecx + done, len)) {
+            rc = EINVALID;
+            break;
+        }
+        rc = Write_To_File(file, buf, len);
+        if (rc <= 0)
+            break;
+        done += rc;
+        if ((ulong_t) rc < len)
+            break;
+    }
+
+    Free(buf);
+    return done > 0 ? (int) done : rc;
+}
+
+/*
+ * Create a pipe.
+ * Params:
+ *   state->ebx - user address of int where the file descriptor
+ *     of the read end should be stored
+ *   state->ecx - user address of int where the file descriptor
+ *     of the write end should be stored
+ *
+ * Returns: 0 if successful, error code (< 0) otherwise
+ */
+static int Sys_Pipe(struct Interrupt_State* state)
+{
+    struct User_Context *context = CURRENT_THREAD->userContext;
+    struct File *readFile, *writeFile;
+    int fds[2];
+    int rc;
+
+    if ((rc = Create_Pipe(&readFile, &writeFile)) != 0)
+        return rc;
+
+    fds[0] = Add_File(readFile);
+    fds[1] = fds[0] < 0 ? EMFILE : Add_File(writeFile);
+    if (fds[1] < 0)
+        rc = EMFILE;
+    else if (!Copy_To_User(state->ebx, &fds[0], sizeof(int)) ||
+             !Copy_To_User(state->ecx, &fds[1], sizeof(int)))
+        rc = EINVALID;
+
+    if (rc != 0) {
+        if (fds[0] >= 0)
+            context->file[fds[0]] = 0;
+        if (fds[1] >= 0)
+            context->file[fds[1]] = 0;
+        Enable_Interrupts();
+        Close(readFile);
+        Close(writeFile);
+        Disable_Interrupts();
+    }
+    return rc;
+}
+
+
+/*
+ * Call another process with a message, and wait for its reply.
+ * Params:
+ *   state->ebx - pid of process to call
+ *   state->ecx..edi - message
+ *
+ * Returns: 0 if successful, with the pid of the replier in ebx
+ *   and the reply in ecx..edi, or error code (< 0) otherwise
+ */
+static int Sys_IpcCall(struct Interrupt_State* state)
+{
+    return Ipc_Call(state);
+}
+
+/*
+ * Wait for a call from another process.
+ * Params: none
+ *
+ * Returns: 0, with the pid of the caller in ebx
+ *   and the message in ecx..edi
+ */
+static int Sys_IpcReceive(struct Interrupt_State* state)
+{
+    return Ipc_Receive(state);
+}
+
+/*
+ * Reply to a call received earlier.
+ * Params:
+ *   state->ebx - pid of caller
+ *   state->ecx..edi - reply
+ *
+ * Returns: 0 if successful, error code (< 0) otherwise
+ */
+static int Sys_IpcReply(struct Interrupt_State* state)
+{
+    return Ipc_Reply(state);
+}
+
+/*
+ * Reply to a call received earlier, and wait for the next one.
+ * Params:
+ *   state->ebx - pid of caller
+ *   state->ecx..edi - reply
+ *
+ * Returns: 0 if successful, with the pid of the next caller in ebx
+ *   and its message in ecx..edi, or error code (< 0) otherwise
+ */
+static int Sys_IpcReplyWait(struct Interrupt_State* state)
+{
+    return Ipc_Reply_Wait(state);
+}
+
+
+/*
+ * Attach a shared memory segment, creating it if it doesn't exist.
+ * Params:
+ *   state->ebx - user address of name of segment
+ *   state->ecx - length of name
+ *   state->edx - size of segment to create, in bytes,
+ *     or 0 to only attach an existing segment
+ *
+ * Returns: selector for the segment if successful,
+ *   error code (< 0) otherwise
+ */
+static int Sys_ShmAttach(struct Interrupt_State* state)
+{
+    char *name = 0;
+    int rc;
+
+    if ((rc = Copy_User_String(state->ebx, state->ecx, MAX_SHM_NAME_LEN, &name)) != 0)
+        return rc;
+
+    Enable_Interrupts();
+    rc = Shm_Attach(CURRENT_THREAD->userContext, name, state->edx);
+    Disable_Interrupts();
+
+    Free(name);
+    return rc;
+}
+
+/*
+ * Detach a shared memory segment.
+ * Params:
+ *   state->ebx - selector for the segment
+ *
+ * Returns: 0 if successful, error code (< 0) otherwise
+ */
+static int Sys_ShmDetach(struct Interrupt_State* state)
+{
+    int rc;
+
+    Enable_Interrupts();
+    rc = Shm_Detach(CURRENT_THREAD->userContext, state->ebx, state);
+    Disable_Interrupts();
+
+    return rc;
+}
 
 /*
  * Global table of system call handler functions.
@@ -469,6 +952,31 @@ const Syscall g_syscallTable[] = {
     Sys_P,
     Sys_V,
     Sys_DestroySemaphore,
+    Sys_GetThreadStats,
+    Sys_SetEDFParams,
+    Sys_GetThreadPoolStats,
+    Sys_Sleep,
+    Sys_SleepUs,
+    Sys_SetAlarm,
+    Sys_WaitAlarm,
+    Sys_FutexWait,
+    Sys_FutexWake,
+    Sys_GetLockStats,
+    Sys_GetTickRate,
+    /* File and pipe system calls. */
+    Sys_Open,
+    Sys_Close,
+    Sys_Read,
+    Sys_Write,
+    Sys_Pipe,
+    /* Synchronous IPC system calls. */
+    Sys_IpcCall,
+    Sys_IpcReceive,
+    Sys_IpcReply,
+    Sys_IpcReplyWait,
+    /* Shared memory system calls. */
+    Sys_ShmAttach,
+    Sys_ShmDetach,
 };
 
 /*
@@ -8,19 +8,49 @@
  * redistribute, and modify it as specified in the file "COPYING".
  */
 
-#include <limits.h>
+#include <stddef.h>
 #include <geekos/io.h>
 #include <geekos/int.h>
 #include <geekos/irq.h>
+#include <geekos/idt.h>
+#include <geekos/apic.h>
 #include <geekos/kthread.h>
+#include <geekos/smp.h>
+#include <geekos/spinlock.h>
+#include <geekos/errno.h>
 #include <geekos/timer.h>
 
-#define MAX_TIMER_EVENTS	100
+/*
+ * Pending timer events are kept in a hierarchical timer wheel.
+ * Level 0 has a slot for each of the next 256 ticks.  Each slot of
+ * level n > 0 covers 64 times as many ticks as a slot of level n-1,
+ * so the four levels together cover 2^26 ticks; events further out
+ * wait in the last level until they come within range.  When the
+ * level 0 index wraps around, the next slot of level 1 is cascaded
+ * down, re-adding its events to the levels below, and so on.
+ * Adding and cancelling an event is constant time, and so is each
+ * tick, apart from the events that expire or cascade.
+ */
+#define WHEEL_ROOT_BITS		8
+#define WHEEL_LEVEL_BITS	6
+#define WHEEL_ROOT_SIZE		(1 << WHEEL_ROOT_BITS)
+#define WHEEL_LEVEL_SIZE	(1 << WHEEL_LEVEL_BITS)
+#define WHEEL_NUM_LEVELS	3	/* above the root level */
+#define WHEEL_MAX_DELTA \
+    ((1UL << (WHEEL_ROOT_BITS + WHEEL_NUM_LEVELS * WHEEL_LEVEL_BITS)) - 1)
 
-static int timerDebug = 0;
-static int timeEventCount;
-static int nextEventID;
-timerEvent pendingTimerEvents[MAX_TIMER_EVENTS];
+static struct Timer_Event *s_wheelRoot[WHEEL_ROOT_SIZE];
+static struct Timer_Event *s_wheelLevel[WHEEL_NUM_LEVELS][WHEEL_LEVEL_SIZE];
+
+/* The next tick whose events the wheel has to run. */
+static ulong_t s_wheelTick;
+
+/*
+ * Protects the timer wheel and the high-resolution timer list.
+ * It is dropped while a callback runs, so that callbacks can
+ * start and cancel timers.
+ */
+static struct Spin_Lock s_timerLock;
 
 /*
  * Global tick counter
@@ -28,265 +58,704 @@ timerEvent pendingTimerEvents[MAX_TIMER_EVENTS];
 volatile ulong_t g_numTicks;
 
 /*
- * Number of times the spin loop can execute during one timer tick
+ * Timer interrupt rate, set by Init_Timer().
  */
-static int s_spinCountPerTick;
+ulong_t g_tickHz = DEFAULT_TICK_HZ;
 
 /*
- * Number of ticks to wait before calibrating the delay loop.
+ * The default quantum, in milliseconds; maximum time a thread can
+ * use before we suspend it and choose another.
  */
-#define CALIBRATE_NUM_TICKS	3
+#define DEFAULT_QUANTUM_MS 40
 
 /*
- * The default quantum; maximum number of ticks a thread can use before
- * we suspend it and choose another.
+ * Settable quantum, in ticks.
  */
-#define DEFAULT_MAX_TICKS 4
+int g_Quantum;
 
 /*
- * Settable quantum.
+ * Input clock of the programmable interval timer, in Hz,
+ * and the I/O ports of its control register and channels 0 and 2.
+ * Channel 2's gate and output are in the system control port.
  */
-int g_Quantum = DEFAULT_MAX_TICKS;
+#define PIT_FREQ		1193182
+#define PIT_CONTROL		0x43
+#define PIT_CHANNEL0		0x40
+#define PIT_CHANNEL2		0x42
+#define PIT_SYSTEM_CONTROL	0x61
+#define PIT_CH2_GATE		0x01
+#define PIT_CH2_SPEAKER		0x02
+#define PIT_CH2_OUT		0x20
 
 /*
- * Ticks per second.
- * FIXME: should set this to something more reasonable, like 100.
+ * The TSC is calibrated by timing CALIBRATE_TSC_MS milliseconds
+ * counted down by PIT channel 2.
  */
-#define TICKS_PER_SEC 18
+#define CALIBRATE_TSC_MS	10
 
-/*#define DEBUG_TIMER */
-#ifdef DEBUG_TIMER
-#  define Debug(args...) Print(args)
-#else
-#  define Debug(args...)
-#endif
+/*
+ * TSC-based monotonic clock.  Nanoseconds are computed from
+ * cycles as (cycles * s_nsMult) >> NS_SHIFT.
+ */
+#define NS_SHIFT 20
+static unsigned long long s_tscBase;
+static ulong_t s_nsMult;
+static ulong_t s_tscKHz;
+
+/*
+ * Pending high-resolution timers, in order of expiry.
+ */
+static struct HR_Timer *s_hrTimerList;
+
+/*
+ * Rate of the local APIC timer, in kHz, or 0 if there is no
+ * local APIC; the high-resolution timers then fall back to being
+ * checked on each tick.  Deadlines further out than
+ * MAX_HR_DEADLINE_NS are cut short, which keeps the count within
+ * 32 bits; the timer is simply programmed again when it goes off.
+ */
+#define MAX_HR_DEADLINE_NS 1000000000ULL
+static ulong_t s_apicTimerKHz;
 
 /* ----------------------------------------------------------------------
  * Private functions
  * ---------------------------------------------------------------------- */
 
-static void Timer_Interrupt_Handler(struct Interrupt_State* state)
+/*
+ * Add an event to the wheel slot for its expiry time.
+ * The timer lock must be held.
+ */
+static void Add_To_Wheel(struct Timer_Event *event)
 {
-    int i;
-    struct Kernel_Thread* current = g_currentThread;
+    ulong_t expires = event->expires;
+    ulong_t delta = expires - s_wheelTick;
+    struct Timer_Event **slot;
+    int level, shift;
+
+    if ((long) delta < 0) {
+	/* Already due: run it on the tick being processed. */
+	slot = &s_wheelRoot[s_wheelTick & (WHEEL_ROOT_SIZE - 1)];
+    } else if (delta < WHEEL_ROOT_SIZE) {
+	slot = &s_wheelRoot[expires & (WHEEL_ROOT_SIZE - 1)];
+    } else {
+	if (delta > WHEEL_MAX_DELTA) {
+	    /* Wait in the last level, to be cascaded again later. */
+	    delta = WHEEL_MAX_DELTA;
+	    expires = s_wheelTick + delta;
+	}
+	for (level = 0, shift = WHEEL_ROOT_BITS + WHEEL_LEVEL_BITS;
+	     level < WHEEL_NUM_LEVELS - 1 && delta >= (1UL << shift);
+	     ++level, shift += WHEEL_LEVEL_BITS)
+	    ;
+	shift -= WHEEL_LEVEL_BITS;
+	slot = &s_wheelLevel[level][(expires >> shift) & (WHEEL_LEVEL_SIZE - 1)];
+    }
 
-    Begin_IRQ(state);
+    event->next = *slot;
+    if (*slot != 0)
+	(*slot)->pprev = &event->next;
+    *slot = event;
+    event->pprev = slot;
+}
 
-    /* Update global and per-thread number of ticks */
-    ++g_numTicks;
-    ++current->numTicks;
+/*
+ * Unlink an event from its wheel slot.
+ * The timer lock must be held.
+ */
+static void Remove_From_Wheel(struct Timer_Event *event)
+{
+    *event->pprev = event->next;
+    if (event->next != 0)
+	event->next->pprev = event->pprev;
+    event->pprev = 0;
+}
+
+/*
+ * Move the events in given slot of an upper level
+ * down to the levels below.
+ * The timer lock must be held.
+ */
+static void Cascade(int level, int index)
+{
+    struct Timer_Event *event = s_wheelLevel[level][index];
+
+    s_wheelLevel[level][index] = 0;
+    while (event != 0) {
+	struct Timer_Event *next = event->next;
+	Add_To_Wheel(event);
+	event = next;
+    }
+}
+
+/*
+ * Run the timer events for every tick up to the current one.
+ * Periodic events are re-added before their callback runs,
+ * so a callback can cancel its own event.
+ */
+static void Run_Timer_Wheel(void)
+{
+    struct Timer_Event **slot, *event;
+    int index, level;
+    ulong_t tick;
+
+    Spin_Lock(&s_timerLock);
+
+    while ((long) (g_numTicks - s_wheelTick) >= 0) {
+	/* Cascade when a level wraps around. */
+	index = s_wheelTick & (WHEEL_ROOT_SIZE - 1);
+	for (level = 0; index == 0 && level < WHEEL_NUM_LEVELS; ++level) {
+	    index = (s_wheelTick >> (WHEEL_ROOT_BITS + level * WHEEL_LEVEL_BITS)) &
+		(WHEEL_LEVEL_SIZE - 1);
+	    Cascade(level, index);
+	}
 
-    /* update timer events */
-    for (i=0; i < timeEventCount; i++) {
-	if (pendingTimerEvents[i].ticks == 0) {
-	    if (timerDebug) Print("timer: event %d expired (%d ticks)\n", 
-	        pendingTimerEvents[i].id, pendingTimerEvents[i].origTicks);
-	    (pendingTimerEvents[i].callBack)(pendingTimerEvents[i].id);
-	} else {
-	    pendingTimerEvents[i].ticks--;
+	/*
+	 * Events added by callbacks may land in this slot,
+	 * so take them one at a time until it is empty.
+	 */
+	tick = s_wheelTick;
+	slot = &s_wheelRoot[tick & (WHEEL_ROOT_SIZE - 1)];
+	while ((event = *slot) != 0) {
+	    Remove_From_Wheel(event);
+	    if (event->period != 0) {
+		event->expires += event->period;
+		Add_To_Wheel(event);
+	    }
+	    Spin_Unlock(&s_timerLock);
+	    event->callBack(event);
+	    Spin_Lock(&s_timerLock);
 	}
+
+	++s_wheelTick;
+    }
+
+    Spin_Unlock(&s_timerLock);
+}
+
+/*
+ * Divide a 64 bit number by a 32 bit one, using only 32 bit divides,
+ * since the kernel isn't linked with libgcc.
+ */
+static unsigned long long Div64_32(unsigned long long n, ulong_t d)
+{
+    ulong_t high = (ulong_t) (n >> 32), low = (ulong_t) n;
+    ulong_t qhigh = high / d, rem = high % d, qlow;
+
+    __asm__ ("divl %2" : "=a" (qlow), "+d" (rem) : "rm" (d), "0" (low));
+    return ((unsigned long long) qhigh << 32) | qlow;
+}
+
+/*
+ * Program the local APIC timer to go off when the earliest pending
+ * high-resolution timer expires, or stop it if none are pending.
+ * Only the boot CPU's timer is used for this; other CPUs interrupt
+ * the boot CPU on the timer's vector to have it reprogrammed.
+ * The timer lock must be held.
+ */
+static void Set_HR_Deadline(void)
+{
+    unsigned long long now, delta;
+    ulong_t count;
+
+    if (s_apicTimerKHz == 0)
+	return;
+    if (Get_CPU_ID() != 0) {
+	Send_IPI(0, APIC_TIMER_VECTOR);
+	return;
+    }
+    if (s_hrTimerList == 0) {
+	Start_APIC_Timer(0);
+	return;
+    }
+
+    now = Get_Time_Ns();
+    delta = s_hrTimerList->expires > now ? s_hrTimerList->expires - now : 0;
+    if (delta > MAX_HR_DEADLINE_NS)
+	delta = MAX_HR_DEADLINE_NS;
+
+    /* Round up, so the timer never goes off early. */
+    count = (ulong_t) Div64_32(delta * s_apicTimerKHz + 999999, 1000000);
+    Start_APIC_Timer(count > 0 ? count : 1);
+}
+
+/*
+ * Fire the high-resolution timers that have expired,
+ * then program the deadline for the next one.
+ */
+static void Run_HR_Timers(void)
+{
+    unsigned long long now = Get_Time_Ns();
+
+    Spin_Lock(&s_timerLock);
+    while (s_hrTimerList != 0 && s_hrTimerList->expires <= now) {
+	struct HR_Timer *timer = s_hrTimerList;
+	s_hrTimerList = timer->next;
+	timer->pending = false;
+	Spin_Unlock(&s_timerLock);
+	timer->callBack(timer);
+	Spin_Lock(&s_timerLock);
     }
+    Set_HR_Deadline();
+    Spin_Unlock(&s_timerLock);
+}
+
+/*
+ * The local APIC timer goes off at the earliest high-resolution
+ * timer's expiry time.
+ */
+static void HR_Timer_Interrupt_Handler(struct Interrupt_State* state)
+{
+    Run_HR_Timers();
+    Local_APIC_EOI();
+}
+
+/*
+ * Charge the thread running on this CPU for a tick, and decide
+ * whether it has to give up the CPU.
+ */
+static void Tick_Current_Thread(void)
+{
+    struct Kernel_Thread* current = CURRENT_THREAD;
+
+    /* Update per-thread number of ticks */
+    ++current->numTicks;
+    ++current->stats.runTicks;
+    Charge_Tick(current);
 
     /*
      * If thread has been running for an entire quantum,
      * inform the interrupt return code that we want
      * to choose a new thread.
      */
-    if (current->numTicks >= g_Quantum) {
-	g_needReschedule = true;
+    if (current->numTicks >= Get_Quantum(current)) {
+	g_needReschedule[Get_CPU_ID()] = true;
 	/*
 	 * The current process is moved to a lower priority queue,
 	 * since it consumed a full quantum.
 	 */
-        if (current->currentReadyQueue < (MAX_QUEUE_LEVEL - 1)) {
-            /*Print("process %d moved to ready queue %d\n", current->pid, current->currentReadyQueue); */
-            current->currentReadyQueue++;
-        }
-
+	Demote_Thread(current);
     }
+}
 
+static void Timer_Interrupt_Handler(struct Interrupt_State* state)
+{
+    Begin_IRQ(state);
+
+    /* Update global number of ticks */
+    ++g_numTicks;
+    Tick_Current_Thread();
+
+    /*
+     * Without a local APIC timer, check for expired
+     * high-resolution timers on each tick.
+     */
+    if (s_apicTimerKHz == 0 && s_hrTimerList != 0)
+	Run_HR_Timers();
+
+    /* Run the timer events that are due. */
+    Run_Timer_Wheel();
 
     End_IRQ(state);
 }
 
 /*
- * Temporary timer interrupt handler used to calibrate
- * the delay loop.
+ * The PIT only interrupts the boot CPU, so the other CPUs get
+ * their scheduler tick from their local APIC timer.
  */
-static void Timer_Calibrate(struct Interrupt_State* state)
+static void AP_Tick_Interrupt_Handler(struct Interrupt_State* state)
 {
-    Begin_IRQ(state);
-    if (g_numTicks < CALIBRATE_NUM_TICKS)
-	++g_numTicks;
-    else {
-	/*
-	 * Now we can look at EAX, which reflects how many times
-	 * the loop has executed
-	 */
-	/*Print("Timer_Calibrate: eax==%d\n", state->eax);*/
-	s_spinCountPerTick = INT_MAX  - state->eax;
-	state->eax = 0;  /* make the loop terminate */
-    }
-    End_IRQ(state);
+    Tick_Current_Thread();
+    Local_APIC_EOI();
 }
 
 /*
- * Delay loop; spins for given number of iterations.
+ * Measure the TSC frequency against PIT channel 2,
+ * and start the monotonic clock.
+ * Interrupts don't matter, since channel 2 is polled.
  */
-static void Spin(int count)
+static void Calibrate_TSC(void)
 {
-    /*
-     * The assembly code is the logical equivalent of
-     *      while (count-- > 0) { // waste some time }
-     * We rely on EAX being used as the counter
-     * variable.
-     */
+    ulong_t latch = PIT_FREQ / (1000 / CALIBRATE_TSC_MS);
+    unsigned long long start, cycles;
 
-    int result;
-    __asm__ __volatile__ (
-	"1: decl %%eax\n\t"
-	"cmpl $0, %%eax\n\t"
-	"nop; nop; nop; nop; nop; nop\n\t"
-	"nop; nop; nop; nop; nop; nop\n\t"
-	"jg 1b"
-	: "=a" (result)
-	: "a" (count)
-    );
+    /* Raise the channel 2 gate, keeping the speaker off. */
+    Out_Byte(PIT_SYSTEM_CONTROL,
+	(In_Byte(PIT_SYSTEM_CONTROL) & ~PIT_CH2_SPEAKER) | PIT_CH2_GATE);
+
+    /* Channel 2, low then high byte, mode 0 (interrupt on terminal count). */
+    Out_Byte(PIT_CONTROL, 0xB0);
+    Out_Byte(PIT_CHANNEL2, latch & 0xff);
+    Out_Byte(PIT_CHANNEL2, latch >> 8);
+
+    start = Read_TSC();
+    while ((In_Byte(PIT_SYSTEM_CONTROL) & PIT_CH2_OUT) == 0)
+	;
+    cycles = Read_TSC() - start;
+
+    s_tscKHz = (ulong_t) Div64_32(cycles, CALIBRATE_TSC_MS);
+    KASSERT(s_tscKHz > 0);
+    s_nsMult = (ulong_t) Div64_32(1000000ULL << NS_SHIFT, s_tscKHz);
+    s_tscBase = Read_TSC();
 }
 
 /*
- * Calibrate the delay loop.
- * This will initialize s_spinCountPerTick, which indicates
- * how many iterations of the loop are executed per timer tick.
+ * Measure the rate of the local APIC timer against the TSC,
+ * and take over the high-resolution timers with it.
+ * Its input clock differs from one system to another.
  */
-static void Calibrate_Delay(void)
+static void Calibrate_APIC_Timer(void)
 {
-    Disable_Interrupts();
+    ulong_t elapsed;
 
-    /* Install temporarily interrupt handler */
-    Install_IRQ(TIMER_IRQ, &Timer_Calibrate);
-    Enable_IRQ(TIMER_IRQ);
+    Install_Interrupt_Handler(APIC_TIMER_VECTOR, &HR_Timer_Interrupt_Handler);
+    Init_APIC_Timer();
 
-    Enable_Interrupts();
+    Start_APIC_Timer(0xFFFFFFFF);
+    Micro_Delay(CALIBRATE_TSC_MS * 1000);
+    elapsed = 0xFFFFFFFF - Get_APIC_Timer_Count();
+    Start_APIC_Timer(0);
 
-    /* Wait a few ticks */
-    while (g_numTicks < CALIBRATE_NUM_TICKS)
-	;
+    s_apicTimerKHz = elapsed / CALIBRATE_TSC_MS;
+    KASSERT(s_apicTimerKHz > 0);
+}
 
-    /*
-     * Execute the spin loop.
-     * The temporary interrupt handler will overwrite the
-     * loop counter when the next tick occurs.
-     */
-    Spin(INT_MAX);
+/*
+ * Program PIT channel 0 to interrupt g_tickHz times a second.
+ */
+static void Set_Tick_Rate(void)
+{
+    ulong_t divisor = (PIT_FREQ + g_tickHz / 2) / g_tickHz;
 
-    Disable_Interrupts();
+    KASSERT(divisor >= 2 && divisor <= 0x10000);
 
-    /*
-     * Mask out the timer IRQ again,
-     * since we will be installing a real timer interrupt handler.
-     */
-    Disable_IRQ(TIMER_IRQ);
-    Enable_Interrupts();
+    /* Channel 0, low then high byte, mode 3 (square wave). */
+    Out_Byte(PIT_CONTROL, 0x36);
+    Out_Byte(PIT_CHANNEL0, divisor & 0xff);
+    Out_Byte(PIT_CHANNEL0, (divisor >> 8) & 0xff);
 }
 
 /* ----------------------------------------------------------------------
  * Public functions
  * ---------------------------------------------------------------------- */
 
-void Init_Timer(void)
+/*
+ * Start the timer interrupt at given rate in Hz, or at
+ * DEFAULT_TICK_HZ if it is 0.
+ */
+void Init_Timer(int tickHz)
 {
-    /*
-     * TODO: reprogram the timer to set the frequency.
-     * In bochs, it defaults to 18Hz, which is actually pretty
-     * reasonable.
-     */
-
     Print("Initializing timer...\n");
 
-    /* configure for default clock */
-    Out_Byte(0x43, 0x36);
-    Out_Byte(0x40, 0x00);
-    Out_Byte(0x40, 0x00);
-
-    /* Calibrate for delay loop */
-    Calibrate_Delay();
-    Print("Delay loop: %d iterations per tick\n", s_spinCountPerTick);
+    if (tickHz != 0 && (tickHz < MIN_TICK_HZ || tickHz > MAX_TICK_HZ)) {
+	Print("Timer: can't tick at %d Hz\n", tickHz);
+	tickHz = 0;
+    }
+    g_tickHz = tickHz != 0 ? tickHz : DEFAULT_TICK_HZ;
+    g_Quantum = Ms_To_Ticks(DEFAULT_QUANTUM_MS);
+    Set_Tick_Rate();
+
+    Calibrate_TSC();
+    Print("Timer: %lu Hz, TSC %lu kHz\n", g_tickHz, s_tscKHz);
+    if (Local_APIC_Present()) {
+	Calibrate_APIC_Timer();
+	Print("Timer: APIC timer %lu kHz\n", s_apicTimerKHz);
+    }
 
     /* Install an interrupt handler for the timer IRQ */
     Install_IRQ(TIMER_IRQ, &Timer_Interrupt_Handler);
     Enable_IRQ(TIMER_IRQ);
 }
 
-int Start_Timer(int ticks, timerCallback cb)
+/*
+ * Start the scheduler tick of the application processor we are
+ * running on, at the same rate as the boot CPU's.
+ * Interrupts must be disabled.
+ */
+void Init_AP_Timer(void)
 {
-    int ret;
+    KASSERT(s_apicTimerKHz > 0);
+    Install_Interrupt_Handler(APIC_TICK_VECTOR, &AP_Tick_Interrupt_Handler);
+    Start_APIC_Tick(s_apicTimerKHz * 1000 / g_tickHz);
+}
 
+/*
+ * Start a timer event, which will fire after given number of
+ * ticks, and then every period ticks if period is non-zero.
+ * A delay of 0 ticks fires the event at the next tick.
+ * Must be called with interrupts disabled.
+ */
+void Start_Timer(struct Timer_Event *event, ulong_t ticks, ulong_t period, timerCallback cb)
+{
     KASSERT(!Interrupts_Enabled());
+    KASSERT(!Is_Timer_Pending(event));
+
+    Spin_Lock(&s_timerLock);
+    event->expires = g_numTicks + ticks;
+    event->period = period;
+    event->callBack = cb;
+    Add_To_Wheel(event);
+    Spin_Unlock(&s_timerLock);
+}
 
-    if (timeEventCount == MAX_TIMER_EVENTS) {
-	return -1;
-    } else {
-	ret = nextEventID++;
-	pendingTimerEvents[timeEventCount].id = ret;
-	pendingTimerEvents[timeEventCount].callBack = cb;
-	pendingTimerEvents[timeEventCount].ticks = ticks;
-	pendingTimerEvents[timeEventCount].origTicks = ticks;
-	timeEventCount++;
-
-	return ret;
-    }
+/*
+ * Get the number of ticks until given pending timer event fires.
+ * Must be called with interrupts disabled.
+ */
+ulong_t Get_Remaining_Timer_Ticks(struct Timer_Event *event)
+{
+    long remaining;
+
+    KASSERT(!Interrupts_Enabled());
+    KASSERT(Is_Timer_Pending(event));
+
+    remaining = (long) (event->expires - g_numTicks);
+    return remaining > 0 ? remaining : 0;
 }
 
-int Get_Remaing_Timer_Ticks(int id)
+/*
+ * Cancel a timer event.
+ * Returns true if the event was pending, false if it had
+ * already fired (for a one-shot event) or was never started.
+ * Must be called with interrupts disabled.
+ */
+bool Cancel_Timer(struct Timer_Event *event)
 {
-    int i;
+    bool pending;
 
     KASSERT(!Interrupts_Enabled());
-    for (i=0; i < timeEventCount; i++) {
-	if (pendingTimerEvents[i].id == id) {
-	    return pendingTimerEvents[i].ticks;
-	}
-    }
 
-    return -1;
+    Spin_Lock(&s_timerLock);
+    pending = Is_Timer_Pending(event);
+    if (pending)
+	Remove_From_Wheel(event);
+    Spin_Unlock(&s_timerLock);
+
+    return pending;
+}
+
+/*
+ * Convert a number of TSC cycles to nanoseconds.
+ */
+unsigned long long Cycles_To_Ns(unsigned long long cycles)
+{
+    /* Split the multiply so it doesn't overflow for long intervals. */
+    return (cycles >> NS_SHIFT) * s_nsMult +
+	(((cycles & ((1UL << NS_SHIFT) - 1)) * s_nsMult) >> NS_SHIFT);
+}
+
+/*
+ * Get the time, in nanoseconds, since the clock was calibrated.
+ */
+unsigned long long Get_Time_Ns(void)
+{
+    return Cycles_To_Ns(Read_TSC() - s_tscBase);
 }
 
-int Cancel_Timer(int id)
+/*
+ * Get the TSC frequency, in kHz.
+ */
+ulong_t Get_TSC_KHz(void)
 {
-    int i;
+    return s_tscKHz;
+}
+
+/*
+ * Start a one-shot high-resolution timer, which will call
+ * given callback once given time (as returned by Get_Time_Ns())
+ * has passed.
+ * Must be called with interrupts disabled.
+ */
+void Start_HR_Timer(struct HR_Timer *timer, unsigned long long expires, HR_Timer_Callback cb)
+{
+    struct HR_Timer **link = &s_hrTimerList;
+
     KASSERT(!Interrupts_Enabled());
-    for (i=0; i < timeEventCount; i++) {
-	if (pendingTimerEvents[i].id == id) {
-	    pendingTimerEvents[i] = pendingTimerEvents[timeEventCount-1];
-	    timeEventCount--;
-	    return 0;
-	}
+    KASSERT(!timer->pending);
+
+    timer->expires = expires;
+    timer->callBack = cb;
+    timer->pending = true;
+
+    /* Timers with the same expiry time fire in the order started. */
+    Spin_Lock(&s_timerLock);
+    while (*link != 0 && (*link)->expires <= expires)
+	link = &(*link)->next;
+    timer->next = *link;
+    *link = timer;
+    if (s_hrTimerList == timer)
+	Set_HR_Deadline();
+    Spin_Unlock(&s_timerLock);
+}
+
+/*
+ * Cancel a pending high-resolution timer.
+ * Returns true if the timer was pending, false if it had
+ * already fired (or was never started).
+ * Must be called with interrupts disabled.
+ */
+bool Cancel_HR_Timer(struct HR_Timer *timer)
+{
+    struct HR_Timer **link = &s_hrTimerList;
+
+    KASSERT(!Interrupts_Enabled());
+
+    Spin_Lock(&s_timerLock);
+    if (!timer->pending) {
+	Spin_Unlock(&s_timerLock);
+	return false;
+    }
+    while (*link != timer) {
+	KASSERT(*link != 0);
+	link = &(*link)->next;
     }
+    *link = timer->next;
+    timer->pending = false;
+    if (link == &s_hrTimerList)
+	Set_HR_Deadline();
+    Spin_Unlock(&s_timerLock);
+    return true;
+}
+
+/*
+ * A sleeping thread, waiting on its own wait queue
+ * for a timer to go off.
+ */
+struct Sleeper {
+    struct Timer_Event event;
+    struct HR_Timer hrTimer;
+    struct Thread_Queue waitQueue;
+    volatile bool done;
+};
+
+static void Wake_Sleeper(struct Sleeper *sleeper)
+{
+    sleeper->done = true;
+    Wake_Up(&sleeper->waitQueue);
+}
 
-    Print("timer: unable to find timer id %d to cancel it\n", id);
-    return -1;
+static void Sleep_Timer_Expired(struct Timer_Event *event)
+{
+    Wake_Sleeper((struct Sleeper *) ((char *) event - offsetof(struct Sleeper, event)));
 }
 
-#define US_PER_TICK (TICKS_PER_SEC * 1000000)
+static void Sleep_HR_Timer_Expired(struct HR_Timer *timer)
+{
+    Wake_Sleeper((struct Sleeper *) ((char *) timer - offsetof(struct Sleeper, hrTimer)));
+}
 
 /*
- * Spin for at least given number of microseconds.
- * FIXME: I'm sure this implementation leaves a lot to
- * be desired.
+ * Wait until given sleeper's timer has gone off.
+ * Interrupts must be disabled.
  */
-void Micro_Delay(int us)
+static void Wait_For_Sleeper(struct Sleeper *sleeper)
 {
-    int num = us * s_spinCountPerTick;
-    int denom = US_PER_TICK;
+    while (!sleeper->done)
+	Wait(&sleeper->waitQueue);
+}
 
-    int numSpins = num / denom;
-    int rem = num % denom;
+/*
+ * Block the current thread for given number of ticks.
+ */
+void Sleep_Ticks(ulong_t ticks)
+{
+    struct Sleeper sleeper;
+    bool iflag;
+
+    Init_Timer_Event(&sleeper.event);
+    Clear_Thread_Queue(&sleeper.waitQueue);
+    sleeper.done = false;
+
+    iflag = Begin_Int_Atomic();
+    Start_Timer(&sleeper.event, ticks, 0, &Sleep_Timer_Expired);
+    Wait_For_Sleeper(&sleeper);
+    End_Int_Atomic(iflag);
+}
 
-    if (rem > 0)
-	++numSpins;
+/*
+ * Block the current thread for at least given number of
+ * microseconds, as measured by the TSC clock.
+ */
+void Sleep_Us(ulong_t us)
+{
+    struct Sleeper sleeper;
+    bool iflag;
+
+    sleeper.hrTimer.pending = false;
+    Clear_Thread_Queue(&sleeper.waitQueue);
+    sleeper.done = false;
+
+    iflag = Begin_Int_Atomic();
+    Start_HR_Timer(&sleeper.hrTimer, Get_Time_Ns() + (unsigned long long) us * 1000,
+	&Sleep_HR_Timer_Expired);
+    Wait_For_Sleeper(&sleeper);
+    End_Int_Atomic(iflag);
+}
+
+static void Alarm_Expired(struct Timer_Event *event)
+{
+    struct Kernel_Thread *kthread = (struct Kernel_Thread *)
+	((char *) event - offsetof(struct Kernel_Thread, alarmEvent));
+
+    ++kthread->alarmsPending;
+    Wake_Up(&kthread->alarmQueue);
+}
+
+/*
+ * Start the current thread's periodic alarm, which goes off
+ * every period ticks, replacing any alarm already set.
+ * A period of 0 cancels the alarm.
+ */
+void Set_Alarm(ulong_t period)
+{
+    struct Kernel_Thread *current = CURRENT_THREAD;
+    bool iflag;
+
+    iflag = Begin_Int_Atomic();
+    Cancel_Timer(&current->alarmEvent);
+    current->alarmsPending = 0;
+    if (period > 0)
+	Start_Timer(&current->alarmEvent, period, period, &Alarm_Expired);
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Wait for the current thread's alarm to go off.
+ * Returns the number of times it has gone off since the last
+ * call, which is more than 1 if the thread fell behind,
+ * or EINVALID if no alarm is set.
+ */
+int Wait_Alarm(void)
+{
+    struct Kernel_Thread *current = CURRENT_THREAD;
+    int count;
+    bool iflag;
+
+    iflag = Begin_Int_Atomic();
+    if (!Is_Timer_Pending(&current->alarmEvent) && current->alarmsPending == 0) {
+	End_Int_Atomic(iflag);
+	return EINVALID;
+    }
+    while (current->alarmsPending == 0)
+	Wait(&current->alarmQueue);
+    count = current->alarmsPending;
+    current->alarmsPending = 0;
+    End_Int_Atomic(iflag);
+
+    return count;
+}
+
+/*
+ * Spin for at least given number of microseconds,
+ * timed by the TSC.
+ */
+void Micro_Delay(int us)
+{
+    unsigned long long start = Read_TSC();
+    unsigned long long cycles;
 
-    Debug("Micro_Delay(): num=%d, denom=%d, spin count = %d\n", num, denom, numSpins);
+    KASSERT(s_tscKHz != 0);
 
-    Spin(numSpins);
+    cycles = Div64_32((unsigned long long) us * s_tscKHz + 999, 1000);
+    while (Read_TSC() - start < cycles)
+	__asm__ __volatile__ ("pause");
 }
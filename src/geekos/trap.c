@@ -26,7 +26,7 @@ static void GPF_Handler(struct Interrupt_State* state)
 {
     /* Send the thread to the reaper... */
     Print("Exception %d received, killing thread %p\n",
-	state->intNum, g_currentThread);
+	state->intNum, CURRENT_THREAD);
     Dump_Interrupt_State(state);
 
     Exit(-1);
@@ -46,7 +46,7 @@ static void Syscall_Handler(struct Interrupt_State* state)
     /* Make sure the the system call number refers to a legal value. */
     if (syscallNum < 0 || syscallNum >= g_numSyscalls) {
 	Print("Illegal system call %d by process %d\n",
-		syscallNum, g_currentThread->pid);
+		syscallNum, CURRENT_THREAD->pid);
 	Exit(-1);
 
 	/* We will never get here */
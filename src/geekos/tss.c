@@ -17,61 +17,66 @@
 #include <geekos/gdt.h>
 #include <geekos/segment.h>
 #include <geekos/string.h>
+#include <geekos/smp.h>
 #include <geekos/tss.h>
 
 /*
- * We use one TSS in GeekOS.
+ * We use one TSS per CPU in GeekOS, since each CPU has its own
+ * kernel stack pointer.
  */
-static struct TSS s_theTSS;
-static struct Segment_Descriptor *s_tssDesc;
-static ushort_t s_tssSelector;
+static struct TSS s_theTSS[MAX_CPUS];
+static struct Segment_Descriptor *s_tssDesc[MAX_CPUS];
+static ushort_t s_tssSelector[MAX_CPUS];
 
-static void __inline__ Load_Task_Register(void)
+static void __inline__ Load_Task_Register(int cpu)
 {
     /* Critical: TSS must be marked as not busy */
-    s_tssDesc->type = 0x09;
+    s_tssDesc[cpu]->type = 0x09;
 
     /* Load the task register */
     __asm__ __volatile__ (
 	"ltr %0"
 	:
-	: "a" (s_tssSelector)
+	: "a" (s_tssSelector[cpu])
     );
 }
 
 /*
- * Initialize the kernel TSS.  This must be done after the memory and
+ * Initialize the kernel TSS of the CPU we are running on.
+ * On the boot CPU, this must be done after the memory and
  * GDT initialization, but before the scheduler is started.
  */
 void Init_TSS(void)
 {
-    s_tssDesc = Allocate_Segment_Descriptor();
-    KASSERT(s_tssDesc != 0);
+    int cpu = Get_CPU_ID();
 
-    memset(&s_theTSS, '\0', sizeof(struct TSS));
-    Init_TSS_Descriptor(s_tssDesc, &s_theTSS);
+    s_tssDesc[cpu] = Allocate_Segment_Descriptor();
+    KASSERT(s_tssDesc[cpu] != 0);
 
-    s_tssSelector = Selector(0, true, Get_Descriptor_Index(s_tssDesc));
+    memset(&s_theTSS[cpu], '\0', sizeof(struct TSS));
+    Init_TSS_Descriptor(s_tssDesc[cpu], &s_theTSS[cpu]);
 
-    Load_Task_Register();
+    s_tssSelector[cpu] = Selector(0, true, Get_Descriptor_Index(s_tssDesc[cpu]));
+
+    Load_Task_Register(cpu);
 }
 
 /*
- * Set kernel stack pointer.
+ * Set kernel stack pointer of the CPU we are running on.
  * This should be called before switching to a new
  * user process, so that interrupts occurring while executing
  * in user mode will be delivered on the correct stack.
+ * Interrupts must be disabled.
  */
 void Set_Kernel_Stack_Pointer(ulong_t esp0)
 {
-    s_theTSS.ss0 = KERNEL_DS;
-    s_theTSS.esp0 = esp0;
+    struct TSS* tss = &s_theTSS[Get_CPU_ID()];
 
     /*
-     * NOTE: I read on alt.os.development that it is necessary to
-     * reload the task register after modifying a TSS.
-     * I haven't verified this in the IA32 documentation,
-     * but there is certainly no harm in being paranoid.
+     * The CPU reads ss0 and esp0 from the TSS in memory on every
+     * transition to kernel mode, so there is no need to reload
+     * the task register after changing them.
      */
-    Load_Task_Register();
+    tss->ss0 = KERNEL_DS;
+    tss->esp0 = esp0;
 }
@@ -84,6 +84,29 @@ void Detach_User_Context(struct Kernel_Thread* kthread)
  *   the executable file doesn't exist.
  */
 int Spawn(const char *program, const char *command, struct Kernel_Thread **pThread)
+{
+    return Spawn_With_Files(program, command, 0, false, pThread);
+}
+
+/*
+ * Spawn a user process with given standard input and output.
+ * Params:
+ *   program - the full path of the program executable file
+ *   command - the command, including name of program and arguments
+ *   stdFiles - files for the new process's STDIN_FD and STDOUT_FD
+ *     descriptors (each of which may be null for the console),
+ *     or null if both should be the console; the process gets
+ *     its own references to them
+ *   detached - true if the new thread should not be owned by
+ *     the current thread (and so cannot be waited for)
+ *   pThread - reference to Kernel_Thread pointer where a pointer to
+ *     the newly created user mode thread (process) should be
+ *     stored
+ * Returns: 0 if successful, or an error code (< 0) if not,
+ *   which is ENOTFOUND if the executable file doesn't exist
+ */
+int Spawn_With_Files(const char *program, const char *command, struct File *stdFiles[2],
+    bool detached, struct Kernel_Thread **pThread)
 {
     /*
      * Hints:
@@ -98,51 +121,71 @@ int Spawn(const char *program, const char *command, struct Kernel_Thread **pThre
      * If all goes well, store the pointer to the new thread in
      * pThread and return 0.  Otherwise, return an error code.
      */
-    //TODO("Spawn a process by reading an executable from a filesystem");
 	char *exeFileData = 0;
 	ulong_t exeFileLength;
 	struct Exe_Format exeFormat;
-	struct User_Context *pUserContext = Malloc (sizeof (struct User_Context));
-	bool detached = ((*pThread)->refCount == 0);
-	
-	Print("Reading %s... \n", program);
-	if(Read_Fully(program, (void**) &exeFileData, &exeFileLength) != 0)
-	{
-		Print("Read_Fully failed to read %s from disk\ne", program);
-		Exit(-1);
-	}
-	Print("Read_Fully OK\n");
-	
-	if(Parse_ELF_Executable(exeFileData, exeFileLength, &exeFormat) != 0)
-	{
-		Print("Parse_ELF_Executable failed\n");
-		Exit(-1);
-	}
-	Print("Parse_ELF_Executable OK\n");
-	
-	if (Load_User_Program(exeFileData, exeFileLength, &exeFormat, command, &pUserContext) != 0)
+	struct User_Context *pUserContext = 0;
+	int i, rc;
+
+	/*
+	 * Failures are returned rather than killing the caller, so
+	 * that a shell can search its path, and go on after a stage
+	 * of a pipeline couldn't be started.
+	 */
+	if ((rc = Read_Fully(program, (void**) &exeFileData, &exeFileLength)) != 0)
+		return rc;
+
+	if ((rc = Parse_ELF_Executable(exeFileData, exeFileLength, &exeFormat)) != 0 ||
+	    (rc = Load_User_Program(exeFileData, exeFileLength, &exeFormat, command, &pUserContext)) != 0)
 	{
-		Print("Load_User_Program failed\n");
-		Exit(-1);
+		Free(exeFileData);
+		return rc;
 	}
-	Print("Load_User_Program OK\n");
 
 	Free(exeFileData);
 	exeFileData=0;
-	
+
+	/* The files must be in place before the process can run. */
+	if (stdFiles != 0)
+	{
+		for (i = 0; i < 2; ++i)
+		{
+			if (stdFiles[i] != 0)
+			{
+				Ref_File(stdFiles[i]);
+				pUserContext->file[i] = stdFiles[i];
+			}
+		}
+	}
+
 	(*pThread) = Start_User_Thread(pUserContext, detached);
-	if(pThread == NULL)
+	if ((*pThread) == NULL)
 	{
-		Print("Start_User_Thread failed\n");
-		Exit(-1);
+		Destroy_User_Context(pUserContext);
+		return ENOMEM;
 	}
-	Print("Start_User_Thread OK\n");
-	Print("Pid: %i\n",(*pThread)->pid);
-	
-//	return((*pThread)->pid);
+
         return(0);
 }
 
+/*
+ * Close all files a process has open.
+ * Interrupts must be enabled.
+ */
+void Close_User_Files(struct User_Context* context)
+{
+    int fd;
+
+    for (fd = 0; fd < USER_MAX_FILES; ++fd) {
+	if (context->file[fd] != 0) {
+	    struct File *file = context->file[fd];
+
+	    context->file[fd] = 0;
+	    Close(file);
+	}
+    }
+}
+
 /*
  * If the given thread has a User_Context,
  * switch to its memory space.
@@ -159,10 +202,16 @@ void Switch_To_User_Context(struct Kernel_Thread* kthread, struct Interrupt_Stat
      * the Set_Kernel_Stack_Pointer() and Switch_To_Address_Space()
      * functions.
      */
-	Set_Kernel_Stack_Pointer(kthread->stackPage + PAGE_SIZE);
-	if (kthread->userContext != NULL){
-			Switch_To_Address_Space(kthread->userContext);
-	}
+	/*
+	 * Kernel threads never leave kernel mode, so they need neither
+	 * a kernel stack in the TSS nor an LDT.  This is called on every
+	 * return from an interrupt, so return as soon as possible.
+	 */
+	if (kthread->userContext == NULL)
+		return;
+
+	Set_Kernel_Stack_Pointer((ulong_t) kthread->stackPage + PAGE_SIZE);
+	Switch_To_Address_Space(kthread->userContext);
     //TODO("Switch to a new user address space, if necessary");
 }
 
@@ -18,8 +18,11 @@
 #include <geekos/segment.h>
 #include <geekos/tss.h>
 #include <geekos/kthread.h>
+#include <geekos/smp.h>
 #include <geekos/argblock.h>
 #include <geekos/user.h>
+#include <geekos/sem.h>
+#include <geekos/shm.h>
 
 /* ----------------------------------------------------------------------
  * Variables
@@ -27,6 +30,11 @@
 
 #define DEFAULT_USER_STACK_SIZE 8192
 
+/*
+ * Selector of the LDT currently loaded in each CPU's LDTR,
+ * or 0 if none is.
+ */
+static ushort_t s_currentLdtSelector[MAX_CPUS];
 
 /* ----------------------------------------------------------------------
  * Private functions
@@ -66,6 +74,8 @@ static bool Validate_User_Memory(struct User_Context* userContext,
  */
 void Destroy_User_Context(struct User_Context* userContext)
 {
+    int cpu;
+
     /*
      * Hints:
      * - you need to free the memory allocated for the user process
@@ -73,6 +83,22 @@ void Destroy_User_Context(struct User_Context* userContext)
      *   for the process's LDT
      */
     //TODO("Destroy a User_Context");
+	Close_User_Files(userContext);
+	Sem_Release_All(userContext);
+	Shm_Detach_All(userContext);
+
+	/*
+	 * The LDT descriptor may be reused for the next process,
+	 * so make sure its selector doesn't look already loaded
+	 * on any CPU.
+	 */
+	Disable_Interrupts();
+	for (cpu = 0; cpu < g_numCPUsOnline; ++cpu) {
+		if (userContext->ldtSelector == s_currentLdtSelector[cpu])
+			s_currentLdtSelector[cpu] = 0;
+	}
+	Enable_Interrupts();
+
 	Free_Segment_Descriptor(userContext->ldtDescriptor);
 	
 	Disable_Interrupts();
@@ -152,8 +178,12 @@ int Load_User_Program(char *exeFileData, ulong_t exeFileLength,
 	(*pUserContext)->argBlockAddr = argBlockAddr;
 	(*pUserContext)->stackPointerAddr = argBlockAddr;
 	(*pUserContext)->refCount = 0;
+	(*pUserContext)->semaphores = 0;
+	(*pUserContext)->maxSemaphores = 0;
+	memset((*pUserContext)->file, '\0', sizeof((*pUserContext)->file));
+	memset((*pUserContext)->shm, '\0', sizeof((*pUserContext)->shm));
+	memset((*pUserContext)->ldt, '\0', sizeof((*pUserContext)->ldt));
 	(*pUserContext)->ldtDescriptor = Allocate_Segment_Descriptor();
-Print("LDT Descriptor is %d\n", &(*pUserContext)->ldtDescriptor);
 Init_LDT_Descriptor((*pUserContext)->ldtDescriptor, (*pUserContext)->ldt, NUM_USER_LDT_ENTRIES);
 indexDescriptor = Get_Descriptor_Index((*pUserContext)->ldtDescriptor);
 (*pUserContext)->ldtSelector = Selector(KERNEL_PRIVILEGE, true, indexDescriptor);
@@ -187,15 +217,15 @@ bool Copy_From_User(void* destInKernel, ulong_t srcInUser, ulong_t bufSize)
     /*
      * Hints:
      * - the User_Context of the current process can be found
-     *   from g_currentThread->userContext
+     *   from CURRENT_THREAD->userContext
      * - the user address is an index relative to the chunk
      *   of memory you allocated for it
      * - make sure the user buffer lies entirely in memory belonging
      *   to the process
      */
     //TODO("Copy memory from user buffer to kernel buffer");
-	unsigned char * memory = (unsigned char *)(g_currentThread->userContext->memory);
-    if(Validate_User_Memory(g_currentThread->userContext,srcInUser,bufSize))
+	unsigned char * memory = (unsigned char *)(CURRENT_THREAD->userContext->memory);
+    if(Validate_User_Memory(CURRENT_THREAD->userContext,srcInUser,bufSize))
 	{
 		memcpy(destInKernel, memory + srcInUser, bufSize);
 		return true;
@@ -224,8 +254,8 @@ bool Copy_To_User(ulong_t destInUser, void* srcInKernel, ulong_t bufSize)
      * Hints: same as for Copy_From_User()
      */
     //TODO("Copy memory from kernel buffer to user buffer");
-	unsigned char * memory = (unsigned char *)(g_currentThread->userContext->memory);
-	if (Validate_User_Memory(g_currentThread->userContext,destInUser,bufSize))
+	unsigned char * memory = (unsigned char *)(CURRENT_THREAD->userContext->memory);
+	if (Validate_User_Memory(CURRENT_THREAD->userContext,destInUser,bufSize))
 	{
                 memcpy(memory+destInUser,srcInKernel,bufSize);
                 return true;
@@ -250,7 +280,13 @@ void Switch_To_Address_Space(struct User_Context *userContext)
      */
     //TODO("Switch to user address space using segmentation/LDT");
 	ushort_t ldtSelector;
+	int cpu = Get_CPU_ID();
 	ldtSelector = userContext->ldtSelector;
-	__asm__ __volatile__ ("lldt %0" : : "a" (ldtSelector));
+
+	/* Skip the lldt if this address space is already loaded. */
+	if (ldtSelector != s_currentLdtSelector[cpu]) {
+		__asm__ __volatile__ ("lldt %0" : : "a" (ldtSelector));
+		s_currentLdtSelector[cpu] = ldtSelector;
+	}
 }
 
@@ -10,6 +10,7 @@
 
 #include <geekos/errno.h>
 #include <geekos/list.h>
+#include <geekos/int.h>
 #include <geekos/string.h>
 #include <geekos/screen.h>
 #include <geekos/malloc.h>
@@ -27,11 +28,11 @@
  * ---------------------------------------------------------------------- */
 
 /*
- * We use a single mutex to protect VFS data structures
- * from concurrent access/modification.  Simple, but not efficient.
- * Perhaps this should really be a reader/writer lock.
+ * Reader/writer lock protecting the lists of filesystems and
+ * mount points.  Lookups, which are by far the most common
+ * operation, only need to lock it for reading.
  */
-static struct Mutex s_vfsLock;
+static struct RW_Lock s_vfsLock;
 
 int debugVFS = 0;
 #define Debug(args...) if (debugVFS) Print("VFS: " args)
@@ -135,14 +136,14 @@ static struct Filesystem *Lookup_Filesystem(const char *fstype)
 {
     struct Filesystem *fs;
 
-    Mutex_Lock(&s_vfsLock);
+    Read_Lock(&s_vfsLock);
     fs = Get_Front_Of_Filesystem_List(&s_filesystemList);
     while (fs != 0) {
 	if (strcmp(fs->fsName, fstype) == 0)
 	    break;
 	fs = Get_Next_In_Filesystem_List(fs);
     }
-    Mutex_Unlock(&s_vfsLock);
+    Read_Unlock(&s_vfsLock);
 
     return fs;
 }
@@ -157,7 +158,7 @@ static struct Mount_Point *Lookup_Mount_Point(const char *prefix)
 {
     struct Mount_Point *mountPoint;
 
-    Mutex_Lock(&s_vfsLock);
+    Read_Lock(&s_vfsLock);
 
     /* Look for a mounted filesystem with a matching prefix */
     mountPoint = Get_Front_Of_Mount_Point_List(&s_mountPointList);
@@ -168,7 +169,7 @@ static struct Mount_Point *Lookup_Mount_Point(const char *prefix)
 	mountPoint = Get_Next_In_Mount_Point_List(mountPoint);
     }
 
-    Mutex_Unlock(&s_vfsLock);
+    Read_Unlock(&s_vfsLock);
 
     return mountPoint;
 }
@@ -255,9 +256,9 @@ bool Register_Filesystem(const char *fsName, struct Filesystem_Ops *fsOps)
     fs->fsName[VFS_MAX_FS_NAME_LEN] = '\0';
 
     /* Add the filesystem to the list */
-    Mutex_Lock(&s_vfsLock);
+    Write_Lock(&s_vfsLock);
     Add_To_Back_Of_Filesystem_List(&s_filesystemList, fs);
-    Mutex_Unlock(&s_vfsLock);
+    Write_Unlock(&s_vfsLock);
 
     return true;
 }
@@ -354,9 +355,9 @@ int Mount(const char *devname, const char *pathPrefix, const char *fstype)
      * FIXME: should ensure that there aren't any filesystems
      * mounted on the same filesystem root.
      */
-    Mutex_Lock(&s_vfsLock);
+    Write_Lock(&s_vfsLock);
     Add_To_Back_Of_Mount_Point_List(&s_mountPointList, mountPoint);
-    Mutex_Unlock(&s_vfsLock);
+    Write_Unlock(&s_vfsLock);
 
     return 0;
 
@@ -389,19 +390,27 @@ int Open(const char *path, int mode, struct File **pFile)
 }
 
 /*
- * Close a file or directory.  This will destroy the file object,
- * so it is important not to use the file again after this function
- * is called.
+ * Close a file or directory.  This drops a reference to the file
+ * object, and destroys it if it was the last one, so it is important
+ * not to use the file again after this function is called.
  * Params:
  *   file - the File to close
  * Returns: 0 if successful, error code (< 0) if not
  */
 int Close(struct File *file)
 {
-    int rc;
+    int rc, refCount;
+    bool iflag;
 
     KASSERT(file->ops->Close != 0); /* All filesystems must implement Close(). */
 
+    iflag = Begin_Int_Atomic();
+    KASSERT(file->refCount > 0);
+    refCount = --file->refCount;
+    End_Int_Atomic(iflag);
+    if (refCount > 0)
+	return 0;
+
     rc = file->ops->Close(file);
     if (rc == 0)
 	Free(file);
@@ -446,7 +455,7 @@ int Sync(void)
     int rc = 0;
     struct Mount_Point *mountPoint;
 
-    Mutex_Lock(&s_vfsLock);
+    Read_Lock(&s_vfsLock);
     for (mountPoint = Get_Front_Of_Mount_Point_List(&s_mountPointList);
 	 mountPoint != 0;
 	 mountPoint = Get_Next_In_Mount_Point_List(mountPoint)) {
@@ -455,7 +464,7 @@ int Sync(void)
 	if (rc != 0)
 	    break;
     }
-    Mutex_Unlock(&s_vfsLock);
+    Read_Unlock(&s_vfsLock);
 
     return rc;
 }
@@ -485,10 +494,25 @@ struct File *Allocate_File(struct File_Ops *ops, int filePos, int endPos, void *
 	file->fsData = fsData;
 	file->mode = mode;
 	file->mountPoint = mountPoint;
+	file->refCount = 1;
     }
     return file;
 }
 
+/*
+ * Add a reference to given file, which must be dropped
+ * with a call to Close().
+ */
+void Ref_File(struct File *file)
+{
+    bool iflag;
+
+    iflag = Begin_Int_Atomic();
+    KASSERT(file->refCount > 0);
+    ++file->refCount;
+    End_Int_Atomic(iflag);
+}
+
 /*
  * Get metadata for given file.
  * Params:
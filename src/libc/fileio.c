@@ -0,0 +1,25 @@
+/*
+ * User-mode file I/O
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/syscall.h>
+#include <string.h>
+#include <fileio.h>
+
+DEF_SYSCALL(Open,SYS_OPEN,int,(const char *path, int mode),
+    const char *arg0 = path; size_t arg1 = strlen(path); int arg2 = mode;,
+    SYSCALL_REGS_3)
+DEF_SYSCALL(Close,SYS_CLOSE,int,(int fd),int arg0 = fd;,SYSCALL_REGS_1)
+DEF_SYSCALL(Read,SYS_READ,int,(int fd, void *buf, ulong_t len),
+    int arg0 = fd; void *arg1 = buf; ulong_t arg2 = len;,
+    SYSCALL_REGS_3)
+DEF_SYSCALL(Write,SYS_WRITE,int,(int fd, const void *buf, ulong_t len),
+    int arg0 = fd; const void *arg1 = buf; ulong_t arg2 = len;,
+    SYSCALL_REGS_3)
+DEF_SYSCALL(Create_Pipe,SYS_PIPE,int,(int *readFd, int *writeFd),
+    int *arg0 = readFd; int *arg1 = writeFd;,
+    SYSCALL_REGS_2)
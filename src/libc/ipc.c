@@ -0,0 +1,71 @@
+/*
+ * Synchronous message passing between processes
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/syscall.h>
+#include <ipc.h>
+
+/*
+ * The IPC system calls take and return the pid of the process at
+ * the other end in ebx and the message in ecx..edi, so they can't
+ * be generated with DEF_SYSCALL.
+ */
+static __inline__ int Ipc_Syscall(int num, int *pid, struct Ipc_Message *msg)
+{
+    int rc;
+
+    __asm__ __volatile__ (SYSCALL
+	: "=a" (rc), "+b" (*pid),
+	  "+c" (msg->word[0]), "+d" (msg->word[1]), "+S" (msg->word[2]), "+D" (msg->word[3])
+	: "0" (num)
+	: "memory");
+    return rc;
+}
+
+/*
+ * Call given process with a message, and wait for its reply,
+ * which replaces the message.
+ * Returns 0 if successful, or an error code (< 0) if not.
+ */
+int Ipc_Call(int pid, struct Ipc_Message *msg)
+{
+    return Ipc_Syscall(SYS_IPCCALL, &pid, msg);
+}
+
+/*
+ * Wait for a call from any process.
+ * Returns the pid of the caller, to be passed to Ipc_Reply()
+ * or Ipc_Reply_Wait(), and stores its message in msg.
+ */
+int Ipc_Receive(struct Ipc_Message *msg)
+{
+    int pid = 0;
+    int rc = Ipc_Syscall(SYS_IPCRECEIVE, &pid, msg);
+
+    return rc == 0 ? pid : rc;
+}
+
+/*
+ * Reply to a call from given process.
+ * Returns 0 if successful, or an error code (< 0) if not.
+ */
+int Ipc_Reply(int pid, struct Ipc_Message *reply)
+{
+    return Ipc_Syscall(SYS_IPCREPLY, &pid, reply);
+}
+
+/*
+ * Reply to a call from given process, and wait for the next
+ * call from any process, whose message replaces the reply.
+ * Returns the pid of the next caller, or an error code (< 0).
+ */
+int Ipc_Reply_Wait(int pid, struct Ipc_Message *msg)
+{
+    int rc = Ipc_Syscall(SYS_IPCREPLYWAIT, &pid, msg);
+
+    return rc == 0 ? pid : rc;
+}
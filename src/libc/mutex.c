@@ -0,0 +1,252 @@
+/*
+ * User-space mutexes and condition variables
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+/*
+ * Source: Ulrich Drepper, "Futexes Are Tricky", mutex version 2.
+ */
+
+#include <geekos/syscall.h>
+#include <mutex.h>
+
+DEF_SYSCALL(Shm_Futex_Wait,SYS_FUTEXWAIT,int,(int shm, ulong_t offset, int expected),
+    ulong_t arg0 = offset; int arg1 = expected; int arg2 = shm;,
+    SYSCALL_REGS_3)
+DEF_SYSCALL(Shm_Futex_Wake,SYS_FUTEXWAKE,int,(int shm, ulong_t offset, int count),
+    ulong_t arg0 = offset; int arg1 = count; int arg2 = shm;,
+    SYSCALL_REGS_3)
+
+int Futex_Wait(volatile int *addr, int expected)
+{
+    return Shm_Futex_Wait(0, (ulong_t) addr, expected);
+}
+
+int Futex_Wake(volatile int *addr, int count)
+{
+    return Shm_Futex_Wake(0, (ulong_t) addr, count);
+}
+
+enum { UNLOCKED, LOCKED, CONTENDED };
+
+/* Wake this many threads to wake them all. */
+#define WAKE_ALL 0x7fffffff
+
+/*
+ * Atomically set *addr to newValue if it equals expected.
+ * Returns the old value of *addr.
+ */
+static __inline__ int Compare_And_Swap(volatile int *addr, int expected, int newValue)
+{
+    int old;
+
+    __asm__ __volatile__ ("lock; cmpxchgl %2, %1"
+	: "=a" (old), "+m" (*addr) : "r" (newValue), "0" (expected) : "memory");
+    return old;
+}
+
+/*
+ * Atomically set *addr to given value, returning its old value.
+ */
+static __inline__ int Exchange(volatile int *addr, int value)
+{
+    __asm__ __volatile__ ("xchgl %0, %1"
+	: "+r" (value), "+m" (*addr) : : "memory");
+    return value;
+}
+
+/*
+ * The same, on an int at given offset in a shared memory segment,
+ * which is reached through fs as in shm.c.
+ */
+static __inline__ int Shm_Compare_And_Swap(int shm, ulong_t offset, int expected, int newValue)
+{
+    int old;
+
+    __asm__ __volatile__ ("movw %w2, %%fs\n\t"
+	"lock; cmpxchgl %3, %%fs:(%4)"
+	: "=a" (old) : "0" (expected), "r" (shm), "r" (newValue), "r" (offset) : "memory");
+    return old;
+}
+
+static __inline__ int Shm_Exchange(int shm, ulong_t offset, int value)
+{
+    __asm__ __volatile__ ("movw %w1, %%fs\n\t"
+	"xchgl %0, %%fs:(%2)"
+	: "+r" (value) : "r" (shm), "r" (offset) : "memory");
+    return value;
+}
+
+static __inline__ int Shm_Load(int shm, ulong_t offset)
+{
+    int value;
+
+    __asm__ __volatile__ ("movw %w1, %%fs\n\t"
+	"movl %%fs:(%2), %0"
+	: "=r" (value) : "r" (shm), "r" (offset) : "memory");
+    return value;
+}
+
+static __inline__ void Shm_Atomic_Add(int shm, ulong_t offset, int delta)
+{
+    __asm__ __volatile__ ("movw %w0, %%fs\n\t"
+	"lock; addl %1, %%fs:(%2)"
+	: : "r" (shm), "r" (delta), "r" (offset) : "memory");
+}
+
+static __inline__ void Atomic_Increment(volatile int *addr)
+{
+    __asm__ __volatile__ ("lock; incl %0" : "+m" (*addr) : : "memory");
+}
+
+static __inline__ void Atomic_Decrement(volatile int *addr)
+{
+    __asm__ __volatile__ ("lock; decl %0" : "+m" (*addr) : : "memory");
+}
+
+/*
+ * Lock a mutex that is, or may be, contended.
+ * The mutex is left CONTENDED, so the unlock will wake a waiter.
+ */
+static void Lock_Contended(struct User_Mutex *mutex)
+{
+    while (Exchange(&mutex->state, CONTENDED) != UNLOCKED)
+	Futex_Wait(&mutex->state, CONTENDED);
+}
+
+void User_Mutex_Init(struct User_Mutex *mutex)
+{
+    mutex->state = UNLOCKED;
+}
+
+void User_Mutex_Lock(struct User_Mutex *mutex)
+{
+    if (Compare_And_Swap(&mutex->state, UNLOCKED, LOCKED) != UNLOCKED)
+	Lock_Contended(mutex);
+}
+
+/*
+ * Lock a mutex if it is unlocked.
+ * Returns true if the mutex was locked.
+ */
+int User_Mutex_Try_Lock(struct User_Mutex *mutex)
+{
+    return Compare_And_Swap(&mutex->state, UNLOCKED, LOCKED) == UNLOCKED;
+}
+
+void User_Mutex_Unlock(struct User_Mutex *mutex)
+{
+    if (Exchange(&mutex->state, UNLOCKED) == CONTENDED)
+	Futex_Wake(&mutex->state, 1);
+}
+
+/*
+ * Mutexes in shared memory segments, named by the segment and the
+ * offset of the mutex in it, work the same way.  A segment starts
+ * out zeroed, so a mutex in it starts out unlocked.  The kernel keys
+ * the futex by where the segment is, so processes with the segment
+ * attached wait on and wake the same futex.
+ */
+static void Shm_Lock_Contended(int shm, ulong_t offset)
+{
+    while (Shm_Exchange(shm, offset, CONTENDED) != UNLOCKED)
+	Shm_Futex_Wait(shm, offset, CONTENDED);
+}
+
+void Shm_Mutex_Lock(int shm, ulong_t offset)
+{
+    if (Shm_Compare_And_Swap(shm, offset, UNLOCKED, LOCKED) != UNLOCKED)
+	Shm_Lock_Contended(shm, offset);
+}
+
+int Shm_Mutex_Try_Lock(int shm, ulong_t offset)
+{
+    return Shm_Compare_And_Swap(shm, offset, UNLOCKED, LOCKED) == UNLOCKED;
+}
+
+void Shm_Mutex_Unlock(int shm, ulong_t offset)
+{
+    if (Shm_Exchange(shm, offset, UNLOCKED) == CONTENDED)
+	Shm_Futex_Wake(shm, offset, 1);
+}
+
+void User_Cond_Init(struct User_Condition *cond)
+{
+    cond->seq = 0;
+    cond->waiters = 0;
+}
+
+/*
+ * Wait on a condition variable, with given mutex locked.
+ * The mutex is released while waiting, and locked again on return.
+ * Like any condition wait, this can return without a signal,
+ * so the caller must recheck its condition.
+ */
+void User_Cond_Wait(struct User_Condition *cond, struct User_Mutex *mutex)
+{
+    int seq = cond->seq;
+
+    Atomic_Increment(&cond->waiters);
+    User_Mutex_Unlock(mutex);
+    /* If a signal came after reading seq, this returns at once. */
+    Futex_Wait(&cond->seq, seq);
+    Atomic_Decrement(&cond->waiters);
+    Lock_Contended(mutex);
+}
+
+/*
+ * Wake one thread waiting on a condition variable.
+ * Only enters the kernel if some thread is waiting.
+ */
+void User_Cond_Signal(struct User_Condition *cond)
+{
+    Atomic_Increment(&cond->seq);
+    if (cond->waiters > 0)
+	Futex_Wake(&cond->seq, 1);
+}
+
+/*
+ * Wake all threads waiting on a condition variable.
+ */
+void User_Cond_Broadcast(struct User_Condition *cond)
+{
+    Atomic_Increment(&cond->seq);
+    if (cond->waiters > 0)
+	Futex_Wake(&cond->seq, WAKE_ALL);
+}
+
+/*
+ * Condition variables in shared memory segments work like
+ * User_Condition, with the sequence number at the given offset
+ * and the waiter count in the int after it.
+ */
+#define SHM_COND_WAITERS(offset) ((offset) + sizeof(int))
+
+void Shm_Cond_Wait(int shm, ulong_t offset, ulong_t mutexOffset)
+{
+    int seq = Shm_Load(shm, offset);
+
+    Shm_Atomic_Add(shm, SHM_COND_WAITERS(offset), 1);
+    Shm_Mutex_Unlock(shm, mutexOffset);
+    /* If a signal came after reading seq, this returns at once. */
+    Shm_Futex_Wait(shm, offset, seq);
+    Shm_Atomic_Add(shm, SHM_COND_WAITERS(offset), -1);
+    Shm_Lock_Contended(shm, mutexOffset);
+}
+
+void Shm_Cond_Signal(int shm, ulong_t offset)
+{
+    Shm_Atomic_Add(shm, offset, 1);
+    if (Shm_Load(shm, SHM_COND_WAITERS(offset)) > 0)
+	Shm_Futex_Wake(shm, offset, 1);
+}
+
+void Shm_Cond_Broadcast(int shm, ulong_t offset)
+{
+    Shm_Atomic_Add(shm, offset, 1);
+    if (Shm_Load(shm, SHM_COND_WAITERS(offset)) > 0)
+	Shm_Futex_Wake(shm, offset, WAKE_ALL);
+}
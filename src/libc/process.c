@@ -12,6 +12,7 @@
 #include <geekos/ktypes.h>
 #include <geekos/syscall.h>
 #include <geekos/errno.h>
+#include <geekos/fileio.h>
 #include <string.h>
 #include <process.h>
 
@@ -20,9 +21,16 @@ DEF_SYSCALL(Null,SYS_NULL,int,(void),,SYSCALL_REGS_0)
 DEF_SYSCALL(Exit,SYS_EXIT,int,(int exitCode), int arg0 = exitCode;, SYSCALL_REGS_1)
 DEF_SYSCALL(Spawn_Program,SYS_SPAWN,int,
     (const char *program, const char *command),
-    const char *arg0 = program; size_t arg1 = strlen(program); const char *arg2 = command; size_t arg3 = strlen(command);,
-    SYSCALL_REGS_4)
-DEF_SYSCALL(Wait,SYS_WAIT,int,(int pid),int arg0 = pid;,SYSCALL_REGS_1)
+    const char *arg0 = program; size_t arg1 = strlen(program); const char *arg2 = command; size_t arg3 = strlen(command); int *arg4 = 0;,
+    SYSCALL_REGS_5)
+static DEF_SYSCALL(Spawn_With_Std_Fds,SYS_SPAWN,int,
+    (const char *program, const char *command, const int *stdFds),
+    const char *arg0 = program; size_t arg1 = strlen(program); const char *arg2 = command; size_t arg3 = strlen(command); const int *arg4 = stdFds;,
+    SYSCALL_REGS_5)
+DEF_SYSCALL(Wait,SYS_WAIT,int,(int pid),int arg0 = pid; void *arg1 = 0;,SYSCALL_REGS_2)
+DEF_SYSCALL(Wait_With_Stats,SYS_WAIT,int,(int pid, struct Thread_Stats *stats),
+    int arg0 = pid; struct Thread_Stats *arg1 = stats;,
+    SYSCALL_REGS_2)
 DEF_SYSCALL(Get_PID,SYS_GETPID,int,(void),,SYSCALL_REGS_0)
 
 #define CMDLEN 79
@@ -44,15 +52,35 @@ static bool Ends_With(const char *name, const char *suffix)
     return true;
 }
 
+/*
+ * Spawn a process whose standard input and output are
+ * the given file descriptors of the caller.
+ */
+int Spawn_Program_With_Files(const char *program, const char *command,
+    int stdinFd, int stdoutFd)
+{
+    int stdFds[2];
+
+    stdFds[0] = stdinFd;
+    stdFds[1] = stdoutFd;
+    return Spawn_With_Std_Fds(program, command, stdFds);
+}
+
 int Spawn_With_Path(const char *program, const char *command,
     const char *path)
+{
+    return Spawn_With_Path_And_Files(program, command, path, STDIN_FD, STDOUT_FD);
+}
+
+int Spawn_With_Path_And_Files(const char *program, const char *command,
+    const char *path, int stdinFd, int stdoutFd)
 {
     int pid;
     char exeName[(CMDLEN*2)+5];
 
     /* Try executing program as specified */
-    pid = Spawn_Program(program, command
-	);
+    pid = Spawn_Program_With_Files(program, command,
+	stdinFd, stdoutFd);
 
     if (pid == ENOTFOUND && strchr(program, '/') == 0) {
 	/* Search for program on path. */
@@ -82,8 +110,8 @@ int Spawn_With_Path(const char *program, const char *command,
 		strcat(exeName, ".exe");
 
 	    /*Print("exeName=%s\n", exeName);*/
-	    pid = Spawn_Program(exeName, command
-		);
+	    pid = Spawn_Program_With_Files(exeName, command,
+		stdinFd, stdoutFd);
 	    if (pid != ENOTFOUND)
 		break;
 	}
@@ -10,9 +10,38 @@
 
 #include <geekos/syscall.h>
 #include <string.h>
+#include <sched.h>
 
 DEF_SYSCALL(Set_Scheduling_Policy,SYS_SETSCHEDULINGPOLICY,int, (int policy, int quantum),
     int arg0 = policy; int arg1 = quantum;,
     SYSCALL_REGS_2)
 DEF_SYSCALL(Get_Time_Of_Day,SYS_GETTIMEOFDAY,int,(void),,SYSCALL_REGS_0)
+DEF_SYSCALL(Get_Thread_Stats,SYS_GETTHREADSTATS,int,(int pid, struct Thread_Stats *stats),
+    int arg0 = pid; struct Thread_Stats *arg1 = stats;,
+    SYSCALL_REGS_2)
+DEF_SYSCALL(Set_EDF_Params,SYS_SETEDFPARAMS,int,(int runtime, int period, int deadline),
+    int arg0 = runtime; int arg1 = period; int arg2 = deadline;,
+    SYSCALL_REGS_3)
+DEF_SYSCALL(Get_Thread_Pool_Stats,SYS_GETTHREADPOOLSTATS,int,(struct Thread_Pool_Stats *stats),
+    struct Thread_Pool_Stats *arg0 = stats;,
+    SYSCALL_REGS_1)
+DEF_SYSCALL(Sleep,SYS_SLEEP,int,(int ticks),int arg0 = ticks;,SYSCALL_REGS_1)
+DEF_SYSCALL(Sleep_Us,SYS_SLEEPUS,int,(int us),int arg0 = us;,SYSCALL_REGS_1)
+DEF_SYSCALL(Set_Alarm,SYS_SETALARM,int,(int period),int arg0 = period;,SYSCALL_REGS_1)
+DEF_SYSCALL(Wait_Alarm,SYS_WAITALARM,int,(void),,SYSCALL_REGS_0)
+DEF_SYSCALL(Get_Lock_Stats,SYS_GETLOCKSTATS,int,(struct Lock_Stats *stats, int max),
+    struct Lock_Stats *arg0 = stats; int arg1 = max;,
+    SYSCALL_REGS_2)
+DEF_SYSCALL(Get_Tick_Rate,SYS_GETTICKRATE,int,(void),,SYSCALL_REGS_0)
+
+/*
+ * Read the CPU's time stamp counter, for timing things
+ * in cycles.  This doesn't enter the kernel.
+ */
+unsigned long long Read_TSC(void)
+{
+    unsigned long long tsc;
 
+    __asm__ __volatile__ ("rdtsc" : "=A" (tsc));
+    return tsc;
+}
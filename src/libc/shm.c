@@ -0,0 +1,50 @@
+/*
+ * Shared memory segments
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/syscall.h>
+#include <string.h>
+#include <shm.h>
+
+/*
+ * Segments are reached through the fs register, which nothing
+ * else in user mode uses.  Shm_Detach() leaves fs null if it
+ * held the detached segment.
+ */
+
+DEF_SYSCALL(Shm_Attach,SYS_SHMATTACH,int,(const char *name, ulong_t size),
+    const char *arg0 = name; size_t arg1 = strlen(name); ulong_t arg2 = size;,
+    SYSCALL_REGS_3)
+DEF_SYSCALL(Shm_Detach,SYS_SHMDETACH,int,(int shm),int arg0 = shm;,SYSCALL_REGS_1)
+
+/*
+ * Copy len bytes at given offset in a segment into buf.
+ */
+void Shm_Read(int shm, ulong_t offset, void *buf, ulong_t len)
+{
+    __asm__ __volatile__ (
+	"movw %w3, %%fs\n\t"
+	"rep movsb %%fs:(%%esi), %%es:(%%edi)"
+	: "+S" (offset), "+D" (buf), "+c" (len)
+	: "r" (shm)
+	: "memory");
+}
+
+/*
+ * Copy len bytes from buf to given offset in a segment.
+ */
+void Shm_Write(int shm, ulong_t offset, const void *buf, ulong_t len)
+{
+    __asm__ __volatile__ (
+	"pushl %%es\n\t"
+	"movw %w3, %%es\n\t"
+	"rep movsb\n\t"
+	"popl %%es"
+	: "+S" (buf), "+D" (offset), "+c" (len)
+	: "r" (shm)
+	: "memory");
+}
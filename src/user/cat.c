@@ -0,0 +1,57 @@
+/*
+ * Copy files, or standard input, to standard output
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <fileio.h>
+
+#define BUFSIZE 512
+
+/*
+ * Copy everything from one descriptor to another.
+ * Returns 0 if successful, or an error code (< 0) if not.
+ */
+static int Copy(int fromFd, int toFd)
+{
+    char buf[BUFSIZE];
+    int n, rc;
+
+    while ((n = Read(fromFd, buf, sizeof(buf))) > 0) {
+	if ((rc = Write(toFd, buf, n)) < 0)
+	    return rc;
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    int i, fd, rc;
+
+    if (argc == 1) {
+	rc = Copy(STDIN_FD, STDOUT_FD);
+	if (rc < 0)
+	    Print("cat: %s\n", Get_Error_String(rc));
+	return rc < 0;
+    }
+
+    for (i = 1; i < argc; ++i) {
+	fd = Open(argv[i], O_READ);
+	if (fd < 0) {
+	    Print("cat: %s: %s\n", argv[i], Get_Error_String(fd));
+	    return 1;
+	}
+	rc = Copy(fd, STDOUT_FD);
+	Close(fd);
+	if (rc < 0) {
+	    Print("cat: %s: %s\n", argv[i], Get_Error_String(rc));
+	    return 1;
+	}
+    }
+
+    return 0;
+}
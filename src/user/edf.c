@@ -0,0 +1,49 @@
+/*
+ * EDF real-time class test program
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <string.h>
+
+/*
+ * Join the EDF class with the given runtime, period and deadline
+ * (in ticks), burn CPU for the given number of ticks,
+ * and report how many deadlines were missed.
+ */
+int main(int argc, char **argv)
+{
+  int runtime, period, deadline, duration;
+  int start, rc;
+  struct Thread_Stats stats;
+
+  if (argc != 5) {
+      Print("usage: %s <runtime> <period> <deadline> <duration>\n", argv[0]);
+      Exit(1);
+  }
+  runtime = atoi(argv[1]);
+  period = atoi(argv[2]);
+  deadline = atoi(argv[3]);
+  duration = atoi(argv[4]);
+
+  rc = Set_EDF_Params(runtime, period, deadline);
+  if (rc != 0) {
+      Print("edf: parameters not admitted (error %d)\n", rc);
+      Exit(1);
+  }
+
+  start = Get_Time_Of_Day();
+  while (Get_Time_Of_Day() - start < duration)
+      ;
+
+  Get_Thread_Stats(0, &stats);
+  Print("edf: ran %lu of %d ticks, %lu deadline misses\n",
+        stats.runTicks, duration, stats.numDeadlineMisses);
+
+  return 0;
+}
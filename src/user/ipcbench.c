@@ -0,0 +1,126 @@
+/*
+ * IPC round-trip benchmark
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <sema.h>
+#include <ipc.h>
+#include <string.h>
+
+#define DEFAULT_ROUNDS 10000
+
+/* Message asking the IPC server to exit. */
+#define IPC_QUIT 0xffffffffUL
+
+/*
+ * Answer each call with its first word plus one, until told to quit.
+ */
+static int IPC_Server(void)
+{
+    struct Ipc_Message msg;
+    int pid;
+
+    pid = Ipc_Receive(&msg);
+    while (pid >= 0 && msg.word[0] != IPC_QUIT) {
+	++msg.word[0];
+	pid = Ipc_Reply_Wait(pid, &msg);
+    }
+    if (pid >= 0)
+	Ipc_Reply(pid, &msg);
+    return pid < 0;
+}
+
+/*
+ * The other end of the semaphore ping-pong.
+ */
+static int Sem_Partner(int rounds)
+{
+    int ping = Create_Semaphore("ipcbench-ping", 0);
+    int pong = Create_Semaphore("ipcbench-pong", 0);
+    int i;
+
+    for (i = 0; i < rounds; i++) {
+	P(ping);
+	V(pong);
+    }
+    Destroy_Semaphore(ping);
+    Destroy_Semaphore(pong);
+    return 0;
+}
+
+/*
+ * Compare the round trip time of an IPC call to another process
+ * against passing control there and back through a pair of
+ * semaphores, as ping.exe and pong.exe do.
+ */
+int main(int argc, char **argv)
+{
+  int rounds = DEFAULT_ROUNDS;
+  int i, pid, rc, ping, pong;
+  char command[64];
+  unsigned long long start;
+  unsigned long ipcCycles, semCycles;
+  struct Ipc_Message msg;
+
+  if (argc == 2 && !strcmp(argv[1], "-server"))
+      return IPC_Server();
+  if (argc == 3 && !strcmp(argv[1], "-sem"))
+      return Sem_Partner(atoi(argv[2]));
+  if (argc == 2)
+      rounds = atoi(argv[1]);
+  if (argc > 2 || rounds <= 0) {
+      Print("usage: %s [rounds]\n", argv[0]);
+      Exit(1);
+  }
+
+  pid = Spawn_Program("/c/ipcbench.exe", "/c/ipcbench.exe -server");
+  if (pid < 0) {
+      Print("ipcbench: spawn failed (error %d)\n", pid);
+      Exit(1);
+  }
+  memset(&msg, '\0', sizeof(msg));
+  start = Read_TSC();
+  for (i = 0; i < rounds; i++) {
+      rc = Ipc_Call(pid, &msg);
+      if (rc < 0) {
+          Print("ipcbench: Ipc_Call failed (error %d)\n", rc);
+          Exit(1);
+      }
+  }
+  ipcCycles = (unsigned long) (Read_TSC() - start) / rounds;
+  if (msg.word[0] != (ulong_t) rounds)
+      Print("ipcbench: wrong reply %lu\n", msg.word[0]);
+  msg.word[0] = IPC_QUIT;
+  Ipc_Call(pid, &msg);
+  Wait(pid);
+
+  ping = Create_Semaphore("ipcbench-ping", 0);
+  pong = Create_Semaphore("ipcbench-pong", 0);
+  snprintf(command, sizeof(command), "/c/ipcbench.exe -sem %d", rounds);
+  pid = Spawn_Program("/c/ipcbench.exe", command);
+  if (pid < 0) {
+      Print("ipcbench: spawn failed (error %d)\n", pid);
+      Exit(1);
+  }
+  start = Read_TSC();
+  for (i = 0; i < rounds; i++) {
+      V(ping);
+      P(pong);
+  }
+  semCycles = (unsigned long) (Read_TSC() - start) / rounds;
+  Wait(pid);
+  Destroy_Semaphore(ping);
+  Destroy_Semaphore(pong);
+
+  Print("ipcbench: %d round trips\n", rounds);
+  Print("  IPC call/reply:         %lu cycles\n", ipcCycles);
+  Print("  semaphore ping-pong:    %lu cycles\n", semCycles);
+
+  return 0;
+}
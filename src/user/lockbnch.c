@@ -0,0 +1,62 @@
+/*
+ * Uncontended lock cost benchmark
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <sema.h>
+#include <mutex.h>
+#include <string.h>
+
+#define DEFAULT_ROUNDS 10000
+
+/*
+ * Compare the cost of an uncontended lock/unlock pair using a
+ * futex-based user mutex against a P/V pair on a kernel semaphore.
+ */
+int main(int argc, char **argv)
+{
+  int rounds = DEFAULT_ROUNDS;
+  int i, sem;
+  unsigned long long start;
+  unsigned long mutexCycles, semCycles;
+  struct User_Mutex mutex = USER_MUTEX_INITIALIZER;
+
+  if (argc == 2)
+      rounds = atoi(argv[1]);
+  if (argc > 2 || rounds <= 0) {
+      Print("usage: %s [rounds]\n", argv[0]);
+      Exit(1);
+  }
+
+  start = Read_TSC();
+  for (i = 0; i < rounds; i++) {
+      User_Mutex_Lock(&mutex);
+      User_Mutex_Unlock(&mutex);
+  }
+  mutexCycles = (unsigned long) (Read_TSC() - start) / rounds;
+
+  sem = Create_Semaphore("lockbnch", 1);
+  if (sem < 0) {
+      Print("lockbnch: Create_Semaphore failed (error %d)\n", sem);
+      Exit(1);
+  }
+  start = Read_TSC();
+  for (i = 0; i < rounds; i++) {
+      P(sem);
+      V(sem);
+  }
+  semCycles = (unsigned long) (Read_TSC() - start) / rounds;
+  Destroy_Semaphore(sem);
+
+  Print("lockbnch: %d rounds\n", rounds);
+  Print("  user mutex lock/unlock: %lu cycles\n", mutexCycles);
+  Print("  semaphore P/V:          %lu cycles\n", semCycles);
+
+  return 0;
+}
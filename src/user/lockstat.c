@@ -0,0 +1,51 @@
+/*
+ * Print the most contended kernel locks
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <string.h>
+
+#define DEFAULT_COUNT 10
+
+static struct Lock_Stats s_stats[MAX_LOCK_STATS];
+
+/*
+ * Print the lock call sites which have spent the longest waiting,
+ * as recorded by a kernel built with LOCK_STATS.
+ */
+int main(int argc, char **argv)
+{
+  int count = DEFAULT_COUNT;
+  int i, n;
+
+  if (argc == 2)
+      count = atoi(argv[1]);
+  if (argc > 2 || count <= 0 || count > MAX_LOCK_STATS) {
+      Print("usage: %s [count (1-%d)]\n", argv[0], MAX_LOCK_STATS);
+      Exit(1);
+  }
+
+  n = Get_Lock_Stats(s_stats, count);
+  if (n < 0) {
+      Print("lockstat: no lock statistics (error %d); build the kernel with LOCK_STATS\n", n);
+      Exit(1);
+  }
+
+  Print("kind  lock      call site                 acquired  contended  wait(kc)  max(kc)  hold(kc)\n");
+  for (i = 0; i < n; i++) {
+      struct Lock_Stats *s = &s_stats[i];
+      Print("%-5s %08lx  %-20s:%-4d %8lu  %9lu  %8lu  %7lu  %8lu\n",
+            s->kind == LOCK_KIND_MUTEX ? "mutex" : "spin",
+            s->lock, s->file, s->line,
+            s->acquisitions, s->contended,
+            s->waitKcycles, s->maxWaitKcycles, s->holdKcycles);
+  }
+
+  return 0;
+}
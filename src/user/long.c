@@ -1,20 +1,33 @@
 
 #include "libuser.h"
 #include "process.h"
+#include "string.h"
 
+/*
+ * With -sleep, Long is a periodic process, woken by its alarm
+ * every tick, instead of a CPU-bound one.
+ */
 int main(int argc, char **argv)
 {
   int i, j ;     	/* loop index */
   int scr_sem;		/* id of screen semaphore */
   int now, start, elapsed; 		
+  int sleepMode = (argc > 1 && !strcmp(argv[1], "-sleep"));
 
   start = Get_Time_Of_Day();
   scr_sem = Create_Semaphore ("screen" , 1) ;   /* register for screen use */
 
+  if (sleepMode)
+      Set_Alarm(1);
   for (i=0; i < 200; i++) {
-      for (j=0 ; j < 10000 ; j++) ;
+      if (sleepMode)
+          Wait_Alarm();
+      else
+          for (j=0 ; j < 10000 ; j++) ;
       now = Get_Time_Of_Day();
   }
+  if (sleepMode)
+      Set_Alarm(0);
   elapsed = Get_Time_Of_Day() - start;
   P (scr_sem) ;
   Print("Process Long is done at time: %d\n", elapsed) ;
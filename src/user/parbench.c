@@ -0,0 +1,83 @@
+/*
+ * Parallel CPU-bound benchmark
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <string.h>
+
+#define DEFAULT_WORKERS 4
+#define MAX_WORKERS 16
+#define DEFAULT_ROUNDS 2000
+
+/* Loop iterations in one round of work. */
+#define ROUND_LENGTH 10000
+
+/*
+ * Spin through the given number of rounds without making
+ * any system calls.
+ */
+static void Work(int rounds)
+{
+  volatile int sum = 0;
+  int i, j;
+
+  for (i = 0; i < rounds; i++)
+      for (j = 0; j < ROUND_LENGTH; j++)
+          sum += j;
+}
+
+/*
+ * Spawn the given number of worker processes (copies of this
+ * program), each doing the same fixed amount of CPU-bound work,
+ * wait for all of them, and report the elapsed time and the
+ * rounds of work done per tick.  With enough CPUs the elapsed
+ * time stays the same as the number of workers goes up.
+ */
+int main(int argc, char **argv)
+{
+  int workers = DEFAULT_WORKERS;
+  int rounds = DEFAULT_ROUNDS;
+  int pids[MAX_WORKERS];
+  char command[64];
+  int i, start, elapsed;
+
+  if (argc == 3 && !strcmp(argv[1], "-child")) {
+      Work(atoi(argv[2]));
+      return 0;
+  }
+  if (argc >= 2)
+      workers = atoi(argv[1]);
+  if (argc == 3)
+      rounds = atoi(argv[2]);
+  if (argc > 3 || workers <= 0 || workers > MAX_WORKERS || rounds <= 0) {
+      Print("usage: %s [workers [rounds]]\n", argv[0]);
+      Exit(1);
+  }
+
+  snprintf(command, sizeof(command), "/c/parbench.exe -child %d", rounds);
+  start = Get_Time_Of_Day();
+  for (i = 0; i < workers; i++) {
+      pids[i] = Spawn_Program("/c/parbench.exe", command);
+      if (pids[i] < 0) {
+          Print("parbench: spawn failed (error %d)\n", pids[i]);
+          Exit(1);
+      }
+  }
+  for (i = 0; i < workers; i++)
+      Wait(pids[i]);
+  elapsed = Get_Time_Of_Day() - start;
+
+  Print("parbench: %d workers x %d rounds in %d ticks (%d ms)", workers, rounds,
+        elapsed, elapsed * 1000 / Get_Tick_Rate());
+  if (elapsed > 0)
+      Print(", %d rounds/tick", workers * rounds / elapsed);
+  Print("\n");
+
+  return 0;
+}
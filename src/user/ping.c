@@ -10,6 +10,7 @@ int main(int argc , char ** argv)
   int scr_sem; 		/* id of screen semaphore */
   int time; 		/* current and start time */
   int ping,pong;	/* id of semaphores to sync processes b & c */
+  int sleepMode = (argc > 1 && !strcmp(argv[1], "-sleep"));
 
   time = Get_Time_Of_Day();
   scr_sem = Create_Semaphore ("screen" , 1) ;   /* register for screen use */
@@ -22,7 +23,10 @@ int main(int argc , char ** argv)
        //Print("ping semaphores[pong].value %d\n", semaphores[pong].value);
        P(pong);
        //Print("Ping: pong acquired %d times\n", i + 1);
-       for (j=0; j < 35; j++);
+       if (sleepMode)
+           Sleep(1);
+       else
+           for (j=0; j < 35; j++);
        V(ping);
   }
 
@@ -10,6 +10,7 @@ int main(int argc , char ** argv)
   int scr_sem; 		/* id of screen semaphore */
   int time; 		/* current and start time */
   int ping,pong;	/* id of semaphores to sync processes b & c */
+  int sleepMode = (argc > 1 && !strcmp(argv[1], "-sleep"));
 
   time = Get_Time_Of_Day();
   scr_sem = Create_Semaphore ("screen" , 1) ;   /* register for screen use */
@@ -19,7 +20,10 @@ int main(int argc , char ** argv)
   Print("Pong: ping %d pong %d\n", ping, pong);
   for (i=0; i < 5; i++) {
        P(ping);
-       for (j=0; j < 35; j++);
+       if (sleepMode)
+           Sleep(1);
+       else
+           for (j=0; j < 35; j++);
        V(pong);
   }
 
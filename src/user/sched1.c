@@ -9,18 +9,25 @@ int main( int argc , char ** argv )
 
   int i,j ;     	/* loop index */
   int holdsched3_sem;
+  int sleepMode = (argc > 1 && !strcmp(argv[1], "-sleep"));
 
   holdsched3_sem = Create_Semaphore("holdsched3_sem",0);
 
   for (i=0; i < 10; i++) {
-    for(j=0;j<20000;j++);
+    if (sleepMode)
+      Sleep(1);
+    else
+      for(j=0;j<20000;j++);
     Print("1");
   }
 
   V(holdsched3_sem);
 
   for (i=0; i < 10; i++) {
-    for(j=0;j<20000;j++);
+    if (sleepMode)
+      Sleep(1);
+    else
+      for(j=0;j<20000;j++);
     Print("1");
   }
   
@@ -8,9 +8,13 @@ int main( int argc , char ** argv )
 {
 
   int i,j ;     	/* loop index */
+  int sleepMode = (argc > 1 && !strcmp(argv[1], "-sleep"));
 
   for (i=0; i < 20; i++) {
-    for(j=0;j<20000;j++);
+    if (sleepMode)
+      Sleep(1);
+    else
+      for(j=0;j<20000;j++);
     Print("2");
   }
 
@@ -14,20 +14,25 @@ int main(int argc , char ** argv)
   int quantum;
 
   int id1, id2, id3;    	/* ID of child process */
+  int sleepMode = 0;		/* children sleep instead of spinning */
 
-  if (argc == 3) {
+  if (argc == 4 && !strcmp(argv[3], "sleep"))
+    sleepMode = 1;
+  if (argc == 3 || sleepMode) {
     if (!strcmp(argv[1], "rr")) {
       policy = 0;
     } else if (!strcmp(argv[1], "mlf")) {
       policy = 1;
+    } else if (!strcmp(argv[1], "cfs")) {
+      policy = 2;
     } else {
-      Print("usage: %s [rr|mlf] <quantum>\n", argv[0]);
+      Print("usage: %s [rr|mlf|cfs] <quantum> [sleep]\n", argv[0]);
       Exit(1);
     }
     quantum = atoi(argv[2]);
     Set_Scheduling_Policy(policy, quantum);
   } else {
-    Print("usage: %s [rr|mlf] <quantum>\n", argv[0]);
+    Print("usage: %s [rr|mlf|cfs] <quantum> [sleep]\n", argv[0]);
     Exit(1);
   }
 
@@ -36,8 +41,10 @@ int main(int argc , char ** argv)
 
 
   id3 = Spawn_Program ( "/c/sched3.exe", "/c/sched3.exe") ;
-  id1 = Spawn_Program ( "/c/sched1.exe", "/c/sched1.exe") ;
-  id2 = Spawn_Program ( "/c/sched2.exe", "/c/sched2.exe") ;
+  id1 = Spawn_Program ( "/c/sched1.exe",
+      sleepMode ? "/c/sched1.exe -sleep" : "/c/sched1.exe") ;
+  id2 = Spawn_Program ( "/c/sched2.exe",
+      sleepMode ? "/c/sched2.exe -sleep" : "/c/sched2.exe") ;
 
   
   Wait(id1);
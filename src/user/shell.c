@@ -11,6 +11,7 @@
 #include <geekos/errno.h>
 #include <conio.h>
 #include <process.h>
+#include <fileio.h>
 #include <string.h>
 
 #define BUFSIZE 79
@@ -37,7 +38,8 @@ char *Strip_Leading_Whitespace(char *s);
 void Trim_Newline(char *s);
 char *Copy_Token(char *token, char *s);
 int Build_Pipeline(char *command, struct Process procList[]);
-void Spawn_Single_Command(struct Process procList[], int nproc, const char *path);
+void Close_Redirections(struct Process *proc);
+void Spawn_Pipeline(struct Process procList[], int nproc, const char *path);
 
 /* Maximum number of processes allowed in a pipeline. */
 #define MAXPROC 5
@@ -95,7 +97,7 @@ int main(int argc, char **argv)
 	if (nproc <= 0)
 	    continue;
 
-	Spawn_Single_Command(procList, nproc, path);
+	Spawn_Pipeline(procList, nproc, path);
     }
 
     Print_String("DONE!\n");
@@ -255,30 +257,80 @@ int Build_Pipeline(char *command, struct Process procList[])
 }
 
 /*
- * Spawn a single command.
+ * Close the shell's descriptors for the redirections of a command.
  */
-void Spawn_Single_Command(struct Process procList[], int nproc, const char *path)
+void Close_Redirections(struct Process *proc)
 {
-    int pid;
+    if (proc->readfd != STDIN_FD)
+	Close(proc->readfd);
+    if (proc->writefd != STDOUT_FD)
+	Close(proc->writefd);
+}
+
+/*
+ * Spawn every command of a pipeline at once, connected by pipes
+ * and with any file redirections, and wait for them all to exit.
+ * If a command can't be started, the ones before it see a pipe
+ * with no reader and the one after it sees end of file.
+ */
+void Spawn_Pipeline(struct Process procList[], int nproc, const char *path)
+{
+    int i, rc;
+    int nextReadfd = STDIN_FD;
+
+    for (i = 0; i < nproc; ++i) {
+	struct Process *proc = &procList[i];
+
+	proc->pid = -1;
+	proc->readfd = nextReadfd;
+	proc->writefd = STDOUT_FD;
+	nextReadfd = STDIN_FD;
+
+	if (proc->flags & INFILE) {
+	    proc->readfd = Open(proc->infile, O_READ);
+	    if (proc->readfd < 0) {
+		Print("Could not open %s: %s\n", proc->infile, Get_Error_String(proc->readfd));
+		proc->readfd = STDIN_FD;
+		break;
+	    }
+	}
+	if (proc->flags & OUTFILE) {
+	    proc->writefd = Open(proc->outfile, O_WRITE|O_CREATE);
+	    if (proc->writefd < 0) {
+		Print("Could not open %s: %s\n", proc->outfile, Get_Error_String(proc->writefd));
+		proc->writefd = STDOUT_FD;
+		break;
+	    }
+	}
+	if (proc->flags & PIPE) {
+	    rc = Create_Pipe(&proc->pipefd, &proc->writefd);
+	    if (rc < 0) {
+		Print("Could not create pipe: %s\n", Get_Error_String(rc));
+		break;
+	    }
+	    nextReadfd = proc->pipefd;
+	}
+
+	proc->pid = Spawn_With_Path_And_Files(proc->program, proc->command,
+	    path, proc->readfd, proc->writefd);
+	if (proc->pid < 0)
+	    Print("Could not spawn process: %s\n", Get_Error_String(proc->pid));
 
-    if (nproc > 1) {
-	Print("Error: pipes not supported yet\n");
-	return;
+	/* Only the children should keep the files open. */
+	Close_Redirections(proc);
     }
-    if (procList[0].flags & (INFILE|OUTFILE)) {
-	Print("Error: I/O redirection not supported yet\n");
-	return;
+
+    if (i < nproc) {
+	/* Stopped early: nothing more to spawn at or after command i. */
+	Close_Redirections(&procList[i]);
+	nproc = i;
     }
 
-    pid = Spawn_With_Path(procList[0].program, procList[0].command,
-	path);
-    if (pid < 0)
-	Print("Could not spawn process: %s\n", Get_Error_String(pid));
-    else {
-	int exitCode = Wait(pid);
-	if (exitCodes)
-	    Print("Exit code was %d\n", exitCode);
+    for (i = 0; i < nproc; ++i) {
+	if (procList[i].pid >= 0) {
+	    int exitCode = Wait(procList[i].pid);
+	    if (exitCodes)
+		Print("Exit code was %d\n", exitCode);
+	}
     }
 }
-
-
@@ -0,0 +1,162 @@
+/*
+ * Shared memory vs pipe bulk transfer benchmark
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <sema.h>
+#include <fileio.h>
+#include <shm.h>
+#include <string.h>
+
+#define DEFAULT_KBYTES 1024
+
+/* Bytes handed from producer to consumer at a time. */
+#define CHUNK_SIZE 4096
+#define CHUNK_LONGS (CHUNK_SIZE / sizeof(ulong_t))
+
+#define SHM_NAME "shmbench"
+
+/*
+ * Fill a chunk with the words expected at its position
+ * in the stream.
+ */
+static void Fill_Chunk(ulong_t *buf, int chunk)
+{
+    ulong_t i;
+
+    for (i = 0; i < CHUNK_LONGS; i++)
+	buf[i] = chunk * CHUNK_LONGS + i;
+}
+
+/*
+ * Consumer: take chunks from the shared segment, checking them
+ * in place.  Exits with 0 if all data was right.
+ */
+static int Shm_Consumer(int chunks)
+{
+    int shm = Shm_Attach(SHM_NAME, 0);
+    int full = Create_Semaphore("shmbench-full", 0);
+    int empty = Create_Semaphore("shmbench-empty", 1);
+    int chunk, bad = 0;
+    ulong_t i;
+
+    if (shm < 0)
+	return 1;
+    for (chunk = 0; chunk < chunks; chunk++) {
+	P(full);
+	for (i = 0; i < CHUNK_LONGS; i++) {
+	    if (Shm_Get_Long(shm, i * sizeof(ulong_t)) != chunk * CHUNK_LONGS + i)
+		bad = 1;
+	}
+	V(empty);
+    }
+    Shm_Detach(shm);
+    return bad;
+}
+
+/*
+ * Consumer: read the stream from standard input.
+ * Exits with 0 if all data was right.
+ */
+static int Pipe_Consumer(int chunks)
+{
+    static ulong_t buf[CHUNK_LONGS];
+    ulong_t expected = 0, total = 0;
+    int n, i, bad = 0;
+
+    while ((n = Read(STDIN_FD, buf, sizeof(buf))) > 0) {
+	for (i = 0; i < n / (int) sizeof(ulong_t); i++) {
+	    if (buf[i] != expected++)
+		bad = 1;
+	}
+	total += n;
+    }
+    return bad || total != (ulong_t) chunks * CHUNK_SIZE;
+}
+
+/*
+ * Move the same amount of data from this process to a child
+ * through a shared memory segment (with a pair of semaphores
+ * to hand over each chunk) and through a pipe.
+ */
+int main(int argc, char **argv)
+{
+  static ulong_t buf[CHUNK_LONGS];
+  int kbytes = DEFAULT_KBYTES;
+  int chunks, chunk, pid, shm, full, empty, readFd, writeFd, rc;
+  char command[64];
+  unsigned long long start;
+  unsigned long shmKcycles, pipeKcycles;
+  int shmExit, pipeExit;
+
+  if (argc == 3 && !strcmp(argv[1], "-shm"))
+      return Shm_Consumer(atoi(argv[2]));
+  if (argc == 3 && !strcmp(argv[1], "-pipe"))
+      return Pipe_Consumer(atoi(argv[2]));
+  if (argc == 2)
+      kbytes = atoi(argv[1]);
+  if (argc > 2 || kbytes <= 0) {
+      Print("usage: %s [kbytes]\n", argv[0]);
+      Exit(1);
+  }
+  chunks = (kbytes * 1024 + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+  shm = Shm_Attach(SHM_NAME, CHUNK_SIZE);
+  if (shm < 0) {
+      Print("shmbench: Shm_Attach failed (error %d)\n", shm);
+      Exit(1);
+  }
+  full = Create_Semaphore("shmbench-full", 0);
+  empty = Create_Semaphore("shmbench-empty", 1);
+  snprintf(command, sizeof(command), "/c/shmbench.exe -shm %d", chunks);
+  pid = Spawn_Program("/c/shmbench.exe", command);
+  if (pid < 0) {
+      Print("shmbench: spawn failed (error %d)\n", pid);
+      Exit(1);
+  }
+  start = Read_TSC();
+  for (chunk = 0; chunk < chunks; chunk++) {
+      Fill_Chunk(buf, chunk);
+      P(empty);
+      Shm_Write(shm, 0, buf, CHUNK_SIZE);
+      V(full);
+  }
+  shmExit = Wait(pid);
+  shmKcycles = (unsigned long) ((Read_TSC() - start) >> 10);
+  Destroy_Semaphore(full);
+  Destroy_Semaphore(empty);
+  Shm_Detach(shm);
+
+  rc = Create_Pipe(&readFd, &writeFd);
+  if (rc < 0) {
+      Print("shmbench: Create_Pipe failed (error %d)\n", rc);
+      Exit(1);
+  }
+  snprintf(command, sizeof(command), "/c/shmbench.exe -pipe %d", chunks);
+  pid = Spawn_Program_With_Files("/c/shmbench.exe", command, readFd, STDOUT_FD);
+  Close(readFd);
+  if (pid < 0) {
+      Print("shmbench: spawn failed (error %d)\n", pid);
+      Exit(1);
+  }
+  start = Read_TSC();
+  for (chunk = 0; chunk < chunks; chunk++) {
+      Fill_Chunk(buf, chunk);
+      Write(writeFd, buf, CHUNK_SIZE);
+  }
+  Close(writeFd);
+  pipeExit = Wait(pid);
+  pipeKcycles = (unsigned long) ((Read_TSC() - start) >> 10);
+
+  Print("shmbench: %d KB in %d byte chunks\n", chunks * CHUNK_SIZE / 1024, CHUNK_SIZE);
+  Print("  shared memory: %lu kcycles%s\n", shmKcycles, shmExit == 0 ? "" : " (data mismatch)");
+  Print("  pipe:          %lu kcycles%s\n", pipeKcycles, pipeExit == 0 ? "" : " (data mismatch)");
+
+  return 0;
+}
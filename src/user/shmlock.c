@@ -0,0 +1,127 @@
+/*
+ * Contended shared memory mutex and condition variable test
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <shm.h>
+#include <mutex.h>
+#include <string.h>
+
+#define DEFAULT_ROUNDS 200
+
+/*
+ * Once in this many rounds, hold the mutex across a sleep of
+ * HOLD_TICKS, and then sleep for REST_TICKS without it.
+ */
+#define SLEEP_EVERY 8
+#define HOLD_TICKS 2
+#define REST_TICKS 1
+
+#define SHM_NAME "shmlock"
+#define SHM_SIZE 4096
+#define MUTEX_OFFSET 0
+#define COUNTER_OFFSET 4
+#define DONE_OFFSET 8
+#define COND_OFFSET 12
+
+/*
+ * Add one to the counter in the segment the given number of
+ * times, under the mutex in the segment.  Now and then the mutex
+ * is held across a sleep, which is longer than the sleep the other
+ * process takes without it, so that the other process finds it
+ * locked and has to wait on its futex until it is unlocked.
+ * Returns the number of rounds in which the mutex was locked.
+ */
+static int Count(int shm, int rounds)
+{
+  int i, contended = 0;
+  ulong_t value;
+
+  for (i = 0; i < rounds; i++) {
+      if (!Shm_Mutex_Try_Lock(shm, MUTEX_OFFSET)) {
+          contended++;
+          Shm_Mutex_Lock(shm, MUTEX_OFFSET);
+      }
+      value = Shm_Get_Long(shm, COUNTER_OFFSET);
+      if (i % SLEEP_EVERY == 0)
+          Sleep(HOLD_TICKS);
+      Shm_Put_Long(shm, COUNTER_OFFSET, value + 1);
+      Shm_Mutex_Unlock(shm, MUTEX_OFFSET);
+      if (i % SLEEP_EVERY == 0)
+          Sleep(REST_TICKS);
+  }
+  return contended;
+}
+
+/*
+ * Run the counting loop in this process and in a child process
+ * at the same time, and check that no increment was lost.
+ * The parent waits for the child's count on a condition variable
+ * in the segment.
+ */
+int main(int argc, char **argv)
+{
+  int rounds = DEFAULT_ROUNDS;
+  int shm, pid, contended;
+  ulong_t total;
+  char command[64];
+
+  if (argc == 3 && !strcmp(argv[1], "-child")) {
+      shm = Shm_Attach(SHM_NAME, 0);
+      if (shm < 0)
+          return 1;
+      contended = Count(shm, atoi(argv[2]));
+      Print("shmlock: child found the mutex locked %d times\n", contended);
+
+      /* Tell the parent we are done. */
+      Shm_Mutex_Lock(shm, MUTEX_OFFSET);
+      Shm_Put_Long(shm, DONE_OFFSET, 1);
+      Shm_Cond_Signal(shm, COND_OFFSET);
+      Shm_Mutex_Unlock(shm, MUTEX_OFFSET);
+      Shm_Detach(shm);
+      return 0;
+  }
+  if (argc == 2)
+      rounds = atoi(argv[1]);
+  if (argc > 2 || rounds <= 0) {
+      Print("usage: %s [rounds]\n", argv[0]);
+      Exit(1);
+  }
+
+  shm = Shm_Attach(SHM_NAME, SHM_SIZE);
+  if (shm < 0) {
+      Print("shmlock: Shm_Attach failed (error %d)\n", shm);
+      Exit(1);
+  }
+  snprintf(command, sizeof(command), "/c/shmlock.exe -child %d", rounds);
+  pid = Spawn_Program("/c/shmlock.exe", command);
+  if (pid < 0) {
+      Print("shmlock: spawn failed (error %d)\n", pid);
+      Exit(1);
+  }
+  contended = Count(shm, rounds);
+
+  /* Wait for the child to finish counting, through the condition. */
+  Shm_Mutex_Lock(shm, MUTEX_OFFSET);
+  while (Shm_Get_Long(shm, DONE_OFFSET) == 0)
+      Shm_Cond_Wait(shm, COND_OFFSET, MUTEX_OFFSET);
+  total = Shm_Get_Long(shm, COUNTER_OFFSET);
+  Shm_Mutex_Unlock(shm, MUTEX_OFFSET);
+
+  if (Wait(pid) != 0) {
+      Print("shmlock: child failed\n");
+      Exit(1);
+  }
+  Shm_Detach(shm);
+
+  Print("shmlock: parent found the mutex locked %d times\n", contended);
+  Print("shmlock: counter is %lu, expected %d: %s\n", total, 2 * rounds,
+        total == (ulong_t) (2 * rounds) ? "ok" : "FAILED");
+  return total == (ulong_t) (2 * rounds) ? 0 : 1;
+}
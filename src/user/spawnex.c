@@ -0,0 +1,63 @@
+/*
+ * Process spawn/exit benchmark
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <sched.h>
+#include <string.h>
+
+#define DEFAULT_COUNT 100
+
+/*
+ * Spawn the given number of short-lived child processes (copies
+ * of this program which exit at once) back to back, and report
+ * the thread recycle pool hit rate and the average
+ * creation-to-exit time of the children.
+ */
+int main(int argc, char **argv)
+{
+  int count = DEFAULT_COUNT;
+  int i, pid, start, elapsed;
+  struct Thread_Pool_Stats before, after;
+  ulong_t hits, misses, exits;
+
+  if (argc == 2 && !strcmp(argv[1], "-child"))
+      return 0;
+  if (argc == 2)
+      count = atoi(argv[1]);
+  if (argc > 2 || count <= 0) {
+      Print("usage: %s [count]\n", argv[0]);
+      Exit(1);
+  }
+
+  Get_Thread_Pool_Stats(&before);
+  start = Get_Time_Of_Day();
+  for (i = 0; i < count; i++) {
+      pid = Spawn_Program("/c/spawnex.exe", "/c/spawnex.exe -child");
+      if (pid < 0) {
+          Print("spawnex: spawn failed (error %d)\n", pid);
+          Exit(1);
+      }
+      Wait(pid);
+  }
+  elapsed = Get_Time_Of_Day() - start;
+  Get_Thread_Pool_Stats(&after);
+
+  hits = after.poolHits - before.poolHits;
+  misses = after.poolMisses - before.poolMisses;
+  exits = after.numExits - before.numExits;
+
+  Print("spawnex: %d processes in %d ticks\n", count, elapsed);
+  Print("  recycle pool: %lu hits, %lu misses (%lu%% hit rate)\n",
+        hits, misses, hits + misses > 0 ? hits * 100 / (hits + misses) : 0);
+  if (exits > 0)
+      Print("  create-to-exit: %lu kcycles on average\n",
+            (after.lifetimeKcycles - before.lifetimeKcycles) / exits);
+
+  return 0;
+}
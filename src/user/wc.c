@@ -0,0 +1,44 @@
+/*
+ * Count lines, words and bytes of standard input
+ * $Revision: 1.1 $
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <conio.h>
+#include <process.h>
+#include <fileio.h>
+
+#define BUFSIZE 512
+
+#define ISSPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\n')
+
+int main(int argc, char **argv)
+{
+    char buf[BUFSIZE];
+    ulong_t lines = 0, words = 0, bytes = 0;
+    bool inWord = false;
+    int n, i;
+
+    while ((n = Read(STDIN_FD, buf, sizeof(buf))) > 0) {
+	bytes += n;
+	for (i = 0; i < n; ++i) {
+	    if (buf[i] == '\n')
+		++lines;
+	    if (ISSPACE(buf[i]))
+		inWord = false;
+	    else if (!inWord) {
+		inWord = true;
+		++words;
+	    }
+	}
+    }
+    if (n < 0) {
+	Print("wc: %s\n", Get_Error_String(n));
+	return 1;
+    }
+
+    Print("%lu %lu %lu\n", lines, words, bytes);
+    return 0;
+}
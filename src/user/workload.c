@@ -39,6 +39,23 @@
 #define NULL 0
 #endif
 
+/*
+ * Print the scheduling statistics of a finished child process.
+ */
+static void Print_Stats(const char *name, int pid, struct Thread_Stats *stats)
+{
+  int i;
+
+  Print ("%s (pid %d): ran %lu ticks, waited %lu ticks, "
+         "%lu voluntary / %lu involuntary switches\n",
+         name, pid, stats->runTicks, stats->waitTicks,
+         stats->numVoluntarySwitches, stats->numInvoluntarySwitches);
+  Print ("  wakeup latency histogram (log2 kcycles):");
+  for (i = 0; i < NUM_LATENCY_BUCKETS; i++)
+      Print (" %lu", stats->wakeupLatency[i]);
+  Print ("\n");
+}
+
 int main(int argc , char ** argv)
 {
   int policy = -1;
@@ -47,23 +64,29 @@ int main(int argc , char ** argv)
   int quantum;
   int scr_sem;			/* sid of screen semaphore */
   int id1, id2, id3;    	/* ID of child process */
+  struct Thread_Stats stats1, stats2, stats3;
+  int sleepMode = 0;		/* children sleep instead of spinning */
 
   scr_sem = Create_Semaphore ("screen" , 1)  ;
 
 
-  if (argc == 3) {
+  if (argc == 4 && !strcmp(argv[3], "sleep"))
+      sleepMode = 1;
+  if (argc == 3 || sleepMode) {
       if (!strcmp(argv[1], "rr")) {
           policy = 0;
       } else if (!strcmp(argv[1], "mlf")) {
           policy = 1;
+      } else if (!strcmp(argv[1], "cfs")) {
+          policy = 2;
       } else {
-	  Print("usage: %s [rr|mlf] <quantum>\n", argv[0]);
+	  Print("usage: %s [rr|mlf|cfs] <quantum> [sleep]\n", argv[0]);
 	  Exit(1);
       }
       quantum = atoi(argv[2]);
       Set_Scheduling_Policy(policy, quantum);
   } else {
-      Print("usage: %s [rr|mlf] <quantum>\n", argv[0]);
+      Print("usage: %s [rr|mlf|cfs] <quantum> [sleep]\n", argv[0]);
       Exit(1);
   }
 
@@ -76,38 +99,41 @@ int main(int argc , char ** argv)
   Print ("************* Start Workload Generator *********\n");
   V (scr_sem) ;
 
-  id1 = Spawn_Program ("/c/long.exe", "/c/long.exe"
-  ) ;
+  id1 = Spawn_Program ("/c/long.exe",
+      sleepMode ? "/c/long.exe -sleep" : "/c/long.exe") ;
   P (scr_sem) ;
   Print ("Process Long has been created with ID = %d\n",id1);
   V (scr_sem) ;
 
 
-  id2 = Spawn_Program ("/c/ping.exe", "/c/ping.exe"
-  ) ;
+  id2 = Spawn_Program ("/c/ping.exe",
+      sleepMode ? "/c/ping.exe -sleep" : "/c/ping.exe") ;
 
   P (scr_sem) ;
   Print ("Process Ping has been created with ID = %d\n",id2);
   V (scr_sem) ;
 
-  id3 = Spawn_Program ("/c/pong.exe", "/c/pong.exe"
-  ) ;
+  id3 = Spawn_Program ("/c/pong.exe",
+      sleepMode ? "/c/pong.exe -sleep" : "/c/pong.exe") ;
   P (scr_sem) ;
   Print ("Process Pong has been created with ID = %d\n",id3);
   V (scr_sem) ;
 
-  Wait(id2);
-  Wait(id3);
+  Wait_With_Stats(id2, &stats2);
+  Wait_With_Stats(id3, &stats3);
 
   elapsed = Get_Time_Of_Day() - start;
   Print ("************* End Workload Generator *********\n");
   Print ("Tests Completed, Total time: %d\n", elapsed) ;
+  Print_Stats ("Ping", id2, &stats2);
+  Print_Stats ("Pong", id3, &stats3);
   Print ("************* End Workload Generator *********\n");
 
-  Wait(id1);
+  Wait_With_Stats(id1, &stats1);
   elapsed = Get_Time_Of_Day() - start;
   Print ("************* End Workload Generator *********\n");
   Print ("Long Completed, Total time: %d\n", elapsed) ;
+  Print_Stats ("Long", id1, &stats1);
   Print ("************* End Workload Generator *********\n");
 
 